@@ -70,6 +70,32 @@ PaError PaJack_SetClientName( const char* name );
  */
 PaError PaJack_GetClientName(const char** clientName);
 
+/** Callback notifying of a change of the JACK server's period.
+ *
+ * @param stream The stream that the callback was set for.
+ * @param framesPerHostBuffer The new number of frames per JACK period.
+ * @param userData The user data passed to PaJack_SetBufferSizeCallback.
+ * @sa PaJack_SetBufferSizeCallback
+ */
+typedef void PaJackBufferSizeCallback( PaStream *stream, unsigned long framesPerHostBuffer, void *userData );
+
+/** Set a callback notifying of changes of the JACK server's period.
+ *
+ * Streams adapt to a new period while they are running, without having to be reopened. A stream that
+ * was opened with paFramesPerBufferUnspecified is called back with buffers of the new size from then on,
+ * otherwise only the adaption to the requested buffer size changes.
+ *
+ * The callback is invoked from a JACK notification thread, before the stream callback receives buffers of
+ * the new size. It must not open or close streams, or set buffer size callbacks. Pass NULL to remove the
+ * callback. Once this has returned, the previous callback isn't running anymore.
+ *
+ * @param stream A stream that was opened with the JACK host API.
+ * @param callback The callback to invoke, or NULL.
+ * @param userData Passed to the callback.
+ * @return paIncompatibleStreamHostApi if the stream doesn't belong to the JACK host API.
+ */
+PaError PaJack_SetBufferSizeCallback( PaStream *stream, PaJackBufferSizeCallback *callback, void *userData );
+
 #ifdef __cplusplus
 }
 #endif
@@ -50,17 +50,46 @@
 extern "C" {
 #endif
 
+/** Flags for PaAlsaStreamInfo::flags. */
+typedef enum PaAlsaStreamFlags
+{
+    /** Use timer-based scheduling for a callback stream.
+     *
+     * Instead of waking up once per hardware period, the audio thread disables period wakeups, uses a large
+     * ALSA buffer and sleeps on a timer until a host buffer's worth of frames is expected to be ready. The
+     * wakeup is placed from the measured buffer fill level and the time processing has been taking. The
+     * playback buffer is only filled up to the requested latency, so the latency stays the same while the
+     * large buffer protects against underruns.
+     *
+     * The device has to support disabling period wakeups, which is generally the case for hw devices. If
+     * ALSA-lib can't disable them, the stream falls back to regular scheduling. Blocking streams ignore the
+     * flag, and timer-scheduled streams are not serviced by the shared engine (see PaAlsa_EnableSharedEngine).
+     * If the flag is set for either direction of a full-duplex stream, both directions use it.
+     */
+    paAlsaTimerScheduling = (1 << 0)
+}
+PaAlsaStreamFlags;
+
 typedef struct PaAlsaStreamInfo
 {
-    unsigned long size;
-    PaHostApiTypeId hostApiType;
-    unsigned long version;
+    unsigned long size;             /**< sizeof(PaAlsaStreamInfo) */
+    PaHostApiTypeId hostApiType;    /**< paALSA */
+    unsigned long version;          /**< 2 */
 
+    /** The ALSA device to open, when the device is paUseHostApiSpecificDeviceSpecification. Ignored otherwise. */
     const char *deviceString;
+
+    /** A combination of PaAlsaStreamFlags. Since version 2, version 1 structures (without this field) are
+     * still accepted. */
+    unsigned long flags;
 }
 PaAlsaStreamInfo;
 
-/** Initialize host API specific structure, call this before setting relevant attributes. */
+/** Initialize host API specific structure, call this before setting relevant attributes.
+ *
+ * The structure can be passed along with either a device index, or paUseHostApiSpecificDeviceSpecification
+ * together with a deviceString.
+ */
 void PaAlsa_InitializeStreamInfo( PaAlsaStreamInfo *info );
 
 /** Instruct whether to enable real-time priority when starting the audio thread.
@@ -70,6 +99,65 @@ void PaAlsa_InitializeStreamInfo( PaAlsaStreamInfo *info );
  **/
 void PaAlsa_EnableRealtimeScheduling( PaStream *s, int enable );
 
+/** Instruct whether the stream should be serviced by the shared ALSA engine thread.
+ *
+ * By default every callback stream is given its own audio thread, which polls the stream's devices. If this
+ * is turned on before the stream is started, the stream is instead attached to a single engine thread that
+ * is shared by all ALSA streams with this setting. The engine polls the descriptors of all attached streams
+ * together, so streams whose periods line up are processed in one wakeup. CPU load is still measured per
+ * stream, see Pa_GetStreamCpuLoad.
+ *
+ * Since the streams are processed one after another, a slow stream callback delays the other streams
+ * attached to the engine. The engine thread is created with realtime scheduling if the stream that
+ * causes it to be created has this enabled (see PaAlsa_EnableRealtimeScheduling).
+ * This setting has no effect on blocking streams, or streams using paAlsaTimerScheduling.
+ **/
+void PaAlsa_EnableSharedEngine( PaStream *s, int enable );
+
+/** Ways of recovering from xruns, see PaAlsa_SetXrunRecovery. */
+typedef enum PaAlsaXrunRecovery
+{
+    /** Restart the devices with the playback buffer filled with silence up to the latency. The output is
+     * interrupted for the time it takes to play that silence. This is the default. */
+    paAlsaXrunRecoverySilence = 0,
+
+    /** Restart the devices with one period of silence in the playback buffer, the least that keeps playback
+     * running until the next wakeup. The rest of the buffer is filled by the stream callback right away. */
+    paAlsaXrunRecoveryMinimal,
+
+    /** As paAlsaXrunRecoveryMinimal, but the period is generated by the stream callback before the devices
+     * are restarted, so no silence is inserted. The callback is invoked with paOutputUnderflow and without input.
+     * Blocking streams and input-only streams recover as with paAlsaXrunRecoveryMinimal. */
+    paAlsaXrunRecoveryRegenerate
+}
+PaAlsaXrunRecovery;
+
+/** Set how the stream recovers from xruns (buffer under- and overruns of its devices).
+ *
+ * This can be changed at any time, it applies to the next xrun.
+ **/
+void PaAlsa_SetXrunRecovery( PaStream *s, PaAlsaXrunRecovery recovery );
+
+/** Xrun statistics of a stream, see PaAlsa_GetStreamXrunStatistics. */
+typedef struct PaAlsaXrunStatistics
+{
+    unsigned long inputXruns;       /**< The number of capture overruns */
+    unsigned long outputXruns;      /**< The number of playback underruns */
+
+    /** The time from the last xrun until the devices were running again, in seconds. An xrun of both capture
+     * and playback is recovered from at once, and counts as one recovery. */
+    PaTime lastRecoveryTime;
+    PaTime maxRecoveryTime;         /**< The longest recovery time, in seconds */
+    PaTime totalRecoveryTime;       /**< The sum of all recovery times, in seconds */
+}
+PaAlsaXrunStatistics;
+
+/** Get the xrun statistics of a stream, accumulated since it was opened.
+ *
+ * This can be called while the stream is running.
+ */
+PaError PaAlsa_GetStreamXrunStatistics( PaStream *s, PaAlsaXrunStatistics *stats );
+
 #if 0
 void PaAlsa_EnableWatchdog( PaStream *s, int enable );
 #endif
@@ -80,6 +168,52 @@ PaError PaAlsa_GetStreamInputCard( PaStream *s, int *card );
 /** Get the ALSA-lib card index of this stream's output device. */
 PaError PaAlsa_GetStreamOutputCard( PaStream *s, int *card );
 
+/** A region of the mmap buffer of a blocking stream, see PaAlsa_AcquireReadRegion and PaAlsa_AcquireWriteRegion.
+ *
+ * The region is in the device's layout: it has channelCount channels, which can be more than the stream was opened
+ * with, and samples in sampleFormat, which can differ from the stream's sample format.
+ */
+typedef struct PaAlsaMmapRegion
+{
+    /** With an interleaved sampleFormat, a pointer to the first frame. With paNonInterleaved, an array of
+     * channelCount pointers, each to the first sample of a channel. */
+    void *buffer;
+    unsigned long frames;           /**< The number of frames in the region */
+    int channelCount;               /**< The number of channels of the device */
+    PaSampleFormat sampleFormat;    /**< The sample format of the device, including paNonInterleaved if applicable */
+}
+PaAlsaMmapRegion;
+
+/** Acquire captured frames of a blocking stream in place, without copying them.
+ *
+ * Waits until frames are available, then describes up to the requested number of frames in region. Fewer frames
+ * may be returned, as a region can't wrap around the end of the ALSA buffer. Process the frames in place, then
+ * release them with PaAlsa_CommitReadRegion before acquiring again. Stream data can't be converted on this path,
+ * see PaAlsaMmapRegion.
+ * @return paInputOverflowed if input was discarded since the last read, as with Pa_ReadStream; region is valid
+ * nonetheless. paDeviceUnavailable if the device can't be accessed through mmap, use Pa_ReadStream then.
+ */
+PaError PaAlsa_AcquireReadRegion( PaStream *s, unsigned long frames, PaAlsaMmapRegion *region );
+
+/** Release frames acquired with PaAlsa_AcquireReadRegion.
+ * @param frames The number of frames consumed, at most the number acquired.
+ */
+PaError PaAlsa_CommitReadRegion( PaStream *s, unsigned long frames );
+
+/** Acquire space for frames to be played by a blocking stream, to be written in place.
+ *
+ * The counterpart of PaAlsa_AcquireReadRegion. Fill the region, including any channels beyond those the stream
+ * was opened with, then pass it on with PaAlsa_CommitWriteRegion. The stream starts playing once a period's
+ * worth of frames has been committed, as with Pa_WriteStream.
+ * @return paOutputUnderflowed if output was dropped since the last write, region is valid nonetheless.
+ */
+PaError PaAlsa_AcquireWriteRegion( PaStream *s, unsigned long frames, PaAlsaMmapRegion *region );
+
+/** Pass frames written to a region acquired with PaAlsa_AcquireWriteRegion on for playback.
+ * @param frames The number of frames written, at most the number acquired.
+ */
+PaError PaAlsa_CommitWriteRegion( PaStream *s, unsigned long frames );
+
 /** Set the number of periods (buffer fragments) to configure devices with.
  *
  * By default the number of periods is 4, this is the lowest number of periods that works well on
@@ -93,6 +227,83 @@ PaError PaAlsa_SetNumPeriods( int numPeriods );
  */
 PaError PaAlsa_SetRetriesBusy( int retries );
 
+/** Set the file in which probed device capabilities are cached between processes.
+ *
+ * Probing opens every ALSA device in both directions during Pa_Initialize, which can take seconds on systems
+ * with many cards. With a cache file the results are saved, and later initializations skip opening devices that
+ * were probed before. The cache is discarded when /proc/asound/cards, the ALSA configuration files or the ALSA
+ * library version change. Call this before Pa_Initialize, the string must stay valid while PortAudio is
+ * initialized. If not set, the PA_ALSA_DEVICE_CACHE environment variable is used. By default there is no cache.
+ * @param path The cache file, NULL disables the cache.
+ */
+void PaAlsa_SetDeviceCachePath( const char *path );
+
+/** Instruct whether to defer probing device capabilities until a device is used.
+ *
+ * If this is turned on before Pa_Initialize, only device names are enumerated during initialization. The
+ * capabilities of a device (channel counts, default sample rate and latencies) are determined the first time
+ * Pa_GetDeviceInfo, Pa_IsFormatSupported or Pa_OpenStream is called for it, and remembered afterwards. Devices
+ * found in the device cache (see PaAlsa_SetDeviceCachePath) aren't probed at all.
+ *
+ * Since devices aren't opened during initialization, the device list may contain devices that turn out to
+ * be unusable, these are reported without any channels. The default devices are chosen based on whether
+ * ALSA reports a device to have capture and playback streams. If not set, the PA_ALSA_LAZY_PROBE environment
+ * variable is used.
+ */
+void PaAlsa_EnableLazyDeviceProbing( int enable );
+
+/** A function called by the device monitor after it has updated the device list, see PaAlsa_EnableDeviceMonitor.
+ * It is called from the monitor thread.
+ */
+typedef void PaAlsaDevicesChangedCallback( void *userData );
+
+/** Watch for sound cards being added or removed while PortAudio is initialized, and update the device list.
+ *
+ * If this is turned on before Pa_Initialize, a monitor thread watches /dev/snd with inotify. Once the device nodes
+ * of a card have appeared or disappeared, the hw devices of all cards are enumerated again. Devices that are gone
+ * become inactive: they keep their index, but have an empty name and no channels, and opening them fails with
+ * paDeviceUnavailable. A device that comes back takes its old slot again, so an index never refers to another device.
+ * Other new devices take slots that haven't been used yet, reservedDevices of which are added to the end of the
+ * device list for this purpose. The indices of other devices don't change, so open streams keep running.
+ * Plugin and aggregate devices aren't updated. If the default input or output device is gone, the first remaining
+ * device supporting the direction becomes the default.
+ *
+ * The callback is invoked after every update, the device list may turn out unchanged (when the card has no pcm
+ * devices, for instance). Device infos can be retrieved again from the callback, but Pa_Terminate must not be
+ * called from it. Device infos retrieved while an update is in progress may be inconsistent, the callback tells
+ * when to retrieve them again. The watched directory can be changed with the PA_ALSA_DEVICE_MONITOR_DIR environment
+ * variable, for testing. Monitoring is only supported on Linux, elsewhere the slots are reserved nonetheless.
+ * @param reservedDevices The number of inactive slots to add to the device list, a negative number disables the
+ * monitor.
+ * @param callback The function to call after updates, may be NULL.
+ */
+void PaAlsa_EnableDeviceMonitor( int reservedDevices, PaAlsaDevicesChangedCallback *callback, void *userData );
+
+/** Enumerate the hw devices anew, and update the device list as the device monitor does.
+ *
+ * This works without the monitor, see PaAlsa_EnableDeviceMonitor, but new devices can only be added if slots
+ * were reserved.
+ */
+PaError PaAlsa_UpdateDeviceList( void );
+
+/** Define an aggregate device, which combines several ALSA devices into one multi-channel device.
+ *
+ * Pa_Initialize adds the aggregate after all other ALSA devices. Its channels are those of the member devices, in
+ * the order the devices are given; a stream with fewer channels only uses the first members. A direction is only
+ * available if all members support it. The first device is the clock master. The other members run on their own
+ * clocks, their audio is resampled to follow the master, with a ratio adapted continuously to the drift measured
+ * from their buffer fill levels. Apart from that drift, the members have to support the stream's sample rate.
+ *
+ * Aggregate devices can only be used with callback streams, in sample formats that the master's hardware supports
+ * as 16 bit or 32 bit integer or as float. Call this before Pa_Initialize, the strings must stay valid while
+ * PortAudio is initialized.
+ * @param name The name of the device, as reported by Pa_GetDeviceInfo.
+ * @param deviceStrings The ALSA device strings of the members.
+ * @param count The number of members, 2 to 8.
+ * @return paInsufficientMemory if 8 aggregate devices have been defined already.
+ */
+PaError PaAlsa_AddAggregateDevice( const char *name, const char * const *deviceStrings, int count );
+
 /** Set the path and name of ALSA library file if PortAudio is configured to load it dynamically (see
  *  PA_ALSA_DYNAMIC). This setting will overwrite the default name set by PA_ALSA_PATHNAME define.
  * @param pathName Full path with filename. Only filename can be used, but dlopen() will lookup default
@@ -1096,6 +1096,31 @@ typedef struct PaStreamInfo
 const PaStreamInfo* Pa_GetStreamInfo( PaStream *stream );
 
 
+/** Change the latency of a stopped stream, without closing and reopening it.
+
+ The host buffers are renegotiated as if the stream had been opened with the
+ given suggested latencies, all other parameters of the stream are kept. Where
+ possible, the buffers and threads of the stream are reused. Query the
+ resulting latencies with Pa_GetStreamInfo().
+
+ @param stream A pointer to an open, stopped stream previously created with Pa_OpenStream().
+
+ @param inputLatency The suggested input latency in seconds, see
+ PaStreamParameters::suggestedLatency. Ignored for output-only streams.
+
+ @param outputLatency The suggested output latency in seconds. Ignored for
+ input-only streams.
+
+ @return paNoError on success. paStreamIsNotStopped if the stream is active,
+ paIncompatibleStreamHostApi if the stream's host API doesn't support changing
+ the latency. If any other error is returned the stream can't be started again,
+ and has to be closed.
+
+ @see Pa_OpenStream, Pa_GetStreamInfo
+*/
+PaError Pa_SetStreamLatency( PaStream *stream, PaTime inputLatency, PaTime outputLatency );
+
+
 /** Returns the current time in seconds for a stream according to the same clock used
  to generate callback PaStreamCallbackTimeInfo timestamps. The time values are
  monotonically increasing and have unspecified origin.
@@ -54,7 +54,7 @@
 
 #include <assert.h>
 
-#include "pa_util.h"   /* for PaUtil_GetTime() */
+#include "pa_util.h"   /* for PaUtil_GetTimeNs() */
 
 
 void PaUtil_InitializeCpuLoadMeasurer( PaUtilCpuLoadMeasurer* measurer, double sampleRate )
@@ -72,21 +72,22 @@ void PaUtil_ResetCpuLoadMeasurer( PaUtilCpuLoadMeasurer* measurer )
 
 void PaUtil_BeginCpuLoadMeasurement( PaUtilCpuLoadMeasurer* measurer )
 {
-    measurer->measurementStartTime = PaUtil_GetTime();
+    measurer->measurementStartTime = PaUtil_GetTimeNs();
 }
 
 
 void PaUtil_EndCpuLoadMeasurement( PaUtilCpuLoadMeasurer* measurer, unsigned long framesProcessed )
 {
-    double measurementEndTime, secondsFor100Percent, measuredLoad;
+    PaUtilTimeNs measurementEndTime;
+    double secondsFor100Percent, measuredLoad;
 
     if( framesProcessed > 0 ){
-        measurementEndTime = PaUtil_GetTime();
+        measurementEndTime = PaUtil_GetTimeNs();
 
         assert( framesProcessed > 0 );
         secondsFor100Percent = framesProcessed * measurer->samplingPeriod;
 
-        measuredLoad = (measurementEndTime - measurer->measurementStartTime) / secondsFor100Percent;
+        measuredLoad = PaUtil_NsToTime( measurementEndTime - measurer->measurementStartTime ) / secondsFor100Percent;
 
         /* Low pass filter the calculated CPU load to reduce jitter using a simple IIR low pass filter. */
         /** FIXME @todo these coefficients shouldn't be hardwired see: http://www.portaudio.com/trac/ticket/113 */
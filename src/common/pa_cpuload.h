@@ -47,6 +47,9 @@
 */
 
 
+#include "pa_util.h" /* PaUtilTimeNs */
+
+
 #ifdef __cplusplus
 extern "C"
 {
@@ -55,7 +58,7 @@ extern "C"
 
 typedef struct {
     double samplingPeriod;
-    double measurementStartTime;
+    PaUtilTimeNs measurementStartTime;
     double averageLoad;
 } PaUtilCpuLoadMeasurer; /**< @todo need better name than measurer */
 
@@ -780,6 +780,9 @@ const PaDeviceInfo* Pa_GetDeviceInfo( PaDeviceIndex device )
     }
     else
     {
+        if( hostApis_[hostApiIndex]->PrepareDeviceInfo )
+            hostApis_[hostApiIndex]->PrepareDeviceInfo( hostApis_[hostApiIndex], hostSpecificDeviceIndex );
+
         result = hostApis_[hostApiIndex]->deviceInfos[ hostSpecificDeviceIndex ];
 
         PA_LOGAPI(("Pa_GetDeviceInfo returned:\n" ));
@@ -1553,6 +1556,41 @@ PaError Pa_IsStreamActive( PaStream *stream )
 }
 
 
+PaError Pa_SetStreamLatency( PaStream *stream, PaTime inputLatency, PaTime outputLatency )
+{
+    PaError result = PaUtil_ValidateStreamPointer( stream );
+
+    PA_LOGAPI_ENTER_PARAMS( "Pa_SetStreamLatency" );
+    PA_LOGAPI(("\tPaStream* stream: 0x%p\n", stream ));
+    PA_LOGAPI(("\tPaTime inputLatency: %f\n", inputLatency ));
+    PA_LOGAPI(("\tPaTime outputLatency: %f\n", outputLatency ));
+
+    if( result == paNoError )
+    {
+        if( PA_STREAM_INTERFACE(stream)->SetLatency == 0 )
+        {
+            result = paIncompatibleStreamHostApi;
+        }
+        else
+        {
+            result = PA_STREAM_INTERFACE(stream)->IsStopped( stream );
+            if( result == 0 )
+            {
+                result = paStreamIsNotStopped;
+            }
+            else if( result == 1 )
+            {
+                result = PA_STREAM_INTERFACE(stream)->SetLatency( stream, inputLatency, outputLatency );
+            }
+        }
+    }
+
+    PA_LOGAPI_EXIT_PAERROR( "Pa_SetStreamLatency", result );
+
+    return result;
+}
+
+
 const PaStreamInfo* Pa_GetStreamInfo( PaStream *stream )
 {
     PaError error = PaUtil_ValidateStreamPointer( stream );
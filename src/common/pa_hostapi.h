@@ -322,6 +322,15 @@ typedef struct PaUtilHostApiRepresentation {
                                   const PaStreamParameters *inputParameters,
                                   const PaStreamParameters *outputParameters,
                                   double sampleRate );
+
+    /**
+        (*PrepareDeviceInfo)() is optional and may be left NULL. If supplied,
+        it is called by Pa_GetDeviceInfo() before deviceInfos[ <device> ] is
+        returned, which allows an implementation to defer determining the
+        capabilities of a device until they are asked for. <device> is a 0
+        based index within the host api's own device index range.
+    */
+    void (*PrepareDeviceInfo)( struct PaUtilHostApiRepresentation *hostApi, PaDeviceIndex device );
 } PaUtilHostApiRepresentation;
 
 
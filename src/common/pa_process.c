@@ -87,49 +87,14 @@ static unsigned long CalculateFrameShift( unsigned long M, unsigned long N )
 }
 
 
-PaError PaUtil_InitializeBufferProcessor( PaUtilBufferProcessor* bp,
-        int inputChannelCount, PaSampleFormat userInputSampleFormat,
-        PaSampleFormat hostInputSampleFormat,
-        int outputChannelCount, PaSampleFormat userOutputSampleFormat,
-        PaSampleFormat hostOutputSampleFormat,
-        double sampleRate,
-        PaStreamFlags streamFlags,
-        unsigned long framesPerUserBuffer,
-        unsigned long framesPerHostBuffer,
-        PaUtilHostBufferSizeMode hostBufferSizeMode,
-        PaStreamCallback *streamCallback, void *userData )
+/* Derive how the host buffers are adapted to the user buffers from the host buffer size */
+static void ConfigureHostBufferSize( PaUtilBufferProcessor* bp,
+        unsigned long framesPerHostBuffer, PaUtilHostBufferSizeMode hostBufferSizeMode )
 {
-    PaError result = paNoError;
-    PaError bytesPerSample;
-    unsigned long tempInputBufferSize, tempOutputBufferSize;
-    PaStreamFlags tempInputStreamFlags;
-
-    if( streamFlags & paNeverDropInput )
-    {
-        /* paNeverDropInput is only valid for full-duplex callback streams, with an unspecified number of frames per buffer. */
-        if( !streamCallback || !(inputChannelCount > 0 && outputChannelCount > 0) ||
-                framesPerUserBuffer != paFramesPerBufferUnspecified )
-            return paInvalidFlag;
-    }
-
-    /* initialize buffer ptrs to zero so they can be freed if necessary in error */
-    bp->tempInputBuffer = 0;
-    bp->tempInputBufferPtrs = 0;
-    bp->tempOutputBuffer = 0;
-    bp->tempOutputBufferPtrs = 0;
-
-    bp->framesPerUserBuffer = framesPerUserBuffer;
     bp->framesPerHostBuffer = framesPerHostBuffer;
-
-    bp->inputChannelCount = inputChannelCount;
-    bp->outputChannelCount = outputChannelCount;
-
     bp->hostBufferSizeMode = hostBufferSizeMode;
 
-    bp->hostInputChannels[0] = bp->hostInputChannels[1] = 0;
-    bp->hostOutputChannels[0] = bp->hostOutputChannels[1] = 0;
-
-    if( framesPerUserBuffer == 0 ) /* streamCallback will accept any buffer size */
+    if( bp->framesPerUserBuffer == 0 ) /* streamCallback will accept any buffer size */
     {
         bp->useNonAdaptingProcess = 1;
         bp->initialFramesInTempInputBuffer = 0;
@@ -147,10 +112,10 @@ PaError PaUtil_InitializeBufferProcessor( PaUtilBufferProcessor* bp,
     }
     else
     {
-        bp->framesPerTempBuffer = framesPerUserBuffer;
+        bp->framesPerTempBuffer = bp->framesPerUserBuffer;
 
         if( hostBufferSizeMode == paUtilFixedHostBufferSize
-                && framesPerHostBuffer % framesPerUserBuffer == 0 )
+                && framesPerHostBuffer % bp->framesPerUserBuffer == 0 )
         {
             bp->useNonAdaptingProcess = 1;
             bp->initialFramesInTempInputBuffer = 0;
@@ -160,15 +125,15 @@ PaError PaUtil_InitializeBufferProcessor( PaUtilBufferProcessor* bp,
         {
             bp->useNonAdaptingProcess = 0;
 
-            if( inputChannelCount > 0 && outputChannelCount > 0 )
+            if( bp->inputChannelCount > 0 && bp->outputChannelCount > 0 )
             {
                 /* full duplex */
                 if( hostBufferSizeMode == paUtilFixedHostBufferSize )
                 {
                     unsigned long frameShift =
-                        CalculateFrameShift( framesPerHostBuffer, framesPerUserBuffer );
+                        CalculateFrameShift( framesPerHostBuffer, bp->framesPerUserBuffer );
 
-                    if( framesPerUserBuffer > framesPerHostBuffer )
+                    if( bp->framesPerUserBuffer > framesPerHostBuffer )
                     {
                         bp->initialFramesInTempInputBuffer = frameShift;
                         bp->initialFramesInTempOutputBuffer = 0;
@@ -182,7 +147,7 @@ PaError PaUtil_InitializeBufferProcessor( PaUtilBufferProcessor* bp,
                 else /* variable host buffer size, add framesPerUserBuffer latency */
                 {
                     bp->initialFramesInTempInputBuffer = 0;
-                    bp->initialFramesInTempOutputBuffer = framesPerUserBuffer;
+                    bp->initialFramesInTempOutputBuffer = bp->framesPerUserBuffer;
                 }
             }
             else
@@ -193,7 +158,50 @@ PaError PaUtil_InitializeBufferProcessor( PaUtilBufferProcessor* bp,
             }
         }
     }
+}
+
+
+PaError PaUtil_InitializeBufferProcessor( PaUtilBufferProcessor* bp,
+        int inputChannelCount, PaSampleFormat userInputSampleFormat,
+        PaSampleFormat hostInputSampleFormat,
+        int outputChannelCount, PaSampleFormat userOutputSampleFormat,
+        PaSampleFormat hostOutputSampleFormat,
+        double sampleRate,
+        PaStreamFlags streamFlags,
+        unsigned long framesPerUserBuffer,
+        unsigned long framesPerHostBuffer,
+        PaUtilHostBufferSizeMode hostBufferSizeMode,
+        PaStreamCallback *streamCallback, void *userData )
+{
+    PaError result = paNoError;
+    PaError bytesPerSample;
+    unsigned long tempInputBufferSize, tempOutputBufferSize;
+    PaStreamFlags tempInputStreamFlags;
+
+    if( streamFlags & paNeverDropInput )
+    {
+        /* paNeverDropInput is only valid for full-duplex callback streams, with an unspecified number of frames per buffer. */
+        if( !streamCallback || !(inputChannelCount > 0 && outputChannelCount > 0) ||
+                framesPerUserBuffer != paFramesPerBufferUnspecified )
+            return paInvalidFlag;
+    }
 
+    /* initialize buffer ptrs to zero so they can be freed if necessary in error */
+    bp->tempInputBuffer = 0;
+    bp->tempInputBufferPtrs = 0;
+    bp->tempOutputBuffer = 0;
+    bp->tempOutputBufferPtrs = 0;
+
+    bp->framesPerUserBuffer = framesPerUserBuffer;
+
+    bp->inputChannelCount = inputChannelCount;
+    bp->outputChannelCount = outputChannelCount;
+
+    bp->hostInputChannels[0] = bp->hostInputChannels[1] = 0;
+    bp->hostOutputChannels[0] = bp->hostOutputChannels[1] = 0;
+
+    ConfigureHostBufferSize( bp, framesPerHostBuffer, hostBufferSizeMode );
+    bp->maxFramesPerTempBuffer = bp->framesPerTempBuffer;
 
     bp->framesInTempInputBuffer = bp->initialFramesInTempInputBuffer;
     bp->framesInTempOutputBuffer = bp->initialFramesInTempOutputBuffer;
@@ -434,6 +442,31 @@ void PaUtil_ResetBufferProcessor( PaUtilBufferProcessor* bp )
 }
 
 
+PaError PaUtil_SetBufferProcessorHostBufferSize( PaUtilBufferProcessor* bp,
+        unsigned long framesPerHostBuffer, PaUtilHostBufferSizeMode hostBufferSizeMode )
+{
+    PaUtilBufferProcessor previous = *bp;
+
+    ConfigureHostBufferSize( bp, framesPerHostBuffer, hostBufferSizeMode );
+    if( bp->framesPerTempBuffer > bp->maxFramesPerTempBuffer )
+    {
+        *bp = previous;
+        return paBufferTooBig;
+    }
+
+    /* Buffered frames remain valid as long as they are adapted the same way */
+    if( bp->useNonAdaptingProcess != previous.useNonAdaptingProcess
+            || bp->framesPerTempBuffer != previous.framesPerTempBuffer
+            || bp->initialFramesInTempInputBuffer != previous.initialFramesInTempInputBuffer
+            || bp->initialFramesInTempOutputBuffer != previous.initialFramesInTempOutputBuffer )
+    {
+        PaUtil_ResetBufferProcessor( bp );
+    }
+
+    return paNoError;
+}
+
+
 unsigned long PaUtil_GetBufferProcessorInputLatencyFrames( PaUtilBufferProcessor* bp )
 {
     return bp->initialFramesInTempInputBuffer;
@@ -259,6 +259,7 @@ typedef struct {
     int userOutputSampleFormatIsEqualToHost;
     int userInputSampleFormatIsEqualToHost;
     unsigned long framesPerTempBuffer;
+    unsigned long maxFramesPerTempBuffer; /**< the number of frames the temp buffers were allocated for */
 
     unsigned int inputChannelCount;
     unsigned int bytesPerHostInputSample;
@@ -397,6 +398,35 @@ PaError PaUtil_InitializeBufferProcessor( PaUtilBufferProcessor* bufferProcessor
 void PaUtil_TerminateBufferProcessor( PaUtilBufferProcessor* bufferProcessor );
 
 
+/** Change the host buffer size of a buffer processor, for example when the
+ host changes its period while a stream is running. This must not be called
+ while a buffer is being processed, the host buffer size takes effect with
+ the next call to PaUtil_BeginBufferProcessing.
+
+ The temporary buffers are not reallocated, so this function may be called
+ from a real-time thread. Initialize the buffer processor with the largest
+ host buffer size that is expected, so that the temporary buffers are large
+ enough. Internally buffered data is kept where the buffer adaption doesn't
+ change, otherwise the buffer processor is reset as by
+ PaUtil_ResetBufferProcessor.
+
+ @param bufferProcessor The buffer processor to reconfigure.
+
+ @param framesPerHostBuffer The new host buffer size, see
+ PaUtil_InitializeBufferProcessor.
+
+ @param hostBufferSizeMode The new host buffer size mode, see
+ PaUtil_InitializeBufferProcessor.
+
+ @return paBufferTooBig if the temporary buffers are too small for the new
+ host buffer size, in which case the buffer processor is left unchanged.
+
+ @see PaUtil_InitializeBufferProcessor
+*/
+PaError PaUtil_SetBufferProcessorHostBufferSize( PaUtilBufferProcessor* bufferProcessor,
+        unsigned long framesPerHostBuffer, PaUtilHostBufferSizeMode hostBufferSizeMode );
+
+
 /** Clear any internally buffered data. If you call
  PaUtil_InitializeBufferProcessor in your OpenStream routine, make sure you
  call PaUtil_ResetBufferProcessor in your StartStream call.
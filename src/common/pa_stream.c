@@ -74,6 +74,7 @@ void PaUtil_InitializeStreamInterface( PaUtilStreamInterface *streamInterface,
     streamInterface->Write = Write;
     streamInterface->GetReadAvailable = GetReadAvailable;
     streamInterface->GetWriteAvailable = GetWriteAvailable;
+    streamInterface->SetLatency = 0;
 }
 
 
@@ -77,10 +77,14 @@ typedef struct {
     PaError (*Write)( PaStream* stream, const void *buffer, unsigned long frames );
     signed long (*GetReadAvailable)( PaStream* stream );
     signed long (*GetWriteAvailable)( PaStream* stream );
+    PaError (*SetLatency)( PaStream* stream, PaTime inputLatency, PaTime outputLatency );
 } PaUtilStreamInterface;
 
 
 /** Initialize the fields of a PaUtilStreamInterface structure.
+
+ SetLatency is optional and is initialized to 0, implementations which support
+ Pa_SetStreamLatency() assign it afterwards. It is only called for a stopped stream.
 */
 void PaUtil_InitializeStreamInterface( PaUtilStreamInterface *streamInterface,
     PaError (*Close)( PaStream* ),
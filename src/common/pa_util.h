@@ -165,6 +165,27 @@ void PaUtil_InitializeClock( void );
 double PaUtil_GetTime( void );
 
 
+/** An integer timestamp in nanoseconds, as returned by PaUtil_GetTimeNs().
+*/
+typedef long long PaUtilTimeNs;
+
+
+/** Return the time of the clock used by PaUtil_GetTime() as an integer number
+ of nanoseconds. Prefer this in code that is executed for every buffer (such as
+ CPU load measurement), it avoids the floating point conversion and the loss of
+ precision when subtracting large times. Convert differences to seconds with
+ PaUtil_NsToTime() where a PaTime is required.
+
+ @see PaUtil_GetTime
+*/
+PaUtilTimeNs PaUtil_GetTimeNs( void );
+
+
+/** Convert a number of nanoseconds to seconds.
+*/
+#define PaUtil_NsToTime( ns ) ( (double)(ns) * 1e-9 )
+
+
 /* void Pa_Sleep( long msec );  must also be implemented in per-platform .c file */
 
 
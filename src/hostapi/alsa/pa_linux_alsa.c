@@ -55,6 +55,8 @@
 
 #include <sys/poll.h>
 #include <string.h> /* strlen() */
+#include <stddef.h> /* offsetof() */
+#include <stdint.h> /* uint64_t */
 #include <limits.h>
 #include <math.h>
 #include <pthread.h>
@@ -62,6 +64,15 @@
 #include <time.h>
 #include <sys/mman.h>
 #include <signal.h> /* For sig_atomic_t */
+#include <unistd.h> /* For pipe() */
+#include <fcntl.h>
+#include <sys/stat.h> /* For stat() */
+#ifdef __linux__
+    #include <sys/timerfd.h> /* For timer-based scheduling */
+    #define PA_ALSA_USE_TIMERFD
+    #include <sys/inotify.h> /* For the device monitor */
+    #define PA_ALSA_USE_INOTIFY
+#endif
 #ifdef PA_ALSA_DYNAMIC
     #include <dlfcn.h> /* For dlXXX functions */
 #endif
@@ -87,9 +98,22 @@
 /* Combine version elements into a single (unsigned) integer */
 #define ALSA_VERSION_INT(major, minor, subminor)  ((major << 16) | (minor << 8) | subminor)
 
+/* SND_PCM_TSTAMP_TYPE_MONOTONIC is an enumerator, added with snd_pcm_sw_params_set_tstamp_type in ALSA 1.0.28 */
+#if SND_LIB_VERSION >= ALSA_VERSION_INT(1, 0, 28)
+    #define PA_ALSA_HAVE_TSTAMP_TYPE
+#endif
+
 /* The acceptable tolerance of sample rate set, to that requested (as a ratio, eg 50 is 2%, 100 is 1%) */
 #define RATE_MAX_DEVIATE_RATIO 100
 
+/* The ALSA buffer size to ask for with timer-based scheduling, in seconds */
+#define TSCHED_BUFFER_TIME 2.0
+
+/* Stream time info is derived from a delay-locked loop per direction, see PaAlsaStreamComponent_GetBufferTime */
+#define CLOCK_BANDWIDTH 0.5                 /* Bandwidth of the loop, in Hz */
+#define CLOCK_MAX_ERROR_NS 2000000          /* Timestamps deviating more than this (xruns, suspends) restart the loop */
+#define CLOCK_RESYNC_NS 1000000000          /* How often the device delay is queried with snd_pcm_status */
+
 /* Defines Alsa function types and pointers to these functions. */
 #define _PA_DEFINE_FUNC(x)  typedef typeof(x) x##_ft; static x##_ft *alsa_##x = 0
 
@@ -122,7 +146,9 @@ _PA_DEFINE_FUNC(snd_pcm_poll_descriptors_count);
 _PA_DEFINE_FUNC(snd_pcm_poll_descriptors_revents);
 _PA_DEFINE_FUNC(snd_pcm_format_size);
 _PA_DEFINE_FUNC(snd_pcm_link);
+_PA_DEFINE_FUNC(snd_pcm_unlink);
 _PA_DEFINE_FUNC(snd_pcm_delay);
+_PA_DEFINE_FUNC(snd_pcm_htimestamp);
 
 _PA_DEFINE_FUNC(snd_pcm_hw_params_sizeof);
 _PA_DEFINE_FUNC(snd_pcm_hw_params_malloc);
@@ -143,6 +169,7 @@ _PA_DEFINE_FUNC(snd_pcm_hw_params_set_buffer_size_min);
 _PA_DEFINE_FUNC(snd_pcm_hw_params_set_period_size_near);
 _PA_DEFINE_FUNC(snd_pcm_hw_params_set_periods_integer);
 _PA_DEFINE_FUNC(snd_pcm_hw_params_set_periods_min);
+_PA_DEFINE_FUNC(snd_pcm_hw_params_set_period_wakeup);
 
 _PA_DEFINE_FUNC(snd_pcm_hw_params_get_buffer_size);
 //_PA_DEFINE_FUNC(snd_pcm_hw_params_get_period_size);
@@ -182,6 +209,9 @@ _PA_DEFINE_FUNC(snd_pcm_sw_params_set_silence_threshold);
 _PA_DEFINE_FUNC(snd_pcm_sw_params_set_silence_size);
 _PA_DEFINE_FUNC(snd_pcm_sw_params_set_xfer_align);
 _PA_DEFINE_FUNC(snd_pcm_sw_params_set_tstamp_mode);
+#ifdef PA_ALSA_HAVE_TSTAMP_TYPE
+_PA_DEFINE_FUNC(snd_pcm_sw_params_set_tstamp_type);
+#endif
 #define alsa_snd_pcm_sw_params_alloca(ptr) __alsa_snd_alloca(ptr, snd_pcm_sw_params)
 
 _PA_DEFINE_FUNC(snd_pcm_info);
@@ -204,6 +234,8 @@ _PA_DEFINE_FUNC(snd_ctl_card_info_free);
 _PA_DEFINE_FUNC(snd_ctl_card_info);
 _PA_DEFINE_FUNC(snd_ctl_card_info_sizeof);
 _PA_DEFINE_FUNC(snd_ctl_card_info_get_name);
+_PA_DEFINE_FUNC(snd_ctl_card_info_get_id);
+_PA_DEFINE_FUNC(snd_ctl_card_info_get_driver);
 #define alsa_snd_ctl_card_info_alloca(ptr) __alsa_snd_alloca(ptr, snd_ctl_card_info)
 
 _PA_DEFINE_FUNC(snd_config);
@@ -225,6 +257,7 @@ _PA_DEFINE_FUNC(snd_pcm_status_get_state);
 _PA_DEFINE_FUNC(snd_pcm_status_get_trigger_tstamp);
 _PA_DEFINE_FUNC(snd_pcm_status_get_trigger_htstamp);
 _PA_DEFINE_FUNC(snd_pcm_status_get_delay);
+_PA_DEFINE_FUNC(snd_pcm_status_get_avail);
 #define alsa_snd_pcm_status_alloca(ptr) __alsa_snd_alloca(ptr, snd_pcm_status)
 
 _PA_DEFINE_FUNC(snd_card_next);
@@ -407,7 +440,9 @@ static int PaAlsa_LoadLibrary()
     _PA_LOAD_FUNC(snd_pcm_poll_descriptors_revents);
     _PA_LOAD_FUNC(snd_pcm_format_size);
     _PA_LOAD_FUNC(snd_pcm_link);
+    _PA_LOAD_FUNC(snd_pcm_unlink);
     _PA_LOAD_FUNC(snd_pcm_delay);
+    _PA_LOAD_FUNC(snd_pcm_htimestamp);
 
     _PA_LOAD_FUNC(snd_pcm_hw_params_sizeof);
     _PA_LOAD_FUNC(snd_pcm_hw_params_malloc);
@@ -428,6 +463,7 @@ static int PaAlsa_LoadLibrary()
     _PA_LOAD_FUNC(snd_pcm_hw_params_set_period_size_near);
     _PA_LOAD_FUNC(snd_pcm_hw_params_set_periods_integer);
     _PA_LOAD_FUNC(snd_pcm_hw_params_set_periods_min);
+    _PA_LOAD_FUNC(snd_pcm_hw_params_set_period_wakeup);
 
     _PA_LOAD_FUNC(snd_pcm_hw_params_get_buffer_size);
 //    _PA_LOAD_FUNC(snd_pcm_hw_params_get_period_size);
@@ -466,6 +502,9 @@ static int PaAlsa_LoadLibrary()
     _PA_LOAD_FUNC(snd_pcm_sw_params_set_silence_size);
     _PA_LOAD_FUNC(snd_pcm_sw_params_set_xfer_align);
     _PA_LOAD_FUNC(snd_pcm_sw_params_set_tstamp_mode);
+#ifdef PA_ALSA_HAVE_TSTAMP_TYPE
+    _PA_LOAD_FUNC(snd_pcm_sw_params_set_tstamp_type);
+#endif
 
     _PA_LOAD_FUNC(snd_pcm_info);
     _PA_LOAD_FUNC(snd_pcm_info_sizeof);
@@ -486,6 +525,8 @@ static int PaAlsa_LoadLibrary()
     _PA_LOAD_FUNC(snd_ctl_card_info);
     _PA_LOAD_FUNC(snd_ctl_card_info_sizeof);
     _PA_LOAD_FUNC(snd_ctl_card_info_get_name);
+    _PA_LOAD_FUNC(snd_ctl_card_info_get_id);
+    _PA_LOAD_FUNC(snd_ctl_card_info_get_driver);
 
     _PA_LOAD_FUNC(snd_config);
     _PA_LOAD_FUNC(snd_config_update);
@@ -506,6 +547,7 @@ static int PaAlsa_LoadLibrary()
     _PA_LOAD_FUNC(snd_pcm_status_get_trigger_tstamp);
     _PA_LOAD_FUNC(snd_pcm_status_get_trigger_htstamp);
     _PA_LOAD_FUNC(snd_pcm_status_get_delay);
+    _PA_LOAD_FUNC(snd_pcm_status_get_avail);
 
     _PA_LOAD_FUNC(snd_card_next);
     _PA_LOAD_FUNC(snd_asoundlib_version);
@@ -598,6 +640,33 @@ static void PaAlsa_CloseLibrary()
 
 static int numPeriods_ = 4;
 static int busyRetries_ = 100;
+static const char *deviceCachePath_ = NULL;
+static int lazyProbing_ = 0;
+
+/* Device monitor, see PaAlsa_EnableDeviceMonitor */
+static int monitorReservedDevices_ = -1;   /* Negative if the monitor is disabled */
+static PaAlsaDevicesChangedCallback *monitorCallback_ = NULL;
+static void *monitorUserData_ = NULL;
+
+/* How long device nodes have to stay unchanged before the device list is updated */
+#define DEVICE_MONITOR_SETTLE_MSEC 200
+
+/* Aggregate devices, see PaAlsa_AddAggregateDevice */
+#define MAX_AGGREGATE_DEVICES 8
+#define MAX_AGGREGATE_MEMBERS 8
+
+typedef struct
+{
+    const char *name;
+    const char *memberNames[MAX_AGGREGATE_MEMBERS];     /* The first member is the clock master */
+    int numMembers;
+    /* The channels of each member, filled in when the aggregate is probed */
+    int maxInputChannels[MAX_AGGREGATE_MEMBERS], maxOutputChannels[MAX_AGGREGATE_MEMBERS];
+}
+PaAlsaAggregateSpec;
+
+static PaAlsaAggregateSpec aggregates_[MAX_AGGREGATE_DEVICES];
+static int numAggregates_ = 0;
 
 int PaAlsa_SetNumPeriods( int numPeriods )
 {
@@ -611,20 +680,35 @@ typedef enum
     StreamDirection_Out
 } StreamDirection;
 
+/* Delay-locked loop mapping the frame positions of a device to time, see PaAlsaClock_Update */
+typedef struct
+{
+    int valid;
+    long long position;         /* The position of the last update */
+    double time;                /* The filtered time of position, in nanoseconds */
+    double framePeriod;         /* The filtered duration of a frame, in nanoseconds */
+} PaAlsaClock;
+
 typedef struct
 {
     PaSampleFormat hostSampleFormat;
     int numUserChannels, numHostChannels;
     int userInterleaved, hostInterleaved;
     int canMmap;
+    /* Without mmap access, frames are processed in nonMmapBuffer and transferred with snd_pcm_readi/writei (or the
+     * non-interleaved variants). The buffer is described by nonMmapAreas, so it is accessed like the mmap buffer */
     void *nonMmapBuffer;
-    unsigned int nonMmapBufferSize;
+    snd_pcm_channel_area_t *nonMmapAreas;
+    snd_pcm_uframes_t nonMmapFrames;    /* The capacity of nonMmapBuffer */
+    snd_pcm_uframes_t nonMmapPending;   /* Processed output frames not yet accepted by ALSA, see FlushOutput */
     PaDeviceIndex device;     /* Keep the device index */
     int deviceIsPlug; /* Distinguish plug types from direct 'hw:' devices */
     int useReventFix; /* Alsa older than 1.0.16, plug devices need a fix */
 
     snd_pcm_t *pcm;
     snd_pcm_uframes_t framesPerPeriod, alsaBufferSize;
+    int timerScheduling;            /* Period wakeups are disabled, see PaAlsaStream_WaitForTimer */
+    snd_pcm_uframes_t watermark;    /* With timer-based scheduling, the playback buffer is only filled up to here */
     snd_pcm_format_t nativeFormat;
     unsigned int nfds;
     int ready;  /* Marked ready from poll */
@@ -633,8 +717,43 @@ typedef struct
     StreamDirection streamDir;
 
     snd_pcm_channel_area_t *channelAreas;  /* Needed for channel adaption */
+    void **regionChannels;      /* Channel pointers of a non-interleaved PaAlsaMmapRegion */
+    unsigned long regionFrames; /* Frames of the acquired PaAlsaMmapRegion, 0 if none */
+
+    /* Time info, see PaAlsaStreamComponent_GetBufferTime */
+    long long framesTransferred;    /* Frames read or written since the clock was reset */
+    PaAlsaClock clock;
+    PaUtilTimeNs clockResyncTime;   /* When to query the device delay again */
+    int monotonicTstamps;           /* ALSA timestamps are CLOCK_MONOTONIC rather than gettimeofday */
+    snd_pcm_sframes_t extraDelay;   /* Frames of delay beyond the buffer, such as in the hardware FIFO */
 } PaAlsaStreamComponent;
 
+/* A member of an aggregate device other than its master, which is driven by one of the stream's components.
+ * The member runs on its own clock, it is resampled to follow the master, see PaAlsaStream_OpenMembers */
+typedef struct
+{
+    snd_pcm_t *pcm;
+    StreamDirection streamDir;
+    int firstChannel;               /* The member's first channel among the stream's channels */
+    int numUserChannels, numHostChannels;
+    snd_pcm_format_t nativeFormat;
+    snd_pcm_format_t bufferFormat;  /* The master's format, which the buffer processor converts from/to */
+    snd_pcm_uframes_t alsaBufferSize;
+    int started;
+
+    unsigned char *buffer;          /* The member's user channels, interleaved, exchanged with the buffer processor */
+    unsigned char *fifo;            /* Device frames captured but not yet resampled, or resampled but not yet written */
+    unsigned long fifoFrames, fifoCapacity;
+    double *lastFrame;              /* The last output frame of the previous buffer, which is interpolated from */
+
+    /* Drift compensation, see AggregateMember_UpdateRatio */
+    double position;                /* Resampling position, in frames of the resampled buffer */
+    double ratio;                   /* Device frames per stream frame */
+    double targetFill, filteredFill, integral;
+} PaAlsaAggregateMember;
+
+struct PaAlsaEngine;
+
 /* Implementation specific stream structure */
 typedef struct PaAlsaStream
 {
@@ -648,16 +767,26 @@ typedef struct PaAlsaStream
     int primeBuffers;
     int callbackMode;              /* bool: are we running in callback mode? */
     int pcmsSynced;                /* Have we successfully synced pcms */
+    int reconfigureFailed;         /* SetStreamLatency left the pcms unusable, see PaAlsaStream_Reconfigure */
     int rtSched;
 
     /* the callback thread uses these to poll the sound device(s), waiting
      * for data to be ready/available */
     struct pollfd* pfds;
     int pollTimeout;
+    int stopFds[2];                         /* Pipe polled along with the devices, written to when stopping */
+
+    /* Timer-based scheduling, see paAlsaTimerScheduling */
+    int timerScheduling;
+    int timerFd;                            /* -1 if not available, the poll timeout is used instead */
+    PaUtilTimeNs tschedCost;                /* Estimate of the time spent processing after a wakeup */
+    PaUtilTimeNs tschedProcessStart;        /* When frames were last handed out for processing, 0 if not */
 
     /* Used in communication between threads */
     volatile sig_atomic_t callback_finished; /* bool: are we in the "callback finished" state? */
     volatile sig_atomic_t callbackAbort;    /* Drop frames? */
+    volatile sig_atomic_t stopRequested;    /* Set by RealStop before waking the callback thread */
+    volatile sig_atomic_t abortRequested;   /* Stop without flushing buffered output */
     volatile sig_atomic_t isActive;         /* Is stream in active state? (Between StartStream and StopStream || !paContinue) */
     PaUnixMutex stateMtx;                   /* Used to synchronize access to stream state */
 
@@ -666,12 +795,97 @@ typedef struct PaAlsaStream
     PaTime underrun;
     PaTime overrun;
 
+    /* Xrun recovery, see PaAlsa_SetXrunRecovery */
+    PaAlsaXrunRecovery xrunRecovery;
+    PaUtilTimeNs xrunTime;                  /* When the xrun being recovered from occurred, 0 if none */
+    int regenerateOutput;                   /* Output is to be regenerated before restarting, see HandleXrun */
+    PaAlsaXrunStatistics xrunStats;         /* Protected by stateMtx */
+
     PaAlsaStreamComponent capture, playback;
+
+    /* Shared engine state, see PaAlsa_EnableSharedEngine */
+    int useSharedEngine;
+    struct PaAlsaEngine *engine;
+    struct PaAlsaStream *engineNext;            /* Next stream attached to the engine */
+    int engineAttached;                         /* Protected by the engine mutex */
+    int engineCallbackResult;
+    int enginePollCapture, enginePollPlayback;  /* Directions the engine is still polling for */
+    int enginePollTimeout;
+    PaUtilTimeNs engineDeadline;                /* The device is considered stalled if not ready by then */
+    unsigned int engineFdIndex;                 /* Index of the stream's descriptors in the engine's pollfds */
+
+    /* Members of aggregate devices besides their masters, see PaAlsa_AddAggregateDevice */
+    PaAlsaAggregateMember *members;
+    int numMembers;
+
+    /* What the stream was opened with, needed to configure it anew, see SetStreamLatency */
+    PaUtilHostApiRepresentation *hostApi;
+    PaStreamParameters inputParameters, outputParameters;
+    double nominalSampleRate;
+    PaStreamFlags streamFlags;
 }
 PaAlsaStream;
 
+/** Shared engine, servicing a number of callback streams from one thread.
+ *
+ * Streams are attached from the main thread by pushing them on the front of the list, streams are only ever
+ * detached by the engine thread itself. A pipe is used to wake up the engine when the list has changed.
+ */
+typedef struct PaAlsaEngine
+{
+    PaUnixThread thread;
+    PaUnixMutex mtx;
+    pthread_cond_t cond;        /* Signalled when a stream has been detached */
+    int running;                /* The thread is servicing streams, protected by mtx */
+    int joinable;               /* The thread has been started and not yet joined */
+    volatile sig_atomic_t quit;
+    int wakeFds[2];
+    PaAlsaStream *streams;
+
+    /* Only accessed by the engine thread */
+    struct pollfd *pfds;
+    unsigned int maxPfds;
+}
+PaAlsaEngine;
+
+/* On-disk cache of device capabilities, see DeviceCache_Load */
+typedef struct
+{
+    char *key;
+    int used;
+    int minInputChannels, maxInputChannels, minOutputChannels, maxOutputChannels;
+    long defaultSampleRate;
+    /* Latencies are stored as integer nanoseconds, which isn't affected by the locale's decimal separator */
+    long long defaultLowInputLatency, defaultHighInputLatency, defaultLowOutputLatency, defaultHighOutputLatency;
+}
+PaAlsaDeviceCacheEntry;
+
+typedef struct
+{
+    const char *path;                   /* NULL if the cache is disabled */
+    unsigned long long signature;
+    PaAlsaDeviceCacheEntry *entries;
+    size_t numEntries, maxEntries;
+    int dirty;                          /* The file has to be rewritten */
+}
+PaAlsaDeviceCache;
+
 /* PaAlsaHostApiRepresentation - host api datastructure specific to this implementation */
 
+/** Watches the device directory for sound cards coming and going, see PaAlsa_EnableDeviceMonitor.
+ */
+typedef struct PaAlsaDeviceMonitor
+{
+    int reservedDevices;        /* Slots at the end of the device list for devices added later */
+    PaUnixMutex mtx;            /* Held while the device list is updated, read or a device is probed */
+    PaUnixThread thread;
+    int running;
+    volatile sig_atomic_t quit;
+    int wakeFds[2];
+    int inotifyFd;
+}
+PaAlsaDeviceMonitor;
+
 typedef struct PaAlsaHostApiRepresentation
 {
     PaUtilHostApiRepresentation baseHostApiRep;
@@ -682,6 +896,15 @@ typedef struct PaAlsaHostApiRepresentation
 
     PaHostApiIndex hostApiIndex;
     PaUint32 alsaLibVersion; /* Retrieved from the library at run-time */
+
+    PaAlsaEngine engine;
+
+    PaAlsaDeviceCache deviceCache;
+    int lazyProbing;        /* Devices are probed on first use, see PaAlsa_EnableLazyDeviceProbing */
+    int probeOpenMode;      /* The mode devices are opened with for probing */
+    int usePlughw;          /* Hw devices are opened through plughw, see PA_ALSA_PLUGHW */
+
+    PaAlsaDeviceMonitor monitor;
 }
 PaAlsaHostApiRepresentation;
 
@@ -692,12 +915,27 @@ typedef struct PaAlsaDeviceInfo
     int isPlug;
     int minInputChannels;
     int minOutputChannels;
+    const PaAlsaAggregateSpec *aggregate;   /* For an aggregate device, alsaName is its master */
+    int isHw;                               /* A device of a sound card, see UpdateDeviceList */
+
+    /* With lazy probing, what is needed to probe the device later */
+    int probed;
+    int hasCapture, hasPlayback;
+    char *cacheKey;
+
+    /* For an inactive slot, the strings of the device that was removed from it, see UpdateDeviceList */
+    char *removedName, *removedAlsaName, *removedCacheKey;
 }
 PaAlsaDeviceInfo;
 
 /* prototypes for functions declared in this file */
 
 static void Terminate( struct PaUtilHostApiRepresentation *hostApi );
+static void PrepareDeviceInfo( struct PaUtilHostApiRepresentation *hostApi, PaDeviceIndex device );
+static void DeviceCache_Terminate( PaAlsaDeviceCache *self );
+static void PaAlsaDeviceMonitor_Initialize( PaAlsaDeviceMonitor *self );
+static PaError PaAlsaDeviceMonitor_Start( PaAlsaDeviceMonitor *self, PaAlsaHostApiRepresentation *alsaApi );
+static void PaAlsaDeviceMonitor_Terminate( PaAlsaDeviceMonitor *self );
 static PaError IsFormatSupported( struct PaUtilHostApiRepresentation *hostApi,
                                   const PaStreamParameters *inputParameters,
                                   const PaStreamParameters *outputParameters,
@@ -719,6 +957,7 @@ static PaError IsStreamStopped( PaStream *s );
 static PaError IsStreamActive( PaStream *stream );
 static PaTime GetStreamTime( PaStream *stream );
 static double GetStreamCpuLoad( PaStream* stream );
+static PaError SetStreamLatency( PaStream *s, PaTime inputLatency, PaTime outputLatency );
 static PaError BuildDeviceList( PaAlsaHostApiRepresentation *hostApi );
 static int SetApproximateSampleRate( snd_pcm_t *pcm,
         snd_pcm_hw_params_t *hwParams, unsigned int *sampleRatePtr );
@@ -727,6 +966,16 @@ static PaUint32 PaAlsaVersionNum(void);
 
 /* Callback prototypes */
 static void *CallbackThreadFunc( void *userData );
+static void PaAlsaEngine_Initialize( PaAlsaEngine *self );
+static void PaAlsaEngine_Terminate( PaAlsaEngine *self );
+static PaError PaAlsaEngine_Attach( PaAlsaEngine *self, PaAlsaStream *stream, int rtSched );
+static PaError PaAlsaEngine_Detach( PaAlsaEngine *self, PaAlsaStream *stream );
+static PaError AlsaStop( PaAlsaStream *stream, int abort );
+static void PaAlsaStream_CloseMembers( PaAlsaStream *self );
+static PaError PaAlsaStream_ResizePollDescriptors( PaAlsaStream *self );
+static PaError PaAlsaStreamComponent_FlushOutput( PaAlsaStreamComponent *self, int *xrun );
+static PaError PaAlsaStream_StartCallbackMode( PaAlsaStream *self, int *callbackResult );
+static PaError PaAlsaStream_RegenerateOutput( PaAlsaStream *self, int *callbackResult );
 
 /* Blocking prototypes */
 static signed long GetStreamReadAvailable( PaStream* s );
@@ -758,9 +1007,12 @@ PaError PaAlsa_Initialize( PaUtilHostApiRepresentation **hostApi, PaHostApiIndex
 
     PA_UNLESS( alsaHostApi = (PaAlsaHostApiRepresentation*) PaUtil_AllocateZeroInitializedMemory(
                 sizeof(PaAlsaHostApiRepresentation) ), paInsufficientMemory );
+    PaAlsaEngine_Initialize( &alsaHostApi->engine );
+    PaAlsaDeviceMonitor_Initialize( &alsaHostApi->monitor );
     PA_UNLESS( alsaHostApi->allocations = PaUtil_CreateAllocationGroup(), paInsufficientMemory );
     alsaHostApi->hostApiIndex = hostApiIndex;
     alsaHostApi->alsaLibVersion = PaAlsaVersionNum();
+    alsaHostApi->monitor.reservedDevices = PA_MAX( monitorReservedDevices_, 0 );
 
     *hostApi = (PaUtilHostApiRepresentation*)alsaHostApi;
     (*hostApi)->info.structVersion = 1;
@@ -770,6 +1022,7 @@ PaError PaAlsa_Initialize( PaUtilHostApiRepresentation **hostApi, PaHostApiIndex
     (*hostApi)->Terminate = Terminate;
     (*hostApi)->OpenStream = OpenStream;
     (*hostApi)->IsFormatSupported = IsFormatSupported;
+    (*hostApi)->PrepareDeviceInfo = PrepareDeviceInfo;
 
     /** If AlsaErrorHandler is to be used, do not forget to unregister callback pointer in
         Terminate function.
@@ -795,14 +1048,24 @@ PaError PaAlsa_Initialize( PaUtilHostApiRepresentation **hostApi, PaHostApiIndex
                                       ReadStream, WriteStream,
                                       GetStreamReadAvailable,
                                       GetStreamWriteAvailable );
+    alsaHostApi->callbackStreamInterface.SetLatency = SetStreamLatency;
+    alsaHostApi->blockingStreamInterface.SetLatency = SetStreamLatency;
 
     PA_ENSURE( PaUnixThreading_Initialize() );
 
+    if( monitorReservedDevices_ >= 0 )
+    {
+        PA_ENSURE( PaAlsaDeviceMonitor_Start( &alsaHostApi->monitor, alsaHostApi ) );
+    }
+
     return result;
 
 error:
     if( alsaHostApi )
     {
+        PaAlsaDeviceMonitor_Terminate( &alsaHostApi->monitor );
+        PaAlsaEngine_Terminate( &alsaHostApi->engine );
+        DeviceCache_Terminate( &alsaHostApi->deviceCache );
         if( alsaHostApi->allocations )
         {
             PaUtil_FreeAllAllocations( alsaHostApi->allocations );
@@ -825,6 +1088,10 @@ static void Terminate( struct PaUtilHostApiRepresentation *hostApi )
     */
     /*snd_lib_error_set_handler(NULL);*/
 
+    PaAlsaDeviceMonitor_Terminate( &alsaHostApi->monitor );
+    PaAlsaEngine_Terminate( &alsaHostApi->engine );
+    DeviceCache_Terminate( &alsaHostApi->deviceCache );
+
     if( alsaHostApi->allocations )
     {
         PaUtil_FreeAllAllocations( alsaHostApi->allocations );
@@ -1028,8 +1295,24 @@ typedef struct
     int isPlug;
     int hasPlayback;
     int hasCapture;
+    char *cacheKey;     /* Identifies the device in the device cache, NULL if not cacheable */
+    int probeState;     /* See ProbeState */
+    const PaAlsaAggregateSpec *aggregate;   /* For an aggregate device, alsaName is its master */
+    int isHw;           /* A device of a sound card, rather than a plugin */
 } HwDevInfo;
 
+/* How far the capabilities of a HwDevInfo have been determined */
+typedef enum
+{
+    ProbeState_Pending = 0,
+    ProbeState_Probed,          /* By opening the device */
+    ProbeState_Cached,          /* From the device cache */
+    ProbeState_Failed
+} ProbeState;
+
+/* The maximum number of threads probing devices concurrently, including the calling thread */
+#define MAX_PROBE_THREADS 4
+
 
 HwDevInfo predefinedNames[] = {
     { "center_lfe", NULL, 0, 1, 0 },
@@ -1081,7 +1364,7 @@ static const HwDevInfo *FindDeviceName( const char *name )
     return NULL;
 }
 
-static PaError PaAlsa_StrDup( PaAlsaHostApiRepresentation *alsaApi,
+static PaError PaAlsa_StrDup( PaUtilAllocationGroup *allocations,
         char **dst,
         const char *src)
 {
@@ -1090,7 +1373,7 @@ static PaError PaAlsa_StrDup( PaAlsaHostApiRepresentation *alsaApi,
 
     /* PA_DEBUG(("PaStrDup %s %d\n", src, len)); */
 
-    PA_UNLESS( *dst = (char *)PaUtil_GroupAllocateZeroInitializedMemory( alsaApi->allocations, len ),
+    PA_UNLESS( *dst = (char *)PaUtil_GroupAllocateZeroInitializedMemory( allocations, len ),
             paInsufficientMemory );
     strncpy( *dst, src, len );
 
@@ -1189,997 +1472,2005 @@ static int OpenPcm( snd_pcm_t **pcmp, const char *name, snd_pcm_stream_t stream,
     return ret;
 }
 
-static PaError FillInDevInfo( PaAlsaHostApiRepresentation *alsaApi, HwDevInfo* deviceHwInfo, int blocking,
-        PaAlsaDeviceInfo* devInfo, int* devIdx )
+/* Device capability cache
+ *
+ * Probing a device means opening its pcm in both directions, which can take a long time with many cards and
+ * plugins. If a cache path is configured (see PaAlsa_SetDeviceCachePath), the probed capabilities are saved
+ * to a text file and reused on the next initialization. The file starts with a signature computed from
+ * /proc/asound/cards, the ALSA configuration files and the alsa-lib version, and is discarded when the
+ * signature no longer matches. Devices are keyed by card id, driver and device number (hw devices) or by
+ * name (plugins), which unlike card indices stay the same when cards are enumerated in a different order.
+ */
+
+#define DEVICE_CACHE_HEADER "PortAudio ALSA device cache 1"
+
+/* FNV-1a hash */
+static unsigned long long DeviceCache_Hash( unsigned long long hash, const void *data, size_t size )
 {
-    PaError result = 0;
-    PaDeviceInfo *baseDeviceInfo = &devInfo->baseDeviceInfo;
-    snd_pcm_t *pcm = NULL;
-    PaUtilHostApiRepresentation *baseApi = &alsaApi->baseHostApiRep;
+    const unsigned char *bytes = (const unsigned char *)data;
+    size_t i;
 
-    PA_DEBUG(( "%s: Filling device info for: %s\n", __FUNCTION__, deviceHwInfo->name ));
+    for( i = 0; i < size; ++i )
+    {
+        hash = ( hash ^ bytes[i] ) * 1099511628211ULL;
+    }
+    return hash;
+}
 
-    /* Zero fields */
-    InitializeDeviceInfo( baseDeviceInfo );
+static unsigned long long DeviceCache_HashFileTime( unsigned long long hash, const char *path )
+{
+    struct stat st;
 
-    /* To determine device capabilities, we must open the device and query the
-     * hardware parameter configuration space */
+    if( path && stat( path, &st ) == 0 )
+    {
+        hash = DeviceCache_Hash( hash, &st.st_mtime, sizeof (st.st_mtime) );
+    }
+    return hash;
+}
 
-    /* Query capture */
-    if( deviceHwInfo->hasCapture &&
-        OpenPcm( &pcm, deviceHwInfo->alsaName, SND_PCM_STREAM_CAPTURE, blocking, 0 ) >= 0 )
+/** Compute the signature of the current card setup.
+ *
+ * @return 0 if /proc/asound/cards can't be read, in which case the cache can't be validated.
+ */
+static unsigned long long DeviceCache_ComputeSignature( PaUint32 alsaLibVersion )
+{
+    unsigned long long hash = 14695981039346656037ULL;
+    char buf[1024], userConfig[512];
+    size_t n, total = 0;
+    FILE *cards;
+
+    if( !( cards = fopen( "/proc/asound/cards", "r" ) ) )
     {
-        if( GropeDevice( pcm, deviceHwInfo->isPlug, StreamDirection_In, blocking, devInfo ) != paNoError )
-        {
-            /* Error */
-            PA_DEBUG(( "%s: Failed groping %s for capture\n", __FUNCTION__, deviceHwInfo->alsaName ));
-            goto end;
-        }
+        return 0;
+    }
+    while( ( n = fread( buf, 1, sizeof (buf), cards ) ) > 0 )
+    {
+        hash = DeviceCache_Hash( hash, buf, n );
+        total += n;
     }
+    fclose( cards );
 
-    /* Query playback */
-    if( deviceHwInfo->hasPlayback &&
-        OpenPcm( &pcm, deviceHwInfo->alsaName, SND_PCM_STREAM_PLAYBACK, blocking, 0 ) >= 0 )
+    hash = DeviceCache_Hash( hash, &alsaLibVersion, sizeof (alsaLibVersion) );
+    hash = DeviceCache_HashFileTime( hash, "/etc/asound.conf" );
+    if( getenv( "HOME" ) )
     {
-        if( GropeDevice( pcm, deviceHwInfo->isPlug, StreamDirection_Out, blocking, devInfo ) != paNoError )
+        snprintf( userConfig, sizeof (userConfig), "%s/.asoundrc", getenv( "HOME" ) );
+        hash = DeviceCache_HashFileTime( hash, userConfig );
+    }
+
+    return total > 0 ? hash : 0;
+}
+
+static PaAlsaDeviceCacheEntry *DeviceCache_Find( PaAlsaDeviceCache *self, const char *key )
+{
+    size_t i;
+
+    for( i = 0; i < self->numEntries; ++i )
+    {
+        if( !strcmp( self->entries[i].key, key ) )
         {
-            /* Error */
-            PA_DEBUG(( "%s: Failed groping %s for playback\n", __FUNCTION__, deviceHwInfo->alsaName ));
-            goto end;
+            return &self->entries[i];
         }
     }
+    return NULL;
+}
 
-    baseDeviceInfo->structVersion = 2;
-    baseDeviceInfo->hostApi = alsaApi->hostApiIndex;
-    baseDeviceInfo->name = deviceHwInfo->name;
-    devInfo->alsaName = deviceHwInfo->alsaName;
-    devInfo->isPlug = deviceHwInfo->isPlug;
+static PaAlsaDeviceCacheEntry *DeviceCache_Add( PaAlsaDeviceCache *self, const char *key )
+{
+    PaAlsaDeviceCacheEntry *entry;
 
-    /* A: Storing pointer to PaAlsaDeviceInfo object as pointer to PaDeviceInfo object.
-     * Should now be safe to add device info, unless the device supports neither capture nor playback
-     */
-    if( baseDeviceInfo->maxInputChannels > 0 || baseDeviceInfo->maxOutputChannels > 0 )
+    if( self->numEntries == self->maxEntries )
     {
-        /* Make device default if there isn't already one or it is the ALSA "default" device */
-        if( ( baseApi->info.defaultInputDevice == paNoDevice ||
-            !strcmp( deviceHwInfo->alsaName, "default" ) ) && baseDeviceInfo->maxInputChannels > 0 )
+        size_t maxEntries = self->maxEntries ? self->maxEntries * 2 : 16;
+        PaAlsaDeviceCacheEntry *entries = (PaAlsaDeviceCacheEntry *)PaUtil_AllocateZeroInitializedMemory(
+                maxEntries * sizeof (PaAlsaDeviceCacheEntry) );
+        if( !entries )
         {
-            baseApi->info.defaultInputDevice = *devIdx;
-            PA_DEBUG(( "Default input device: %s\n", deviceHwInfo->name ));
+            return NULL;
         }
-        if( ( baseApi->info.defaultOutputDevice == paNoDevice ||
-            !strcmp( deviceHwInfo->alsaName, "default" ) ) && baseDeviceInfo->maxOutputChannels > 0 )
+        if( self->entries )
         {
-            baseApi->info.defaultOutputDevice = *devIdx;
-            PA_DEBUG(( "Default output device: %s\n", deviceHwInfo->name ));
+            memcpy( entries, self->entries, self->numEntries * sizeof (PaAlsaDeviceCacheEntry) );
         }
-        PA_DEBUG(( "%s: Adding device %s: %d\n", __FUNCTION__, deviceHwInfo->name, *devIdx ));
-        baseApi->deviceInfos[*devIdx] = (PaDeviceInfo *) devInfo;
-        (*devIdx) += 1;
+        PaUtil_FreeMemory( self->entries );
+        self->entries = entries;
+        self->maxEntries = maxEntries;
     }
-    else
+
+    entry = &self->entries[self->numEntries];
+    memset( entry, 0, sizeof (PaAlsaDeviceCacheEntry) );
+    if( !( entry->key = (char *)PaUtil_AllocateZeroInitializedMemory( strlen( key ) + 1 ) ) )
     {
-        PA_DEBUG(( "%s: Skipped device: %s, all channels == 0\n", __FUNCTION__, deviceHwInfo->name ));
+        return NULL;
     }
+    strcpy( entry->key, key );
+    ++self->numEntries;
 
-end:
-    return result;
+    return entry;
 }
 
-/* Build PaDeviceInfo list, ignore devices for which we cannot determine capabilities (possibly busy, sigh) */
-static PaError BuildDeviceList( PaAlsaHostApiRepresentation *alsaApi )
+/** Load the cache file.
+ *
+ * The cache is left disabled if no path is given or the card setup can't be determined. A missing, stale or
+ * malformed file just results in an empty cache, which is written anew.
+ */
+static void DeviceCache_Load( PaAlsaDeviceCache *self, const char *path, PaUint32 alsaLibVersion )
 {
-    PaUtilHostApiRepresentation *baseApi = &alsaApi->baseHostApiRep;
-    PaAlsaDeviceInfo *deviceInfoArray;
-    int cardIdx = -1;
-    snd_ctl_card_info_t *cardInfo;
-    PaError result = paNoError;
-    size_t numDeviceNames = 0, maxDeviceNames = 1;
-    HwDevInfo *hwDevInfos = NULL;
-    snd_config_t *topNode = NULL;
-    snd_pcm_info_t *pcmInfo;
-    int res;
-    int blocking = SND_PCM_NONBLOCK;
-    int usePlughw = 0;
-    char *hwPrefix = "";
-    char alsaCardName[50];
-#ifdef PA_ENABLE_DEBUG_OUTPUT
-    PaTime startTime = PaUtil_GetTime();
-#endif
-
-    if( getenv( "PA_ALSA_INITIALIZE_BLOCK" ) && atoi( getenv( "PA_ALSA_INITIALIZE_BLOCK" ) ) )
-        blocking = 0;
+    char line[512];
+    unsigned long long signature = 0;
+    FILE *file;
 
-    /* If PA_ALSA_PLUGHW is 1 (non-zero), use the plughw: pcm throughout instead of hw: */
-    if( getenv( "PA_ALSA_PLUGHW" ) && atoi( getenv( "PA_ALSA_PLUGHW" ) ) )
+    memset( self, 0, sizeof (PaAlsaDeviceCache) );
+    if( !path || !*path || !( self->signature = DeviceCache_ComputeSignature( alsaLibVersion ) ) )
     {
-        usePlughw = 1;
-        hwPrefix = "plug";
-        PA_DEBUG(( "%s: Using Plughw\n", __FUNCTION__ ));
+        return;
     }
+    self->path = path;
+    self->dirty = 1;
 
-    /* These two will be set to the first working input and output device, respectively */
-    baseApi->info.defaultInputDevice = paNoDevice;
-    baseApi->info.defaultOutputDevice = paNoDevice;
-
-    /* Gather info about hw devices
-
-     * alsa_snd_card_next() modifies the integer passed to it to be:
-     *      the index of the first card if the parameter is -1
-     *      the index of the next card if the parameter is the index of a card
-     *      -1 if there are no more cards
-     *
-     * The function itself returns 0 if it succeeded. */
-    cardIdx = -1;
-    alsa_snd_ctl_card_info_alloca( &cardInfo );
-    alsa_snd_pcm_info_alloca( &pcmInfo );
-    while( alsa_snd_card_next( &cardIdx ) == 0 && cardIdx >= 0 )
+    if( !( file = fopen( path, "r" ) ) )
     {
-        char *cardName;
-        int devIdx = -1;
-        snd_ctl_t *ctl;
-        char buf[66];
+        PA_DEBUG(( "%s: No device cache at %s\n", __FUNCTION__, path ));
+        return;
+    }
+    if( !fgets( line, sizeof (line), file ) || strncmp( line, DEVICE_CACHE_HEADER "\n", sizeof (line) ) ||
+            !fgets( line, sizeof (line), file ) || sscanf( line, "signature %llx", &signature ) != 1 ||
+            signature != self->signature )
+    {
+        PA_DEBUG(( "%s: Device cache %s is stale, ignoring it\n", __FUNCTION__, path ));
+        goto end;
+    }
 
-        snprintf( alsaCardName, sizeof (alsaCardName), "hw:%d", cardIdx );
+    while( fgets( line, sizeof (line), file ) )
+    {
+        PaAlsaDeviceCacheEntry entry;
+        char *values = strchr( line, '\t' );
 
-        /* Acquire name of card */
-        if( alsa_snd_ctl_open( &ctl, alsaCardName, 0 ) < 0 )
+        if( !values )
         {
-            /* Unable to open card :( */
-            PA_DEBUG(( "%s: Unable to open device %s\n", __FUNCTION__, alsaCardName ));
             continue;
         }
-        alsa_snd_ctl_card_info( ctl, cardInfo );
-
-        PA_ENSURE( PaAlsa_StrDup( alsaApi, &cardName, alsa_snd_ctl_card_info_get_name( cardInfo )) );
-
-        while( alsa_snd_ctl_pcm_next_device( ctl, &devIdx ) == 0 && devIdx >= 0 )
+        *values++ = '\0';
+        if( sscanf( values, "%d %d %d %d %ld %lld %lld %lld %lld", &entry.minInputChannels, &entry.maxInputChannels,
+                    &entry.minOutputChannels, &entry.maxOutputChannels, &entry.defaultSampleRate,
+                    &entry.defaultLowInputLatency, &entry.defaultHighInputLatency, &entry.defaultLowOutputLatency,
+                    &entry.defaultHighOutputLatency ) != 9 || DeviceCache_Find( self, line ) )
         {
-            char *alsaDeviceName, *deviceName, *infoName;
-            size_t len;
-            int hasPlayback = 0, hasCapture = 0;
-
-            snprintf( buf, sizeof (buf), "%s%s,%d", hwPrefix, alsaCardName, devIdx );
-
-            /* Obtain info about this particular device */
-            alsa_snd_pcm_info_set_device( pcmInfo, devIdx );
-            alsa_snd_pcm_info_set_subdevice( pcmInfo, 0 );
-            alsa_snd_pcm_info_set_stream( pcmInfo, SND_PCM_STREAM_CAPTURE );
-            if( alsa_snd_ctl_pcm_info( ctl, pcmInfo ) >= 0 )
-            {
-                hasCapture = 1;
-            }
+            continue;
+        }
 
-            alsa_snd_pcm_info_set_stream( pcmInfo, SND_PCM_STREAM_PLAYBACK );
-            if( alsa_snd_ctl_pcm_info( ctl, pcmInfo ) >= 0 )
+        {
+            PaAlsaDeviceCacheEntry *added = DeviceCache_Add( self, line );
+            if( !added )
             {
-                hasPlayback = 1;
+                break;
             }
+            entry.key = added->key;
+            entry.used = 0;
+            *added = entry;
+        }
+    }
+    self->dirty = 0;
+    PA_DEBUG(( "%s: Loaded %lu devices from cache %s\n", __FUNCTION__, (unsigned long)self->numEntries, path ));
 
-            if( !hasPlayback && !hasCapture )
-            {
-                /* Error */
-                continue;
-            }
+end:
+    fclose( file );
+}
 
-            infoName = SkipCardDetailsInName( (char *)alsa_snd_pcm_info_get_name( pcmInfo ), cardName );
+/** Fill in device info from the cache.
+ *
+ * @return 1 if the device was found in the cache.
+ */
+static int DeviceCache_Fetch( PaAlsaDeviceCache *self, const char *key, PaAlsaDeviceInfo *devInfo )
+{
+    PaAlsaDeviceCacheEntry *entry;
+    PaDeviceInfo *baseDeviceInfo = &devInfo->baseDeviceInfo;
 
-            /* The length of the string written by snprintf plus terminating 0 */
-            len = snprintf( NULL, 0, "%s: %s (%s)", cardName, infoName, buf ) + 1;
-            PA_UNLESS( deviceName = (char *)PaUtil_GroupAllocateZeroInitializedMemory( alsaApi->allocations, len ),
-                    paInsufficientMemory );
-            snprintf( deviceName, len, "%s: %s (%s)", cardName, infoName, buf );
+    if( !self || !self->path || !key || !( entry = DeviceCache_Find( self, key ) ) )
+    {
+        return 0;
+    }
 
-            PA_DEBUG(( "%s: Found device [%d]: %s\n", __FUNCTION__, numDeviceNames, deviceName ));
+    entry->used = 1;
+    devInfo->minInputChannels = entry->minInputChannels;
+    baseDeviceInfo->maxInputChannels = entry->maxInputChannels;
+    devInfo->minOutputChannels = entry->minOutputChannels;
+    baseDeviceInfo->maxOutputChannels = entry->maxOutputChannels;
+    baseDeviceInfo->defaultSampleRate = (double)entry->defaultSampleRate;
+    baseDeviceInfo->defaultLowInputLatency = PaUtil_NsToTime( entry->defaultLowInputLatency );
+    baseDeviceInfo->defaultHighInputLatency = PaUtil_NsToTime( entry->defaultHighInputLatency );
+    baseDeviceInfo->defaultLowOutputLatency = PaUtil_NsToTime( entry->defaultLowOutputLatency );
+    baseDeviceInfo->defaultHighOutputLatency = PaUtil_NsToTime( entry->defaultHighOutputLatency );
 
-            ++numDeviceNames;
-            if( !hwDevInfos || numDeviceNames > maxDeviceNames )
-            {
-                maxDeviceNames *= 2;
-                PA_UNLESS( hwDevInfos = (HwDevInfo *) realloc( hwDevInfos, maxDeviceNames * sizeof (HwDevInfo) ),
-                        paInsufficientMemory );
-            }
+    return 1;
+}
 
-            PA_ENSURE( PaAlsa_StrDup( alsaApi, &alsaDeviceName, buf ) );
+/** Store probed device info in the cache.
+ *
+ * Devices without any channels are not stored, since they might just have been busy.
+ */
+static void DeviceCache_Store( PaAlsaDeviceCache *self, const char *key, const PaAlsaDeviceInfo *devInfo )
+{
+    PaAlsaDeviceCacheEntry *entry;
+    const PaDeviceInfo *baseDeviceInfo = &devInfo->baseDeviceInfo;
 
-            hwDevInfos[ numDeviceNames - 1 ].alsaName = alsaDeviceName;
-            hwDevInfos[ numDeviceNames - 1 ].name = deviceName;
-            hwDevInfos[ numDeviceNames - 1 ].isPlug = usePlughw;
-            hwDevInfos[ numDeviceNames - 1 ].hasPlayback = hasPlayback;
-            hwDevInfos[ numDeviceNames - 1 ].hasCapture = hasCapture;
-        }
-        alsa_snd_ctl_close( ctl );
+    if( !self || !self->path || !key ||
+            ( baseDeviceInfo->maxInputChannels <= 0 && baseDeviceInfo->maxOutputChannels <= 0 ) )
+    {
+        return;
     }
-
-    /* Iterate over plugin devices */
-    if( NULL == (*alsa_snd_config) )
+    if( !( entry = DeviceCache_Find( self, key ) ) && !( entry = DeviceCache_Add( self, key ) ) )
     {
-        /* alsa_snd_config_update is called implicitly by some functions, if this hasn't happened snd_config will be NULL (bleh) */
-        ENSURE_( alsa_snd_config_update(), paUnanticipatedHostError );
-        PA_DEBUG(( "Updating snd_config\n" ));
+        return;
     }
-    assert( *alsa_snd_config );
-    if( ( res = alsa_snd_config_search( *alsa_snd_config, "pcm", &topNode ) ) >= 0 )
-    {
-        snd_config_iterator_t i, next;
 
-        alsa_snd_config_for_each( i, next, topNode )
+    entry->used = 1;
+    entry->minInputChannels = devInfo->minInputChannels;
+    entry->maxInputChannels = baseDeviceInfo->maxInputChannels;
+    entry->minOutputChannels = devInfo->minOutputChannels;
+    entry->maxOutputChannels = baseDeviceInfo->maxOutputChannels;
+    entry->defaultSampleRate = (long)baseDeviceInfo->defaultSampleRate;
+    entry->defaultLowInputLatency = (long long)( baseDeviceInfo->defaultLowInputLatency * 1e9 );
+    entry->defaultHighInputLatency = (long long)( baseDeviceInfo->defaultHighInputLatency * 1e9 );
+    entry->defaultLowOutputLatency = (long long)( baseDeviceInfo->defaultLowOutputLatency * 1e9 );
+    entry->defaultHighOutputLatency = (long long)( baseDeviceInfo->defaultHighOutputLatency * 1e9 );
+    self->dirty = 1;
+}
+
+/** Write the cache file if anything changed, and free the cache.
+ *
+ * Only entries of devices that are still present are kept. The file is replaced atomically, so concurrently
+ * initializing processes never see a partial file.
+ */
+static void DeviceCache_Terminate( PaAlsaDeviceCache *self )
+{
+    size_t i;
+
+    for( i = 0; i < self->numEntries; ++i )
+    {
+        if( !self->entries[i].used )
         {
-            const char *tpStr = "unknown", *idStr = NULL;
-            int err = 0;
+            self->dirty = 1;
+        }
+    }
 
-            char *alsaDeviceName, *deviceName;
-            const HwDevInfo *predefined = NULL;
-            snd_config_t *n = alsa_snd_config_iterator_entry( i ), * tp = NULL;;
+    if( self->path && self->dirty )
+    {
+        char tmpPath[PATH_MAX];
+        FILE *file;
 
-            if( (err = alsa_snd_config_search( n, "type", &tp )) < 0 )
+        snprintf( tmpPath, sizeof (tmpPath), "%s.%d", self->path, (int)getpid() );
+        if( ( file = fopen( tmpPath, "w" ) ) )
+        {
+            int ok;
+
+            fprintf( file, DEVICE_CACHE_HEADER "\nsignature %llx\n", self->signature );
+            for( i = 0; i < self->numEntries; ++i )
             {
-                if( -ENOENT != err )
+                const PaAlsaDeviceCacheEntry *entry = &self->entries[i];
+                if( !entry->used )
                 {
-                    ENSURE_(err, paUnanticipatedHostError);
+                    continue;
                 }
+                fprintf( file, "%s\t%d %d %d %d %ld %lld %lld %lld %lld\n", entry->key, entry->minInputChannels,
+                        entry->maxInputChannels, entry->minOutputChannels, entry->maxOutputChannels,
+                        entry->defaultSampleRate, entry->defaultLowInputLatency, entry->defaultHighInputLatency,
+                        entry->defaultLowOutputLatency, entry->defaultHighOutputLatency );
             }
-            else
+            ok = !ferror( file );
+            if( fclose( file ) == 0 && ok && rename( tmpPath, self->path ) == 0 )
             {
-                ENSURE_( alsa_snd_config_get_string( tp, &tpStr ), paUnanticipatedHostError );
+                PA_DEBUG(( "%s: Wrote device cache %s\n", __FUNCTION__, self->path ));
             }
-            ENSURE_( alsa_snd_config_get_id( n, &idStr ), paUnanticipatedHostError );
-            if( IgnorePlugin( idStr ) )
+            else
             {
-                PA_DEBUG(( "%s: Ignoring ALSA plugin device [%s] of type [%s]\n", __FUNCTION__, idStr, tpStr ));
-                continue;
+                PA_DEBUG(( "%s: Failed to write device cache %s\n", __FUNCTION__, self->path ));
+                remove( tmpPath );
             }
-            PA_DEBUG(( "%s: Found plugin [%s] of type [%s]\n", __FUNCTION__, idStr, tpStr ));
+        }
+    }
 
-            PA_UNLESS( alsaDeviceName = (char*)PaUtil_GroupAllocateZeroInitializedMemory( alsaApi->allocations,
-                                                            strlen(idStr) + 6 ), paInsufficientMemory );
-            strcpy( alsaDeviceName, idStr );
-            PA_UNLESS( deviceName = (char*)PaUtil_GroupAllocateZeroInitializedMemory( alsaApi->allocations,
-                                                            strlen(idStr) + 1 ), paInsufficientMemory );
-            strcpy( deviceName, idStr );
+    for( i = 0; i < self->numEntries; ++i )
+    {
+        PaUtil_FreeMemory( self->entries[i].key );
+    }
+    PaUtil_FreeMemory( self->entries );
+    memset( self, 0, sizeof (PaAlsaDeviceCache) );
+}
 
-            ++numDeviceNames;
-            if( !hwDevInfos || numDeviceNames > maxDeviceNames )
-            {
-                maxDeviceNames *= 2;
-                PA_UNLESS( hwDevInfos = (HwDevInfo *) realloc( hwDevInfos, maxDeviceNames * sizeof (HwDevInfo) ),
-                        paInsufficientMemory );
-            }
+/** Determine the capabilities of a device, from the cache or by opening it in each supported direction.
+ *
+ * Sets deviceHwInfo->probeState. Probing different hw devices is safe to do concurrently, in which case
+ * cache must be NULL since the cache isn't thread safe.
+ */
+static void ProbeAggregateDevice( HwDevInfo *deviceHwInfo, int blocking, PaAlsaDeviceInfo *devInfo );
 
-            predefined = FindDeviceName( alsaDeviceName );
+static void ProbeDevice( HwDevInfo* deviceHwInfo, int blocking, PaAlsaDeviceInfo* devInfo, PaAlsaDeviceCache *cache )
+{
+    snd_pcm_t *pcm = NULL;
 
-            hwDevInfos[numDeviceNames - 1].alsaName = alsaDeviceName;
-            hwDevInfos[numDeviceNames - 1].name     = deviceName;
-            hwDevInfos[numDeviceNames - 1].isPlug   = 1;
+    /* Zero fields */
+    InitializeDeviceInfo( &devInfo->baseDeviceInfo );
 
-            if( predefined )
-            {
-                hwDevInfos[numDeviceNames - 1].hasPlayback = predefined->hasPlayback;
-                hwDevInfos[numDeviceNames - 1].hasCapture  = predefined->hasCapture;
-            }
-            else
-            {
-                hwDevInfos[numDeviceNames - 1].hasPlayback = 1;
-                hwDevInfos[numDeviceNames - 1].hasCapture  = 1;
-            }
-        }
+    if( deviceHwInfo->aggregate )
+    {
+        ProbeAggregateDevice( deviceHwInfo, blocking, devInfo );
+        return;
     }
-    else
-        PA_DEBUG(( "%s: Iterating over ALSA plugins failed: %s\n", __FUNCTION__, alsa_snd_strerror( res ) ));
 
-    /* allocate deviceInfo memory based on the number of devices */
-    PA_UNLESS( baseApi->deviceInfos = (PaDeviceInfo**)PaUtil_GroupAllocateZeroInitializedMemory(
-            alsaApi->allocations, sizeof(PaDeviceInfo*) * (numDeviceNames) ), paInsufficientMemory );
+    if( DeviceCache_Fetch( cache, deviceHwInfo->cacheKey, devInfo ) )
+    {
+        PA_DEBUG(( "%s: Using cached info for %s\n", __FUNCTION__, deviceHwInfo->alsaName ));
+        deviceHwInfo->probeState = ProbeState_Cached;
+        return;
+    }
 
-    /* allocate all device info structs in a contiguous block */
-    PA_UNLESS( deviceInfoArray = (PaAlsaDeviceInfo*)PaUtil_GroupAllocateZeroInitializedMemory(
-            alsaApi->allocations, sizeof(PaAlsaDeviceInfo) * numDeviceNames ), paInsufficientMemory );
+    /* To determine device capabilities, we must open the device and query the
+     * hardware parameter configuration space */
+    deviceHwInfo->probeState = ProbeState_Failed;
 
-    /* Loop over list of cards, filling in info. If a device is deemed unavailable (can't get name),
-     * it's ignored.
-     *
-     * Note that we do this in two stages. This is a workaround owing to the fact that the 'dmix'
-     * plugin may cause the underlying hardware device to be busy for a short while even after it
-     * (dmix) is closed. The 'default' plugin may also point to the dmix plugin, so the same goes
-     * for this.
-     */
-    PA_DEBUG(( "%s: Filling device info for %d devices\n", __FUNCTION__, numDeviceNames ));
-    int devIdx = 0;
-    for( size_t i = 0; i < numDeviceNames; ++i )
+    /* Query capture */
+    if( deviceHwInfo->hasCapture &&
+        OpenPcm( &pcm, deviceHwInfo->alsaName, SND_PCM_STREAM_CAPTURE, blocking, 0 ) >= 0 )
     {
-        PaAlsaDeviceInfo* devInfo = &deviceInfoArray[i];
-        HwDevInfo* hwInfo = &hwDevInfos[i];
-        if( !strcmp( hwInfo->name, "dmix" ) || !strcmp( hwInfo->name, "default" ) )
+        if( GropeDevice( pcm, deviceHwInfo->isPlug, StreamDirection_In, blocking, devInfo ) != paNoError )
         {
-            continue;
+            /* Error */
+            PA_DEBUG(( "%s: Failed groping %s for capture\n", __FUNCTION__, deviceHwInfo->alsaName ));
+            return;
         }
+    }
 
-        PA_ENSURE( FillInDevInfo( alsaApi, hwInfo, blocking, devInfo, &devIdx ) );
+    /* Query playback */
+    if( deviceHwInfo->hasPlayback &&
+        OpenPcm( &pcm, deviceHwInfo->alsaName, SND_PCM_STREAM_PLAYBACK, blocking, 0 ) >= 0 )
+    {
+        if( GropeDevice( pcm, deviceHwInfo->isPlug, StreamDirection_Out, blocking, devInfo ) != paNoError )
+        {
+            /* Error */
+            PA_DEBUG(( "%s: Failed groping %s for playback\n", __FUNCTION__, deviceHwInfo->alsaName ));
+            return;
+        }
     }
-    assert( devIdx <= numDeviceNames );
-    /* Now inspect 'dmix' and 'default' plugins */
-    for( size_t i = 0; i < numDeviceNames; ++i )
+
+    deviceHwInfo->probeState = ProbeState_Probed;
+}
+
+/** Probe each member of an aggregate device, the aggregate has the sum of their channels.
+ *
+ * A direction is only supported if every member supports it. The other capabilities are those of the master,
+ * which the members follow. The channels of each member are recorded in the aggregate's spec, for dividing the
+ * channels of a stream between the members. Aggregates aren't cached, as the members may be any devices.
+ */
+static void ProbeAggregateDevice( HwDevInfo *deviceHwInfo, int blocking, PaAlsaDeviceInfo *devInfo )
+{
+    PaAlsaAggregateSpec *aggregate = (PaAlsaAggregateSpec *)deviceHwInfo->aggregate;
+    PaDeviceInfo *baseDeviceInfo = &devInfo->baseDeviceInfo;
+    int maxInputChannels = 0, maxOutputChannels = 0, hasCapture = 1, hasPlayback = 1;
+
+    deviceHwInfo->probeState = ProbeState_Failed;
+    for( int i = 0; i < aggregate->numMembers; ++i )
     {
-        PaAlsaDeviceInfo* devInfo = &deviceInfoArray[i];
-        HwDevInfo* hwInfo = &hwDevInfos[i];
-        if( strcmp( hwInfo->name, "dmix" ) && strcmp( hwInfo->name, "default" ) )
+        HwDevInfo memberHwInfo;
+        PaAlsaDeviceInfo memberInfo;
+
+        memset( &memberHwInfo, 0, sizeof (HwDevInfo) );
+        memset( &memberInfo, 0, sizeof (PaAlsaDeviceInfo) );
+        memberHwInfo.alsaName = memberHwInfo.name = (char *)aggregate->memberNames[i];
+        memberHwInfo.isPlug = strncmp( "hw:", aggregate->memberNames[i], 3 ) != 0;
+        memberHwInfo.hasCapture = memberHwInfo.hasPlayback = 1;
+        ProbeDevice( &memberHwInfo, blocking, &memberInfo, NULL );
+        if( memberHwInfo.probeState == ProbeState_Failed )
         {
-            continue;
+            PA_DEBUG(( "%s: Failed probing %s, member of %s\n", __FUNCTION__, aggregate->memberNames[i],
+                        aggregate->name ));
+            return;
         }
 
-        PA_ENSURE( FillInDevInfo( alsaApi, hwInfo, blocking, devInfo, &devIdx ) );
+        if( i == 0 )
+        {
+            *baseDeviceInfo = memberInfo.baseDeviceInfo;
+            devInfo->minInputChannels = memberInfo.minInputChannels;
+            devInfo->minOutputChannels = memberInfo.minOutputChannels;
+        }
+        aggregate->maxInputChannels[i] = memberInfo.baseDeviceInfo.maxInputChannels;
+        aggregate->maxOutputChannels[i] = memberInfo.baseDeviceInfo.maxOutputChannels;
+        maxInputChannels += aggregate->maxInputChannels[i];
+        maxOutputChannels += aggregate->maxOutputChannels[i];
+        hasCapture = hasCapture && aggregate->maxInputChannels[i] > 0;
+        hasPlayback = hasPlayback && aggregate->maxOutputChannels[i] > 0;
     }
-    free( hwDevInfos );
 
-    baseApi->info.deviceCount = devIdx;   /* Number of successfully queried devices */
+    baseDeviceInfo->maxInputChannels = hasCapture ? maxInputChannels : 0;
+    baseDeviceInfo->maxOutputChannels = hasPlayback ? maxOutputChannels : 0;
+    deviceHwInfo->probeState = ProbeState_Probed;
+}
 
-#ifdef PA_ENABLE_DEBUG_OUTPUT
-    PA_DEBUG(( "%s: Building device list took %f seconds\n", __FUNCTION__, PaUtil_GetTime() - startTime ));
-#endif
+/* Work shared by the threads of ProbeDevicesConcurrently */
+typedef struct
+{
+    HwDevInfo *hwDevInfos;
+    PaAlsaDeviceInfo *deviceInfos;
+    size_t numDevices;
+    size_t next;            /* The next device to probe, protected by mtx */
+    int blocking;
+    PaUnixMutex mtx;
+}
+PaAlsaProbeQueue;
 
-end:
-    return result;
+static void *ProbeThreadFunc( void *userData )
+{
+    PaAlsaProbeQueue *queue = (PaAlsaProbeQueue *)userData;
 
-error:
-    /* No particular action */
-    goto end;
+    while( 1 )
+    {
+        size_t i;
+
+        PaUnixMutex_Lock( &queue->mtx );
+        i = queue->next++;
+        PaUnixMutex_Unlock( &queue->mtx );
+
+        if( i >= queue->numDevices )
+        {
+            break;
+        }
+        if( queue->hwDevInfos[i].probeState == ProbeState_Pending )
+        {
+            ProbeDevice( &queue->hwDevInfos[i], queue->blocking, &queue->deviceInfos[i], NULL );
+        }
+    }
+
+    return NULL;
 }
 
-/* Check against known device capabilities */
-static PaError ValidateParameters( const PaStreamParameters *parameters, PaUtilHostApiRepresentation *hostApi, StreamDirection mode )
+/** Probe hw devices on a pool of up to MAX_PROBE_THREADS threads.
+ *
+ * Opening a device can take a long time (notably with USB devices), which is spent waiting on the device.
+ * Distinct hw devices can be opened independently of each other, unlike plugins, which may share the
+ * underlying hw device and so would find it busy. The devices are only probed here, they are added to the
+ * device list in order by FillInDevInfo afterwards, so the device indices are the same as with serial
+ * probing. If no threads can be created, the calling thread probes all devices by itself.
+ */
+static PaError ProbeDevicesConcurrently( HwDevInfo *hwDevInfos, PaAlsaDeviceInfo *deviceInfos, size_t numDevices,
+        int blocking, PaAlsaDeviceCache *cache )
 {
     PaError result = paNoError;
-    int maxChans;
-    const PaAlsaDeviceInfo *deviceInfo = NULL;
-    assert( parameters );
+    PaAlsaProbeQueue queue;
+    PaUnixThread threads[MAX_PROBE_THREADS - 1];
+    size_t i, numPending = 0;
+    int numThreads = 0, mutexInitialized = 0;
 
-    if( parameters->device != paUseHostApiSpecificDeviceSpecification )
+    /* Serve what we can from the cache beforehand, it isn't thread safe */
+    for( i = 0; i < numDevices; ++i )
     {
-        assert( parameters->device < hostApi->info.deviceCount );
-        PA_UNLESS( parameters->hostApiSpecificStreamInfo == NULL, paBadIODeviceCombination );
-        deviceInfo = GetDeviceInfo( hostApi, parameters->device );
+        InitializeDeviceInfo( &deviceInfos[i].baseDeviceInfo );
+        if( DeviceCache_Fetch( cache, hwDevInfos[i].cacheKey, &deviceInfos[i] ) )
+        {
+            hwDevInfos[i].probeState = ProbeState_Cached;
+        }
+        else
+        {
+            ++numPending;
+        }
     }
-    else
+    if( numPending < 2 )
     {
-        const PaAlsaStreamInfo *streamInfo = parameters->hostApiSpecificStreamInfo;
+        /* Leave it to FillInDevInfo */
+        return paNoError;
+    }
 
-        PA_UNLESS( parameters->device == paUseHostApiSpecificDeviceSpecification, paInvalidDevice );
-        PA_UNLESS( streamInfo->size == sizeof (PaAlsaStreamInfo) && streamInfo->version == 1,
-                paIncompatibleHostApiSpecificStreamInfo );
-        PA_UNLESS( streamInfo->deviceString != NULL, paInvalidDevice );
+    memset( &queue, 0, sizeof (queue) );
+    queue.hwDevInfos = hwDevInfos;
+    queue.deviceInfos = deviceInfos;
+    queue.numDevices = numDevices;
+    queue.blocking = blocking;
+    PA_ENSURE( PaUnixMutex_Initialize( &queue.mtx ) );
+    mutexInitialized = 1;
 
-        /* Skip further checking */
-        return paNoError;
+    while( numThreads < MAX_PROBE_THREADS - 1 && (size_t)numThreads + 1 < numPending )
+    {
+        if( PaUnixThread_New( &threads[numThreads], ProbeThreadFunc, &queue, 0., 0 ) != paNoError )
+        {
+            PA_DEBUG(( "%s: Failed to create probing thread\n", __FUNCTION__ ));
+            break;
+        }
+        ++numThreads;
     }
+    PA_DEBUG(( "%s: Probing %lu devices on %d threads\n", __FUNCTION__, (unsigned long)numPending, numThreads + 1 ));
 
-    assert( deviceInfo );
-    assert( parameters->hostApiSpecificStreamInfo == NULL );
-    maxChans = ( StreamDirection_In == mode ? deviceInfo->baseDeviceInfo.maxInputChannels :
-        deviceInfo->baseDeviceInfo.maxOutputChannels );
-    PA_UNLESS( parameters->channelCount <= maxChans, paInvalidChannelCount );
+    ProbeThreadFunc( &queue );
+    while( numThreads > 0 )
+    {
+        PaUnixThread_Terminate( &threads[--numThreads], 1, NULL );
+    }
 
 error:
+    if( mutexInitialized )
+    {
+        PaUnixMutex_Terminate( &queue.mtx );
+    }
     return result;
 }
 
-/* Given an open stream, what sample formats are available? */
-static PaSampleFormat GetAvailableFormats( snd_pcm_t *pcm )
+/** Fill in device info, probing the device if it hasn't been by ProbeDevicesConcurrently.
+ *
+ * @return Whether the device can be used, that is whether it supports capture or playback (for a device that
+ * hasn't been probed, whether ALSA reports it to have capture or playback streams).
+ */
+static int InitializeDevInfo( PaAlsaHostApiRepresentation *alsaApi, HwDevInfo *deviceHwInfo, int blocking,
+        PaAlsaDeviceInfo *devInfo, PaAlsaDeviceCache *cache )
 {
-    PaSampleFormat available = 0;
-    snd_pcm_hw_params_t *hwParams;
-    alsa_snd_pcm_hw_params_alloca( &hwParams );
-
-    alsa_snd_pcm_hw_params_any( pcm, hwParams );
-
-    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_FLOAT ) >= 0)
-        available |= paFloat32;
-
-    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_S32 ) >= 0)
-        available |= paInt32;
-
-#ifdef PA_LITTLE_ENDIAN
-    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_S24_3LE ) >= 0)
-        available |= paInt24;
-#elif defined PA_BIG_ENDIAN
-    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_S24_3BE ) >= 0)
-        available |= paInt24;
-#endif
-
-    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_S16 ) >= 0)
-        available |= paInt16;
+    PaDeviceInfo *baseDeviceInfo = &devInfo->baseDeviceInfo;
 
-    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_U8 ) >= 0)
-        available |= paUInt8;
+    PA_DEBUG(( "%s: Filling device info for: %s\n", __FUNCTION__, deviceHwInfo->name ));
 
-    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_S8 ) >= 0)
-        available |= paInt8;
+    if( deviceHwInfo->probeState == ProbeState_Pending )
+    {
+        if( alsaApi->lazyProbing )
+        {
+            /* Only take what the cache has, the device is probed on first use otherwise */
+            InitializeDeviceInfo( baseDeviceInfo );
+            if( DeviceCache_Fetch( cache, deviceHwInfo->cacheKey, devInfo ) )
+                deviceHwInfo->probeState = ProbeState_Cached;
+        }
+        else
+        {
+            ProbeDevice( deviceHwInfo, blocking, devInfo, cache );
+        }
+    }
+    if( deviceHwInfo->probeState == ProbeState_Failed )
+    {
+        return 0;
+    }
+    if( deviceHwInfo->probeState == ProbeState_Probed )
+    {
+        DeviceCache_Store( cache, deviceHwInfo->cacheKey, devInfo );
+    }
 
-    return available;
+    baseDeviceInfo->structVersion = 2;
+    baseDeviceInfo->hostApi = alsaApi->hostApiIndex;
+    baseDeviceInfo->name = deviceHwInfo->name;
+    devInfo->alsaName = deviceHwInfo->alsaName;
+    devInfo->isPlug = deviceHwInfo->isPlug;
+    devInfo->probed = deviceHwInfo->probeState != ProbeState_Pending;
+    devInfo->hasCapture = devInfo->probed ? baseDeviceInfo->maxInputChannels > 0 : deviceHwInfo->hasCapture;
+    devInfo->hasPlayback = devInfo->probed ? baseDeviceInfo->maxOutputChannels > 0 : deviceHwInfo->hasPlayback;
+    devInfo->cacheKey = deviceHwInfo->cacheKey;
+    devInfo->aggregate = deviceHwInfo->aggregate;
+    devInfo->isHw = deviceHwInfo->isHw;
+
+    return devInfo->hasCapture || devInfo->hasPlayback;
 }
 
-/* Output to console all formats supported by device */
-static void LogAllAvailableFormats( snd_pcm_t *pcm )
+/** Fill in device info and add the device to the device list, unless it can't be used.
+ */
+static PaError FillInDevInfo( PaAlsaHostApiRepresentation *alsaApi, HwDevInfo* deviceHwInfo, int blocking,
+        PaAlsaDeviceInfo* devInfo, int* devIdx, PaAlsaDeviceCache *cache )
 {
-    PaSampleFormat available = 0;
-    snd_pcm_hw_params_t *hwParams;
-    alsa_snd_pcm_hw_params_alloca( &hwParams );
-
-    alsa_snd_pcm_hw_params_any( pcm, hwParams );
-
-    PA_DEBUG(( " --- Supported Formats ---\n" ));
+    PaError result = 0;
+    PaUtilHostApiRepresentation *baseApi = &alsaApi->baseHostApiRep;
 
-    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_S8 ) >= 0)
-        PA_DEBUG(( "SND_PCM_FORMAT_S8\n" ));
-    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_U8 ) >= 0)
-        PA_DEBUG(( "SND_PCM_FORMAT_U8\n" ));
-
-    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_S16_LE ) >= 0)
-        PA_DEBUG(( "SND_PCM_FORMAT_S16_LE\n" ));
-    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_S16_BE ) >= 0)
-        PA_DEBUG(( "SND_PCM_FORMAT_S16_BE\n" ));
-
-    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_U16_LE ) >= 0)
-        PA_DEBUG(( "SND_PCM_FORMAT_U16_LE\n" ));
-    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_U16_BE ) >= 0)
-        PA_DEBUG(( "SND_PCM_FORMAT_U16_BE\n" ));
-
-    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_S24_LE ) >= 0)
-        PA_DEBUG(( "SND_PCM_FORMAT_S24_LE\n" ));
-    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_S24_BE ) >= 0)
-        PA_DEBUG(( "SND_PCM_FORMAT_S24_BE\n" ));
+    /* A: Storing pointer to PaAlsaDeviceInfo object as pointer to PaDeviceInfo object.
+     * Should now be safe to add device info, unless the device supports neither capture nor playback
+     */
+    if( InitializeDevInfo( alsaApi, deviceHwInfo, blocking, devInfo, cache ) )
+    {
+        /* Make device default if there isn't already one or it is the ALSA "default" device */
+        if( ( baseApi->info.defaultInputDevice == paNoDevice ||
+            ( !devInfo->aggregate && !strcmp( deviceHwInfo->alsaName, "default" ) ) ) && devInfo->hasCapture )
+        {
+            baseApi->info.defaultInputDevice = *devIdx;
+            PA_DEBUG(( "Default input device: %s\n", deviceHwInfo->name ));
+        }
+        if( ( baseApi->info.defaultOutputDevice == paNoDevice ||
+            ( !devInfo->aggregate && !strcmp( deviceHwInfo->alsaName, "default" ) ) ) && devInfo->hasPlayback )
+        {
+            baseApi->info.defaultOutputDevice = *devIdx;
+            PA_DEBUG(( "Default output device: %s\n", deviceHwInfo->name ));
+        }
+        PA_DEBUG(( "%s: Adding device %s: %d\n", __FUNCTION__, deviceHwInfo->name, *devIdx ));
+        baseApi->deviceInfos[*devIdx] = (PaDeviceInfo *) devInfo;
+        (*devIdx) += 1;
+    }
+    else
+    {
+        PA_DEBUG(( "%s: Skipped device: %s, all channels == 0\n", __FUNCTION__, deviceHwInfo->name ));
+    }
 
-    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_U24_LE ) >= 0)
-        PA_DEBUG(( "SND_PCM_FORMAT_U24_LE\n" ));
-    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_U24_BE ) >= 0)
-        PA_DEBUG(( "SND_PCM_FORMAT_U24_BE\n" ));
+    return result;
+}
 
-    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_FLOAT_LE ) >= 0)
-        PA_DEBUG(( "SND_PCM_FORMAT_FLOAT_LE\n" ));
-    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_FLOAT_BE ) >= 0)
-        PA_DEBUG(( "SND_PCM_FORMAT_FLOAT_BE\n" ));
+/** Probe a device that was added to the device list without being probed, with lazy probing.
+ *
+ * If probing fails (possibly because the device is busy), the device is reported without channels for now
+ * and probing is attempted again the next time.
+ */
+static void ProbeDeferredDevice( PaAlsaHostApiRepresentation *alsaApi, PaAlsaDeviceInfo *devInfo )
+{
+    PaDeviceInfo *baseDeviceInfo = &devInfo->baseDeviceInfo;
+    PaDeviceInfo identity = *baseDeviceInfo;
+    HwDevInfo hwInfo;
 
-    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_FLOAT64_LE ) >= 0)
-        PA_DEBUG(( "SND_PCM_FORMAT_FLOAT64_LE\n" ));
-    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_FLOAT64_BE ) >= 0)
-        PA_DEBUG(( "SND_PCM_FORMAT_FLOAT64_BE\n" ));
+    if( devInfo->probed )
+    {
+        return;
+    }
 
-    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_IEC958_SUBFRAME_LE ) >= 0)
-        PA_DEBUG(( "SND_PCM_FORMAT_IEC958_SUBFRAME_LE\n" ));
-    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_IEC958_SUBFRAME_BE ) >= 0)
-        PA_DEBUG(( "SND_PCM_FORMAT_IEC958_SUBFRAME_BE\n" ));
+    PA_DEBUG(( "%s: Probing %s on first use\n", __FUNCTION__, devInfo->alsaName ));
+    hwInfo.alsaName = devInfo->alsaName;
+    hwInfo.name = (char *)baseDeviceInfo->name;
+    hwInfo.isPlug = devInfo->isPlug;
+    hwInfo.hasCapture = devInfo->hasCapture;
+    hwInfo.hasPlayback = devInfo->hasPlayback;
+    hwInfo.cacheKey = devInfo->cacheKey;
+    hwInfo.probeState = ProbeState_Pending;
+    hwInfo.aggregate = devInfo->aggregate;
+    hwInfo.isHw = devInfo->isHw;
+    ProbeDevice( &hwInfo, alsaApi->probeOpenMode, devInfo, &alsaApi->deviceCache );
 
-    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_MU_LAW ) >= 0)
-        PA_DEBUG(( "SND_PCM_FORMAT_MU_LAW\n" ));
-    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_A_LAW ) >= 0)
-        PA_DEBUG(( "SND_PCM_FORMAT_A_LAW\n" ));
+    if( hwInfo.probeState == ProbeState_Failed )
+    {
+        InitializeDeviceInfo( baseDeviceInfo );
+        devInfo->minInputChannels = devInfo->minOutputChannels = 0;
+    }
+    else
+    {
+        if( hwInfo.probeState == ProbeState_Probed )
+            DeviceCache_Store( &alsaApi->deviceCache, devInfo->cacheKey, devInfo );
+        devInfo->probed = 1;
+    }
 
-    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_IMA_ADPCM ) >= 0)
-        PA_DEBUG(( "SND_PCM_FORMAT_IMA_ADPCM\n" ));
-    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_MPEG ) >= 0)
-        PA_DEBUG(( "SND_PCM_FORMAT_MPEG\n" ));
+    /* ProbeDevice resets the fields that identify the device */
+    baseDeviceInfo->structVersion = identity.structVersion;
+    baseDeviceInfo->name = identity.name;
+    baseDeviceInfo->hostApi = identity.hostApi;
+}
 
-    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_GSM ) >= 0)
-        PA_DEBUG(( "SND_PCM_FORMAT_GSM\n" ));
-    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_SPECIAL ) >= 0)
-        PA_DEBUG(( "SND_PCM_FORMAT_SPECIAL\n" ));
+static void PrepareDeviceInfo( struct PaUtilHostApiRepresentation *hostApi, PaDeviceIndex device )
+{
+    PaAlsaHostApiRepresentation *alsaApi = (PaAlsaHostApiRepresentation *)hostApi;
 
-    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_S24_3LE ) >= 0)
-        PA_DEBUG(( "SND_PCM_FORMAT_S24_3LE\n" ));
-    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_S24_3BE ) >= 0)
-        PA_DEBUG(( "SND_PCM_FORMAT_S24_3BE\n" ));
+    PaUnixMutex_Lock( &alsaApi->monitor.mtx );
+    ProbeDeferredDevice( alsaApi, (PaAlsaDeviceInfo *)hostApi->deviceInfos[device] );
+    PaUnixMutex_Unlock( &alsaApi->monitor.mtx );
+}
 
-    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_U24_3LE ) >= 0)
-        PA_DEBUG(( "SND_PCM_FORMAT_U24_3LE\n" ));
-    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_U24_3BE ) >= 0)
-        PA_DEBUG(( "SND_PCM_FORMAT_U24_3BE\n" ));
+/** Gather the hw devices of all sound cards.
+ *
+ * The devices are appended to hwDevInfos, which is grown as necessary. Names are allocated in allocations.
+ */
+static PaError ScanHwDevices( PaAlsaHostApiRepresentation *alsaApi, PaUtilAllocationGroup *allocations,
+        PaAlsaDeviceCache *cache, HwDevInfo **hwDevInfos, size_t *numDeviceNames, size_t *maxDeviceNames )
+{
+    PaError result = paNoError;
+    int cardIdx = -1;
+    snd_ctl_card_info_t *cardInfo;
+    snd_pcm_info_t *pcmInfo;
+    char *hwPrefix = alsaApi->usePlughw ? "plug" : "";
+    char alsaCardName[50];
 
-    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_S20_3LE ) >= 0)
-        PA_DEBUG(( "SND_PCM_FORMAT_S20_3LE\n" ));
-    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_S20_3BE ) >= 0)
-        PA_DEBUG(( "SND_PCM_FORMAT_S20_3BE\n" ));
+    /* Gather info about hw devices
 
-    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_U20_3LE ) >= 0)
-        PA_DEBUG(( "SND_PCM_FORMAT_U20_3LE\n" ));
-    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_U20_3BE ) >= 0)
-        PA_DEBUG(( "SND_PCM_FORMAT_U20_3BE\n" ));
+     * alsa_snd_card_next() modifies the integer passed to it to be:
+     *      the index of the first card if the parameter is -1
+     *      the index of the next card if the parameter is the index of a card
+     *      -1 if there are no more cards
+     *
+     * The function itself returns 0 if it succeeded. */
+    alsa_snd_ctl_card_info_alloca( &cardInfo );
+    alsa_snd_pcm_info_alloca( &pcmInfo );
+    while( alsa_snd_card_next( &cardIdx ) == 0 && cardIdx >= 0 )
+    {
+        char *cardName;
+        int devIdx = -1;
+        snd_ctl_t *ctl;
+        char buf[66];
 
-    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_S18_3LE ) >= 0)
-        PA_DEBUG(( "SND_PCM_FORMAT_S18_3LE\n" ));
-    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_S18_3BE ) >= 0)
-        PA_DEBUG(( "SND_PCM_FORMAT_S18_3BE\n" ));
+        snprintf( alsaCardName, sizeof (alsaCardName), "hw:%d", cardIdx );
 
-    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_U18_3LE ) >= 0)
-        PA_DEBUG(( "SND_PCM_FORMAT_U18_3LE\n" ));
-    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_U18_3BE ) >= 0)
-        PA_DEBUG(( "SND_PCM_FORMAT_U18_3BE\n" ));
+        /* Acquire name of card */
+        if( alsa_snd_ctl_open( &ctl, alsaCardName, 0 ) < 0 )
+        {
+            /* Unable to open card :( */
+            PA_DEBUG(( "%s: Unable to open device %s\n", __FUNCTION__, alsaCardName ));
+            continue;
+        }
+        alsa_snd_ctl_card_info( ctl, cardInfo );
 
-    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_S16 ) >= 0)
-        PA_DEBUG(( "SND_PCM_FORMAT_S16\n" ));
-    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_U16 ) >= 0)
-        PA_DEBUG(( "SND_PCM_FORMAT_U16\n" ));
+        PA_ENSURE( PaAlsa_StrDup( allocations, &cardName, alsa_snd_ctl_card_info_get_name( cardInfo )) );
 
-    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_S24 ) >= 0)
-        PA_DEBUG(( "SND_PCM_FORMAT_S24\n" ));
-    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_U24 ) >= 0)
-        PA_DEBUG(( "SND_PCM_FORMAT_U24\n" ));
+        while( alsa_snd_ctl_pcm_next_device( ctl, &devIdx ) == 0 && devIdx >= 0 )
+        {
+            char *alsaDeviceName, *deviceName, *infoName, *cacheKey = NULL;
+            size_t len;
+            int hasPlayback = 0, hasCapture = 0;
 
-    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_S32 ) >= 0)
-        PA_DEBUG(( "SND_PCM_FORMAT_S32\n" ));
-    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_U32 ) >= 0)
-        PA_DEBUG(( "SND_PCM_FORMAT_U32\n" ));
+            snprintf( buf, sizeof (buf), "%s%s,%d", hwPrefix, alsaCardName, devIdx );
 
-    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_FLOAT ) >= 0)
-        PA_DEBUG(( "SND_PCM_FORMAT_FLOAT\n" ));
-    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_FLOAT64 ) >= 0)
-        PA_DEBUG(( "SND_PCM_FORMAT_FLOAT64\n" ));
+            /* Obtain info about this particular device */
+            alsa_snd_pcm_info_set_device( pcmInfo, devIdx );
+            alsa_snd_pcm_info_set_subdevice( pcmInfo, 0 );
+            alsa_snd_pcm_info_set_stream( pcmInfo, SND_PCM_STREAM_CAPTURE );
+            if( alsa_snd_ctl_pcm_info( ctl, pcmInfo ) >= 0 )
+            {
+                hasCapture = 1;
+            }
 
-    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_IEC958_SUBFRAME ) >= 0)
-        PA_DEBUG(( "SND_PCM_FORMAT_IEC958_SUBFRAME\n" ));
+            alsa_snd_pcm_info_set_stream( pcmInfo, SND_PCM_STREAM_PLAYBACK );
+            if( alsa_snd_ctl_pcm_info( ctl, pcmInfo ) >= 0 )
+            {
+                hasPlayback = 1;
+            }
 
-    PA_DEBUG(( " -------------------------\n" ));
-}
+            if( !hasPlayback && !hasCapture )
+            {
+                /* Error */
+                continue;
+            }
 
-static snd_pcm_format_t Pa2AlsaFormat( PaSampleFormat paFormat )
-{
-    switch( paFormat )
-    {
-        case paFloat32:
-            return SND_PCM_FORMAT_FLOAT;
+            infoName = SkipCardDetailsInName( (char *)alsa_snd_pcm_info_get_name( pcmInfo ), cardName );
 
-        case paInt16:
-            return SND_PCM_FORMAT_S16;
+            /* The length of the string written by snprintf plus terminating 0 */
+            len = snprintf( NULL, 0, "%s: %s (%s)", cardName, infoName, buf ) + 1;
+            PA_UNLESS( deviceName = (char *)PaUtil_GroupAllocateZeroInitializedMemory( allocations, len ),
+                    paInsufficientMemory );
+            snprintf( deviceName, len, "%s: %s (%s)", cardName, infoName, buf );
 
-        case paInt24:
-#ifdef PA_LITTLE_ENDIAN
-            return SND_PCM_FORMAT_S24_3LE;
-#elif defined PA_BIG_ENDIAN
-            return SND_PCM_FORMAT_S24_3BE;
-#endif
+            PA_DEBUG(( "%s: Found device [%d]: %s\n", __FUNCTION__, *numDeviceNames, deviceName ));
 
-        case paInt32:
-            return SND_PCM_FORMAT_S32;
+            ++*numDeviceNames;
+            if( !*hwDevInfos || *numDeviceNames > *maxDeviceNames )
+            {
+                *maxDeviceNames *= 2;
+                PA_UNLESS( *hwDevInfos = (HwDevInfo *) realloc( *hwDevInfos, *maxDeviceNames * sizeof (HwDevInfo) ),
+                        paInsufficientMemory );
+            }
 
-        case paInt8:
-            return SND_PCM_FORMAT_S8;
+            PA_ENSURE( PaAlsa_StrDup( allocations, &alsaDeviceName, buf ) );
 
-        case paUInt8:
-            return SND_PCM_FORMAT_U8;
+            if( cache->path )
+            {
+                char key[256];
+                snprintf( key, sizeof (key), "%shw:%s,%d %s", hwPrefix, alsa_snd_ctl_card_info_get_id( cardInfo ),
+                        devIdx, alsa_snd_ctl_card_info_get_driver( cardInfo ) );
+                PA_ENSURE( PaAlsa_StrDup( allocations, &cacheKey, key ) );
+            }
 
-        default:
-            return SND_PCM_FORMAT_UNKNOWN;
+            (*hwDevInfos)[ *numDeviceNames - 1 ].alsaName = alsaDeviceName;
+            (*hwDevInfos)[ *numDeviceNames - 1 ].name = deviceName;
+            (*hwDevInfos)[ *numDeviceNames - 1 ].isPlug = alsaApi->usePlughw;
+            (*hwDevInfos)[ *numDeviceNames - 1 ].isHw = 1;
+            (*hwDevInfos)[ *numDeviceNames - 1 ].hasPlayback = hasPlayback;
+            (*hwDevInfos)[ *numDeviceNames - 1 ].hasCapture = hasCapture;
+            (*hwDevInfos)[ *numDeviceNames - 1 ].cacheKey = cacheKey;
+            (*hwDevInfos)[ *numDeviceNames - 1 ].probeState = ProbeState_Pending;
+            (*hwDevInfos)[ *numDeviceNames - 1 ].aggregate = NULL;
+        }
+        alsa_snd_ctl_close( ctl );
     }
+
+error:
+    return result;
 }
 
-/** Open an ALSA pcm handle.
+/** Make a device info describe an unused slot of the device list, see PaAlsa_EnableDeviceMonitor.
  *
- * The device to be open can be specified by name in a custom PaAlsaStreamInfo struct, or it will be by
- * the Portaudio device number supplied in the stream parameters.
+ * The info is filled in aside and copied, so the name is valid at any time for those reading the device list.
  */
-static PaError AlsaOpen( const PaUtilHostApiRepresentation *hostApi, const PaStreamParameters *params, StreamDirection
-        streamDir, snd_pcm_t **pcm )
+static void InitializeInactiveDevInfo( PaAlsaHostApiRepresentation *alsaApi, PaAlsaDeviceInfo *devInfo )
+{
+    PaAlsaDeviceInfo inactive;
+
+    memset( &inactive, 0, sizeof (PaAlsaDeviceInfo) );
+    InitializeDeviceInfo( &inactive.baseDeviceInfo );
+    inactive.baseDeviceInfo.structVersion = 2;
+    inactive.baseDeviceInfo.hostApi = alsaApi->hostApiIndex;
+    inactive.baseDeviceInfo.name = "";
+    inactive.probed = 1;
+    *devInfo = inactive;
+}
+
+/* Build PaDeviceInfo list, ignore devices for which we cannot determine capabilities (possibly busy, sigh) */
+static PaError BuildDeviceList( PaAlsaHostApiRepresentation *alsaApi )
 {
+    PaUtilHostApiRepresentation *baseApi = &alsaApi->baseHostApiRep;
+    PaAlsaDeviceInfo *deviceInfoArray;
     PaError result = paNoError;
-    int ret;
-    const char* deviceName = "";
-    const PaAlsaDeviceInfo *deviceInfo = NULL;
-    PaAlsaStreamInfo *streamInfo = (PaAlsaStreamInfo *)params->hostApiSpecificStreamInfo;
+    size_t numDeviceNames = 0, maxDeviceNames = 1, numHwDeviceNames;
+    HwDevInfo *hwDevInfos = NULL;
+    snd_config_t *topNode = NULL;
+    int res;
+    int blocking = SND_PCM_NONBLOCK;
+    PaAlsaDeviceCache *cache = &alsaApi->deviceCache;
+#ifdef PA_ENABLE_DEBUG_OUTPUT
+    PaTime startTime = PaUtil_GetTime();
+#endif
+
+    DeviceCache_Load( cache, deviceCachePath_ ? deviceCachePath_ : getenv( "PA_ALSA_DEVICE_CACHE" ),
+            alsaApi->alsaLibVersion );
+
+    if( getenv( "PA_ALSA_INITIALIZE_BLOCK" ) && atoi( getenv( "PA_ALSA_INITIALIZE_BLOCK" ) ) )
+        blocking = 0;
+    alsaApi->probeOpenMode = blocking;
+
+    alsaApi->lazyProbing = lazyProbing_ ||
+        ( getenv( "PA_ALSA_LAZY_PROBE" ) && atoi( getenv( "PA_ALSA_LAZY_PROBE" ) ) );
 
-    if( !streamInfo )
+    /* If PA_ALSA_PLUGHW is 1 (non-zero), use the plughw: pcm throughout instead of hw: */
+    if( getenv( "PA_ALSA_PLUGHW" ) && atoi( getenv( "PA_ALSA_PLUGHW" ) ) )
     {
-        deviceInfo = GetDeviceInfo( hostApi, params->device );
-        deviceName = deviceInfo->alsaName;
+        alsaApi->usePlughw = 1;
+        PA_DEBUG(( "%s: Using Plughw\n", __FUNCTION__ ));
     }
-    else
-        deviceName = streamInfo->deviceString;
 
-    PA_DEBUG(( "%s: Opening device %s\n", __FUNCTION__, deviceName ));
-    if( (ret = OpenPcm( pcm, deviceName, streamDir == StreamDirection_In ? SND_PCM_STREAM_CAPTURE : SND_PCM_STREAM_PLAYBACK,
-                    SND_PCM_NONBLOCK, 1 )) < 0 )
+    /* These two will be set to the first working input and output device, respectively */
+    baseApi->info.defaultInputDevice = paNoDevice;
+    baseApi->info.defaultOutputDevice = paNoDevice;
+
+    PA_ENSURE( ScanHwDevices( alsaApi, alsaApi->allocations, cache, &hwDevInfos, &numDeviceNames, &maxDeviceNames ) );
+    numHwDeviceNames = numDeviceNames;
+
+    /* Iterate over plugin devices */
+    if( NULL == (*alsa_snd_config) )
     {
-        /* Not to be closed */
-        *pcm = NULL;
-        ENSURE_( ret, -EBUSY == ret ? paDeviceUnavailable : paBadIODeviceCombination );
+        /* alsa_snd_config_update is called implicitly by some functions, if this hasn't happened snd_config will be NULL (bleh) */
+        ENSURE_( alsa_snd_config_update(), paUnanticipatedHostError );
+        PA_DEBUG(( "Updating snd_config\n" ));
     }
-    ENSURE_( alsa_snd_pcm_nonblock( *pcm, 0 ), paUnanticipatedHostError );
+    assert( *alsa_snd_config );
+    if( ( res = alsa_snd_config_search( *alsa_snd_config, "pcm", &topNode ) ) >= 0 )
+    {
+        snd_config_iterator_t i, next;
 
-end:
-    return result;
+        alsa_snd_config_for_each( i, next, topNode )
+        {
+            const char *tpStr = "unknown", *idStr = NULL;
+            int err = 0;
 
-error:
-    goto end;
-}
+            char *alsaDeviceName, *deviceName;
+            const HwDevInfo *predefined = NULL;
+            snd_config_t *n = alsa_snd_config_iterator_entry( i ), * tp = NULL;;
 
-static PaError TestParameters( const PaUtilHostApiRepresentation *hostApi, const PaStreamParameters *parameters,
-        double sampleRate, StreamDirection streamDir )
-{
-    PaError result = paNoError;
-    snd_pcm_t *pcm = NULL;
-    PaSampleFormat availableFormats;
-    /* We are able to adapt to a number of channels less than what the device supports */
-    unsigned int numHostChannels;
-    PaSampleFormat hostFormat;
-    snd_pcm_hw_params_t *hwParams;
-    unsigned int uintSampleRate = (unsigned int) sampleRate;
+            if( (err = alsa_snd_config_search( n, "type", &tp )) < 0 )
+            {
+                if( -ENOENT != err )
+                {
+                    ENSURE_(err, paUnanticipatedHostError);
+                }
+            }
+            else
+            {
+                ENSURE_( alsa_snd_config_get_string( tp, &tpStr ), paUnanticipatedHostError );
+            }
+            ENSURE_( alsa_snd_config_get_id( n, &idStr ), paUnanticipatedHostError );
+            if( IgnorePlugin( idStr ) )
+            {
+                PA_DEBUG(( "%s: Ignoring ALSA plugin device [%s] of type [%s]\n", __FUNCTION__, idStr, tpStr ));
+                continue;
+            }
+            PA_DEBUG(( "%s: Found plugin [%s] of type [%s]\n", __FUNCTION__, idStr, tpStr ));
 
-    alsa_snd_pcm_hw_params_alloca( &hwParams );
+            PA_UNLESS( alsaDeviceName = (char*)PaUtil_GroupAllocateZeroInitializedMemory( alsaApi->allocations,
+                                                            strlen(idStr) + 6 ), paInsufficientMemory );
+            strcpy( alsaDeviceName, idStr );
+            PA_UNLESS( deviceName = (char*)PaUtil_GroupAllocateZeroInitializedMemory( alsaApi->allocations,
+                                                            strlen(idStr) + 1 ), paInsufficientMemory );
+            strcpy( deviceName, idStr );
 
-    if( !parameters->hostApiSpecificStreamInfo )
-    {
-        const PaAlsaDeviceInfo *devInfo = GetDeviceInfo( hostApi, parameters->device );
-        numHostChannels = PA_MAX( parameters->channelCount, StreamDirection_In == streamDir ?
-                devInfo->minInputChannels : devInfo->minOutputChannels );
-    }
-    else
-        numHostChannels = parameters->channelCount;
+            ++numDeviceNames;
+            if( !hwDevInfos || numDeviceNames > maxDeviceNames )
+            {
+                maxDeviceNames *= 2;
+                PA_UNLESS( hwDevInfos = (HwDevInfo *) realloc( hwDevInfos, maxDeviceNames * sizeof (HwDevInfo) ),
+                        paInsufficientMemory );
+            }
 
-    PA_ENSURE( AlsaOpen( hostApi, parameters, streamDir, &pcm ) );
+            predefined = FindDeviceName( alsaDeviceName );
 
-    alsa_snd_pcm_hw_params_any( pcm, hwParams );
+            hwDevInfos[numDeviceNames - 1].alsaName = alsaDeviceName;
+            hwDevInfos[numDeviceNames - 1].name     = deviceName;
+            hwDevInfos[numDeviceNames - 1].isPlug   = 1;
+            hwDevInfos[numDeviceNames - 1].isHw     = 0;
+            hwDevInfos[numDeviceNames - 1].cacheKey = cache->path ? deviceName : NULL;
+            hwDevInfos[numDeviceNames - 1].probeState = ProbeState_Pending;
+            hwDevInfos[numDeviceNames - 1].aggregate = NULL;
 
-    if( SetApproximateSampleRate( pcm, hwParams, &uintSampleRate ) < 0 )
-    {
-        result = paInvalidSampleRate;
-        goto error;
+            if( predefined )
+            {
+                hwDevInfos[numDeviceNames - 1].hasPlayback = predefined->hasPlayback;
+                hwDevInfos[numDeviceNames - 1].hasCapture  = predefined->hasCapture;
+            }
+            else
+            {
+                hwDevInfos[numDeviceNames - 1].hasPlayback = 1;
+                hwDevInfos[numDeviceNames - 1].hasCapture  = 1;
+            }
+        }
     }
+    else
+        PA_DEBUG(( "%s: Iterating over ALSA plugins failed: %s\n", __FUNCTION__, alsa_snd_strerror( res ) ));
 
-    if( alsa_snd_pcm_hw_params_set_channels( pcm, hwParams, numHostChannels ) < 0 )
+    /* Aggregate devices */
+    for( int i = 0; i < numAggregates_; ++i )
     {
-        result = paInvalidChannelCount;
-        goto error;
+        const char *masterName = aggregates_[i].memberNames[0];
+
+        ++numDeviceNames;
+        if( !hwDevInfos || numDeviceNames > maxDeviceNames )
+        {
+            maxDeviceNames *= 2;
+            PA_UNLESS( hwDevInfos = (HwDevInfo *) realloc( hwDevInfos, maxDeviceNames * sizeof (HwDevInfo) ),
+                    paInsufficientMemory );
+        }
+
+        hwDevInfos[numDeviceNames - 1].alsaName = (char *)masterName;
+        hwDevInfos[numDeviceNames - 1].name = (char *)aggregates_[i].name;
+        hwDevInfos[numDeviceNames - 1].isPlug = strncmp( "hw:", masterName, 3 ) != 0;
+        hwDevInfos[numDeviceNames - 1].isHw = 0;
+        hwDevInfos[numDeviceNames - 1].hasPlayback = 1;
+        hwDevInfos[numDeviceNames - 1].hasCapture = 1;
+        hwDevInfos[numDeviceNames - 1].cacheKey = NULL;
+        hwDevInfos[numDeviceNames - 1].probeState = ProbeState_Pending;
+        hwDevInfos[numDeviceNames - 1].aggregate = &aggregates_[i];
     }
 
-    /* See if we can find a best possible match */
-    availableFormats = GetAvailableFormats( pcm );
-    PA_ENSURE( hostFormat = PaUtil_SelectClosestAvailableFormat( availableFormats, parameters->sampleFormat ) );
+    /* allocate deviceInfo memory based on the number of devices, and the slots reserved for the device monitor */
+    PA_UNLESS( baseApi->deviceInfos = (PaDeviceInfo**)PaUtil_GroupAllocateZeroInitializedMemory(
+            alsaApi->allocations, sizeof(PaDeviceInfo*) * (numDeviceNames + alsaApi->monitor.reservedDevices) ),
+            paInsufficientMemory );
 
-    /* Some specific hardware (reported: Audio8 DJ) can fail with assertion during this step. */
-    ENSURE_( alsa_snd_pcm_hw_params_set_format( pcm, hwParams, Pa2AlsaFormat( hostFormat ) ), paUnanticipatedHostError );
+    /* allocate all device info structs in a contiguous block */
+    PA_UNLESS( deviceInfoArray = (PaAlsaDeviceInfo*)PaUtil_GroupAllocateZeroInitializedMemory(
+            alsaApi->allocations, sizeof(PaAlsaDeviceInfo) * numDeviceNames ), paInsufficientMemory );
 
-    /*
-     * Intel HDA driver doesn't set PCM rule to limit maximum size of buffer.
-     * This can result in a request for too large a buffer size.
-     * That can cause a memory allocation error in ALSA PCM core, at least it does in Linux kernel 5.8.
-     * As a workaround, limit buffer size to a reasonable value.
+    /* Loop over list of cards, filling in info. If a device is deemed unavailable (can't get name),
+     * it's ignored.
+     *
+     * Note that we do this in two stages. This is a workaround owing to the fact that the 'dmix'
+     * plugin may cause the underlying hardware device to be busy for a short while even after it
+     * (dmix) is closed. The 'default' plugin may also point to the dmix plugin, so the same goes
+     * for this.
      */
+    PA_DEBUG(( "%s: Filling device info for %d devices\n", __FUNCTION__, numDeviceNames ));
+    if( !alsaApi->lazyProbing )
     {
-        unsigned int bufferTimeMicros = 50 * 1000;
-        int direction = 0;
-        ENSURE_( alsa_snd_pcm_hw_params_set_buffer_time_near( pcm, hwParams,
-                &bufferTimeMicros, &direction ), paBufferTooBig );
+        PA_ENSURE( ProbeDevicesConcurrently( hwDevInfos, deviceInfoArray, numHwDeviceNames, blocking, cache ) );
     }
+    int devIdx = 0;
+    for( size_t i = 0; i < numDeviceNames; ++i )
+    {
+        PaAlsaDeviceInfo* devInfo = &deviceInfoArray[i];
+        HwDevInfo* hwInfo = &hwDevInfos[i];
+        if( hwInfo->aggregate || !strcmp( hwInfo->name, "dmix" ) || !strcmp( hwInfo->name, "default" ) )
+        {
+            continue;
+        }
 
+        PA_ENSURE( FillInDevInfo( alsaApi, hwInfo, blocking, devInfo, &devIdx, cache ) );
+    }
+    assert( devIdx <= numDeviceNames );
+    /* Now inspect 'dmix' and 'default' plugins */
+    for( size_t i = 0; i < numDeviceNames; ++i )
     {
-        /* It happens that this call fails because the device is busy */
-        int ret = 0;
-        if( ( ret = alsa_snd_pcm_hw_params( pcm, hwParams ) ) < 0 )
+        PaAlsaDeviceInfo* devInfo = &deviceInfoArray[i];
+        HwDevInfo* hwInfo = &hwDevInfos[i];
+        if( hwInfo->aggregate || ( strcmp( hwInfo->name, "dmix" ) && strcmp( hwInfo->name, "default" ) ) )
         {
-            if( -EINVAL == ret )
-            {
-                /* Don't know what to return here */
-                result = paBadIODeviceCombination;
-                goto error;
-            }
-            else if( -EBUSY == ret )
-            {
-                result = paDeviceUnavailable;
-                PA_DEBUG(( "%s: Device is busy\n", __FUNCTION__ ));
-            }
-            else
-            {
-                result = paUnanticipatedHostError;
-            }
+            continue;
+        }
 
-            ENSURE_( ret, result );
+        PA_ENSURE( FillInDevInfo( alsaApi, hwInfo, blocking, devInfo, &devIdx, cache ) );
+    }
+    /* Aggregate devices come last, so they don't change the indices of other devices */
+    for( size_t i = 0; i < numDeviceNames; ++i )
+    {
+        if( hwDevInfos[i].aggregate )
+        {
+            PA_ENSURE( FillInDevInfo( alsaApi, &hwDevInfos[i], blocking, &deviceInfoArray[i], &devIdx, cache ) );
+        }
+    }
+    free( hwDevInfos );
+
+    baseApi->info.deviceCount = devIdx;   /* Number of successfully queried devices */
+
+    /* Inactive slots for devices added later, see PaAlsa_EnableDeviceMonitor */
+    if( alsaApi->monitor.reservedDevices > 0 )
+    {
+        PaAlsaDeviceInfo *reserved;
+
+        PA_UNLESS( reserved = (PaAlsaDeviceInfo *)PaUtil_GroupAllocateZeroInitializedMemory( alsaApi->allocations,
+                    sizeof(PaAlsaDeviceInfo) * alsaApi->monitor.reservedDevices ), paInsufficientMemory );
+        for( int i = 0; i < alsaApi->monitor.reservedDevices; ++i )
+        {
+            InitializeInactiveDevInfo( alsaApi, &reserved[i] );
+            baseApi->deviceInfos[baseApi->info.deviceCount++] = (PaDeviceInfo *)&reserved[i];
         }
     }
 
+#ifdef PA_ENABLE_DEBUG_OUTPUT
+    PA_DEBUG(( "%s: Building device list took %f seconds\n", __FUNCTION__, PaUtil_GetTime() - startTime ));
+#endif
+
 end:
-    if( pcm )
+    if( result != paNoError || !alsaApi->lazyProbing )
     {
-        alsa_snd_pcm_close( pcm );
+        /* With lazy probing the cache is kept, to store devices as they are probed */
+        DeviceCache_Terminate( cache );
     }
     return result;
 
 error:
+    /* No particular action */
     goto end;
 }
 
-static PaError IsFormatSupported( struct PaUtilHostApiRepresentation *hostApi,
-                                  const PaStreamParameters *inputParameters,
-                                  const PaStreamParameters *outputParameters,
-                                  double sampleRate )
+/** Check that a default device is still there, otherwise pick the first device supporting the direction.
+ *
+ * @param defaultDevice A default device of the host API, as a global device index
+ */
+static void UpdateDefaultDevice( PaUtilHostApiRepresentation *baseApi, PaDeviceIndex *defaultDevice, int capture )
 {
-    int inputChannelCount = 0, outputChannelCount = 0;
-    PaSampleFormat inputSampleFormat, outputSampleFormat;
-    PaError result = paFormatIsSupported;
-
-    if( inputParameters )
-    {
-        PA_ENSURE( ValidateParameters( inputParameters, hostApi, StreamDirection_In ) );
-
-        inputChannelCount = inputParameters->channelCount;
-        inputSampleFormat = inputParameters->sampleFormat;
-    }
+    const PaAlsaDeviceInfo *devInfo;
+    int base = baseApi->privatePaFrontInfo.baseDeviceIndex;
 
-    if( outputParameters )
+    if( *defaultDevice != paNoDevice && GetDeviceInfo( baseApi, *defaultDevice - base )->alsaName )
     {
-        PA_ENSURE( ValidateParameters( outputParameters, hostApi, StreamDirection_Out ) );
-
-        outputChannelCount = outputParameters->channelCount;
-        outputSampleFormat = outputParameters->sampleFormat;
+        return;
     }
 
-    if( inputChannelCount )
+    *defaultDevice = paNoDevice;
+    for( int i = 0; i < baseApi->info.deviceCount; ++i )
     {
-        if( ( result = TestParameters( hostApi, inputParameters, sampleRate, StreamDirection_In ) )
-                != paNoError )
-            goto error;
-    }
-    if ( outputChannelCount )
-    {
-        if( ( result = TestParameters( hostApi, outputParameters, sampleRate, StreamDirection_Out ) )
-                != paNoError )
-            goto error;
+        devInfo = GetDeviceInfo( baseApi, i );
+        if( devInfo->alsaName && ( capture ? devInfo->hasCapture : devInfo->hasPlayback ) )
+        {
+            *defaultDevice = base + i;
+            PA_DEBUG(( "%s: Default %s device: %s\n", __FUNCTION__, capture ? "input" : "output",
+                        devInfo->baseDeviceInfo.name ));
+            break;
+        }
     }
-
-    return paFormatIsSupported;
-
-error:
-    return result;
 }
 
-
-static PaError PaAlsaStreamComponent_Initialize( PaAlsaStreamComponent *self, PaAlsaHostApiRepresentation *alsaApi,
-        const PaStreamParameters *params, StreamDirection streamDir, int callbackMode )
+/** Synchronize the hw devices in the device list with the sound cards present.
+ *
+ * The hw devices of all cards are enumerated anew and matched with those in the list by name, which includes the
+ * card. Devices that are gone are made inactive, but their slots remember them. A device that comes back takes its
+ * old slot, other new devices take the first slots that haven't been used, so that an index never refers to another
+ * device. Plugin and aggregate devices are left as they are. Called with the monitor's mutex held.
+ */
+static PaError UpdateDeviceList( PaAlsaHostApiRepresentation *alsaApi )
 {
     PaError result = paNoError;
-    PaSampleFormat userSampleFormat = params->sampleFormat, hostSampleFormat = paNoError;
-    assert( params->channelCount > 0 );
-
-    /* Make sure things have an initial value */
-    memset( self, 0, sizeof (PaAlsaStreamComponent) );
+    PaUtilHostApiRepresentation *baseApi = &alsaApi->baseHostApiRep;
+    PaUtilAllocationGroup *scanAllocations = NULL;
+    HwDevInfo *hwDevInfos = NULL;
+    size_t numDeviceNames = 0, maxDeviceNames = 1;
+    char *present = NULL, *listed = NULL;
+    PaAlsaDeviceInfo *devInfo, newInfo;
+    int i;
+    size_t j;
+
+    /* The names of devices that are already listed are only needed for matching */
+    PA_UNLESS( scanAllocations = PaUtil_CreateAllocationGroup(), paInsufficientMemory );
+    PA_ENSURE( ScanHwDevices( alsaApi, scanAllocations, &alsaApi->deviceCache, &hwDevInfos, &numDeviceNames,
+                &maxDeviceNames ) );
+    PA_UNLESS( present = (char *)PaUtil_AllocateZeroInitializedMemory( baseApi->info.deviceCount + 1 ),
+            paInsufficientMemory );
+    PA_UNLESS( listed = (char *)PaUtil_AllocateZeroInitializedMemory( numDeviceNames + 1 ), paInsufficientMemory );
 
-    if( NULL == params->hostApiSpecificStreamInfo )
+    for( j = 0; j < numDeviceNames; ++j )
     {
-        const PaAlsaDeviceInfo *devInfo = GetDeviceInfo( &alsaApi->baseHostApiRep, params->device );
-        self->numHostChannels = PA_MAX( params->channelCount, StreamDirection_In == streamDir ? devInfo->minInputChannels
-                : devInfo->minOutputChannels );
-        self->deviceIsPlug = devInfo->isPlug;
-        PA_DEBUG(( "%s: Host Chans %c %i\n", __FUNCTION__, streamDir == StreamDirection_In ? 'C' : 'P', self->numHostChannels ));
+        for( i = 0; i < baseApi->info.deviceCount; ++i )
+        {
+            devInfo = (PaAlsaDeviceInfo *)baseApi->deviceInfos[i];
+            if( devInfo->isHw && !strcmp( devInfo->baseDeviceInfo.name, hwDevInfos[j].name ) )
+            {
+                present[i] = listed[j] = 1;
+                break;
+            }
+        }
     }
-    else
+
+    for( i = 0; i < baseApi->info.deviceCount; ++i )
     {
-        /* We're blissfully unaware of the minimum channelCount */
-        self->numHostChannels = params->channelCount;
-        /* Check if device name does not start with hw: to determine if it is a 'plug' device */
-        if( strncmp( "hw:", ((PaAlsaStreamInfo *)params->hostApiSpecificStreamInfo)->deviceString, 3 ) != 0  )
-            self->deviceIsPlug = 1; /* An Alsa plug device, not a direct hw device */
+        devInfo = (PaAlsaDeviceInfo *)baseApi->deviceInfos[i];
+        if( devInfo->isHw && !present[i] )
+        {
+            /* Kept for when the device comes back, readers may still hold the name */
+            char *removedName = (char *)devInfo->baseDeviceInfo.name, *removedAlsaName = devInfo->alsaName,
+                 *removedCacheKey = devInfo->cacheKey;
+
+            PA_DEBUG(( "%s: Removing device %s: %d\n", __FUNCTION__, devInfo->baseDeviceInfo.name, i ));
+            InitializeInactiveDevInfo( alsaApi, devInfo );
+            devInfo->removedName = removedName;
+            devInfo->removedAlsaName = removedAlsaName;
+            devInfo->removedCacheKey = removedCacheKey;
+        }
     }
-    if( self->deviceIsPlug && alsaApi->alsaLibVersion < ALSA_VERSION_INT( 1, 0, 16 ) )
-        self->useReventFix = 1; /* Prior to Alsa1.0.16, plug devices may stutter without this fix */
-
-    self->device = params->device;
 
-    PA_ENSURE( AlsaOpen( &alsaApi->baseHostApiRep, params, streamDir, &self->pcm ) );
-    self->nfds = alsa_snd_pcm_poll_descriptors_count( self->pcm );
+    for( j = 0; j < numDeviceNames; ++j )
+    {
+        HwDevInfo *hwInfo = &hwDevInfos[j];
+        int freeSlot = -1;
 
-    PA_ENSURE( hostSampleFormat = PaUtil_SelectClosestAvailableFormat( GetAvailableFormats( self->pcm ), userSampleFormat ) );
+        if( listed[j] )
+        {
+            continue;
+        }
+        for( i = 0; i < baseApi->info.deviceCount; ++i )
+        {
+            devInfo = (PaAlsaDeviceInfo *)baseApi->deviceInfos[i];
+            if( devInfo->alsaName )
+            {
+                continue;
+            }
+            if( devInfo->removedName && !strcmp( devInfo->removedName, hwInfo->name ) )
+            {
+                break;
+            }
+            if( !devInfo->removedName && freeSlot < 0 )
+            {
+                freeSlot = i;
+            }
+        }
+        if( i == baseApi->info.deviceCount )
+        {
+            if( freeSlot < 0 )
+            {
+                PA_DEBUG(( "%s: No free slot for device %s\n", __FUNCTION__, hwInfo->name ));
+                continue;
+            }
+            i = freeSlot;
+        }
+        devInfo = (PaAlsaDeviceInfo *)baseApi->deviceInfos[i];
 
-    self->hostSampleFormat = hostSampleFormat;
-    self->nativeFormat = Pa2AlsaFormat( hostSampleFormat );
-    self->hostInterleaved = self->userInterleaved = !( userSampleFormat & paNonInterleaved );
-    self->numUserChannels = params->channelCount;
-    self->streamDir = streamDir;
-    self->canMmap = 0;
-    self->nonMmapBuffer = NULL;
-    self->nonMmapBufferSize = 0;
+        /* The strings are kept in the slot until the device is added, a device that comes back reuses them. The
+         * name includes the ALSA name, so only the cache key may differ */
+        if( !devInfo->removedName )
+        {
+            PA_ENSURE( PaAlsa_StrDup( alsaApi->allocations, &devInfo->removedName, hwInfo->name ) );
+        }
+        if( !devInfo->removedAlsaName )
+        {
+            PA_ENSURE( PaAlsa_StrDup( alsaApi->allocations, &devInfo->removedAlsaName, hwInfo->alsaName ) );
+        }
+        if( devInfo->removedCacheKey && ( !hwInfo->cacheKey || strcmp( devInfo->removedCacheKey, hwInfo->cacheKey ) ) )
+        {
+            PaUtil_GroupFreeMemory( alsaApi->allocations, devInfo->removedCacheKey );
+            devInfo->removedCacheKey = NULL;
+        }
+        if( hwInfo->cacheKey && !devInfo->removedCacheKey )
+        {
+            PA_ENSURE( PaAlsa_StrDup( alsaApi->allocations, &devInfo->removedCacheKey, hwInfo->cacheKey ) );
+        }
+        hwInfo->name = devInfo->removedName;
+        hwInfo->alsaName = devInfo->removedAlsaName;
+        hwInfo->cacheKey = devInfo->removedCacheKey;
 
-    if( !callbackMode && !self->userInterleaved )
-    {
-        /* Pre-allocate non-interleaved user provided buffers */
-        PA_UNLESS( self->userBuffers = PaUtil_AllocateZeroInitializedMemory( sizeof (void *) * self->numUserChannels ),
-                paInsufficientMemory );
+        /* Filled in aside, as probing resets the fields that identify the device */
+        memset( &newInfo, 0, sizeof (PaAlsaDeviceInfo) );
+        if( InitializeDevInfo( alsaApi, hwInfo, alsaApi->probeOpenMode, &newInfo, &alsaApi->deviceCache ) )
+        {
+            PA_DEBUG(( "%s: Adding device %s: %d\n", __FUNCTION__, hwInfo->name, i ));
+            *(PaAlsaDeviceInfo *)baseApi->deviceInfos[i] = newInfo;
+        }
     }
 
-error:
+    UpdateDefaultDevice( baseApi, &baseApi->info.defaultInputDevice, 1 );
+    UpdateDefaultDevice( baseApi, &baseApi->info.defaultOutputDevice, 0 );
 
-    /* Log all available formats. */
-    if ( hostSampleFormat == paSampleFormatNotSupported )
+error:
+    PaUtil_FreeMemory( listed );
+    PaUtil_FreeMemory( present );
+    free( hwDevInfos );
+    if( scanAllocations )
     {
-        LogAllAvailableFormats( self->pcm );
-        PA_DEBUG(( "%s: Please provide the log output to PortAudio developers, your hardware does not have any sample format implemented yet.\n", __FUNCTION__ ));
+        PaUtil_FreeAllAllocations( scanAllocations );
+        PaUtil_DestroyAllocationGroup( scanAllocations );
     }
-
     return result;
 }
 
-static void PaAlsaStreamComponent_Terminate( PaAlsaStreamComponent *self )
+/** Return the flags of the PaAlsaStreamInfo passed with stream parameters, if any.
+ */
+static unsigned long GetStreamInfoFlags( const PaStreamParameters *parameters )
 {
-    alsa_snd_pcm_close( self->pcm );
-    PaUtil_FreeMemory( self->userBuffers ); /* (Ptr can be NULL; PaUtil_FreeMemory includes a NULL check) */
-    PaUtil_FreeMemory( self->nonMmapBuffer );
+    const PaAlsaStreamInfo *streamInfo = parameters ? parameters->hostApiSpecificStreamInfo : NULL;
+    return streamInfo && streamInfo->version >= 2 ? streamInfo->flags : 0;
 }
 
-/*
-static int nearbyint_(float value) {
-    if(  value - (int)value > .5 )
-        return (int)ceil( value );
-    return (int)floor( value );
+/** The number of channels of a stream on an aggregate device that go to a member, members take them in order.
+ */
+static int GetAggregateMemberChannels( const PaAlsaAggregateSpec *aggregate, StreamDirection streamDir,
+        int channelCount, int member )
+{
+    const int *maxChannels = StreamDirection_In == streamDir ? aggregate->maxInputChannels :
+        aggregate->maxOutputChannels;
+
+    for( int i = 0; i < member; ++i )
+    {
+        channelCount -= PA_MIN( channelCount, maxChannels[i] );
+    }
+    return PA_MIN( channelCount, maxChannels[member] );
 }
-*/
 
-/** Initiate configuration, preparing for determining a period size suitable for both capture and playback components.
+/** Return the parameters for opening the device, which for an aggregate device is its master.
  *
+ * @param masterParams Storage for the master's parameters, if different.
  */
-static PaError PaAlsaStreamComponent_InitialConfigure( PaAlsaStreamComponent *self, const PaStreamParameters *params,
-        int primeBuffers, snd_pcm_hw_params_t *hwParams, unsigned int *sampleRatePtr )
+static const PaStreamParameters *GetMasterParameters( const PaUtilHostApiRepresentation *hostApi,
+        const PaStreamParameters *params, StreamDirection streamDir, PaStreamParameters *masterParams )
 {
-    /* Configuration consists of setting all of ALSA's parameters.
-     * These parameters come in two flavors: hardware parameters
-     * and software parameters.  Hardware parameters will affect
-     * the way the device is initialized, software parameters
-     * affect the way ALSA interacts with me, the user-level client.
-     */
-
-    PaError result = paNoError;
-    snd_pcm_access_t accessMode, alternateAccessMode;
-    int dir = 0;
-    snd_pcm_t *pcm = self->pcm;
-    unsigned int minPeriods = 2;
-    unsigned int requestedRate = *sampleRatePtr;
+    const PaAlsaDeviceInfo *devInfo;
 
-    /* self->framesPerPeriod = framesPerHostBuffer; */
-
-    /* ... fill up the configuration space with all possible
-     * combinations of parameters this device will accept */
-    ENSURE_( alsa_snd_pcm_hw_params_any( pcm, hwParams ), paUnanticipatedHostError );
-
-    ENSURE_( alsa_snd_pcm_hw_params_set_periods_integer( pcm, hwParams ), paUnanticipatedHostError );
-    /* I think there should be at least 2 periods (even though ALSA doesn't appear to enforce this) */
-    dir = 0;
-    ENSURE_( alsa_snd_pcm_hw_params_set_periods_min( pcm, hwParams, &minPeriods, &dir ), paUnanticipatedHostError );
-
-    if( self->userInterleaved )
+    if( params->device == paUseHostApiSpecificDeviceSpecification ||
+            !( devInfo = GetDeviceInfo( hostApi, params->device ) )->aggregate )
     {
-        accessMode          = SND_PCM_ACCESS_MMAP_INTERLEAVED;
-        alternateAccessMode = SND_PCM_ACCESS_MMAP_NONINTERLEAVED;
-
-        /* test if MMAP supported */
-        self->canMmap = alsa_snd_pcm_hw_params_test_access( pcm, hwParams, accessMode ) >= 0 ||
-                        alsa_snd_pcm_hw_params_test_access( pcm, hwParams, alternateAccessMode ) >= 0;
-
-        PA_DEBUG(( "%s: device MMAP SND_PCM_ACCESS_MMAP_INTERLEAVED: %s\n", __FUNCTION__, ( alsa_snd_pcm_hw_params_test_access( pcm, hwParams, accessMode ) >= 0 ? "YES" : "NO" ) ));
-        PA_DEBUG(( "%s: device MMAP SND_PCM_ACCESS_MMAP_NONINTERLEAVED: %s\n", __FUNCTION__, ( alsa_snd_pcm_hw_params_test_access( pcm, hwParams, alternateAccessMode ) >= 0 ? "YES" : "NO" ) ));
-
-        if( !self->canMmap )
-        {
-            accessMode          = SND_PCM_ACCESS_RW_INTERLEAVED;
-            alternateAccessMode = SND_PCM_ACCESS_RW_NONINTERLEAVED;
-        }
+        return params;
     }
-    else
-    {
-        accessMode          = SND_PCM_ACCESS_MMAP_NONINTERLEAVED;
-        alternateAccessMode = SND_PCM_ACCESS_MMAP_INTERLEAVED;
-
-        /* test if MMAP supported */
-        self->canMmap = alsa_snd_pcm_hw_params_test_access( pcm, hwParams, accessMode ) >= 0 ||
-                        alsa_snd_pcm_hw_params_test_access( pcm, hwParams, alternateAccessMode ) >= 0;
-
-        PA_DEBUG((" %s: device MMAP SND_PCM_ACCESS_MMAP_NONINTERLEAVED: %s\n", __FUNCTION__, ( alsa_snd_pcm_hw_params_test_access( pcm, hwParams, accessMode ) >= 0 ? "YES" : "NO" ) ));
-        PA_DEBUG(( "%s: device MMAP SND_PCM_ACCESS_MMAP_INTERLEAVED: %s\n", __FUNCTION__, ( alsa_snd_pcm_hw_params_test_access( pcm, hwParams, alternateAccessMode ) >= 0 ? "YES" : "NO" ) ));
 
-        if( !self->canMmap )
-        {
-            accessMode          = SND_PCM_ACCESS_RW_NONINTERLEAVED;
-            alternateAccessMode = SND_PCM_ACCESS_RW_INTERLEAVED;
-        }
-    }
+    *masterParams = *params;
+    masterParams->channelCount = GetAggregateMemberChannels( devInfo->aggregate, streamDir, params->channelCount, 0 );
+    return masterParams;
+}
 
-    PA_DEBUG(( "%s: device can MMAP: %s\n", __FUNCTION__, ( self->canMmap ? "YES" : "NO" ) ));
+/* Check against known device capabilities, called with the monitor's mutex held */
+static PaError ValidateParameters( const PaStreamParameters *parameters, PaUtilHostApiRepresentation *hostApi, StreamDirection mode )
+{
+    PaError result = paNoError;
+    int maxChans;
+    const PaAlsaDeviceInfo *deviceInfo = NULL;
+    const PaAlsaStreamInfo *streamInfo;
+    assert( parameters );
+    streamInfo = parameters->hostApiSpecificStreamInfo;
 
-    /* If requested access mode fails, try alternate mode */
-    if( alsa_snd_pcm_hw_params_set_access( pcm, hwParams, accessMode ) < 0 )
+    if( streamInfo )
     {
-        int err = 0;
-        if( ( err = alsa_snd_pcm_hw_params_set_access( pcm, hwParams, alternateAccessMode )) < 0 )
-        {
-            result = paUnanticipatedHostError;
-            PaUtil_SetLastHostErrorInfo( paALSA, err, alsa_snd_strerror( err ) );
-            goto error;
-        }
-        /* Flip mode */
-        self->hostInterleaved = !self->userInterleaved;
+        /* Version 1 lacks the flags field */
+        PA_UNLESS( ( streamInfo->version == 1 && streamInfo->size == offsetof( PaAlsaStreamInfo, flags ) ) ||
+                ( streamInfo->version == 2 && streamInfo->size == sizeof (PaAlsaStreamInfo) ),
+                paIncompatibleHostApiSpecificStreamInfo );
     }
 
-    /* Some specific hardware (reported: Audio8 DJ) can fail with assertion during this step. */
-    ENSURE_( alsa_snd_pcm_hw_params_set_format( pcm, hwParams, self->nativeFormat ), paUnanticipatedHostError );
-
-    if( ( result = SetApproximateSampleRate( pcm, hwParams, sampleRatePtr )) != paUnanticipatedHostError )
+    if( parameters->device != paUseHostApiSpecificDeviceSpecification )
     {
-        if( result == paInvalidSampleRate ) /* From the SetApproximateSampleRate() call above */
-        { /* The sample rate was returned as 'out of tolerance' of the one requested */
-            PA_DEBUG(( "%s: Wanted %.3f, closest sample rate was %u\n",
-                    __FUNCTION__, requestedRate, *sampleRatePtr ));
-            PA_ENSURE( paInvalidSampleRate );
-        }
+        assert( parameters->device < hostApi->info.deviceCount );
+        ProbeDeferredDevice( (PaAlsaHostApiRepresentation *)hostApi,
+                (PaAlsaDeviceInfo *)hostApi->deviceInfos[parameters->device] );
+        deviceInfo = GetDeviceInfo( hostApi, parameters->device );
     }
     else
     {
-        PA_ENSURE( paUnanticipatedHostError );
+        PA_UNLESS( streamInfo && streamInfo->deviceString != NULL, paInvalidDevice );
+
+        /* Skip further checking */
+        return paNoError;
     }
 
-    ENSURE_( alsa_snd_pcm_hw_params_set_channels( pcm, hwParams, self->numHostChannels ), paInvalidChannelCount );
+    assert( deviceInfo );
+    /* The device has been removed, see PaAlsa_EnableDeviceMonitor */
+    PA_UNLESS( deviceInfo->alsaName, paDeviceUnavailable );
+    if( !deviceInfo->probed )
+    {
+        /* An aggregate's channels can't be divided between its members without knowing them */
+        PA_UNLESS( !deviceInfo->aggregate, paDeviceUnavailable );
 
-end:
-    return result;
+        /* The capabilities couldn't be determined (the device may be busy), leave it to opening the device */
+        return paNoError;
+    }
+    maxChans = ( StreamDirection_In == mode ? deviceInfo->baseDeviceInfo.maxInputChannels :
+        deviceInfo->baseDeviceInfo.maxOutputChannels );
+    PA_UNLESS( parameters->channelCount <= maxChans, paInvalidChannelCount );
 
 error:
-    /* No particular action */
-    goto end;
+    return result;
 }
 
-/** Finish the configuration of the component's ALSA device.
- *
- * As part of this method, the component's alsaBufferSize attribute will be set.
- * @param latency: The latency for this component.
- */
-static PaError PaAlsaStreamComponent_FinishConfigure( PaAlsaStreamComponent *self, snd_pcm_hw_params_t* hwParams,
-        const PaStreamParameters *params, int primeBuffers, unsigned int sampleRate, PaTime* latency )
+/* Given an open stream, what sample formats are available? */
+static PaSampleFormat GetAvailableFormats( snd_pcm_t *pcm )
 {
-    PaError result = paNoError;
-    snd_pcm_sw_params_t* swParams;
-    snd_pcm_uframes_t bufSz = 0;
-    *latency = -1.;
+    PaSampleFormat available = 0;
+    snd_pcm_hw_params_t *hwParams;
+    alsa_snd_pcm_hw_params_alloca( &hwParams );
 
-    alsa_snd_pcm_sw_params_alloca( &swParams );
+    alsa_snd_pcm_hw_params_any( pcm, hwParams );
 
-    bufSz = params->suggestedLatency * sampleRate + self->framesPerPeriod;
-    ENSURE_( alsa_snd_pcm_hw_params_set_buffer_size_near( self->pcm, hwParams, &bufSz ), paUnanticipatedHostError );
+    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_FLOAT ) >= 0)
+        available |= paFloat32;
 
-    /* Set the parameters! */
-    {
-        int r = alsa_snd_pcm_hw_params( self->pcm, hwParams );
-#ifdef PA_ENABLE_DEBUG_OUTPUT
-        if( r < 0 )
-        {
-            snd_output_t *output = NULL;
-            alsa_snd_output_stdio_attach( &output, stderr, 0 );
-            alsa_snd_pcm_hw_params_dump( hwParams, output );
-        }
+    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_S32 ) >= 0)
+        available |= paInt32;
+
+#ifdef PA_LITTLE_ENDIAN
+    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_S24_3LE ) >= 0)
+        available |= paInt24;
+#elif defined PA_BIG_ENDIAN
+    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_S24_3BE ) >= 0)
+        available |= paInt24;
 #endif
-        ENSURE_( r, paUnanticipatedHostError );
-    }
-    if( alsa_snd_pcm_hw_params_get_buffer_size != NULL )
-    {
-        ENSURE_( alsa_snd_pcm_hw_params_get_buffer_size( hwParams, &self->alsaBufferSize ), paUnanticipatedHostError );
-    }
-    else
-    {
-        self->alsaBufferSize = bufSz;
-    }
 
-    /* Latency in seconds */
-    *latency = (self->alsaBufferSize - self->framesPerPeriod) / (double)sampleRate;
+    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_S16 ) >= 0)
+        available |= paInt16;
 
-    /* Now software parameters... */
-    ENSURE_( alsa_snd_pcm_sw_params_current( self->pcm, swParams ), paUnanticipatedHostError );
+    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_U8 ) >= 0)
+        available |= paUInt8;
 
-    ENSURE_( alsa_snd_pcm_sw_params_set_start_threshold( self->pcm, swParams, self->framesPerPeriod ), paUnanticipatedHostError );
-    ENSURE_( alsa_snd_pcm_sw_params_set_stop_threshold( self->pcm, swParams, self->alsaBufferSize ), paUnanticipatedHostError );
+    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_S8 ) >= 0)
+        available |= paInt8;
 
-    /* Silence buffer in the case of underrun */
-    if( !primeBuffers ) /* XXX: Make sense? */
-    {
-        snd_pcm_uframes_t boundary;
-        ENSURE_( alsa_snd_pcm_sw_params_get_boundary( swParams, &boundary ), paUnanticipatedHostError );
-        ENSURE_( alsa_snd_pcm_sw_params_set_silence_threshold( self->pcm, swParams, 0 ), paUnanticipatedHostError );
+    return available;
+}
+
+/* Output to console all formats supported by device */
+static void LogAllAvailableFormats( snd_pcm_t *pcm )
+{
+    PaSampleFormat available = 0;
+    snd_pcm_hw_params_t *hwParams;
+    alsa_snd_pcm_hw_params_alloca( &hwParams );
+
+    alsa_snd_pcm_hw_params_any( pcm, hwParams );
+
+    PA_DEBUG(( " --- Supported Formats ---\n" ));
+
+    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_S8 ) >= 0)
+        PA_DEBUG(( "SND_PCM_FORMAT_S8\n" ));
+    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_U8 ) >= 0)
+        PA_DEBUG(( "SND_PCM_FORMAT_U8\n" ));
+
+    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_S16_LE ) >= 0)
+        PA_DEBUG(( "SND_PCM_FORMAT_S16_LE\n" ));
+    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_S16_BE ) >= 0)
+        PA_DEBUG(( "SND_PCM_FORMAT_S16_BE\n" ));
+
+    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_U16_LE ) >= 0)
+        PA_DEBUG(( "SND_PCM_FORMAT_U16_LE\n" ));
+    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_U16_BE ) >= 0)
+        PA_DEBUG(( "SND_PCM_FORMAT_U16_BE\n" ));
+
+    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_S24_LE ) >= 0)
+        PA_DEBUG(( "SND_PCM_FORMAT_S24_LE\n" ));
+    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_S24_BE ) >= 0)
+        PA_DEBUG(( "SND_PCM_FORMAT_S24_BE\n" ));
+
+    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_U24_LE ) >= 0)
+        PA_DEBUG(( "SND_PCM_FORMAT_U24_LE\n" ));
+    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_U24_BE ) >= 0)
+        PA_DEBUG(( "SND_PCM_FORMAT_U24_BE\n" ));
+
+    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_FLOAT_LE ) >= 0)
+        PA_DEBUG(( "SND_PCM_FORMAT_FLOAT_LE\n" ));
+    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_FLOAT_BE ) >= 0)
+        PA_DEBUG(( "SND_PCM_FORMAT_FLOAT_BE\n" ));
+
+    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_FLOAT64_LE ) >= 0)
+        PA_DEBUG(( "SND_PCM_FORMAT_FLOAT64_LE\n" ));
+    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_FLOAT64_BE ) >= 0)
+        PA_DEBUG(( "SND_PCM_FORMAT_FLOAT64_BE\n" ));
+
+    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_IEC958_SUBFRAME_LE ) >= 0)
+        PA_DEBUG(( "SND_PCM_FORMAT_IEC958_SUBFRAME_LE\n" ));
+    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_IEC958_SUBFRAME_BE ) >= 0)
+        PA_DEBUG(( "SND_PCM_FORMAT_IEC958_SUBFRAME_BE\n" ));
+
+    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_MU_LAW ) >= 0)
+        PA_DEBUG(( "SND_PCM_FORMAT_MU_LAW\n" ));
+    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_A_LAW ) >= 0)
+        PA_DEBUG(( "SND_PCM_FORMAT_A_LAW\n" ));
+
+    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_IMA_ADPCM ) >= 0)
+        PA_DEBUG(( "SND_PCM_FORMAT_IMA_ADPCM\n" ));
+    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_MPEG ) >= 0)
+        PA_DEBUG(( "SND_PCM_FORMAT_MPEG\n" ));
+
+    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_GSM ) >= 0)
+        PA_DEBUG(( "SND_PCM_FORMAT_GSM\n" ));
+    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_SPECIAL ) >= 0)
+        PA_DEBUG(( "SND_PCM_FORMAT_SPECIAL\n" ));
+
+    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_S24_3LE ) >= 0)
+        PA_DEBUG(( "SND_PCM_FORMAT_S24_3LE\n" ));
+    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_S24_3BE ) >= 0)
+        PA_DEBUG(( "SND_PCM_FORMAT_S24_3BE\n" ));
+
+    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_U24_3LE ) >= 0)
+        PA_DEBUG(( "SND_PCM_FORMAT_U24_3LE\n" ));
+    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_U24_3BE ) >= 0)
+        PA_DEBUG(( "SND_PCM_FORMAT_U24_3BE\n" ));
+
+    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_S20_3LE ) >= 0)
+        PA_DEBUG(( "SND_PCM_FORMAT_S20_3LE\n" ));
+    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_S20_3BE ) >= 0)
+        PA_DEBUG(( "SND_PCM_FORMAT_S20_3BE\n" ));
+
+    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_U20_3LE ) >= 0)
+        PA_DEBUG(( "SND_PCM_FORMAT_U20_3LE\n" ));
+    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_U20_3BE ) >= 0)
+        PA_DEBUG(( "SND_PCM_FORMAT_U20_3BE\n" ));
+
+    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_S18_3LE ) >= 0)
+        PA_DEBUG(( "SND_PCM_FORMAT_S18_3LE\n" ));
+    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_S18_3BE ) >= 0)
+        PA_DEBUG(( "SND_PCM_FORMAT_S18_3BE\n" ));
+
+    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_U18_3LE ) >= 0)
+        PA_DEBUG(( "SND_PCM_FORMAT_U18_3LE\n" ));
+    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_U18_3BE ) >= 0)
+        PA_DEBUG(( "SND_PCM_FORMAT_U18_3BE\n" ));
+
+    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_S16 ) >= 0)
+        PA_DEBUG(( "SND_PCM_FORMAT_S16\n" ));
+    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_U16 ) >= 0)
+        PA_DEBUG(( "SND_PCM_FORMAT_U16\n" ));
+
+    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_S24 ) >= 0)
+        PA_DEBUG(( "SND_PCM_FORMAT_S24\n" ));
+    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_U24 ) >= 0)
+        PA_DEBUG(( "SND_PCM_FORMAT_U24\n" ));
+
+    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_S32 ) >= 0)
+        PA_DEBUG(( "SND_PCM_FORMAT_S32\n" ));
+    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_U32 ) >= 0)
+        PA_DEBUG(( "SND_PCM_FORMAT_U32\n" ));
+
+    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_FLOAT ) >= 0)
+        PA_DEBUG(( "SND_PCM_FORMAT_FLOAT\n" ));
+    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_FLOAT64 ) >= 0)
+        PA_DEBUG(( "SND_PCM_FORMAT_FLOAT64\n" ));
+
+    if( alsa_snd_pcm_hw_params_test_format( pcm, hwParams, SND_PCM_FORMAT_IEC958_SUBFRAME ) >= 0)
+        PA_DEBUG(( "SND_PCM_FORMAT_IEC958_SUBFRAME\n" ));
+
+    PA_DEBUG(( " -------------------------\n" ));
+}
+
+static snd_pcm_format_t Pa2AlsaFormat( PaSampleFormat paFormat )
+{
+    switch( paFormat )
+    {
+        case paFloat32:
+            return SND_PCM_FORMAT_FLOAT;
+
+        case paInt16:
+            return SND_PCM_FORMAT_S16;
+
+        case paInt24:
+#ifdef PA_LITTLE_ENDIAN
+            return SND_PCM_FORMAT_S24_3LE;
+#elif defined PA_BIG_ENDIAN
+            return SND_PCM_FORMAT_S24_3BE;
+#endif
+
+        case paInt32:
+            return SND_PCM_FORMAT_S32;
+
+        case paInt8:
+            return SND_PCM_FORMAT_S8;
+
+        case paUInt8:
+            return SND_PCM_FORMAT_U8;
+
+        default:
+            return SND_PCM_FORMAT_UNKNOWN;
+    }
+}
+
+/** Open an ALSA pcm handle.
+ *
+ * The device to be open can be specified by name in a custom PaAlsaStreamInfo struct, or it will be by
+ * the Portaudio device number supplied in the stream parameters.
+ */
+static PaError AlsaOpen( const PaUtilHostApiRepresentation *hostApi, const PaStreamParameters *params, StreamDirection
+        streamDir, snd_pcm_t **pcm )
+{
+    PaError result = paNoError;
+    int ret;
+    const char* deviceName = "";
+    const PaAlsaDeviceInfo *deviceInfo = NULL;
+    PaAlsaStreamInfo *streamInfo = (PaAlsaStreamInfo *)params->hostApiSpecificStreamInfo;
+
+    if( params->device != paUseHostApiSpecificDeviceSpecification )
+    {
+        deviceInfo = GetDeviceInfo( hostApi, params->device );
+        deviceName = deviceInfo->alsaName;
+    }
+    else
+        deviceName = streamInfo->deviceString;
+
+    PA_DEBUG(( "%s: Opening device %s\n", __FUNCTION__, deviceName ));
+    if( (ret = OpenPcm( pcm, deviceName, streamDir == StreamDirection_In ? SND_PCM_STREAM_CAPTURE : SND_PCM_STREAM_PLAYBACK,
+                    SND_PCM_NONBLOCK, 1 )) < 0 )
+    {
+        /* Not to be closed */
+        *pcm = NULL;
+        ENSURE_( ret, -EBUSY == ret ? paDeviceUnavailable : paBadIODeviceCombination );
+    }
+    ENSURE_( alsa_snd_pcm_nonblock( *pcm, 0 ), paUnanticipatedHostError );
+
+end:
+    return result;
+
+error:
+    goto end;
+}
+
+static PaError TestParameters( const PaUtilHostApiRepresentation *hostApi, const PaStreamParameters *parameters,
+        double sampleRate, StreamDirection streamDir )
+{
+    PaError result = paNoError;
+    snd_pcm_t *pcm = NULL;
+    PaSampleFormat availableFormats;
+    /* We are able to adapt to a number of channels less than what the device supports */
+    unsigned int numHostChannels;
+    PaSampleFormat hostFormat;
+    snd_pcm_hw_params_t *hwParams;
+    unsigned int uintSampleRate = (unsigned int) sampleRate;
+    PaStreamParameters masterParameters;
+
+    alsa_snd_pcm_hw_params_alloca( &hwParams );
+
+    /* Only the master of an aggregate device is tested, the other members are checked when opening a stream */
+    parameters = GetMasterParameters( hostApi, parameters, streamDir, &masterParameters );
+    if( parameters->device != paUseHostApiSpecificDeviceSpecification )
+    {
+        const PaAlsaDeviceInfo *devInfo = GetDeviceInfo( hostApi, parameters->device );
+        numHostChannels = PA_MAX( parameters->channelCount, StreamDirection_In == streamDir ?
+                devInfo->minInputChannels : devInfo->minOutputChannels );
+    }
+    else
+        numHostChannels = parameters->channelCount;
+
+    PA_ENSURE( AlsaOpen( hostApi, parameters, streamDir, &pcm ) );
+
+    alsa_snd_pcm_hw_params_any( pcm, hwParams );
+
+    if( SetApproximateSampleRate( pcm, hwParams, &uintSampleRate ) < 0 )
+    {
+        result = paInvalidSampleRate;
+        goto error;
+    }
+
+    if( alsa_snd_pcm_hw_params_set_channels( pcm, hwParams, numHostChannels ) < 0 )
+    {
+        result = paInvalidChannelCount;
+        goto error;
+    }
+
+    /* See if we can find a best possible match */
+    availableFormats = GetAvailableFormats( pcm );
+    PA_ENSURE( hostFormat = PaUtil_SelectClosestAvailableFormat( availableFormats, parameters->sampleFormat ) );
+
+    /* Some specific hardware (reported: Audio8 DJ) can fail with assertion during this step. */
+    ENSURE_( alsa_snd_pcm_hw_params_set_format( pcm, hwParams, Pa2AlsaFormat( hostFormat ) ), paUnanticipatedHostError );
+
+    /*
+     * Intel HDA driver doesn't set PCM rule to limit maximum size of buffer.
+     * This can result in a request for too large a buffer size.
+     * That can cause a memory allocation error in ALSA PCM core, at least it does in Linux kernel 5.8.
+     * As a workaround, limit buffer size to a reasonable value.
+     */
+    {
+        unsigned int bufferTimeMicros = 50 * 1000;
+        int direction = 0;
+        ENSURE_( alsa_snd_pcm_hw_params_set_buffer_time_near( pcm, hwParams,
+                &bufferTimeMicros, &direction ), paBufferTooBig );
+    }
+
+    {
+        /* It happens that this call fails because the device is busy */
+        int ret = 0;
+        if( ( ret = alsa_snd_pcm_hw_params( pcm, hwParams ) ) < 0 )
+        {
+            if( -EINVAL == ret )
+            {
+                /* Don't know what to return here */
+                result = paBadIODeviceCombination;
+                goto error;
+            }
+            else if( -EBUSY == ret )
+            {
+                result = paDeviceUnavailable;
+                PA_DEBUG(( "%s: Device is busy\n", __FUNCTION__ ));
+            }
+            else
+            {
+                result = paUnanticipatedHostError;
+            }
+
+            ENSURE_( ret, result );
+        }
+    }
+
+end:
+    if( pcm )
+    {
+        alsa_snd_pcm_close( pcm );
+    }
+    return result;
+
+error:
+    goto end;
+}
+
+static PaError IsFormatSupported( struct PaUtilHostApiRepresentation *hostApi,
+                                  const PaStreamParameters *inputParameters,
+                                  const PaStreamParameters *outputParameters,
+                                  double sampleRate )
+{
+    PaAlsaHostApiRepresentation *alsaApi = (PaAlsaHostApiRepresentation *)hostApi;
+    int inputChannelCount = 0, outputChannelCount = 0;
+    PaSampleFormat inputSampleFormat, outputSampleFormat;
+    PaError result = paFormatIsSupported;
+
+    /* The device monitor updates the device list in place */
+    PA_ENSURE( PaUnixMutex_Lock( &alsaApi->monitor.mtx ) );
+
+    if( inputParameters )
+    {
+        PA_ENSURE( ValidateParameters( inputParameters, hostApi, StreamDirection_In ) );
+
+        inputChannelCount = inputParameters->channelCount;
+        inputSampleFormat = inputParameters->sampleFormat;
+    }
+
+    if( outputParameters )
+    {
+        PA_ENSURE( ValidateParameters( outputParameters, hostApi, StreamDirection_Out ) );
+
+        outputChannelCount = outputParameters->channelCount;
+        outputSampleFormat = outputParameters->sampleFormat;
+    }
+
+    if( inputChannelCount )
+    {
+        if( ( result = TestParameters( hostApi, inputParameters, sampleRate, StreamDirection_In ) )
+                != paNoError )
+            goto error;
+    }
+    if ( outputChannelCount )
+    {
+        if( ( result = TestParameters( hostApi, outputParameters, sampleRate, StreamDirection_Out ) )
+                != paNoError )
+            goto error;
+    }
+
+    result = paFormatIsSupported;
+
+error:
+    PaUnixMutex_Unlock( &alsaApi->monitor.mtx );
+    return result;
+}
+
+
+static PaError PaAlsaStreamComponent_Initialize( PaAlsaStreamComponent *self, PaAlsaHostApiRepresentation *alsaApi,
+        const PaStreamParameters *params, StreamDirection streamDir, int callbackMode )
+{
+    PaError result = paNoError;
+    PaSampleFormat userSampleFormat = params->sampleFormat, hostSampleFormat = paNoError;
+    assert( params->channelCount > 0 );
+
+    /* Make sure things have an initial value */
+    memset( self, 0, sizeof (PaAlsaStreamComponent) );
+
+    if( params->device != paUseHostApiSpecificDeviceSpecification )
+    {
+        const PaAlsaDeviceInfo *devInfo = GetDeviceInfo( &alsaApi->baseHostApiRep, params->device );
+        self->numHostChannels = PA_MAX( params->channelCount, StreamDirection_In == streamDir ? devInfo->minInputChannels
+                : devInfo->minOutputChannels );
+        self->deviceIsPlug = devInfo->isPlug;
+        PA_DEBUG(( "%s: Host Chans %c %i\n", __FUNCTION__, streamDir == StreamDirection_In ? 'C' : 'P', self->numHostChannels ));
+    }
+    else
+    {
+        /* We're blissfully unaware of the minimum channelCount */
+        self->numHostChannels = params->channelCount;
+        /* Check if device name does not start with hw: to determine if it is a 'plug' device */
+        if( strncmp( "hw:", ((PaAlsaStreamInfo *)params->hostApiSpecificStreamInfo)->deviceString, 3 ) != 0  )
+            self->deviceIsPlug = 1; /* An Alsa plug device, not a direct hw device */
+    }
+    if( self->deviceIsPlug && alsaApi->alsaLibVersion < ALSA_VERSION_INT( 1, 0, 16 ) )
+        self->useReventFix = 1; /* Prior to Alsa1.0.16, plug devices may stutter without this fix */
+
+    self->device = params->device;
+
+    PA_ENSURE( AlsaOpen( &alsaApi->baseHostApiRep, params, streamDir, &self->pcm ) );
+    self->nfds = alsa_snd_pcm_poll_descriptors_count( self->pcm );
+
+    PA_ENSURE( hostSampleFormat = PaUtil_SelectClosestAvailableFormat( GetAvailableFormats( self->pcm ), userSampleFormat ) );
+
+    self->hostSampleFormat = hostSampleFormat;
+    self->nativeFormat = Pa2AlsaFormat( hostSampleFormat );
+    self->hostInterleaved = self->userInterleaved = !( userSampleFormat & paNonInterleaved );
+    self->numUserChannels = params->channelCount;
+    self->streamDir = streamDir;
+    self->canMmap = 0;
+    self->nonMmapBuffer = NULL;
+    self->nonMmapAreas = NULL;
+
+    if( !callbackMode && !self->userInterleaved )
+    {
+        /* Pre-allocate non-interleaved user provided buffers */
+        PA_UNLESS( self->userBuffers = PaUtil_AllocateZeroInitializedMemory( sizeof (void *) * self->numUserChannels ),
+                paInsufficientMemory );
+    }
+
+error:
+
+    /* Log all available formats. */
+    if ( hostSampleFormat == paSampleFormatNotSupported )
+    {
+        LogAllAvailableFormats( self->pcm );
+        PA_DEBUG(( "%s: Please provide the log output to PortAudio developers, your hardware does not have any sample format implemented yet.\n", __FUNCTION__ ));
+    }
+
+    return result;
+}
+
+static void PaAlsaStreamComponent_Terminate( PaAlsaStreamComponent *self )
+{
+    alsa_snd_pcm_close( self->pcm );
+    PaUtil_FreeMemory( self->userBuffers ); /* (Ptr can be NULL; PaUtil_FreeMemory includes a NULL check) */
+    PaUtil_FreeMemory( self->nonMmapBuffer );
+    PaUtil_FreeMemory( self->nonMmapAreas );
+    PaUtil_FreeMemory( self->regionChannels );
+}
+
+/*
+static int nearbyint_(float value) {
+    if(  value - (int)value > .5 )
+        return (int)ceil( value );
+    return (int)floor( value );
+}
+*/
+
+/** Initiate configuration, preparing for determining a period size suitable for both capture and playback components.
+ *
+ */
+static PaError PaAlsaStreamComponent_InitialConfigure( PaAlsaStreamComponent *self, const PaStreamParameters *params,
+        int primeBuffers, snd_pcm_hw_params_t *hwParams, unsigned int *sampleRatePtr )
+{
+    /* Configuration consists of setting all of ALSA's parameters.
+     * These parameters come in two flavors: hardware parameters
+     * and software parameters.  Hardware parameters will affect
+     * the way the device is initialized, software parameters
+     * affect the way ALSA interacts with me, the user-level client.
+     */
+
+    PaError result = paNoError;
+    snd_pcm_access_t accessMode, alternateAccessMode;
+    int dir = 0;
+    snd_pcm_t *pcm = self->pcm;
+    unsigned int minPeriods = 2;
+    unsigned int requestedRate = *sampleRatePtr;
+
+    /* self->framesPerPeriod = framesPerHostBuffer; */
+
+    /* ... fill up the configuration space with all possible
+     * combinations of parameters this device will accept */
+    ENSURE_( alsa_snd_pcm_hw_params_any( pcm, hwParams ), paUnanticipatedHostError );
+
+    ENSURE_( alsa_snd_pcm_hw_params_set_periods_integer( pcm, hwParams ), paUnanticipatedHostError );
+    /* I think there should be at least 2 periods (even though ALSA doesn't appear to enforce this) */
+    dir = 0;
+    ENSURE_( alsa_snd_pcm_hw_params_set_periods_min( pcm, hwParams, &minPeriods, &dir ), paUnanticipatedHostError );
+
+    /* May have been flipped by an earlier configuration, see SetStreamLatency */
+    self->hostInterleaved = self->userInterleaved;
+    if( self->userInterleaved )
+    {
+        accessMode          = SND_PCM_ACCESS_MMAP_INTERLEAVED;
+        alternateAccessMode = SND_PCM_ACCESS_MMAP_NONINTERLEAVED;
+
+        /* test if MMAP supported */
+        self->canMmap = alsa_snd_pcm_hw_params_test_access( pcm, hwParams, accessMode ) >= 0 ||
+                        alsa_snd_pcm_hw_params_test_access( pcm, hwParams, alternateAccessMode ) >= 0;
+
+        PA_DEBUG(( "%s: device MMAP SND_PCM_ACCESS_MMAP_INTERLEAVED: %s\n", __FUNCTION__, ( alsa_snd_pcm_hw_params_test_access( pcm, hwParams, accessMode ) >= 0 ? "YES" : "NO" ) ));
+        PA_DEBUG(( "%s: device MMAP SND_PCM_ACCESS_MMAP_NONINTERLEAVED: %s\n", __FUNCTION__, ( alsa_snd_pcm_hw_params_test_access( pcm, hwParams, alternateAccessMode ) >= 0 ? "YES" : "NO" ) ));
+
+        if( !self->canMmap )
+        {
+            accessMode          = SND_PCM_ACCESS_RW_INTERLEAVED;
+            alternateAccessMode = SND_PCM_ACCESS_RW_NONINTERLEAVED;
+        }
+    }
+    else
+    {
+        accessMode          = SND_PCM_ACCESS_MMAP_NONINTERLEAVED;
+        alternateAccessMode = SND_PCM_ACCESS_MMAP_INTERLEAVED;
+
+        /* test if MMAP supported */
+        self->canMmap = alsa_snd_pcm_hw_params_test_access( pcm, hwParams, accessMode ) >= 0 ||
+                        alsa_snd_pcm_hw_params_test_access( pcm, hwParams, alternateAccessMode ) >= 0;
+
+        PA_DEBUG((" %s: device MMAP SND_PCM_ACCESS_MMAP_NONINTERLEAVED: %s\n", __FUNCTION__, ( alsa_snd_pcm_hw_params_test_access( pcm, hwParams, accessMode ) >= 0 ? "YES" : "NO" ) ));
+        PA_DEBUG(( "%s: device MMAP SND_PCM_ACCESS_MMAP_INTERLEAVED: %s\n", __FUNCTION__, ( alsa_snd_pcm_hw_params_test_access( pcm, hwParams, alternateAccessMode ) >= 0 ? "YES" : "NO" ) ));
+
+        if( !self->canMmap )
+        {
+            accessMode          = SND_PCM_ACCESS_RW_NONINTERLEAVED;
+            alternateAccessMode = SND_PCM_ACCESS_RW_INTERLEAVED;
+        }
+    }
+
+    PA_DEBUG(( "%s: device can MMAP: %s\n", __FUNCTION__, ( self->canMmap ? "YES" : "NO" ) ));
+
+    /* If requested access mode fails, try alternate mode */
+    if( alsa_snd_pcm_hw_params_set_access( pcm, hwParams, accessMode ) < 0 )
+    {
+        int err = 0;
+        if( ( err = alsa_snd_pcm_hw_params_set_access( pcm, hwParams, alternateAccessMode )) < 0 )
+        {
+            result = paUnanticipatedHostError;
+            PaUtil_SetLastHostErrorInfo( paALSA, err, alsa_snd_strerror( err ) );
+            goto error;
+        }
+        /* Flip mode */
+        self->hostInterleaved = !self->userInterleaved;
+    }
+
+    /* Some specific hardware (reported: Audio8 DJ) can fail with assertion during this step. */
+    ENSURE_( alsa_snd_pcm_hw_params_set_format( pcm, hwParams, self->nativeFormat ), paUnanticipatedHostError );
+
+    if( ( result = SetApproximateSampleRate( pcm, hwParams, sampleRatePtr )) != paUnanticipatedHostError )
+    {
+        if( result == paInvalidSampleRate ) /* From the SetApproximateSampleRate() call above */
+        { /* The sample rate was returned as 'out of tolerance' of the one requested */
+            PA_DEBUG(( "%s: Wanted %.3f, closest sample rate was %u\n",
+                    __FUNCTION__, requestedRate, *sampleRatePtr ));
+            PA_ENSURE( paInvalidSampleRate );
+        }
+    }
+    else
+    {
+        PA_ENSURE( paUnanticipatedHostError );
+    }
+
+    ENSURE_( alsa_snd_pcm_hw_params_set_channels( pcm, hwParams, self->numHostChannels ), paInvalidChannelCount );
+
+end:
+    return result;
+
+error:
+    /* No particular action */
+    goto end;
+}
+
+/** Allocate the buffer of a component without mmap access, large enough to hold the whole ALSA buffer.
+ *
+ * The channel areas are laid out like those of an mmapped buffer with the same access type: interleaved frames, or
+ * a block of samples per channel.
+ */
+static PaError PaAlsaStreamComponent_AllocateNonMmapBuffer( PaAlsaStreamComponent *self )
+{
+    PaError result = paNoError;
+    unsigned int width = alsa_snd_pcm_format_size( self->nativeFormat, 1 ) * 8;
+
+    PaUtil_FreeMemory( self->nonMmapBuffer );
+    PaUtil_FreeMemory( self->nonMmapAreas );
+    self->nonMmapAreas = NULL;
+    self->nonMmapFrames = self->alsaBufferSize;
+    self->nonMmapPending = 0;
+    PA_UNLESS( self->nonMmapBuffer = PaUtil_AllocateZeroInitializedMemory( alsa_snd_pcm_format_size( self->nativeFormat,
+                    self->nonMmapFrames * self->numHostChannels ) ), paInsufficientMemory );
+    PA_UNLESS( self->nonMmapAreas = (snd_pcm_channel_area_t *)PaUtil_AllocateZeroInitializedMemory(
+                self->numHostChannels * sizeof (snd_pcm_channel_area_t) ), paInsufficientMemory );
+
+    for( int i = 0; i < self->numHostChannels; ++i )
+    {
+        snd_pcm_channel_area_t *area = &self->nonMmapAreas[i];
+        if( self->hostInterleaved )
+        {
+            area->addr = self->nonMmapBuffer;
+            area->first = i * width;
+            area->step = self->numHostChannels * width;
+        }
+        else
+        {
+            area->addr = (unsigned char *)self->nonMmapBuffer + i * ( self->nonMmapFrames * width / 8 );
+            area->first = 0;
+            area->step = width;
+        }
+    }
+
+error:
+    return result;
+}
+
+/** Finish the configuration of the component's ALSA device.
+ *
+ * As part of this method, the component's alsaBufferSize attribute will be set.
+ * @param latency: The latency for this component.
+ */
+static PaError PaAlsaStreamComponent_FinishConfigure( PaAlsaStreamComponent *self, snd_pcm_hw_params_t* hwParams,
+        const PaStreamParameters *params, int primeBuffers, unsigned int sampleRate, PaTime* latency )
+{
+    PaError result = paNoError;
+    snd_pcm_sw_params_t* swParams;
+    snd_pcm_uframes_t bufSz = 0;
+    *latency = -1.;
+
+    alsa_snd_pcm_sw_params_alloca( &swParams );
+
+    bufSz = params->suggestedLatency * sampleRate + self->framesPerPeriod;
+    if( self->timerScheduling )
+    {
+        /* Ask for a large buffer, of which only the requested latency is used (see PaAlsaStream_WaitForTimer) */
+        self->watermark = bufSz;
+        bufSz = PA_MAX( bufSz, (snd_pcm_uframes_t)( TSCHED_BUFFER_TIME * sampleRate ) );
+    }
+    ENSURE_( alsa_snd_pcm_hw_params_set_buffer_size_near( self->pcm, hwParams, &bufSz ), paUnanticipatedHostError );
+
+    /* Set the parameters! */
+    {
+        int r = alsa_snd_pcm_hw_params( self->pcm, hwParams );
+#ifdef PA_ENABLE_DEBUG_OUTPUT
+        if( r < 0 )
+        {
+            snd_output_t *output = NULL;
+            alsa_snd_output_stdio_attach( &output, stderr, 0 );
+            alsa_snd_pcm_hw_params_dump( hwParams, output );
+        }
+#endif
+        ENSURE_( r, paUnanticipatedHostError );
+    }
+    if( alsa_snd_pcm_hw_params_get_buffer_size != NULL )
+    {
+        ENSURE_( alsa_snd_pcm_hw_params_get_buffer_size( hwParams, &self->alsaBufferSize ), paUnanticipatedHostError );
+    }
+    else
+    {
+        self->alsaBufferSize = bufSz;
+    }
+
+    if( self->timerScheduling )
+    {
+        self->watermark = PA_MIN( self->watermark, self->alsaBufferSize );
+    }
+    else
+    {
+        self->watermark = self->alsaBufferSize;
+    }
+
+    /* Latency in seconds */
+    *latency = (self->watermark - self->framesPerPeriod) / (double)sampleRate;
+
+    if( !self->canMmap )
+    {
+        PA_ENSURE( PaAlsaStreamComponent_AllocateNonMmapBuffer( self ) );
+    }
+
+    /* Now software parameters... */
+    ENSURE_( alsa_snd_pcm_sw_params_current( self->pcm, swParams ), paUnanticipatedHostError );
+
+    ENSURE_( alsa_snd_pcm_sw_params_set_start_threshold( self->pcm, swParams, self->framesPerPeriod ), paUnanticipatedHostError );
+    ENSURE_( alsa_snd_pcm_sw_params_set_stop_threshold( self->pcm, swParams, self->alsaBufferSize ), paUnanticipatedHostError );
+
+    /* Silence buffer in the case of underrun, also when priming so stale output isn't replayed */
+    {
+        snd_pcm_uframes_t boundary;
+        ENSURE_( alsa_snd_pcm_sw_params_get_boundary( swParams, &boundary ), paUnanticipatedHostError );
+        ENSURE_( alsa_snd_pcm_sw_params_set_silence_threshold( self->pcm, swParams, 0 ), paUnanticipatedHostError );
         ENSURE_( alsa_snd_pcm_sw_params_set_silence_size( self->pcm, swParams, boundary ), paUnanticipatedHostError );
     }
 
     ENSURE_( alsa_snd_pcm_sw_params_set_avail_min( self->pcm, swParams, self->framesPerPeriod ), paUnanticipatedHostError );
     ENSURE_( alsa_snd_pcm_sw_params_set_xfer_align( self->pcm, swParams, 1 ), paUnanticipatedHostError );
     ENSURE_( alsa_snd_pcm_sw_params_set_tstamp_mode( self->pcm, swParams, SND_PCM_TSTAMP_ENABLE ), paUnanticipatedHostError );
+    /* Timestamps are compared with PaUtil_GetTimeNs, ALSA defaults to gettimeofday. If they can't be made monotonic,
+     * they are converted in PaAlsaStreamComponent_TimestampToNs */
+    self->monotonicTstamps = 0;
+#ifdef PA_ALSA_HAVE_TSTAMP_TYPE
+    if( alsa_snd_pcm_sw_params_set_tstamp_type )
+    {
+        self->monotonicTstamps = alsa_snd_pcm_sw_params_set_tstamp_type( self->pcm, swParams,
+                SND_PCM_TSTAMP_TYPE_MONOTONIC ) >= 0;
+    }
+#endif
+    if( !self->monotonicTstamps )
+    {
+        PA_DEBUG(( "%s: Monotonic timestamps unavailable, converting from gettimeofday\n", __FUNCTION__ ));
+    }
 
     /* Set the parameters! */
     ENSURE_( alsa_snd_pcm_sw_params( self->pcm, swParams ), paUnanticipatedHostError );
@@ -2188,14 +3479,200 @@ error:
     return result;
 }
 
+/* Wakeup pipes */
+
+/** Create a pipe that is polled along with the ALSA descriptors, in order to wake a thread up from poll().
+ */
+static PaError OpenWakePipe( int fds[2] )
+{
+    PaError result = paNoError;
+
+    PA_UNLESS( pipe( fds ) == 0, paInternalError );
+    fcntl( fds[0], F_SETFL, O_NONBLOCK );
+    fcntl( fds[1], F_SETFL, O_NONBLOCK );
+
+error:
+    return result;
+}
+
+static void CloseWakePipe( int fds[2] )
+{
+    if( fds[0] >= 0 )
+    {
+        close( fds[0] );
+        close( fds[1] );
+        fds[0] = fds[1] = -1;
+    }
+}
+
+static void SignalWakePipe( int fds[2] )
+{
+    char c = 0;
+    if( write( fds[1], &c, 1 ) < 0 && errno != EAGAIN )
+    {
+        PA_DEBUG(( "%s: Failed to write to wakeup pipe\n", __FUNCTION__ ));
+    }
+}
+
+static void DrainWakePipe( int fds[2] )
+{
+    char buf[16];
+    while( read( fds[0], buf, sizeof (buf) ) > 0 )
+        ;
+}
+
+/* Device monitor */
+
+static void PaAlsaDeviceMonitor_Initialize( PaAlsaDeviceMonitor *self )
+{
+    memset( self, 0, sizeof (PaAlsaDeviceMonitor) );
+    PaUnixMutex_Initialize( &self->mtx );
+    self->wakeFds[0] = self->wakeFds[1] = -1;
+    self->inotifyFd = -1;
+}
+
+#ifdef PA_ALSA_USE_INOTIFY
+/** The device monitor thread's function.
+ *
+ * A card shows up as a number of device nodes, which have their permissions set in steps, so the device list is
+ * only updated once the nodes have stopped changing for DEVICE_MONITOR_SETTLE_MSEC.
+ */
+static void *PaAlsaDeviceMonitor_ThreadFunc( void *userData )
+{
+    PaError result = paNoError;
+    PaAlsaHostApiRepresentation *alsaApi = (PaAlsaHostApiRepresentation *)userData;
+    PaAlsaDeviceMonitor *self = &alsaApi->monitor;
+    struct pollfd pfds[2];
+    char buf[4096] __attribute__ ((aligned( __alignof__ (struct inotify_event) )));
+    int pending = 0;
+
+    pfds[0].fd = self->wakeFds[0];
+    pfds[0].events = POLLIN;
+    pfds[1].fd = self->inotifyFd;
+    pfds[1].events = POLLIN;
+
+    while( !self->quit )
+    {
+        int pollResults = poll( pfds, 2, pending ? DEVICE_MONITOR_SETTLE_MSEC : -1 );
+        ssize_t len;
+
+        if( pollResults < 0 )
+        {
+            if( errno == EINTR )
+            {
+                continue;
+            }
+            PA_ENSURE( paInternalError );
+        }
+
+        if( pfds[0].revents & POLLIN )
+        {
+            DrainWakePipe( self->wakeFds );
+        }
+        if( pfds[1].revents & POLLIN )
+        {
+            while( ( len = read( self->inotifyFd, buf, sizeof (buf) ) ) > 0 )
+            {
+                const struct inotify_event *event;
+                char *p;
+
+                for( p = buf; p < buf + len; p += sizeof (struct inotify_event) + event->len )
+                {
+                    event = (const struct inotify_event *)p;
+                    if( event->len && ( !strncmp( event->name, "controlC", 8 ) || !strncmp( event->name, "pcmC", 4 ) ) )
+                    {
+                        pending = 1;
+                    }
+                }
+            }
+        }
+        else if( 0 == pollResults && pending )
+        {
+            pending = 0;
+            PA_DEBUG(( "%s: Sound devices changed, updating device list\n", __FUNCTION__ ));
+            PaUnixMutex_Lock( &self->mtx );
+            result = UpdateDeviceList( alsaApi );
+            PaUnixMutex_Unlock( &self->mtx );
+            PA_ENSURE( result );
+
+            if( monitorCallback_ )
+            {
+                monitorCallback_( monitorUserData_ );
+            }
+        }
+    }
+
+error:
+    PA_DEBUG(( "%s: Device monitor exiting\n", __FUNCTION__ ));
+    PaUnixThreading_EXIT( result );
+}
+#endif
+
+/** Start watching the device directory, unless inotify isn't available.
+ *
+ * If the directory can't be watched, there is nothing to monitor and the device list stays as it is.
+ */
+static PaError PaAlsaDeviceMonitor_Start( PaAlsaDeviceMonitor *self, PaAlsaHostApiRepresentation *alsaApi )
+{
+    PaError result = paNoError;
+#ifdef PA_ALSA_USE_INOTIFY
+    const char *dir = getenv( "PA_ALSA_DEVICE_MONITOR_DIR" ) ? getenv( "PA_ALSA_DEVICE_MONITOR_DIR" ) : "/dev/snd";
+
+    PA_UNLESS( ( self->inotifyFd = inotify_init1( IN_NONBLOCK | IN_CLOEXEC ) ) >= 0, paInternalError );
+    if( inotify_add_watch( self->inotifyFd, dir, IN_CREATE | IN_DELETE | IN_ATTRIB | IN_MOVED_FROM | IN_MOVED_TO ) < 0 )
+    {
+        PA_DEBUG(( "%s: Can't watch %s: %s\n", __FUNCTION__, dir, strerror( errno ) ));
+        goto error;
+    }
+    PA_ENSURE( OpenWakePipe( self->wakeFds ) );
+    PA_ENSURE( PaUnixThread_New( &self->thread, &PaAlsaDeviceMonitor_ThreadFunc, alsaApi, 0., 0 ) );
+    self->running = 1;
+    PA_DEBUG(( "%s: Watching %s\n", __FUNCTION__, dir ));
+
+error:
+#else
+    (void)self;
+    (void)alsaApi;
+    PA_DEBUG(( "%s: Device monitoring isn't supported on this platform\n", __FUNCTION__ ));
+#endif
+    return result;
+}
+
+static void PaAlsaDeviceMonitor_Terminate( PaAlsaDeviceMonitor *self )
+{
+    if( self->running )
+    {
+        PaError threadRes;
+
+        self->quit = 1;
+        SignalWakePipe( self->wakeFds );
+        if( PaUnixThread_Terminate( &self->thread, 1, &threadRes ) == paNoError && threadRes != paNoError )
+        {
+            PA_DEBUG(( "%s: Device monitor thread returned: %d\n", __FUNCTION__, threadRes ));
+        }
+        self->running = 0;
+    }
+
+    CloseWakePipe( self->wakeFds );
+    if( self->inotifyFd >= 0 )
+    {
+        close( self->inotifyFd );
+        self->inotifyFd = -1;
+    }
+    PaUnixMutex_Terminate( &self->mtx );
+}
+
 static PaError PaAlsaStream_Initialize( PaAlsaStream *self, PaAlsaHostApiRepresentation *alsaApi, const PaStreamParameters *inParams,
         const PaStreamParameters *outParams, double sampleRate, unsigned long framesPerUserBuffer, PaStreamCallback callback,
         PaStreamFlags streamFlags, void *userData )
 {
     PaError result = paNoError;
+    PaStreamParameters masterInParams, masterOutParams;
     assert( self );
 
     memset( self, 0, sizeof( PaAlsaStream ) );
+    self->stopFds[0] = self->stopFds[1] = -1;
+    self->timerFd = -1;
 
     if( NULL != callback )
     {
@@ -2213,26 +3690,41 @@ static PaError PaAlsaStream_Initialize( PaAlsaStream *self, PaAlsaHostApiReprese
 
     self->framesPerUserBuffer = framesPerUserBuffer;
     self->neverDropInput = streamFlags & paNeverDropInput;
-    /* XXX: Ignore paPrimeOutputBuffersUsingStreamCallback until buffer priming is fully supported in pa_process.c */
-    /*
-    if( outParams & streamFlags & paPrimeOutputBuffersUsingStreamCallback )
+    self->engine = &alsaApi->engine;
+    if( NULL != callback && outParams && ( streamFlags & paPrimeOutputBuffersUsingStreamCallback ) )
         self->primeBuffers = 1;
-        */
+    if( NULL != callback && ( ( GetStreamInfoFlags( inParams ) | GetStreamInfoFlags( outParams ) ) &
+                paAlsaTimerScheduling ) )
+        self->timerScheduling = 1;
     memset( &self->capture, 0, sizeof (PaAlsaStreamComponent) );
     memset( &self->playback, 0, sizeof (PaAlsaStreamComponent) );
     if( inParams )
     {
-        PA_ENSURE( PaAlsaStreamComponent_Initialize( &self->capture, alsaApi, inParams, StreamDirection_In, NULL != callback ) );
+        PA_ENSURE( PaAlsaStreamComponent_Initialize( &self->capture, alsaApi, GetMasterParameters( &alsaApi->baseHostApiRep,
+                        inParams, StreamDirection_In, &masterInParams ), StreamDirection_In, NULL != callback ) );
     }
     if( outParams )
     {
-        PA_ENSURE( PaAlsaStreamComponent_Initialize( &self->playback, alsaApi, outParams, StreamDirection_Out, NULL != callback ) );
+        PA_ENSURE( PaAlsaStreamComponent_Initialize( &self->playback, alsaApi, GetMasterParameters( &alsaApi->baseHostApiRep,
+                        outParams, StreamDirection_Out, &masterOutParams ), StreamDirection_Out, NULL != callback ) );
     }
 
     assert( self->capture.nfds || self->playback.nfds );
 
+    /* In callback mode there is room for the stop pipe and the timer after the devices' descriptors */
     PA_UNLESS( self->pfds = (struct pollfd*)PaUtil_AllocateZeroInitializedMemory( ( self->capture.nfds +
-                    self->playback.nfds ) * sizeof( struct pollfd ) ), paInsufficientMemory );
+                    self->playback.nfds + 2 ) * sizeof( struct pollfd ) ), paInsufficientMemory );
+    if( self->callbackMode )
+    {
+        PA_ENSURE( OpenWakePipe( self->stopFds ) );
+    }
+#ifdef PA_ALSA_USE_TIMERFD
+    if( self->timerScheduling )
+    {
+        if( ( self->timerFd = timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC ) ) < 0 )
+            PA_DEBUG(( "%s: timerfd_create failed, using poll timeouts\n", __FUNCTION__ ));
+    }
+#endif
 
     PaUtil_InitializeCpuLoadMeasurer( &self->cpuLoadMeasurer, sampleRate );
     ASSERT_CALL_( PaUnixMutex_Initialize( &self->stateMtx ), paNoError );
@@ -2257,8 +3749,14 @@ static void PaAlsaStream_Terminate( PaAlsaStream *self )
     {
         PaAlsaStreamComponent_Terminate( &self->playback );
     }
+    PaAlsaStream_CloseMembers( self );
 
     PaUtil_FreeMemory( self->pfds );
+    CloseWakePipe( self->stopFds );
+    if( self->timerFd >= 0 )
+    {
+        close( self->timerFd );
+    }
     ASSERT_CALL_( PaUnixMutex_Terminate( &self->stateMtx ), paNoError );
 
     PaUtil_FreeMemory( self );
@@ -2417,449 +3915,990 @@ static PaError PaAlsaStreamComponent_DetermineFramesPerBuffer( PaAlsaStreamCompo
             }
             else
             {
-                assert( framesPerHostBuffer % framesPerUserBuffer == 0 );
-                if( alsa_snd_pcm_hw_params_test_period_size( self->pcm, hwParams, framesPerHostBuffer, 0 ) < 0 )
-                {
-                    if( alsa_snd_pcm_hw_params_test_period_size( self->pcm, hwParams, framesPerHostBuffer + framesPerUserBuffer, 0 ) == 0 )
-                        framesPerHostBuffer += framesPerUserBuffer;
-                    else if( alsa_snd_pcm_hw_params_test_period_size( self->pcm, hwParams, framesPerHostBuffer - framesPerUserBuffer, 0 ) == 0 )
-                        framesPerHostBuffer -= framesPerUserBuffer;
-                }
+                assert( framesPerHostBuffer % framesPerUserBuffer == 0 );
+                if( alsa_snd_pcm_hw_params_test_period_size( self->pcm, hwParams, framesPerHostBuffer, 0 ) < 0 )
+                {
+                    if( alsa_snd_pcm_hw_params_test_period_size( self->pcm, hwParams, framesPerHostBuffer + framesPerUserBuffer, 0 ) == 0 )
+                        framesPerHostBuffer += framesPerUserBuffer;
+                    else if( alsa_snd_pcm_hw_params_test_period_size( self->pcm, hwParams, framesPerHostBuffer - framesPerUserBuffer, 0 ) == 0 )
+                        framesPerHostBuffer -= framesPerUserBuffer;
+                }
+            }
+        }
+#endif
+
+#ifdef PA_ALSA_USE_OBSOLETE_HOST_BUFFER_CALC
+
+        if( framesPerUserBuffer != paFramesPerBufferUnspecified )
+        {
+            /* Try to get a power-of-two of the user buffer size. */
+            framesPerHostBuffer = framesPerUserBuffer;
+            if( framesPerHostBuffer < bufferSize )
+            {
+                while( bufferSize / framesPerHostBuffer > numPeriods )
+                {
+                    framesPerHostBuffer *= 2;
+                }
+                /* One extra period is preferable to one less (should be more robust) */
+                if( bufferSize / framesPerHostBuffer < numPeriods )
+                {
+                    framesPerHostBuffer /= 2;
+                }
+            }
+            else
+            {
+                while( bufferSize / framesPerHostBuffer < numPeriods )
+                {
+                    if( framesPerUserBuffer % ( framesPerHostBuffer / 2 ) != 0 )
+                    {
+                        /* Can't be divided any further */
+                        break;
+                    }
+                    framesPerHostBuffer /= 2;
+                }
+            }
+
+            if( framesPerHostBuffer < framesPerUserBuffer )
+            {
+                assert( framesPerUserBuffer % framesPerHostBuffer == 0 );
+                if( alsa_snd_pcm_hw_params_test_period_size( self->pcm, hwParams, framesPerHostBuffer, 0 ) < 0 )
+                {
+                    if( alsa_snd_pcm_hw_params_test_period_size( self->pcm, hwParams, framesPerHostBuffer * 2, 0 ) == 0 )
+                        framesPerHostBuffer *= 2;
+                    else if( alsa_snd_pcm_hw_params_test_period_size( self->pcm, hwParams, framesPerHostBuffer / 2, 0 ) == 0 )
+                        framesPerHostBuffer /= 2;
+                }
+            }
+            else
+            {
+                assert( framesPerHostBuffer % framesPerUserBuffer == 0 );
+                if( alsa_snd_pcm_hw_params_test_period_size( self->pcm, hwParams, framesPerHostBuffer, 0 ) < 0 )
+                {
+                    if( alsa_snd_pcm_hw_params_test_period_size( self->pcm, hwParams, framesPerHostBuffer + framesPerUserBuffer, 0 ) == 0 )
+                        framesPerHostBuffer += framesPerUserBuffer;
+                    else if( alsa_snd_pcm_hw_params_test_period_size( self->pcm, hwParams, framesPerHostBuffer - framesPerUserBuffer, 0 ) == 0 )
+                        framesPerHostBuffer -= framesPerUserBuffer;
+                }
+            }
+        }
+        else
+        {
+            framesPerHostBuffer = bufferSize / numPeriods;
+        }
+#endif
+        PA_DEBUG(( "%s: suggested host buffer period   = %lu \n", __FUNCTION__, framesPerHostBuffer ));
+    }
+
+    {
+        /* Get min/max period sizes and adjust our chosen */
+        snd_pcm_uframes_t min = 0, max = 0, minmax_diff;
+        ENSURE_( alsa_snd_pcm_hw_params_get_period_size_min( hwParams, &min, NULL ), paUnanticipatedHostError );
+        ENSURE_( alsa_snd_pcm_hw_params_get_period_size_max( hwParams, &max, NULL ), paUnanticipatedHostError );
+        minmax_diff = max - min;
+
+        if( framesPerHostBuffer < min )
+        {
+            PA_DEBUG(( "%s: The determined period size (%lu) is less than minimum (%lu)\n", __FUNCTION__, framesPerHostBuffer, min ));
+            framesPerHostBuffer = (( minmax_diff == 2 ) ? min + 1 : min );
+        }
+        else if( framesPerHostBuffer > max )
+        {
+            PA_DEBUG(( "%s: The determined period size (%lu) is greater than maximum (%lu)\n", __FUNCTION__, framesPerHostBuffer, max ));
+            framesPerHostBuffer = (( minmax_diff == 2 ) ? max - 1 : max );
+        }
+
+        PA_DEBUG(( "%s: device period minimum          = %lu\n", __FUNCTION__, min ));
+        PA_DEBUG(( "%s: device period maximum          = %lu\n", __FUNCTION__, max ));
+        PA_DEBUG(( "%s: host buffer period             = %lu\n", __FUNCTION__, framesPerHostBuffer ));
+        PA_DEBUG(( "%s: host buffer period latency     = %f\n", __FUNCTION__, (double)( framesPerHostBuffer / sampleRate ) ));
+
+        /* Try setting period size */
+        dir = 0;
+        ENSURE_( alsa_snd_pcm_hw_params_set_period_size_near( self->pcm, hwParams, &framesPerHostBuffer, &dir ), paUnanticipatedHostError );
+        if( dir != 0 )
+        {
+            PA_DEBUG(( "%s: The configured period size is non-integer.\n", __FUNCTION__, dir ));
+            *accurate = 0;
+        }
+    }
+
+    /* Set result */
+    self->framesPerPeriod = framesPerHostBuffer;
+
+error:
+    return result;
+}
+
+/* We need to determine how many frames per host buffer (period) to use.  Our
+ * goals are to provide the best possible performance, but also to
+ * honor the requested latency settings as closely as we can. Therefore this
+ * decision is based on:
+ *
+ *   - the period sizes that playback and/or capture support.  The
+ *     host buffer size has to be one of these.
+ *   - the number of periods that playback and/or capture support.
+ *
+ * We want to make period_size*(num_periods-1) to be as close as possible
+ * to latency*rate for both playback and capture.
+ *
+ * This method will determine suitable period sizes for capture and playback handles, and report the maximum number of
+ * frames per host buffer. The latter is relevant, in case we should be so unfortunate that the period size differs
+ * between capture and playback. If this should happen, the stream's hostBufferSizeMode attribute will be set to
+ * paUtilBoundedHostBufferSize, because the best we can do is limit the size of individual host buffers to the upper
+ * bound. The size of host buffers scheduled for processing should only matter if the user has specified a buffer size,
+ * but when he/she does we must strive for an optimal configuration. By default we'll opt for a fixed host buffer size,
+ * which should be fine if the period size is the same for capture and playback. In general, if there is a specified user
+ * buffer size, this method tries it best to determine a period size which is a multiple of the user buffer size.
+ *
+ * The framesPerPeriod attributes of the individual capture and playback components of the stream are set to corresponding
+ * values determined here. Since these should be reported as
+ *
+ * This is one of those blocks of code that will just take a lot of
+ * refinement to be any good.
+ *
+ * In the full-duplex case it is possible that the routine was unable
+ * to find a number of frames per buffer acceptable to both devices
+ * TODO: Implement an algorithm to find the value closest to acceptance
+ * by both devices, to minimize difference between period sizes?
+ *
+ * @param determinedFramesPerHostBuffer: The determined host buffer size.
+ */
+static PaError PaAlsaStream_DetermineFramesPerBuffer( PaAlsaStream* self, double sampleRate, const PaStreamParameters* inputParameters,
+        const PaStreamParameters* outputParameters, unsigned long framesPerUserBuffer, snd_pcm_hw_params_t* hwParamsCapture,
+        snd_pcm_hw_params_t* hwParamsPlayback, PaUtilHostBufferSizeMode* hostBufferSizeMode )
+{
+    PaError result = paNoError;
+    unsigned long framesPerHostBuffer = 0;
+    int dir = 0;
+    int accurate = 1;
+    unsigned numPeriods = numPeriods_;
+
+    if( self->capture.pcm && self->playback.pcm )
+    {
+        if( framesPerUserBuffer == paFramesPerBufferUnspecified )
+        {
+            /* Come up with a common desired latency */
+            snd_pcm_uframes_t desiredBufSz, e, minPeriodSize, maxPeriodSize, optimalPeriodSize, periodSize,
+                              minCapture, minPlayback, maxCapture, maxPlayback;
+
+            dir = 0;
+            ENSURE_( alsa_snd_pcm_hw_params_get_period_size_min( hwParamsCapture, &minCapture, &dir ), paUnanticipatedHostError );
+            dir = 0;
+            ENSURE_( alsa_snd_pcm_hw_params_get_period_size_min( hwParamsPlayback, &minPlayback, &dir ), paUnanticipatedHostError );
+            dir = 0;
+            ENSURE_( alsa_snd_pcm_hw_params_get_period_size_max( hwParamsCapture, &maxCapture, &dir ), paUnanticipatedHostError );
+            dir = 0;
+            ENSURE_( alsa_snd_pcm_hw_params_get_period_size_max( hwParamsPlayback, &maxPlayback, &dir ), paUnanticipatedHostError );
+            minPeriodSize = PA_MAX( minPlayback, minCapture );
+            maxPeriodSize = PA_MIN( maxPlayback, maxCapture );
+            PA_UNLESS( minPeriodSize <= maxPeriodSize, paBadIODeviceCombination );
+
+            desiredBufSz = (snd_pcm_uframes_t)( PA_MIN( outputParameters->suggestedLatency, inputParameters->suggestedLatency )
+                    * sampleRate );
+            /* Clamp desiredBufSz */
+            {
+                snd_pcm_uframes_t maxBufferSize;
+                snd_pcm_uframes_t maxBufferSizeCapture, maxBufferSizePlayback;
+                ENSURE_( alsa_snd_pcm_hw_params_get_buffer_size_max( hwParamsCapture, &maxBufferSizeCapture ), paUnanticipatedHostError );
+                ENSURE_( alsa_snd_pcm_hw_params_get_buffer_size_max( hwParamsPlayback, &maxBufferSizePlayback ), paUnanticipatedHostError );
+                maxBufferSize = PA_MIN( maxBufferSizeCapture, maxBufferSizePlayback );
+
+                desiredBufSz = PA_MIN( desiredBufSz, maxBufferSize );
+            }
+
+            /* Find the closest power of 2 */
+            e = ilogb( minPeriodSize );
+            if( minPeriodSize & ( minPeriodSize - 1 ) )
+                e += 1;
+            periodSize = (snd_pcm_uframes_t)pow( 2, e );
+
+            while( periodSize <= maxPeriodSize )
+            {
+                if( alsa_snd_pcm_hw_params_test_period_size( self->playback.pcm, hwParamsPlayback, periodSize, 0 ) >= 0 &&
+                        alsa_snd_pcm_hw_params_test_period_size( self->capture.pcm, hwParamsCapture, periodSize, 0 ) >= 0 )
+                {
+                    /* OK! */
+                    break;
+                }
+
+                periodSize *= 2;
+            }
+
+            optimalPeriodSize = PA_MAX( desiredBufSz / numPeriods, minPeriodSize );
+            optimalPeriodSize = PA_MIN( optimalPeriodSize, maxPeriodSize );
+
+            /* Find the closest power of 2 */
+            e = ilogb( optimalPeriodSize );
+            if( optimalPeriodSize & (optimalPeriodSize - 1) )
+                e += 1;
+            optimalPeriodSize = (snd_pcm_uframes_t)pow( 2, e );
+
+            while( optimalPeriodSize >= periodSize )
+            {
+                if( alsa_snd_pcm_hw_params_test_period_size( self->capture.pcm, hwParamsCapture, optimalPeriodSize, 0 )
+                        >= 0 && alsa_snd_pcm_hw_params_test_period_size( self->playback.pcm, hwParamsPlayback,
+                            optimalPeriodSize, 0 ) >= 0 )
+                {
+                    break;
+                }
+                optimalPeriodSize /= 2;
+            }
+
+            if( optimalPeriodSize > periodSize )
+                periodSize = optimalPeriodSize;
+
+            if( periodSize <= maxPeriodSize )
+            {
+                /* Looks good, the periodSize _should_ be acceptable by both devices */
+                ENSURE_( alsa_snd_pcm_hw_params_set_period_size( self->capture.pcm, hwParamsCapture, periodSize, 0 ),
+                        paUnanticipatedHostError );
+                ENSURE_( alsa_snd_pcm_hw_params_set_period_size( self->playback.pcm, hwParamsPlayback, periodSize, 0 ),
+                        paUnanticipatedHostError );
+                self->capture.framesPerPeriod = self->playback.framesPerPeriod = periodSize;
+                framesPerHostBuffer = periodSize;
+            }
+            else
+            {
+                /* Unable to find a common period size, oh well */
+                optimalPeriodSize = PA_MAX( desiredBufSz / numPeriods, minPeriodSize );
+                optimalPeriodSize = PA_MIN( optimalPeriodSize, maxPeriodSize );
+
+                self->capture.framesPerPeriod = optimalPeriodSize;
+                dir = 0;
+                ENSURE_( alsa_snd_pcm_hw_params_set_period_size_near( self->capture.pcm, hwParamsCapture, &self->capture.framesPerPeriod, &dir ),
+                        paUnanticipatedHostError );
+                self->playback.framesPerPeriod = optimalPeriodSize;
+                dir = 0;
+                ENSURE_( alsa_snd_pcm_hw_params_set_period_size_near( self->playback.pcm, hwParamsPlayback, &self->playback.framesPerPeriod, &dir ),
+                        paUnanticipatedHostError );
+                framesPerHostBuffer = PA_MAX( self->capture.framesPerPeriod, self->playback.framesPerPeriod );
+                *hostBufferSizeMode = paUtilBoundedHostBufferSize;
             }
         }
-#endif
+        else
+        {
+            /* We choose the simple route and determine a suitable number of frames per buffer for one component of
+             * the stream, then we hope that this will work for the other component too (it should!).
+             */
 
-#ifdef PA_ALSA_USE_OBSOLETE_HOST_BUFFER_CALC
+            unsigned maxPeriods = 0;
+            PaAlsaStreamComponent* first = &self->capture, * second = &self->playback;
+            const PaStreamParameters* firstStreamParams = inputParameters;
+            snd_pcm_hw_params_t* firstHwParams = hwParamsCapture, * secondHwParams = hwParamsPlayback;
 
-        if( framesPerUserBuffer != paFramesPerBufferUnspecified )
-        {
-            /* Try to get a power-of-two of the user buffer size. */
-            framesPerHostBuffer = framesPerUserBuffer;
-            if( framesPerHostBuffer < bufferSize )
-            {
-                while( bufferSize / framesPerHostBuffer > numPeriods )
-                {
-                    framesPerHostBuffer *= 2;
-                }
-                /* One extra period is preferable to one less (should be more robust) */
-                if( bufferSize / framesPerHostBuffer < numPeriods )
-                {
-                    framesPerHostBuffer /= 2;
-                }
-            }
-            else
+            dir = 0;
+            ENSURE_( alsa_snd_pcm_hw_params_get_periods_max( hwParamsPlayback, &maxPeriods, &dir ), paUnanticipatedHostError );
+            if( maxPeriods < numPeriods )
             {
-                while( bufferSize / framesPerHostBuffer < numPeriods )
-                {
-                    if( framesPerUserBuffer % ( framesPerHostBuffer / 2 ) != 0 )
-                    {
-                        /* Can't be divided any further */
-                        break;
-                    }
-                    framesPerHostBuffer /= 2;
-                }
+                /* The playback component is trickier to get right, try that first */
+                first = &self->playback;
+                second = &self->capture;
+                firstStreamParams = outputParameters;
+                firstHwParams = hwParamsPlayback;
+                secondHwParams = hwParamsCapture;
             }
 
-            if( framesPerHostBuffer < framesPerUserBuffer )
+            PA_ENSURE( PaAlsaStreamComponent_DetermineFramesPerBuffer( first, firstStreamParams, framesPerUserBuffer,
+                        sampleRate, firstHwParams, &accurate ) );
+
+            second->framesPerPeriod = first->framesPerPeriod;
+            dir = 0;
+            ENSURE_( alsa_snd_pcm_hw_params_set_period_size_near( second->pcm, secondHwParams, &second->framesPerPeriod, &dir ),
+                    paUnanticipatedHostError );
+            if( self->capture.framesPerPeriod == self->playback.framesPerPeriod )
             {
-                assert( framesPerUserBuffer % framesPerHostBuffer == 0 );
-                if( alsa_snd_pcm_hw_params_test_period_size( self->pcm, hwParams, framesPerHostBuffer, 0 ) < 0 )
-                {
-                    if( alsa_snd_pcm_hw_params_test_period_size( self->pcm, hwParams, framesPerHostBuffer * 2, 0 ) == 0 )
-                        framesPerHostBuffer *= 2;
-                    else if( alsa_snd_pcm_hw_params_test_period_size( self->pcm, hwParams, framesPerHostBuffer / 2, 0 ) == 0 )
-                        framesPerHostBuffer /= 2;
-                }
+                framesPerHostBuffer = self->capture.framesPerPeriod;
             }
             else
             {
-                assert( framesPerHostBuffer % framesPerUserBuffer == 0 );
-                if( alsa_snd_pcm_hw_params_test_period_size( self->pcm, hwParams, framesPerHostBuffer, 0 ) < 0 )
-                {
-                    if( alsa_snd_pcm_hw_params_test_period_size( self->pcm, hwParams, framesPerHostBuffer + framesPerUserBuffer, 0 ) == 0 )
-                        framesPerHostBuffer += framesPerUserBuffer;
-                    else if( alsa_snd_pcm_hw_params_test_period_size( self->pcm, hwParams, framesPerHostBuffer - framesPerUserBuffer, 0 ) == 0 )
-                        framesPerHostBuffer -= framesPerUserBuffer;
-                }
+                framesPerHostBuffer = PA_MAX( self->capture.framesPerPeriod, self->playback.framesPerPeriod );
+                *hostBufferSizeMode = paUtilBoundedHostBufferSize;
             }
         }
+    }
+    else    /* half-duplex is a slightly simpler case */
+    {
+        if( self->capture.pcm )
+        {
+            PA_ENSURE( PaAlsaStreamComponent_DetermineFramesPerBuffer( &self->capture, inputParameters, framesPerUserBuffer,
+                        sampleRate, hwParamsCapture, &accurate) );
+            framesPerHostBuffer = self->capture.framesPerPeriod;
+        }
         else
         {
-            framesPerHostBuffer = bufferSize / numPeriods;
+            assert( self->playback.pcm );
+            PA_ENSURE( PaAlsaStreamComponent_DetermineFramesPerBuffer( &self->playback, outputParameters, framesPerUserBuffer,
+                        sampleRate, hwParamsPlayback, &accurate ) );
+            framesPerHostBuffer = self->playback.framesPerPeriod;
         }
-
-        /* non-mmap mode needs a reasonably-sized buffer or it'll stutter */
-        if( !self->canMmap && framesPerHostBuffer < 2048 )
-            framesPerHostBuffer = 2048;
-#endif
-        PA_DEBUG(( "%s: suggested host buffer period   = %lu \n", __FUNCTION__, framesPerHostBuffer ));
     }
 
+    PA_UNLESS( framesPerHostBuffer != 0, paInternalError );
+    self->maxFramesPerHostBuffer = framesPerHostBuffer;
+
+    if( (self->playback.pcm && !self->playback.canMmap) || !accurate )
     {
-        /* Get min/max period sizes and adjust our chosen */
-        snd_pcm_uframes_t min = 0, max = 0, minmax_diff;
-        ENSURE_( alsa_snd_pcm_hw_params_get_period_size_min( hwParams, &min, NULL ), paUnanticipatedHostError );
-        ENSURE_( alsa_snd_pcm_hw_params_get_period_size_max( hwParams, &max, NULL ), paUnanticipatedHostError );
-        minmax_diff = max - min;
+        /* Don't know the exact size per host buffer */
+        *hostBufferSizeMode = paUtilBoundedHostBufferSize;
+        /* Raise upper bound */
+        if( !accurate )
+            ++self->maxFramesPerHostBuffer;
+    }
 
-        if( framesPerHostBuffer < min )
+error:
+    return result;
+}
+
+/** Set up ALSA stream parameters.
+ *
+ */
+static PaError PaAlsaStream_Configure( PaAlsaStream *self, const PaStreamParameters *inParams, const PaStreamParameters*
+        outParams, double sampleRate, unsigned long framesPerUserBuffer, double* inputLatency, double* outputLatency,
+        PaUtilHostBufferSizeMode* hostBufferSizeMode )
+{
+    PaError result = paNoError;
+    unsigned int approximateSampleRate = (unsigned int)(sampleRate + 0.5);
+    double preciseSampleRate = sampleRate;
+    double preciseCaptureSampleRate = 0;
+    double precisePlaybackSampleRate = 0;
+    snd_pcm_hw_params_t* hwParamsCapture, * hwParamsPlayback;
+
+    alsa_snd_pcm_hw_params_alloca( &hwParamsCapture );
+    alsa_snd_pcm_hw_params_alloca( &hwParamsPlayback );
+
+    if( self->capture.pcm )
+        PA_ENSURE( PaAlsaStreamComponent_InitialConfigure( &self->capture, inParams, self->primeBuffers, hwParamsCapture,
+                    &approximateSampleRate ) );
+    if( self->playback.pcm )
+        PA_ENSURE( PaAlsaStreamComponent_InitialConfigure( &self->playback, outParams, self->primeBuffers, hwParamsPlayback,
+                    &approximateSampleRate ) );
+
+    if( self->timerScheduling )
+    {
+        /* With timer-based scheduling, hardware period interrupts aren't needed. This requires non-blocking mode,
+         * and has to succeed for both pcms */
+        if( !alsa_snd_pcm_hw_params_set_period_wakeup ||
+                ( self->capture.pcm && ( alsa_snd_pcm_nonblock( self->capture.pcm, 1 ) < 0 ||
+                  alsa_snd_pcm_hw_params_set_period_wakeup( self->capture.pcm, hwParamsCapture, 0 ) < 0 ) ) ||
+                ( self->playback.pcm && ( alsa_snd_pcm_nonblock( self->playback.pcm, 1 ) < 0 ||
+                  alsa_snd_pcm_hw_params_set_period_wakeup( self->playback.pcm, hwParamsPlayback, 0 ) < 0 ) ) )
         {
-            PA_DEBUG(( "%s: The determined period size (%lu) is less than minimum (%lu)\n", __FUNCTION__, framesPerHostBuffer, min ));
-            framesPerHostBuffer = (( minmax_diff == 2 ) ? min + 1 : min );
+            PA_DEBUG(( "%s: Unable to disable period wakeups, falling back to regular scheduling\n", __FUNCTION__ ));
+            self->timerScheduling = 0;
+            if( self->capture.pcm )
+            {
+                if( alsa_snd_pcm_hw_params_set_period_wakeup )
+                    alsa_snd_pcm_hw_params_set_period_wakeup( self->capture.pcm, hwParamsCapture, 1 );
+                ENSURE_( alsa_snd_pcm_nonblock( self->capture.pcm, 0 ), paUnanticipatedHostError );
+            }
+            if( self->playback.pcm )
+            {
+                if( alsa_snd_pcm_hw_params_set_period_wakeup )
+                    alsa_snd_pcm_hw_params_set_period_wakeup( self->playback.pcm, hwParamsPlayback, 1 );
+                ENSURE_( alsa_snd_pcm_nonblock( self->playback.pcm, 0 ), paUnanticipatedHostError );
+            }
         }
-        else if( framesPerHostBuffer > max )
+        self->capture.timerScheduling = self->playback.timerScheduling = self->timerScheduling;
+    }
+
+    /* Read/write transfers mustn't block the callback thread, see PaAlsaStreamComponent_FlushOutput */
+    if( self->callbackMode )
+    {
+        if( self->capture.pcm && !self->capture.canMmap )
+            ENSURE_( alsa_snd_pcm_nonblock( self->capture.pcm, 1 ), paUnanticipatedHostError );
+        if( self->playback.pcm && !self->playback.canMmap )
+            ENSURE_( alsa_snd_pcm_nonblock( self->playback.pcm, 1 ), paUnanticipatedHostError );
+    }
+
+    PA_ENSURE( PaAlsaStream_DetermineFramesPerBuffer( self, approximateSampleRate, inParams, outParams, framesPerUserBuffer,
+                hwParamsCapture, hwParamsPlayback, hostBufferSizeMode ) );
+
+    if( self->capture.pcm )
+    {
+        assert( self->capture.framesPerPeriod != 0 );
+        PA_ENSURE( PaAlsaStreamComponent_FinishConfigure( &self->capture, hwParamsCapture, inParams, self->primeBuffers, approximateSampleRate,
+                    inputLatency ) );
+        /* Now that we have finalized the hwParams, we can get a more accurate sample rate. */
+        ENSURE_( GetExactSampleRate( hwParamsCapture, &preciseCaptureSampleRate ), paUnanticipatedHostError );
+        PA_DEBUG(( "%s: Capture period size: %lu, latency: %f\n", __FUNCTION__, self->capture.framesPerPeriod, *inputLatency ));
+        preciseSampleRate = preciseCaptureSampleRate;
+    }
+    if( self->playback.pcm )
+    {
+        assert( self->playback.framesPerPeriod != 0 );
+        PA_ENSURE( PaAlsaStreamComponent_FinishConfigure( &self->playback, hwParamsPlayback, outParams, self->primeBuffers, approximateSampleRate,
+                    outputLatency ) );
+        /* Now that we have finalized the hwParams, we can get a more accurate sample rate. */
+        ENSURE_( GetExactSampleRate( hwParamsPlayback, &precisePlaybackSampleRate ), paUnanticipatedHostError );
+        PA_DEBUG(( "%s: Playback period size: %lu, latency: %f\n", __FUNCTION__, self->playback.framesPerPeriod, *outputLatency ));
+        preciseSampleRate = precisePlaybackSampleRate;
+    }
+
+    /* Warn if the input and output rates are very different. */
+    if( self->capture.pcm && self->playback.pcm )
+    {
+        if (fabs(preciseCaptureSampleRate - precisePlaybackSampleRate) >= 1.0)
         {
-            PA_DEBUG(( "%s: The determined period size (%lu) is greater than maximum (%lu)\n", __FUNCTION__, framesPerHostBuffer, max ));
-            framesPerHostBuffer = (( minmax_diff == 2 ) ? max - 1 : max );
+            PA_DEBUG(( "%s: Warning: input and output sample rates differ, %f != %f\n",
+                    __FUNCTION__, preciseCaptureSampleRate, precisePlaybackSampleRate ));
         }
+    }
 
-        PA_DEBUG(( "%s: device period minimum          = %lu\n", __FUNCTION__, min ));
-        PA_DEBUG(( "%s: device period maximum          = %lu\n", __FUNCTION__, max ));
-        PA_DEBUG(( "%s: host buffer period             = %lu\n", __FUNCTION__, framesPerHostBuffer ));
-        PA_DEBUG(( "%s: host buffer period latency     = %f\n", __FUNCTION__, (double)( framesPerHostBuffer / sampleRate ) ));
+    self->streamRepresentation.streamInfo.sampleRate = preciseSampleRate;
 
-        /* Try setting period size */
-        dir = 0;
-        ENSURE_( alsa_snd_pcm_hw_params_set_period_size_near( self->pcm, hwParams, &framesPerHostBuffer, &dir ), paUnanticipatedHostError );
-        if( dir != 0 )
+    /* this will cause the two streams to automatically start/stop/prepare in sync.
+     * We only need to execute these operations on one of the pair.
+     * A: We don't want to do this on a blocking stream.
+     */
+    if( self->callbackMode && self->capture.pcm && self->playback.pcm )
+    {
+        int err = alsa_snd_pcm_link( self->capture.pcm, self->playback.pcm );
+        if( err == 0 )
+            self->pcmsSynced = 1;
+        else
+            PA_DEBUG(( "%s: Unable to sync pcms: %s\n", __FUNCTION__, alsa_snd_strerror( err ) ));
+    }
+
+    {
+        unsigned long minFramesPerHostBuffer = PA_MIN( self->capture.pcm ? self->capture.framesPerPeriod : ULONG_MAX,
+            self->playback.pcm ? self->playback.framesPerPeriod : ULONG_MAX );
+        self->pollTimeout = CalculatePollTimeout( self, minFramesPerHostBuffer );    /* Period in msecs, rounded up */
+
+        /* Time before watchdog unthrottles realtime thread == 1/4 of period time in msecs */
+        /* self->threading.throttledSleepTime = (unsigned long) (minFramesPerHostBuffer / sampleRate / 4 * 1000); */
+    }
+
+    if( self->callbackMode )
+    {
+        /* If the user expects a certain number of frames per callback we will either have to rely on block adaption
+         * (framesPerHostBuffer is not an integer multiple of framesPerPeriod) or we can simply align the number
+         * of host buffer frames with what the user specified */
+        if( self->framesPerUserBuffer != paFramesPerBufferUnspecified )
         {
-            PA_DEBUG(( "%s: The configured period size is non-integer.\n", __FUNCTION__, dir ));
-            *accurate = 0;
+            /* self->alignFrames = 1; */
+
+            /* Unless the ratio between number of host and user buffer frames is an integer we will have to rely
+             * on block adaption */
+        /*
+            if( framesPerHostBuffer % framesPerPeriod != 0 || (self->capture.pcm && self->playback.pcm &&
+                        self->capture.framesPerPeriod != self->playback.framesPerPeriod) )
+                self->useBlockAdaption = 1;
+            else
+                self->alignFrames = 1;
+        */
         }
     }
 
-    /* Set result */
-    self->framesPerPeriod = framesPerHostBuffer;
-
 error:
     return result;
 }
 
-/* We need to determine how many frames per host buffer (period) to use.  Our
- * goals are to provide the best possible performance, but also to
- * honor the requested latency settings as closely as we can. Therefore this
- * decision is based on:
- *
- *   - the period sizes that playback and/or capture support.  The
- *     host buffer size has to be one of these.
- *   - the number of periods that playback and/or capture support.
- *
- * We want to make period_size*(num_periods-1) to be as close as possible
- * to latency*rate for both playback and capture.
- *
- * This method will determine suitable period sizes for capture and playback handles, and report the maximum number of
- * frames per host buffer. The latter is relevant, in case we should be so unfortunate that the period size differs
- * between capture and playback. If this should happen, the stream's hostBufferSizeMode attribute will be set to
- * paUtilBoundedHostBufferSize, because the best we can do is limit the size of individual host buffers to the upper
- * bound. The size of host buffers scheduled for processing should only matter if the user has specified a buffer size,
- * but when he/she does we must strive for an optimal configuration. By default we'll opt for a fixed host buffer size,
- * which should be fine if the period size is the same for capture and playback. In general, if there is a specified user
- * buffer size, this method tries it best to determine a period size which is a multiple of the user buffer size.
+/* Aggregate devices
  *
- * The framesPerPeriod attributes of the individual capture and playback components of the stream are set to corresponding
- * values determined here. Since these should be reported as
- *
- * This is one of those blocks of code that will just take a lot of
- * refinement to be any good.
+ * The stream's components drive the master of an aggregate device like any other device. The other members are
+ * opened as pcms of their own, in nonblocking mode, and serviced by the stream's thread along with the master:
+ * captured frames are read and resampled into a buffer that is registered with the buffer processor after the
+ * master's channels, output is resampled from such a buffer and written after the master has been processed.
  *
- * In the full-duplex case it is possible that the routine was unable
- * to find a number of frames per buffer acceptable to both devices
- * TODO: Implement an algorithm to find the value closest to acceptance
- * by both devices, to minimize difference between period sizes?
+ * A member's clock drifts from the master's, which shows in the fill level of its FIFO (capture) or its ALSA
+ * buffer (playback). The resampling ratio is steered by a PI controller that keeps the level at a target. The
+ * gains are chosen for a controller that settles over several seconds, as the drift between sound cards is in the
+ * order of 100 ppm, while periodic fluctuations of the fill level must not modulate the ratio audibly.
+ */
+#define AGGREGATE_KP 4e-6               /* Ratio correction per frame of fill level error */
+#define AGGREGATE_KI 8e-12              /* Integrated for every frame processed */
+#define AGGREGATE_MAX_DEVIATION 0.005   /* The ratio stays within 0.5% of 1 */
+#define AGGREGATE_FILL_SMOOTHING 0.05   /* Coefficient of the lowpass filter on the fill level */
+
+/* Samples are converted through doubles, members only use formats the master's format can also be */
+static double AggregateMember_GetSample( snd_pcm_format_t format, const unsigned char *frame, int channel )
+{
+    switch( format )
+    {
+        case SND_PCM_FORMAT_S16:
+            return ((const int16_t *)frame)[channel] * ( 1. / 32768. );
+        case SND_PCM_FORMAT_S32:
+            return ((const int32_t *)frame)[channel] * ( 1. / 2147483648. );
+        default:
+            return ((const float *)frame)[channel];
+    }
+}
+
+static void AggregateMember_PutSample( snd_pcm_format_t format, unsigned char *frame, int channel, double value )
+{
+    value = PA_MAX( -1., PA_MIN( value, 1. ) );
+    switch( format )
+    {
+        case SND_PCM_FORMAT_S16:
+            ((int16_t *)frame)[channel] = (int16_t)( value * 32767. );
+            break;
+        case SND_PCM_FORMAT_S32:
+            ((int32_t *)frame)[channel] = (int32_t)( value * 2147483647. );
+            break;
+        default:
+            ((float *)frame)[channel] = (float)value;
+    }
+}
+
+static int IsAggregateFormat( snd_pcm_format_t format )
+{
+    return SND_PCM_FORMAT_S16 == format || SND_PCM_FORMAT_S32 == format || SND_PCM_FORMAT_FLOAT == format;
+}
+
+/** Open a member of an aggregate device, for numChannels of the stream's channels starting at firstChannel.
  *
- * @param determinedFramesPerHostBuffer: The determined host buffer size.
+ * The member is configured at the master's sample rate and with a period close to the master's. Its buffer is
+ * made larger than the master's, so the playback target level can be the master's latency.
  */
-static PaError PaAlsaStream_DetermineFramesPerBuffer( PaAlsaStream* self, double sampleRate, const PaStreamParameters* inputParameters,
-        const PaStreamParameters* outputParameters, unsigned long framesPerUserBuffer, snd_pcm_hw_params_t* hwParamsCapture,
-        snd_pcm_hw_params_t* hwParamsPlayback, PaUtilHostBufferSizeMode* hostBufferSizeMode )
+static PaError AggregateMember_Open( PaAlsaAggregateMember *self, const char *name, StreamDirection streamDir,
+        int firstChannel, int numChannels, const PaAlsaStreamComponent *master, double sampleRate,
+        unsigned long maxFramesPerHostBuffer )
 {
     PaError result = paNoError;
-    unsigned long framesPerHostBuffer = 0;
-    int dir = 0;
-    int accurate = 1;
-    unsigned numPeriods = numPeriods_;
+    snd_pcm_hw_params_t *hwParams;
+    snd_pcm_uframes_t framesPerPeriod = master->framesPerPeriod, bufferSize = 2 * master->alsaBufferSize;
+    static const snd_pcm_format_t alternateFormats[] = { SND_PCM_FORMAT_FLOAT, SND_PCM_FORMAT_S32, SND_PCM_FORMAT_S16 };
+    unsigned int minChannels;
+    size_t frameBytes;
+    int ret, i;
 
-    if( self->capture.pcm && self->playback.pcm )
+    alsa_snd_pcm_hw_params_alloca( &hwParams );
+
+    self->streamDir = streamDir;
+    self->firstChannel = firstChannel;
+    self->numUserChannels = numChannels;
+    self->bufferFormat = master->nativeFormat;
+
+    PA_DEBUG(( "%s: Opening member %s for %d channels\n", __FUNCTION__, name, numChannels ));
+    if( ( ret = OpenPcm( &self->pcm, name, StreamDirection_In == streamDir ? SND_PCM_STREAM_CAPTURE :
+                    SND_PCM_STREAM_PLAYBACK, SND_PCM_NONBLOCK, 1 ) ) < 0 )
     {
-        if( framesPerUserBuffer == paFramesPerBufferUnspecified )
-        {
-            /* Come up with a common desired latency */
-            snd_pcm_uframes_t desiredBufSz, e, minPeriodSize, maxPeriodSize, optimalPeriodSize, periodSize,
-                              minCapture, minPlayback, maxCapture, maxPlayback;
+        /* Not to be closed */
+        self->pcm = NULL;
+        ENSURE_( ret, -EBUSY == ret ? paDeviceUnavailable : paBadIODeviceCombination );
+    }
 
-            dir = 0;
-            ENSURE_( alsa_snd_pcm_hw_params_get_period_size_min( hwParamsCapture, &minCapture, &dir ), paUnanticipatedHostError );
-            dir = 0;
-            ENSURE_( alsa_snd_pcm_hw_params_get_period_size_min( hwParamsPlayback, &minPlayback, &dir ), paUnanticipatedHostError );
-            dir = 0;
-            ENSURE_( alsa_snd_pcm_hw_params_get_period_size_max( hwParamsCapture, &maxCapture, &dir ), paUnanticipatedHostError );
-            dir = 0;
-            ENSURE_( alsa_snd_pcm_hw_params_get_period_size_max( hwParamsPlayback, &maxPlayback, &dir ), paUnanticipatedHostError );
-            minPeriodSize = PA_MAX( minPlayback, minCapture );
-            maxPeriodSize = PA_MIN( maxPlayback, maxCapture );
-            PA_UNLESS( minPeriodSize <= maxPeriodSize, paBadIODeviceCombination );
+    ENSURE_( alsa_snd_pcm_hw_params_any( self->pcm, hwParams ), paUnanticipatedHostError );
+    ENSURE_( alsa_snd_pcm_hw_params_set_access( self->pcm, hwParams, SND_PCM_ACCESS_RW_INTERLEAVED ),
+            paUnanticipatedHostError );
 
-            desiredBufSz = (snd_pcm_uframes_t)( PA_MIN( outputParameters->suggestedLatency, inputParameters->suggestedLatency )
-                    * sampleRate );
-            /* Clamp desiredBufSz */
-            {
-                snd_pcm_uframes_t maxBufferSize;
-                snd_pcm_uframes_t maxBufferSizeCapture, maxBufferSizePlayback;
-                ENSURE_( alsa_snd_pcm_hw_params_get_buffer_size_max( hwParamsCapture, &maxBufferSizeCapture ), paUnanticipatedHostError );
-                ENSURE_( alsa_snd_pcm_hw_params_get_buffer_size_max( hwParamsPlayback, &maxBufferSizePlayback ), paUnanticipatedHostError );
-                maxBufferSize = PA_MIN( maxBufferSizeCapture, maxBufferSizePlayback );
+    /* Prefer the master's format, then the most precise one */
+    self->nativeFormat = self->bufferFormat;
+    for( i = 0; alsa_snd_pcm_hw_params_test_format( self->pcm, hwParams, self->nativeFormat ) < 0; ++i )
+    {
+        PA_UNLESS( i < (int)( sizeof (alternateFormats) / sizeof (alternateFormats[0]) ), paSampleFormatNotSupported );
+        self->nativeFormat = alternateFormats[i];
+    }
+    ENSURE_( alsa_snd_pcm_hw_params_set_format( self->pcm, hwParams, self->nativeFormat ), paUnanticipatedHostError );
 
-                desiredBufSz = PA_MIN( desiredBufSz, maxBufferSize );
-            }
+    ENSURE_( alsa_snd_pcm_hw_params_get_channels_min( hwParams, &minChannels ), paUnanticipatedHostError );
+    self->numHostChannels = PA_MAX( numChannels, (int)minChannels );
+    ENSURE_( alsa_snd_pcm_hw_params_set_channels( self->pcm, hwParams, self->numHostChannels ), paInvalidChannelCount );
 
-            /* Find the closest power of 2 */
-            e = ilogb( minPeriodSize );
-            if( minPeriodSize & ( minPeriodSize - 1 ) )
-                e += 1;
-            periodSize = (snd_pcm_uframes_t)pow( 2, e );
+    /* Only drift is compensated, the member has to run at the master's rate */
+    ENSURE_( alsa_snd_pcm_hw_params_set_rate( self->pcm, hwParams, (unsigned int)sampleRate, 0 ), paInvalidSampleRate );
+    ENSURE_( alsa_snd_pcm_hw_params_set_period_size_near( self->pcm, hwParams, &framesPerPeriod, NULL ),
+            paUnanticipatedHostError );
+    ENSURE_( alsa_snd_pcm_hw_params_set_buffer_size_near( self->pcm, hwParams, &bufferSize ),
+            paUnanticipatedHostError );
+    ENSURE_( alsa_snd_pcm_hw_params( self->pcm, hwParams ), paUnanticipatedHostError );
+    ENSURE_( alsa_snd_pcm_hw_params_get_buffer_size( hwParams, &self->alsaBufferSize ), paUnanticipatedHostError );
 
-            while( periodSize <= maxPeriodSize )
-            {
-                if( alsa_snd_pcm_hw_params_test_period_size( self->playback.pcm, hwParamsPlayback, periodSize, 0 ) >= 0 &&
-                        alsa_snd_pcm_hw_params_test_period_size( self->capture.pcm, hwParamsCapture, periodSize, 0 ) >= 0 )
-                {
-                    /* OK! */
-                    break;
-                }
+    if( StreamDirection_In == streamDir )
+    {
+        /* Enough for a host buffer, plus a period as the member's frames arrive a period at a time */
+        self->targetFill = maxFramesPerHostBuffer + framesPerPeriod;
+        self->fifoCapacity = self->alsaBufferSize + 2 * maxFramesPerHostBuffer;
+    }
+    else
+    {
+        /* The master's latency, as far as the member's buffer leaves room for writing a host buffer */
+        snd_pcm_uframes_t room = self->alsaBufferSize - PA_MIN( self->alsaBufferSize, 2 * maxFramesPerHostBuffer );
+        self->targetFill = PA_MIN( master->watermark, room );
+        /* Resampling produces at most a host buffer plus the maximum deviation */
+        self->fifoCapacity = 2 * maxFramesPerHostBuffer + 2;
+    }
+    PA_DEBUG(( "%s: Member period %lu, buffer %lu, target fill %.0f\n", __FUNCTION__, framesPerPeriod,
+                self->alsaBufferSize, self->targetFill ));
 
-                periodSize *= 2;
-            }
+    frameBytes = alsa_snd_pcm_format_size( self->nativeFormat, self->numHostChannels );
+    PA_UNLESS( self->fifo = (unsigned char *)PaUtil_AllocateZeroInitializedMemory( self->fifoCapacity * frameBytes ),
+            paInsufficientMemory );
+    PA_UNLESS( self->buffer = (unsigned char *)PaUtil_AllocateZeroInitializedMemory( maxFramesPerHostBuffer *
+                alsa_snd_pcm_format_size( self->bufferFormat, numChannels ) ), paInsufficientMemory );
+    PA_UNLESS( self->lastFrame = (double *)PaUtil_AllocateZeroInitializedMemory( numChannels * sizeof (double) ),
+            paInsufficientMemory );
 
-            optimalPeriodSize = PA_MAX( desiredBufSz / numPeriods, minPeriodSize );
-            optimalPeriodSize = PA_MIN( optimalPeriodSize, maxPeriodSize );
+error:
+    return result;
+}
 
-            /* Find the closest power of 2 */
-            e = ilogb( optimalPeriodSize );
-            if( optimalPeriodSize & (optimalPeriodSize - 1) )
-                e += 1;
-            optimalPeriodSize = (snd_pcm_uframes_t)pow( 2, e );
+static void AggregateMember_Close( PaAlsaAggregateMember *self )
+{
+    if( self->pcm )
+    {
+        alsa_snd_pcm_close( self->pcm );
+    }
+    PaUtil_FreeMemory( self->buffer );
+    PaUtil_FreeMemory( self->fifo );
+    PaUtil_FreeMemory( self->lastFrame );
+}
 
-            while( optimalPeriodSize >= periodSize )
-            {
-                if( alsa_snd_pcm_hw_params_test_period_size( self->capture.pcm, hwParamsCapture, optimalPeriodSize, 0 )
-                        >= 0 && alsa_snd_pcm_hw_params_test_period_size( self->playback.pcm, hwParamsPlayback,
-                            optimalPeriodSize, 0 ) >= 0 )
-                {
-                    break;
-                }
-                optimalPeriodSize /= 2;
-            }
+/** Write silence to a playback member, as far as it fits. The FIFO is used as a source, so it is cleared. */
+static void AggregateMember_WriteSilence( PaAlsaAggregateMember *self, unsigned long frames )
+{
+    snd_pcm_sframes_t written;
 
-            if( optimalPeriodSize > periodSize )
-                periodSize = optimalPeriodSize;
+    memset( self->fifo, 0, self->fifoCapacity * alsa_snd_pcm_format_size( self->nativeFormat, self->numHostChannels ) );
+    self->fifoFrames = 0;
+    while( frames > 0 && ( written = alsa_snd_pcm_writei( self->pcm, self->fifo,
+                    PA_MIN( frames, self->fifoCapacity ) ) ) > 0 )
+    {
+        frames -= written;
+    }
+}
 
-            if( periodSize <= maxPeriodSize )
-            {
-                /* Looks good, the periodSize _should_ be acceptable by both devices */
-                ENSURE_( alsa_snd_pcm_hw_params_set_period_size( self->capture.pcm, hwParamsCapture, periodSize, 0 ),
-                        paUnanticipatedHostError );
-                ENSURE_( alsa_snd_pcm_hw_params_set_period_size( self->playback.pcm, hwParamsPlayback, periodSize, 0 ),
-                        paUnanticipatedHostError );
-                self->capture.framesPerPeriod = self->playback.framesPerPeriod = periodSize;
-                framesPerHostBuffer = periodSize;
-            }
-            else
-            {
-                /* Unable to find a common period size, oh well */
-                optimalPeriodSize = PA_MAX( desiredBufSz / numPeriods, minPeriodSize );
-                optimalPeriodSize = PA_MIN( optimalPeriodSize, maxPeriodSize );
+/** Reset drift compensation and start a member. Playback members are filled with silence up to the target level.
+ */
+static PaError AggregateMember_Start( PaAlsaAggregateMember *self )
+{
+    PaError result = paNoError;
 
-                self->capture.framesPerPeriod = optimalPeriodSize;
-                dir = 0;
-                ENSURE_( alsa_snd_pcm_hw_params_set_period_size_near( self->capture.pcm, hwParamsCapture, &self->capture.framesPerPeriod, &dir ),
-                        paUnanticipatedHostError );
-                self->playback.framesPerPeriod = optimalPeriodSize;
-                dir = 0;
-                ENSURE_( alsa_snd_pcm_hw_params_set_period_size_near( self->playback.pcm, hwParamsPlayback, &self->playback.framesPerPeriod, &dir ),
-                        paUnanticipatedHostError );
-                framesPerHostBuffer = PA_MAX( self->capture.framesPerPeriod, self->playback.framesPerPeriod );
-                *hostBufferSizeMode = paUtilBoundedHostBufferSize;
-            }
-        }
-        else
-        {
-            /* We choose the simple route and determine a suitable number of frames per buffer for one component of
-             * the stream, then we hope that this will work for the other component too (it should!).
-             */
+    self->ratio = 1.;
+    self->position = 0.;
+    self->integral = 0.;
+    self->filteredFill = self->targetFill;
+    self->fifoFrames = 0;
+    memset( self->lastFrame, 0, self->numUserChannels * sizeof (double) );
 
-            unsigned maxPeriods = 0;
-            PaAlsaStreamComponent* first = &self->capture, * second = &self->playback;
-            const PaStreamParameters* firstStreamParams = inputParameters;
-            snd_pcm_hw_params_t* firstHwParams = hwParamsCapture, * secondHwParams = hwParamsPlayback;
+    ENSURE_( alsa_snd_pcm_prepare( self->pcm ), paUnanticipatedHostError );
+    if( StreamDirection_Out == self->streamDir )
+    {
+        /* Writing starts playback, due to the default start threshold */
+        AggregateMember_WriteSilence( self, (unsigned long)self->targetFill );
+    }
+    if( alsa_snd_pcm_state( self->pcm ) == SND_PCM_STATE_PREPARED )
+    {
+        ENSURE_( alsa_snd_pcm_start( self->pcm ), paUnanticipatedHostError );
+    }
+    self->started = 1;
 
-            dir = 0;
-            ENSURE_( alsa_snd_pcm_hw_params_get_periods_max( hwParamsPlayback, &maxPeriods, &dir ), paUnanticipatedHostError );
-            if( maxPeriods < numPeriods )
-            {
-                /* The playback component is trickier to get right, try that first */
-                first = &self->playback;
-                second = &self->capture;
-                firstStreamParams = outputParameters;
-                firstHwParams = hwParamsPlayback;
-                secondHwParams = hwParamsCapture;
-            }
+error:
+    return result;
+}
 
-            PA_ENSURE( PaAlsaStreamComponent_DetermineFramesPerBuffer( first, firstStreamParams, framesPerUserBuffer,
-                        sampleRate, firstHwParams, &accurate ) );
+static void AggregateMember_Stop( PaAlsaAggregateMember *self )
+{
+    if( self->started )
+    {
+        alsa_snd_pcm_drop( self->pcm );
+        self->started = 0;
+    }
+}
 
-            second->framesPerPeriod = first->framesPerPeriod;
-            dir = 0;
-            ENSURE_( alsa_snd_pcm_hw_params_set_period_size_near( second->pcm, secondHwParams, &second->framesPerPeriod, &dir ),
-                    paUnanticipatedHostError );
-            if( self->capture.framesPerPeriod == self->playback.framesPerPeriod )
-            {
-                framesPerHostBuffer = self->capture.framesPerPeriod;
-            }
-            else
-            {
-                framesPerHostBuffer = PA_MAX( self->capture.framesPerPeriod, self->playback.framesPerPeriod );
-                *hostBufferSizeMode = paUtilBoundedHostBufferSize;
-            }
+/** Recover a member from an xrun or suspend.
+ *
+ * The stream goes on with the master, so this isn't reported to the callback. The member restarts at the target
+ * level, pending frames are dropped.
+ */
+static void AggregateMember_Recover( PaAlsaAggregateMember *self, int err )
+{
+    PA_DEBUG(( "%s: Member error: %s\n", __FUNCTION__, alsa_snd_strerror( err ) ));
+    if( alsa_snd_pcm_recover( self->pcm, err, 1 ) < 0 )
+    {
+        return;
+    }
+
+    if( StreamDirection_Out == self->streamDir )
+    {
+        AggregateMember_WriteSilence( self, (unsigned long)self->targetFill );
+    }
+    else
+    {
+        self->fifoFrames = 0;
+        alsa_snd_pcm_start( self->pcm );
+    }
+    self->filteredFill = self->targetFill;
+}
+
+/** Steer the resampling ratio from the fill level.
+ *
+ * The level is filtered, since it fluctuates with the periods of the master and the member. Frames piling up in
+ * a capture member, or being consumed faster than expected by a playback member, mean the member's clock runs
+ * fast relative to the master's, and more device frames have to go into each frame of the stream.
+ */
+static void AggregateMember_UpdateRatio( PaAlsaAggregateMember *self, double fill, unsigned long frames )
+{
+    double error, correction;
+
+    self->filteredFill += AGGREGATE_FILL_SMOOTHING * ( fill - self->filteredFill );
+    error = self->filteredFill - self->targetFill;
+    if( StreamDirection_Out == self->streamDir )
+    {
+        error = -error;
+    }
+
+    self->integral += AGGREGATE_KI * error * frames;
+    self->integral = PA_MAX( -AGGREGATE_MAX_DEVIATION, PA_MIN( self->integral, AGGREGATE_MAX_DEVIATION ) );
+    correction = AGGREGATE_KP * error + self->integral;
+    self->ratio = 1. + PA_MAX( -AGGREGATE_MAX_DEVIATION, PA_MIN( correction, AGGREGATE_MAX_DEVIATION ) );
+}
+
+/** Read what a capture member has captured, and resample numFrames for the buffer processor.
+ *
+ * Linear interpolation is used. If the member falls behind, the missing frames are silenced.
+ */
+static void AggregateMember_Capture( PaAlsaAggregateMember *self, PaUtilBufferProcessor *bp, unsigned long numFrames )
+{
+    size_t frameBytes = alsa_snd_pcm_format_size( self->nativeFormat, self->numHostChannels );
+    size_t bufferFrameBytes = alsa_snd_pcm_format_size( self->bufferFormat, self->numUserChannels );
+    int swidth = alsa_snd_pcm_format_size( self->bufferFormat, 1 );
+    double position = self->position;
+    unsigned long consumed;
+
+    while( self->fifoFrames < self->fifoCapacity )
+    {
+        snd_pcm_sframes_t framesRead = alsa_snd_pcm_readi( self->pcm, self->fifo + self->fifoFrames * frameBytes,
+                self->fifoCapacity - self->fifoFrames );
+        if( framesRead == 0 || framesRead == -EAGAIN )
+        {
+            break;
         }
+        if( framesRead < 0 )
+        {
+            AggregateMember_Recover( self, framesRead );
+            break;
+        }
+        self->fifoFrames += framesRead;
     }
-    else    /* half-duplex is a slightly simpler case */
+    AggregateMember_UpdateRatio( self, self->fifoFrames, numFrames );
+
+    for( unsigned long i = 0; i < numFrames; ++i )
     {
-        if( self->capture.pcm )
+        unsigned long index = (unsigned long)position;
+        double frac = position - index;
+        const unsigned char *a = self->fifo + index * frameBytes, *b = a + frameBytes;
+        unsigned char *out = self->buffer + i * bufferFrameBytes;
+
+        if( index + 1 >= self->fifoFrames )
         {
-            PA_ENSURE( PaAlsaStreamComponent_DetermineFramesPerBuffer( &self->capture, inputParameters, framesPerUserBuffer,
-                        sampleRate, hwParamsCapture, &accurate) );
-            framesPerHostBuffer = self->capture.framesPerPeriod;
+            PA_DEBUG(( "%s: Member underflow, %lu frames\n", __FUNCTION__, numFrames - i ));
+            memset( out, 0, ( numFrames - i ) * bufferFrameBytes );
+            break;
         }
-        else
+        for( int c = 0; c < self->numUserChannels; ++c )
         {
-            assert( self->playback.pcm );
-            PA_ENSURE( PaAlsaStreamComponent_DetermineFramesPerBuffer( &self->playback, outputParameters, framesPerUserBuffer,
-                        sampleRate, hwParamsPlayback, &accurate ) );
-            framesPerHostBuffer = self->playback.framesPerPeriod;
+            double x = AggregateMember_GetSample( self->nativeFormat, a, c );
+            AggregateMember_PutSample( self->bufferFormat, out, c,
+                    x + ( AggregateMember_GetSample( self->nativeFormat, b, c ) - x ) * frac );
         }
+        position += self->ratio;
     }
 
-    PA_UNLESS( framesPerHostBuffer != 0, paInternalError );
-    self->maxFramesPerHostBuffer = framesPerHostBuffer;
+    consumed = PA_MIN( (unsigned long)position, self->fifoFrames );
+    memmove( self->fifo, self->fifo + consumed * frameBytes, ( self->fifoFrames - consumed ) * frameBytes );
+    self->fifoFrames -= consumed;
+    self->position = position - consumed;
 
-    if( (self->playback.pcm && !self->playback.canMmap) || !accurate )
+    for( int c = 0; c < self->numUserChannels; ++c )
     {
-        /* Don't know the exact size per host buffer */
-        *hostBufferSizeMode = paUtilBoundedHostBufferSize;
-        /* Raise upper bound */
-        if( !accurate )
-            ++self->maxFramesPerHostBuffer;
+        PaUtil_SetInputChannel( bp, self->firstChannel + c, self->buffer + c * swidth, self->numUserChannels );
     }
+}
 
-error:
-    return result;
+static void AggregateMember_RegisterPlayback( PaAlsaAggregateMember *self, PaUtilBufferProcessor *bp )
+{
+    int swidth = alsa_snd_pcm_format_size( self->bufferFormat, 1 );
+
+    for( int c = 0; c < self->numUserChannels; ++c )
+    {
+        PaUtil_SetOutputChannel( bp, self->firstChannel + c, self->buffer + c * swidth, self->numUserChannels );
+    }
 }
 
-/** Set up ALSA stream parameters.
+/** Resample numFrames of output from the buffer processor and write them to a playback member.
  *
+ * Resampling interpolates between the frames of the buffer, preceded by the last frame of the previous buffer.
+ * Output that doesn't fit in the member's buffer is dropped. Host channels beyond the user's are silenced.
  */
-static PaError PaAlsaStream_Configure( PaAlsaStream *self, const PaStreamParameters *inParams, const PaStreamParameters*
-        outParams, double sampleRate, unsigned long framesPerUserBuffer, double* inputLatency, double* outputLatency,
-        PaUtilHostBufferSizeMode* hostBufferSizeMode )
+static void AggregateMember_Playback( PaAlsaAggregateMember *self, unsigned long numFrames )
 {
-    PaError result = paNoError;
-    unsigned int approximateSampleRate = (unsigned int)(sampleRate + 0.5);
-    double preciseSampleRate = sampleRate;
-    double preciseCaptureSampleRate = 0;
-    double precisePlaybackSampleRate = 0;
-    snd_pcm_hw_params_t* hwParamsCapture, * hwParamsPlayback;
+    size_t frameBytes = alsa_snd_pcm_format_size( self->nativeFormat, self->numHostChannels );
+    size_t bufferFrameBytes = alsa_snd_pcm_format_size( self->bufferFormat, self->numUserChannels );
+    const unsigned char *lastFrame = self->buffer + ( numFrames - 1 ) * bufferFrameBytes;
+    double position = self->position;
+    snd_pcm_sframes_t avail, written;
 
-    alsa_snd_pcm_hw_params_alloca( &hwParamsCapture );
-    alsa_snd_pcm_hw_params_alloca( &hwParamsPlayback );
+    if( !self->started || numFrames == 0 )
+    {
+        /* Not while priming the master's output */
+        return;
+    }
 
-    if( self->capture.pcm )
-        PA_ENSURE( PaAlsaStreamComponent_InitialConfigure( &self->capture, inParams, self->primeBuffers, hwParamsCapture,
-                    &approximateSampleRate ) );
-    if( self->playback.pcm )
-        PA_ENSURE( PaAlsaStreamComponent_InitialConfigure( &self->playback, outParams, self->primeBuffers, hwParamsPlayback,
-                    &approximateSampleRate ) );
+    if( ( avail = alsa_snd_pcm_avail_update( self->pcm ) ) < 0 )
+    {
+        AggregateMember_Recover( self, avail );
+        avail = alsa_snd_pcm_avail_update( self->pcm );
+    }
+    AggregateMember_UpdateRatio( self, (double)self->alsaBufferSize - PA_MAX( avail, 0 ), numFrames );
 
-    PA_ENSURE( PaAlsaStream_DetermineFramesPerBuffer( self, approximateSampleRate, inParams, outParams, framesPerUserBuffer,
-                hwParamsCapture, hwParamsPlayback, hostBufferSizeMode ) );
+    /* Positions are relative to the last frame of the previous buffer */
+    self->fifoFrames = 0;
+    while( position < numFrames && self->fifoFrames < self->fifoCapacity )
+    {
+        unsigned long index = (unsigned long)position;
+        double frac = position - index;
+        const unsigned char *b = self->buffer + index * bufferFrameBytes;
+        unsigned char *out = self->fifo + self->fifoFrames * frameBytes;
 
-    if( self->capture.pcm )
+        for( int c = 0; c < self->numHostChannels; ++c )
+        {
+            double value = 0.;
+            if( c < self->numUserChannels )
+            {
+                double x = index > 0 ? AggregateMember_GetSample( self->bufferFormat, b - bufferFrameBytes, c ) :
+                    self->lastFrame[c];
+                value = x + ( AggregateMember_GetSample( self->bufferFormat, b, c ) - x ) * frac;
+            }
+            AggregateMember_PutSample( self->nativeFormat, out, c, value );
+        }
+        ++self->fifoFrames;
+        position += 1. / self->ratio;
+    }
+    self->position = PA_MAX( position - numFrames, 0. );
+    for( int c = 0; c < self->numUserChannels; ++c )
     {
-        assert( self->capture.framesPerPeriod != 0 );
-        PA_ENSURE( PaAlsaStreamComponent_FinishConfigure( &self->capture, hwParamsCapture, inParams, self->primeBuffers, approximateSampleRate,
-                    inputLatency ) );
-        /* Now that we have finalized the hwParams, we can get a more accurate sample rate. */
-        ENSURE_( GetExactSampleRate( hwParamsCapture, &preciseCaptureSampleRate ), paUnanticipatedHostError );
-        PA_DEBUG(( "%s: Capture period size: %lu, latency: %f\n", __FUNCTION__, self->capture.framesPerPeriod, *inputLatency ));
-        preciseSampleRate = preciseCaptureSampleRate;
+        self->lastFrame[c] = AggregateMember_GetSample( self->bufferFormat, lastFrame, c );
     }
-    if( self->playback.pcm )
+
+    written = alsa_snd_pcm_writei( self->pcm, self->fifo, self->fifoFrames );
+    if( written < 0 && written != -EAGAIN )
     {
-        assert( self->playback.framesPerPeriod != 0 );
-        PA_ENSURE( PaAlsaStreamComponent_FinishConfigure( &self->playback, hwParamsPlayback, outParams, self->primeBuffers, approximateSampleRate,
-                    outputLatency ) );
-        /* Now that we have finalized the hwParams, we can get a more accurate sample rate. */
-        ENSURE_( GetExactSampleRate( hwParamsPlayback, &precisePlaybackSampleRate ), paUnanticipatedHostError );
-        PA_DEBUG(( "%s: Playback period size: %lu, latency: %f\n", __FUNCTION__, self->playback.framesPerPeriod, *outputLatency ));
-        preciseSampleRate = precisePlaybackSampleRate;
+        AggregateMember_Recover( self, written );
     }
+    else if( written < (snd_pcm_sframes_t)self->fifoFrames )
+    {
+        PA_DEBUG(( "%s: Member overflow, dropped %lu frames\n", __FUNCTION__,
+                    self->fifoFrames - PA_MAX( written, 0 ) ));
+    }
+}
 
-    /* Warn if the input and output rates are very different. */
-    if( self->capture.pcm && self->playback.pcm )
+/** Open the members of aggregate devices besides their masters, which the stream's components have opened.
+ *
+ * Members are serviced along with the master by the callback thread, blocking streams can't use aggregates.
+ */
+static PaError PaAlsaStream_OpenMembers( PaAlsaStream *self, const PaUtilHostApiRepresentation *hostApi,
+        const PaStreamParameters *inParams, const PaStreamParameters *outParams, double sampleRate )
+{
+    PaError result = paNoError;
+    const PaStreamParameters *params[2] = { inParams, outParams };
+    const PaAlsaAggregateSpec *aggregates[2] = { NULL, NULL };
+    PaAlsaStreamComponent *masters[2] = { &self->capture, &self->playback };
+    int maxMembers = 0;
+
+    for( int i = 0; i < 2; ++i )
     {
-        if (fabs(preciseCaptureSampleRate - precisePlaybackSampleRate) >= 1.0)
+        if( params[i] && params[i]->device != paUseHostApiSpecificDeviceSpecification &&
+                ( aggregates[i] = GetDeviceInfo( hostApi, params[i]->device )->aggregate ) )
         {
-            PA_DEBUG(( "%s: Warning: input and output sample rates differ, %f != %f\n",
-                    __FUNCTION__, preciseCaptureSampleRate, precisePlaybackSampleRate ));
+            maxMembers += aggregates[i]->numMembers - 1;
+            PA_UNLESS( IsAggregateFormat( masters[i]->nativeFormat ), paSampleFormatNotSupported );
         }
     }
+    if( !maxMembers )
+    {
+        goto error;
+    }
+    PA_UNLESS( self->callbackMode, paBadIODeviceCombination );
 
-    self->streamRepresentation.streamInfo.sampleRate = preciseSampleRate;
+    PA_UNLESS( self->members = (PaAlsaAggregateMember *)PaUtil_AllocateZeroInitializedMemory( maxMembers *
+                sizeof (PaAlsaAggregateMember) ), paInsufficientMemory );
+    for( int i = 0; i < 2; ++i )
+    {
+        StreamDirection streamDir = i == 0 ? StreamDirection_In : StreamDirection_Out;
+        int firstChannel = masters[i]->numUserChannels;
 
-    /* this will cause the two streams to automatically start/stop/prepare in sync.
-     * We only need to execute these operations on one of the pair.
-     * A: We don't want to do this on a blocking stream.
-     */
-    if( self->callbackMode && self->capture.pcm && self->playback.pcm )
+        for( int j = 1; aggregates[i] && j < aggregates[i]->numMembers; ++j )
+        {
+            int numChannels = GetAggregateMemberChannels( aggregates[i], streamDir, params[i]->channelCount, j );
+            if( numChannels == 0 )
+            {
+                break;
+            }
+            /* Counted first, so a partially opened member is closed */
+            PA_ENSURE( AggregateMember_Open( &self->members[self->numMembers++], aggregates[i]->memberNames[j],
+                        streamDir, firstChannel, numChannels, masters[i], sampleRate, self->maxFramesPerHostBuffer ) );
+            firstChannel += numChannels;
+        }
+    }
+
+error:
+    return result;
+}
+
+static void PaAlsaStream_CloseMembers( PaAlsaStream *self )
+{
+    for( int i = 0; i < self->numMembers; ++i )
     {
-        int err = alsa_snd_pcm_link( self->capture.pcm, self->playback.pcm );
-        if( err == 0 )
-            self->pcmsSynced = 1;
-        else
-            PA_DEBUG(( "%s: Unable to sync pcms: %s\n", __FUNCTION__, alsa_snd_strerror( err ) ));
+        AggregateMember_Close( &self->members[i] );
     }
+    PaUtil_FreeMemory( self->members );
+    self->members = NULL;
+    self->numMembers = 0;
+}
+
+static PaError PaAlsaStream_StartMembers( PaAlsaStream *self )
+{
+    PaError result = paNoError;
 
+    for( int i = 0; i < self->numMembers; ++i )
     {
-        unsigned long minFramesPerHostBuffer = PA_MIN( self->capture.pcm ? self->capture.framesPerPeriod : ULONG_MAX,
-            self->playback.pcm ? self->playback.framesPerPeriod : ULONG_MAX );
-        self->pollTimeout = CalculatePollTimeout( self, minFramesPerHostBuffer );    /* Period in msecs, rounded up */
+        PA_ENSURE( AggregateMember_Start( &self->members[i] ) );
+    }
 
-        /* Time before watchdog unthrottles realtime thread == 1/4 of period time in msecs */
-        /* self->threading.throttledSleepTime = (unsigned long) (minFramesPerHostBuffer / sampleRate / 4 * 1000); */
+error:
+    return result;
+}
+
+static void PaAlsaStream_StopMembers( PaAlsaStream *self )
+{
+    for( int i = 0; i < self->numMembers; ++i )
+    {
+        AggregateMember_Stop( &self->members[i] );
     }
+}
 
-    if( self->callbackMode )
+/** Register the buffers of members with the buffer processor, once the master's frame count is known.
+ *
+ * Input of capture members is read and resampled here, output of playback members is written in
+ * PaAlsaStream_EndMemberProcessing.
+ */
+static void PaAlsaStream_SetUpMemberBuffers( PaAlsaStream *self, unsigned long numFrames )
+{
+    for( int i = 0; i < self->numMembers; ++i )
     {
-        /* If the user expects a certain number of frames per callback we will either have to rely on block adaption
-         * (framesPerHostBuffer is not an integer multiple of framesPerPeriod) or we can simply align the number
-         * of host buffer frames with what the user specified */
-        if( self->framesPerUserBuffer != paFramesPerBufferUnspecified )
-        {
-            /* self->alignFrames = 1; */
+        PaAlsaAggregateMember *member = &self->members[i];
 
-            /* Unless the ratio between number of host and user buffer frames is an integer we will have to rely
-             * on block adaption */
-        /*
-            if( framesPerHostBuffer % framesPerPeriod != 0 || (self->capture.pcm && self->playback.pcm &&
-                        self->capture.framesPerPeriod != self->playback.framesPerPeriod) )
-                self->useBlockAdaption = 1;
-            else
-                self->alignFrames = 1;
-        */
+        if( StreamDirection_In == member->streamDir && self->capture.ready )
+        {
+            AggregateMember_Capture( member, &self->bufferProcessor, numFrames );
+        }
+        else if( StreamDirection_Out == member->streamDir && self->playback.ready )
+        {
+            AggregateMember_RegisterPlayback( member, &self->bufferProcessor );
         }
     }
+}
 
-error:
-    return result;
+static void PaAlsaStream_EndMemberProcessing( PaAlsaStream *self, unsigned long numFrames )
+{
+    for( int i = 0; i < self->numMembers; ++i )
+    {
+        if( StreamDirection_Out == self->members[i].streamDir )
+        {
+            AggregateMember_Playback( &self->members[i], numFrames );
+        }
+    }
 }
 
 static PaError OpenStream( struct PaUtilHostApiRepresentation *hostApi,
@@ -2882,10 +4921,15 @@ static PaError OpenStream( struct PaUtilHostApiRepresentation *hostApi,
     /* Operate with fixed host buffer size by default, since other modes will invariably lead to block adaption */
     /* XXX: Use Bounded by default? Output tends to get stuttery with Fixed ... */
     PaUtilHostBufferSizeMode hostBufferSizeMode = paUtilFixedHostBufferSize;
+    int locked = 0;
 
     if( ( streamFlags & paPlatformSpecificFlags ) != 0 )
         return paInvalidFlag;
 
+    /* The device monitor updates the device list in place */
+    PA_ENSURE( PaUnixMutex_Lock( &alsaHostApi->monitor.mtx ) );
+    locked = 1;
+
     if( inputParameters )
     {
         PA_ENSURE( ValidateParameters( inputParameters, hostApi, StreamDirection_In ) );
@@ -2911,9 +4955,26 @@ static PaError OpenStream( struct PaUtilHostApiRepresentation *hostApi,
     PA_UNLESS( stream = (PaAlsaStream*)PaUtil_AllocateZeroInitializedMemory( sizeof(PaAlsaStream) ), paInsufficientMemory );
     PA_ENSURE( PaAlsaStream_Initialize( stream, alsaHostApi, inputParameters, outputParameters, sampleRate,
                 framesPerBuffer, callback, streamFlags, userData ) );
+    stream->hostApi = hostApi;
+    if( inputParameters )
+    {
+        stream->inputParameters = *inputParameters;
+        stream->inputParameters.hostApiSpecificStreamInfo = NULL;
+    }
+    if( outputParameters )
+    {
+        stream->outputParameters = *outputParameters;
+        stream->outputParameters.hostApiSpecificStreamInfo = NULL;
+    }
+    stream->nominalSampleRate = sampleRate;
+    stream->streamFlags = streamFlags;
 
     PA_ENSURE( PaAlsaStream_Configure( stream, inputParameters, outputParameters, sampleRate, framesPerBuffer,
                 &inputLatency, &outputLatency, &hostBufferSizeMode ) );
+    PA_ENSURE( PaAlsaStream_OpenMembers( stream, hostApi, inputParameters, outputParameters, sampleRate ) );
+    PA_ENSURE( PaAlsaStream_ResizePollDescriptors( stream ) );
+    PaUnixMutex_Unlock( &alsaHostApi->monitor.mtx );
+    locked = 0;
     hostInputSampleFormat = stream->capture.hostSampleFormat | (!stream->capture.hostInterleaved ? paNonInterleaved : 0);
     hostOutputSampleFormat = stream->playback.hostSampleFormat | (!stream->playback.hostInterleaved ? paNonInterleaved : 0);
 
@@ -2938,6 +4999,10 @@ static PaError OpenStream( struct PaUtilHostApiRepresentation *hostApi,
     return result;
 
 error:
+    if( locked )
+    {
+        PaUnixMutex_Unlock( &alsaHostApi->monitor.mtx );
+    }
     if( stream )
     {
         PA_DEBUG(( "%s: Stream in error, terminating\n", __FUNCTION__ ));
@@ -2960,11 +5025,53 @@ static PaError CloseStream( PaStream* s )
     return result;
 }
 
+/** Restart the time info clock of a component, see PaAlsaStreamComponent_GetBufferTime. */
+static void PaAlsaStreamComponent_ResetClock( PaAlsaStreamComponent *self )
+{
+    self->clock.valid = 0;
+    self->framesTransferred = 0;
+    self->clockResyncTime = 0;
+}
+
+/** The number of frames of silence to start playback with.
+ *
+ * Normally the buffer is filled up to the watermark. When restarting after an xrun with one of the faster
+ * recovery modes, a single period is enough to keep playing until the next wakeup.
+ */
+static snd_pcm_uframes_t PaAlsaStream_SilenceFrames( const PaAlsaStream *stream )
+{
+    if( stream->xrunTime && paAlsaXrunRecoverySilence != stream->xrunRecovery )
+        return stream->playback.framesPerPeriod;
+    return stream->playback.watermark;
+}
+
+/** Silence the buffer of a playback component without mmap access, the counterpart of SilenceBuffer.
+ *
+ * The silence is written in one go after preparing the pcm.
+ */
+static PaError SilenceNonMmapBuffer( PaAlsaStream *stream )
+{
+    PaError result = paNoError;
+    PaAlsaStreamComponent *self = &stream->playback;
+    snd_pcm_uframes_t frames = PA_MIN( PaAlsaStream_SilenceFrames( stream ), self->nonMmapFrames );
+    int xrun = 0;
+
+    alsa_snd_pcm_areas_silence( self->nonMmapAreas, 0, self->numHostChannels, frames, self->nativeFormat );
+    self->nonMmapPending = frames;
+    PA_ENSURE( PaAlsaStreamComponent_FlushOutput( self, &xrun ) );
+    PA_UNLESS( !xrun, paInternalError );
+
+error:
+    return result;
+}
+
 static void SilenceBuffer( PaAlsaStream *stream )
 {
     const snd_pcm_channel_area_t *areas;
     snd_pcm_uframes_t frames = (snd_pcm_uframes_t)alsa_snd_pcm_avail_update( stream->playback.pcm ), offset;
 
+    /* Don't fill beyond the latency of a timer-scheduled stream */
+    frames = PA_MIN( frames, PaAlsaStream_SilenceFrames( stream ) );
     alsa_snd_pcm_mmap_begin( stream->playback.pcm, &areas, &offset, &frames );
     alsa_snd_pcm_areas_silence( areas, offset, stream->playback.numHostChannels, frames, stream->playback.nativeFormat );
     alsa_snd_pcm_mmap_commit( stream->playback.pcm, offset, frames );
@@ -2983,6 +5090,10 @@ static PaError AlsaStart( PaAlsaStream *stream, int priming )
 {
     PaError result = paNoError;
 
+    /* Positions are counted anew, the clocks resync from the first timestamps */
+    PaAlsaStreamComponent_ResetClock( &stream->capture );
+    PaAlsaStreamComponent_ResetClock( &stream->playback );
+
     if( stream->playback.pcm )
     {
         if( stream->callbackMode )
@@ -2992,9 +5103,16 @@ static PaError AlsaStart( PaAlsaStream *stream, int priming )
                 /* Buffer isn't primed, so prepare and silence */
                 ENSURE_( alsa_snd_pcm_prepare( stream->playback.pcm ), paUnanticipatedHostError );
                 if( stream->playback.canMmap )
+                {
                     SilenceBuffer( stream );
+                }
+                else
+                {
+                    PA_ENSURE( SilenceNonMmapBuffer( stream ) );
+                }
             }
-            if( stream->playback.canMmap )
+            /* The pcm may already have been started by the start threshold, while priming or silencing */
+            if( alsa_snd_pcm_state( stream->playback.pcm ) == SND_PCM_STATE_PREPARED )
                 ENSURE_( alsa_snd_pcm_start( stream->playback.pcm ), paUnanticipatedHostError );
         }
         else
@@ -3006,6 +5124,7 @@ static PaError AlsaStart( PaAlsaStream *stream, int priming )
         /* For a blocking stream we want to start capture as well, since nothing will happen otherwise */
         ENSURE_( alsa_snd_pcm_start( stream->capture.pcm ), paUnanticipatedHostError );
     }
+    PA_ENSURE( PaAlsaStream_StartMembers( stream ) );
 
 end:
     return result;
@@ -3060,13 +5179,30 @@ static PaError StartStream( PaStream *s )
     PaAlsaStream* stream = (PaAlsaStream*)s;
     int streamStarted = 0;  /* So we can know whether we need to take the stream down */
 
+    PA_UNLESS( !stream->reconfigureFailed, paUnanticipatedHostError );
+
     /* Ready the processor */
     PaUtil_ResetBufferProcessor( &stream->bufferProcessor );
 
     /* Set now, so we can test for activity further down */
     stream->isActive = 1;
-
+    stream->stopRequested = 0;
+    stream->abortRequested = 0;
+    stream->xrunTime = 0;
+    stream->regenerateOutput = 0;
     if( stream->callbackMode )
+    {
+        DrainWakePipe( stream->stopFds );
+    }
+
+    if( stream->callbackMode && stream->useSharedEngine )
+    {
+        stream->engineCallbackResult = paContinue;
+        PA_ENSURE( PaAlsaStream_StartCallbackMode( stream, &stream->engineCallbackResult ) );
+        streamStarted = 1;
+        PA_ENSURE( PaAlsaEngine_Attach( stream->engine, stream, stream->rtSched ) );
+    }
+    else if( stream->callbackMode )
     {
         PA_ENSURE( PaUnixThread_New( &stream->thread, &CallbackThreadFunc, stream, 1., stream->rtSched ) );
     }
@@ -3081,7 +5217,10 @@ end:
 error:
     if( streamStarted )
     {
-        AbortStream( stream );
+        if( stream->callbackMode )
+            AlsaStop( stream, 1 );  /* Failed attaching to the shared engine */
+        else
+            AbortStream( stream );
     }
     stream->isActive = 0;
 
@@ -3140,6 +5279,7 @@ static PaError AlsaStop( PaAlsaStream *stream, int abort )
             }
         }
     }
+    PaAlsaStream_StopMembers( stream );
 
 end:
     return result;
@@ -3159,20 +5299,28 @@ error:
 static PaError RealStop( PaAlsaStream *stream, int abort )
 {
     PaError result = paNoError;
+#ifdef PA_ENABLE_DEBUG_OUTPUT
+    PaTime stopTime = PaUtil_GetTime();
+#endif
 
-    /* First deal with the callback thread, cancelling and/or joining
-     * it if necessary
+    /* First deal with the callback thread, waking it up and joining it. The thread is never cancelled,
+     * an abort just tells it not to flush buffered output.
      */
-    if( stream->callbackMode )
+    if( stream->callbackMode && stream->useSharedEngine )
+    {
+        stream->abortRequested = abort;
+        PA_ENSURE( PaAlsaEngine_Detach( stream->engine, stream ) );
+        stream->callback_finished = 0;
+    }
+    else if( stream->callbackMode )
     {
         PaError threadRes;
-        stream->callbackAbort = abort;
+        stream->abortRequested = abort;
+        stream->stopRequested = 1;
 
-        if( !abort )
-        {
-            PA_DEBUG(( "Stopping callback\n" ));
-        }
-        PA_ENSURE( PaUnixThread_Terminate( &stream->thread, !abort, &threadRes ) );
+        PA_DEBUG(( "%s callback\n", abort ? "Aborting" : "Stopping" ));
+        SignalWakePipe( stream->stopFds );
+        PA_ENSURE( PaUnixThread_Terminate( &stream->thread, 1, &threadRes ) );
         if( threadRes != paNoError )
         {
             PA_DEBUG(( "Callback thread returned: %d\n", threadRes ));
@@ -3190,6 +5338,8 @@ static PaError RealStop( PaAlsaStream *stream, int abort )
     }
 
     stream->isActive = 0;
+    PA_DEBUG(( "%s: Stream %s in %.3f ms\n", __FUNCTION__, abort ? "aborted" : "stopped",
+                ( PaUtil_GetTime() - stopTime ) * 1000. ));
 
 end:
     return result;
@@ -3226,11 +5376,29 @@ static PaError IsStreamActive( PaStream *s )
     return stream->isActive;
 }
 
-/** Extract audio/trigger htstamp from status and convert into PaTime (seconds).
+/** Convert an ALSA timestamp of the component into nanoseconds of the same clock as PaUtil_GetTimeNs.
+ *
+ * gettimeofday timestamps are moved by the current distance between the clocks, so that a step of the wall clock
+ * only offsets the ones taken before it.
+ */
+static PaUtilTimeNs PaAlsaStreamComponent_TimestampToNs( const PaAlsaStreamComponent *self,
+        const snd_htimestamp_t *timestamp )
+{
+    PaUtilTimeNs ns = (PaUtilTimeNs)timestamp->tv_sec * 1000000000 + timestamp->tv_nsec;
+    struct timespec realtime;
+
+    if( self->monotonicTstamps || clock_gettime( CLOCK_REALTIME, &realtime ) != 0 )
+    {
+        return ns;
+    }
+    return ns + PaUtil_GetTimeNs() - ( (PaUtilTimeNs)realtime.tv_sec * 1000000000 + realtime.tv_nsec );
+}
+
+/** Get the audio or trigger timestamp from a status of the component, see PaAlsaStreamComponent_TimestampToNs.
  *
- * trigger is boolean:  trigger stampstamp vs audio timestamp.  If delay is non-NULL, return delay in
- * frames.  */
-static PaTime StatusToTime( const snd_pcm_status_t *status, int trigger, snd_pcm_uframes_t* delay )
+ * If delay is non-NULL, return delay in frames. */
+static PaUtilTimeNs StatusToTimeNs( const PaAlsaStreamComponent *self, const snd_pcm_status_t *status, int trigger,
+        snd_pcm_uframes_t* delay )
 {
     snd_htimestamp_t timestamp;
     if ( trigger )
@@ -3243,42 +5411,159 @@ static PaTime StatusToTime( const snd_pcm_status_t *status, int trigger, snd_pcm
     }
     if ( delay )
     {
-        *delay = alsa_snd_pcm_status_get_delay( status );
+        *delay = alsa_snd_pcm_status_get_delay( status );
+    }
+    return PaAlsaStreamComponent_TimestampToNs( self, &timestamp );
+}
+
+/** The stream's clock is the one of PaUtil_GetTimeNs, which ALSA timestamps are taken from as well
+ * (SND_PCM_TSTAMP_TYPE_MONOTONIC) or converted to. Reading it doesn't require a syscall.
+ */
+static PaTime GetStreamTime( PaStream *s )
+{
+    (void)s;
+    return PaUtil_NsToTime( PaUtil_GetTimeNs() );
+}
+
+static double GetStreamCpuLoad( PaStream* s )
+{
+    PaAlsaStream *stream = (PaAlsaStream*)s;
+
+    return PaUtil_GetCpuLoad( &stream->cpuLoadMeasurer );
+}
+
+/** Configure the devices of a stopped stream for a new latency.
+ *
+ * The pcms stay open, their hardware and software parameters are set anew, as are those of aggregate members.
+ * The buffer processor is kept unless the host buffer size or mode changed, which doesn't happen if the user
+ * buffer size was specified and the period size follows it.
+ */
+/** Make room in pfds for the poll descriptors of the pcms, their number may change when they are configured anew.
+ */
+static PaError PaAlsaStream_ResizePollDescriptors( PaAlsaStream *self )
+{
+    PaError result = paNoError;
+    int captureNfds = self->capture.pcm ? alsa_snd_pcm_poll_descriptors_count( self->capture.pcm ) : 0;
+    int playbackNfds = self->playback.pcm ? alsa_snd_pcm_poll_descriptors_count( self->playback.pcm ) : 0;
+    struct pollfd *pfds;
+
+    PA_UNLESS( captureNfds >= 0 && playbackNfds >= 0, paUnanticipatedHostError );
+    if( captureNfds + playbackNfds > self->capture.nfds + self->playback.nfds )
+    {
+        /* As in PaAlsaStream_Initialize, with room for the stop pipe and the timer */
+        PA_UNLESS( pfds = (struct pollfd*)PaUtil_AllocateZeroInitializedMemory( ( captureNfds + playbackNfds + 2 ) *
+                        sizeof( struct pollfd ) ), paInsufficientMemory );
+        PaUtil_FreeMemory( self->pfds );
+        self->pfds = pfds;
+    }
+    self->capture.nfds = captureNfds;
+    self->playback.nfds = playbackNfds;
+
+error:
+    return result;
+}
+
+/** Configure the pcms of a stopped stream anew, with the suggested latencies in its parameters.
+ */
+static PaError PaAlsaStream_Reconfigure( PaAlsaStream *self, PaTime *inLatency, PaTime *outLatency,
+        PaUtilHostBufferSizeMode *hostBufferSizeMode )
+{
+    PaError result = paNoError;
+    const PaStreamParameters *inParams = self->capture.pcm ? &self->inputParameters : NULL;
+    const PaStreamParameters *outParams = self->playback.pcm ? &self->outputParameters : NULL;
+    PaUnixMutex *monitorMtx = &((PaAlsaHostApiRepresentation *)self->hostApi)->monitor.mtx;
+    int locked = 0;
+
+    PaAlsaStream_CloseMembers( self );
+    /* Linked again by PaAlsaStream_Configure */
+    if( self->pcmsSynced )
+    {
+        ENSURE_( alsa_snd_pcm_unlink( self->capture.pcm ), paUnanticipatedHostError );
+        self->pcmsSynced = 0;
+    }
+
+    /* The device monitor updates the device list in place */
+    PA_ENSURE( PaUnixMutex_Lock( monitorMtx ) );
+    locked = 1;
+    PA_ENSURE( PaAlsaStream_Configure( self, inParams, outParams, self->nominalSampleRate, self->framesPerUserBuffer,
+                inLatency, outLatency, hostBufferSizeMode ) );
+    PA_ENSURE( PaAlsaStream_OpenMembers( self, self->hostApi, inParams, outParams, self->nominalSampleRate ) );
+    PA_ENSURE( PaAlsaStream_ResizePollDescriptors( self ) );
+
+error:
+    if( locked )
+    {
+        PaUnixMutex_Unlock( monitorMtx );
     }
-    return timestamp.tv_sec + ( (PaTime)timestamp.tv_nsec * 1e-9 );
+    return result;
 }
 
-static PaTime GetStreamTime( PaStream *s )
+static PaError SetStreamLatency( PaStream *s, PaTime inputLatency, PaTime outputLatency )
 {
+    PaError result = paNoError;
     PaAlsaStream *stream = (PaAlsaStream*)s;
-
-    snd_timestamp_t timestamp;
-    snd_pcm_status_t* status;
-    alsa_snd_pcm_status_alloca( &status );
-
-    /* TODO: what if we have both?  does it really matter? */
-
-    /* TODO: if running in callback mode, this will mean
-     * libasound routines are being called from multiple threads.
-     * need to verify that libasound is thread-safe. */
-
-    if( stream->capture.pcm )
-    {
-        alsa_snd_pcm_status( stream->capture.pcm, status );
+    PaUtilHostBufferSizeMode hostBufferSizeMode = paUtilFixedHostBufferSize;
+    unsigned long maxFramesPerHostBuffer = stream->maxFramesPerHostBuffer;
+    PaTime inLatency = 0., outLatency = 0.;
+    PaTime oldInputLatency = stream->inputParameters.suggestedLatency,
+           oldOutputLatency = stream->outputParameters.suggestedLatency;
+    double sampleRate = stream->nominalSampleRate;
+
+    PA_UNLESS( !stream->reconfigureFailed, paUnanticipatedHostError );
+
+    stream->inputParameters.suggestedLatency = inputLatency;
+    stream->outputParameters.suggestedLatency = outputLatency;
+
+    result = PaAlsaStream_Reconfigure( stream, &inLatency, &outLatency, &hostBufferSizeMode );
+    if( result == paNoError && ( stream->maxFramesPerHostBuffer != maxFramesPerHostBuffer ||
+            hostBufferSizeMode != stream->bufferProcessor.hostBufferSizeMode ) )
+    {
+        /* Initialized aside, so the stream keeps a valid buffer processor if this fails */
+        PaUtilBufferProcessor bufferProcessor;
+
+        result = PaUtil_InitializeBufferProcessor( &bufferProcessor,
+                        stream->bufferProcessor.inputChannelCount, stream->inputParameters.sampleFormat,
+                        stream->capture.hostSampleFormat | (!stream->capture.hostInterleaved ? paNonInterleaved : 0),
+                        stream->bufferProcessor.outputChannelCount, stream->outputParameters.sampleFormat,
+                        stream->playback.hostSampleFormat | (!stream->playback.hostInterleaved ? paNonInterleaved : 0),
+                        sampleRate, stream->streamFlags, stream->framesPerUserBuffer, stream->maxFramesPerHostBuffer,
+                        hostBufferSizeMode, stream->streamRepresentation.streamCallback,
+                        stream->streamRepresentation.userData );
+        if( result == paNoError )
+        {
+            PaUtil_TerminateBufferProcessor( &stream->bufferProcessor );
+            stream->bufferProcessor = bufferProcessor;
+        }
     }
-    else if( stream->playback.pcm )
+    if( result != paNoError )
     {
-        alsa_snd_pcm_status( stream->playback.pcm, status );
+        /* Go back to the configuration the buffer processor was set up for, so the stream stays usable */
+        PA_DEBUG(( "%s: Failed to apply latencies, restoring the previous ones\n", __FUNCTION__ ));
+        stream->inputParameters.suggestedLatency = oldInputLatency;
+        stream->outputParameters.suggestedLatency = oldOutputLatency;
+        if( PaAlsaStream_Reconfigure( stream, &inLatency, &outLatency, &hostBufferSizeMode ) != paNoError ||
+                stream->maxFramesPerHostBuffer != maxFramesPerHostBuffer ||
+                hostBufferSizeMode != stream->bufferProcessor.hostBufferSizeMode )
+        {
+            PA_DEBUG(( "%s: Failed to restore the previous latencies, the stream can't be started\n", __FUNCTION__ ));
+            stream->reconfigureFailed = 1;
+        }
+        goto error;
     }
 
-    return StatusToTime( status, 0, NULL );
-}
+    if( stream->capture.pcm )
+        stream->streamRepresentation.streamInfo.inputLatency = inLatency + (PaTime)(
+                PaUtil_GetBufferProcessorInputLatencyFrames( &stream->bufferProcessor ) / sampleRate);
+    if( stream->playback.pcm )
+        stream->streamRepresentation.streamInfo.outputLatency = outLatency + (PaTime)(
+                PaUtil_GetBufferProcessorOutputLatencyFrames( &stream->bufferProcessor ) / sampleRate);
 
-static double GetStreamCpuLoad( PaStream* s )
-{
-    PaAlsaStream *stream = (PaAlsaStream*)s;
+    PA_DEBUG(( "%s: Stream: maxFramesPerHostBuffer = %lu, latency i=%f, o=%f\n", __FUNCTION__,
+                stream->maxFramesPerHostBuffer, stream->streamRepresentation.streamInfo.inputLatency,
+                stream->streamRepresentation.streamInfo.outputLatency ));
 
-    return PaUtil_GetCpuLoad( &stream->cpuLoadMeasurer );
+error:
+    return result;
 }
 
 /* Set the stream sample rate to a nominal value requested; allow only a defined tolerance range */
@@ -3353,18 +5638,57 @@ error:
     return result;
 }
 
+/** Account for an xrun in the stream's statistics.
+ *
+ * @param inputXruns The number of capture xruns to add
+ * @param outputXruns The number of playback xruns to add
+ * The recovery time is recorded unless output is yet to be regenerated, see PaAlsaStream_RegenerateOutput.
+ */
+static void PaAlsaStream_UpdateXrunStatistics( PaAlsaStream *self, int inputXruns, int outputXruns )
+{
+    PaAlsaXrunStatistics *stats = &self->xrunStats;
+    PaTime recoveryTime;
+
+    if( !self->xrunTime )
+        return;
+
+    ASSERT_CALL_( PaUnixMutex_Lock( &self->stateMtx ), paNoError );
+    stats->inputXruns += inputXruns;
+    stats->outputXruns += outputXruns;
+    if( !self->regenerateOutput )
+    {
+        recoveryTime = PaUtil_NsToTime( PaUtil_GetTimeNs() - self->xrunTime );
+        stats->lastRecoveryTime = recoveryTime;
+        stats->maxRecoveryTime = PA_MAX( stats->maxRecoveryTime, recoveryTime );
+        stats->totalRecoveryTime += recoveryTime;
+    }
+    ASSERT_CALL_( PaUnixMutex_Unlock( &self->stateMtx ), paNoError );
+
+    if( !self->regenerateOutput )
+    {
+        PA_DEBUG(( "%s: Recovered from xrun in %.3f ms\n", __FUNCTION__, recoveryTime * 1000. ));
+        self->xrunTime = 0;
+    }
+}
+
 /** Recover from xrun state.
  *
+ * How the pcms are restarted depends on the stream's PaAlsaXrunRecovery mode. If output is to be regenerated, the
+ * pcms are only stopped here, the callback thread restarts them with PaAlsaStream_RegenerateOutput once it is
+ * back outside of buffer processing.
  */
 static PaError PaAlsaStream_HandleXrun( PaAlsaStream *self )
 {
     PaError result = paNoError;
     snd_pcm_status_t *st;
-    PaTime now = PaUtil_GetTime();
+    PaUtilTimeNs now = PaUtil_GetTimeNs(), trigger;
     snd_timestamp_t t;
     int restartAlsa = 0; /* do not restart Alsa by default */
+    int inputXruns = 0, outputXruns = 0;
 
     alsa_snd_pcm_status_alloca( &st );
+    /* Output that wasn't accepted before the xrun is stale by now */
+    self->playback.nonMmapPending = 0;
 
     if( self->playback.pcm )
     {
@@ -3372,7 +5696,10 @@ static PaError PaAlsaStream_HandleXrun( PaAlsaStream *self )
         if( alsa_snd_pcm_status_get_state( st ) == SND_PCM_STATE_XRUN )
         {
             alsa_snd_pcm_status_get_trigger_tstamp( st, &t );
-            self->underrun = ( now - StatusToTime( st, 1, NULL ) ) * 1000;
+            trigger = StatusToTimeNs( &self->playback, st, 1, NULL );
+            self->underrun = ( now - trigger ) * 1e-6;
+            self->xrunTime = trigger;
+            ++outputXruns;
 
             if( !self->playback.canMmap )
             {
@@ -3391,7 +5718,11 @@ static PaError PaAlsaStream_HandleXrun( PaAlsaStream *self )
         alsa_snd_pcm_status( self->capture.pcm, st );
         if( alsa_snd_pcm_status_get_state( st ) == SND_PCM_STATE_XRUN )
         {
-            self->overrun = ( now - StatusToTime( st, 1, NULL ) ) * 1000;
+            trigger = StatusToTimeNs( &self->capture, st, 1, NULL );
+            self->overrun = ( now - trigger ) * 1e-6;
+            if( !self->xrunTime || trigger < self->xrunTime )
+                self->xrunTime = trigger;
+            ++inputXruns;
 
             if (!self->capture.canMmap)
             {
@@ -3408,9 +5739,22 @@ static PaError PaAlsaStream_HandleXrun( PaAlsaStream *self )
 
     if( restartAlsa )
     {
-        PA_DEBUG(( "%s: restarting Alsa to recover from XRUN\n", __FUNCTION__ ));
-        PA_ENSURE( AlsaRestart( self ) );
+        if( self->callbackMode && self->playback.pcm && paAlsaXrunRecoveryRegenerate == self->xrunRecovery )
+        {
+            PA_DEBUG(( "%s: stopping Alsa to regenerate output after XRUN\n", __FUNCTION__ ));
+            PA_ENSURE( PaUnixMutex_Lock( &self->stateMtx ) );
+            result = AlsaStop( self, 0 );
+            PA_ENSURE( PaUnixMutex_Unlock( &self->stateMtx ) );
+            PA_ENSURE( result );
+            self->regenerateOutput = 1;
+        }
+        else
+        {
+            PA_DEBUG(( "%s: restarting Alsa to recover from XRUN\n", __FUNCTION__ ));
+            PA_ENSURE( AlsaRestart( self ) );
+        }
     }
+    PaAlsaStream_UpdateXrunStatistics( self, inputXruns, outputXruns );
 
 end:
     return result;
@@ -3501,44 +5845,111 @@ static void OnExit( void *data )
     stream->isActive = 0;
 }
 
-static void CalculateTimeInfo( PaAlsaStream *stream, PaStreamCallbackTimeInfo *timeInfo )
+/** Feed the loop with the time at which the device was at position.
+ *
+ * The loop follows the timestamps of the device with a second order filter, which smoothes the jitter of the
+ * timestamps and tracks the actual sample rate. Positions without progress since the last update are ignored.
+ */
+static void PaAlsaClock_Update( PaAlsaClock *self, long long position, PaUtilTimeNs time, double sampleRate )
 {
-    snd_pcm_status_t *status;
-    PaTime capture_time = 0., playback_time = 0.;
+    double predicted, error, omega;
+    long long frames = position - self->position;
 
-    alsa_snd_pcm_status_alloca( &status );
+    if( self->valid && frames <= 0 )
+    {
+        return;
+    }
 
-    if( stream->capture.pcm )
+    predicted = self->time + frames * self->framePeriod;
+    error = time - predicted;
+    if( !self->valid || fabs( error ) > CLOCK_MAX_ERROR_NS )
     {
-        snd_pcm_sframes_t capture_delay;
+        self->valid = 1;
+        self->position = position;
+        self->time = time;
+        self->framePeriod = 1e9 / sampleRate;
+        return;
+    }
+
+    omega = 2. * M_PI * CLOCK_BANDWIDTH * frames / sampleRate;
+    self->time = predicted + sqrt( 2. ) * omega * error;
+    self->framePeriod += omega * omega * error / frames;
+    self->position = position;
+}
+
+/** The time at which the device is at position.
+ */
+static PaUtilTimeNs PaAlsaClock_TimeOf( const PaAlsaClock *self, long long position )
+{
+    return (PaUtilTimeNs)( self->time + ( position - self->position ) * self->framePeriod );
+}
+
+/** The time at which the next frame to be read was captured, or the next frame to be written will be played.
+ *
+ * The device's position is the number of frames transferred, minus the frames queued for playback or plus the
+ * frames available for reading. It is timestamped by ALSA when the hw pointer is updated, which
+ * snd_pcm_htimestamp reads from the mmapped status of hw devices without a syscall. Only every CLOCK_RESYNC_NS,
+ * snd_pcm_status is used to find the delay beyond the buffer, which snd_pcm_htimestamp doesn't report.
+ */
+static PaUtilTimeNs PaAlsaStreamComponent_GetBufferTime( PaAlsaStreamComponent *self, PaUtilTimeNs now,
+        double sampleRate )
+{
+    snd_pcm_uframes_t avail;
+    snd_htimestamp_t timestamp;
+    int sign = StreamDirection_In == self->streamDir ? 1 : -1;
 
-        alsa_snd_pcm_status( stream->capture.pcm, status );
-        capture_time = StatusToTime( status, 0, &capture_delay );
+    if( now >= self->clockResyncTime || !alsa_snd_pcm_htimestamp )
+    {
+        snd_pcm_status_t *status;
+        snd_pcm_sframes_t bufferDelay;
 
-        timeInfo->currentTime = capture_time;
-        timeInfo->inputBufferAdcTime = capture_time -
-            (PaTime)capture_delay / stream->streamRepresentation.streamInfo.sampleRate;
+        alsa_snd_pcm_status_alloca( &status );
+        alsa_snd_pcm_status( self->pcm, status );
+        avail = alsa_snd_pcm_status_get_avail( status );
+        bufferDelay = StreamDirection_In == self->streamDir ? (snd_pcm_sframes_t)avail :
+            (snd_pcm_sframes_t)self->alsaBufferSize - (snd_pcm_sframes_t)avail;
+        self->extraDelay = PA_MAX( alsa_snd_pcm_status_get_delay( status ) - bufferDelay, 0 );
+        PaAlsaClock_Update( &self->clock, self->framesTransferred + sign * ( StreamDirection_In == self->streamDir ?
+                    (long long)avail : (long long)( self->alsaBufferSize - avail ) ),
+                StatusToTimeNs( self, status, 0, NULL ), sampleRate );
+        self->clockResyncTime = now + CLOCK_RESYNC_NS;
     }
-    if( stream->playback.pcm )
+    else if( alsa_snd_pcm_htimestamp( self->pcm, &avail, &timestamp ) == 0 )
     {
-        snd_pcm_sframes_t playback_delay;
-        PaTime playback_time;
+        PaAlsaClock_Update( &self->clock, self->framesTransferred + sign * ( StreamDirection_In == self->streamDir ?
+                    (long long)avail : (long long)( self->alsaBufferSize - avail ) ),
+                PaAlsaStreamComponent_TimestampToNs( self, &timestamp ), sampleRate );
+    }
 
-        alsa_snd_pcm_status( stream->playback.pcm, status );
-        playback_time = StatusToTime( status, 0, &playback_delay );
+    if( !self->clock.valid )
+    {
+        return now;
+    }
+    /* Output is processed behind any frames ALSA hasn't accepted yet */
+    return PaAlsaClock_TimeOf( &self->clock, self->framesTransferred + self->nonMmapPending ) -
+        (PaUtilTimeNs)( sign * self->extraDelay * 1e9 / sampleRate );
+}
 
-        if( stream->capture.pcm ) /* Full duplex */
-        {
-            /* Hmm, we have both a playback and a capture timestamp.
-             * Hopefully they are the same... */
-            if( fabs( capture_time - playback_time ) > 0.01 )
-                PA_DEBUG(( "Capture time and playback time differ by %f\n", fabs( capture_time-playback_time ) ));
-        }
-        else
-            timeInfo->currentTime = playback_time;
+/** Calculate the time info passed to the stream callback.
+ *
+ * Rather than querying the status of the devices for every buffer, which is a syscall per device, the buffer times
+ * are derived from per device delay-locked loops (see PaAlsaStreamComponent_GetBufferTime).
+ */
+static void CalculateTimeInfo( PaAlsaStream *stream, PaStreamCallbackTimeInfo *timeInfo )
+{
+    PaUtilTimeNs now = PaUtil_GetTimeNs();
+    double sampleRate = stream->streamRepresentation.streamInfo.sampleRate;
 
-        timeInfo->outputBufferDacTime = timeInfo->currentTime +
-            (PaTime)playback_delay / stream->streamRepresentation.streamInfo.sampleRate;
+    timeInfo->currentTime = PaUtil_NsToTime( now );
+    if( stream->capture.pcm )
+    {
+        timeInfo->inputBufferAdcTime = PaUtil_NsToTime(
+                PaAlsaStreamComponent_GetBufferTime( &stream->capture, now, sampleRate ) );
+    }
+    if( stream->playback.pcm )
+    {
+        timeInfo->outputBufferDacTime = PaUtil_NsToTime(
+                PaAlsaStreamComponent_GetBufferTime( &stream->playback, now, sampleRate ) );
     }
 }
 
@@ -3560,27 +5971,18 @@ static PaError PaAlsaStreamComponent_EndProcessing( PaAlsaStreamComponent *self,
     if( !self->ready )
         goto end;
 
-    if( !self->canMmap && StreamDirection_Out == self->streamDir )
+    if( !self->canMmap )
     {
-        /* Play sound */
-        if( self->hostInterleaved )
-            res = alsa_snd_pcm_writei( self->pcm, self->nonMmapBuffer, numFrames );
-        else
+        /* Input has been read already, output is queued behind frames ALSA didn't accept yet */
+        if( StreamDirection_Out == self->streamDir )
         {
-            void *bufs[self->numHostChannels];
-            int bufsize = alsa_snd_pcm_format_size( self->nativeFormat, self->framesPerPeriod + 1 );
-            unsigned char *buffer = self->nonMmapBuffer;
-            for( int i = 0; i < self->numHostChannels; ++i )
-            {
-                bufs[i] = buffer;
-                buffer += bufsize;
-            }
-            res = alsa_snd_pcm_writen( self->pcm, bufs, numFrames );
+            self->nonMmapPending += numFrames;
+            PA_ENSURE( PaAlsaStreamComponent_FlushOutput( self, xrun ) );
         }
+        goto end;
     }
 
-    if( self->canMmap )
-        res = alsa_snd_pcm_mmap_commit( self->pcm, self->offset, numFrames );
+    res = alsa_snd_pcm_mmap_commit( self->pcm, self->offset, numFrames );
 
     if( res == -EPIPE )
     {
@@ -3597,6 +5999,75 @@ static PaError PaAlsaStreamComponent_EndProcessing( PaAlsaStreamComponent *self,
     else
     {
         ENSURE_( res, paUnanticipatedHostError );
+        self->framesTransferred += numFrames;
+    }
+
+end:
+error:
+    return result;
+}
+
+/** Write the processed frames of a playback component without mmap access to ALSA.
+ *
+ * All pending frames are passed in a single call. In callback mode the pcm is non-blocking, in which case ALSA may
+ * accept only part of them. The rest is moved to the front of the buffer, and written before the next frames, which
+ * are processed behind them. Frames are counted as transferred once ALSA has accepted them.
+ */
+static PaError PaAlsaStreamComponent_FlushOutput( PaAlsaStreamComponent *self, int *xrun )
+{
+    PaError result = paNoError;
+    snd_pcm_sframes_t res;
+
+    if( self->nonMmapPending == 0 )
+        goto end;
+
+    if( self->hostInterleaved )
+        res = alsa_snd_pcm_writei( self->pcm, self->nonMmapBuffer, self->nonMmapPending );
+    else
+    {
+        void *bufs[self->numHostChannels];
+        for( int i = 0; i < self->numHostChannels; ++i )
+            bufs[i] = self->nonMmapAreas[i].addr;
+        res = alsa_snd_pcm_writen( self->pcm, bufs, self->nonMmapPending );
+    }
+
+    if( res == -EAGAIN )
+    {
+        res = 0;
+    }
+    else if( res == -EPIPE
+    // ESTRPIPE is provided by the Linux kernel headers, and is unavailable
+    // on the BSDs, which can still use alsalib.
+#if defined(ESTRPIPE) && ESTRPIPE != EPIPE
+            || res == -ESTRPIPE
+#endif
+           )
+    {
+        *xrun = 1;
+        self->nonMmapPending = 0;
+        goto end;
+    }
+    ENSURE_( res, paUnanticipatedHostError );
+
+    self->framesTransferred += res;
+    self->nonMmapPending -= res;
+    if( res > 0 && self->nonMmapPending > 0 )
+    {
+        if( self->hostInterleaved )
+        {
+            size_t frameBytes = alsa_snd_pcm_format_size( self->nativeFormat, self->numHostChannels );
+            memmove( self->nonMmapBuffer, (unsigned char *)self->nonMmapBuffer + res * frameBytes,
+                    self->nonMmapPending * frameBytes );
+        }
+        else
+        {
+            size_t sampleBytes = alsa_snd_pcm_format_size( self->nativeFormat, 1 );
+            for( int i = 0; i < self->numHostChannels; ++i )
+            {
+                unsigned char *channel = self->nonMmapAreas[i].addr;
+                memmove( channel, channel + res * sampleBytes, self->nonMmapPending * sampleBytes );
+            }
+        }
     }
 
 end:
@@ -3628,7 +6099,7 @@ static PaError PaAlsaStreamComponent_DoChannelAdaption( PaAlsaStreamComponent *s
     if( self->hostInterleaved )
     {
         int swidth = alsa_snd_pcm_format_size( self->nativeFormat, 1 );
-        unsigned char *buffer = self->canMmap ? ExtractAddress( self->channelAreas, self->offset ) : self->nonMmapBuffer;
+        unsigned char *buffer = ExtractAddress( self->channelAreas, self->offset );
 
         /* Start after the last user channel */
         p = buffer + self->numUserChannels * swidth;
@@ -3695,6 +6166,10 @@ static PaError PaAlsaStream_EndProcessing( PaAlsaStream *self, unsigned long num
             PA_ENSURE( PaAlsaStreamComponent_DoChannelAdaption( &self->playback, &self->bufferProcessor, numFrames ) );
         }
         PA_ENSURE( PaAlsaStreamComponent_EndProcessing( &self->playback, numFrames, &xrun ) );
+        if( self->playback.ready )
+        {
+            PaAlsaStream_EndMemberProcessing( self, numFrames );
+        }
     }
 
 error:
@@ -3708,9 +6183,21 @@ error:
 static PaError PaAlsaStreamComponent_GetAvailableFrames( PaAlsaStreamComponent *self, unsigned long *numFrames, int *xrunOccurred )
 {
     PaError result = paNoError;
-    snd_pcm_sframes_t framesAvail = alsa_snd_pcm_avail_update( self->pcm );
+    snd_pcm_sframes_t framesAvail;
     *xrunOccurred = 0;
+    *numFrames = 0;
+
+    if( !self->canMmap && StreamDirection_Out == self->streamDir )
+    {
+        /* Pending output takes up space in ALSA's buffer, pass it on first */
+        PA_ENSURE( PaAlsaStreamComponent_FlushOutput( self, xrunOccurred ) );
+        if( *xrunOccurred )
+        {
+            goto end;
+        }
+    }
 
+    framesAvail = alsa_snd_pcm_avail_update( self->pcm );
     if( -EPIPE == framesAvail )
     {
         *xrunOccurred = 1;
@@ -3721,8 +6208,14 @@ static PaError PaAlsaStreamComponent_GetAvailableFrames( PaAlsaStreamComponent *
         ENSURE_( framesAvail, paUnanticipatedHostError );
     }
 
+    if( !self->canMmap && StreamDirection_Out == self->streamDir )
+    {
+        framesAvail = (snd_pcm_uframes_t)framesAvail > self->nonMmapPending ? framesAvail - self->nonMmapPending : 0;
+    }
     *numFrames = framesAvail;
 
+end:
+
 error:
     return result;
 }
@@ -3810,35 +6303,214 @@ static PaError PaAlsaStream_GetAvailableFrames( PaAlsaStream *self, int queryCap
         PA_ENSURE( PaAlsaStreamComponent_GetAvailableFrames( &self->capture, &captureFrames, xrunOccurred ) );
         if( *xrunOccurred )
         {
-            goto end;
+            goto end;
+        }
+    }
+    if( queryPlayback )
+    {
+        assert( self->playback.pcm );
+        PA_ENSURE( PaAlsaStreamComponent_GetAvailableFrames( &self->playback, &playbackFrames, xrunOccurred ) );
+        if( *xrunOccurred )
+        {
+            goto end;
+        }
+    }
+
+    if( queryCapture && queryPlayback )
+    {
+        *available = PA_MIN( captureFrames, playbackFrames );
+        /*PA_DEBUG(("capture: %lu, playback: %lu, combined: %lu\n", captureFrames, playbackFrames, *available));*/
+    }
+    else if( queryCapture )
+    {
+        *available = captureFrames;
+    }
+    else
+    {
+        *available = playbackFrames;
+    }
+
+end:
+error:
+    return result;
+}
+
+/** Get the number of available frames for the pcms that are marked ready, once polling has finished.
+ *
+ * @concern FullDuplex If only one direction is marked ready (from poll), the number of frames available for
+ * the other direction is returned. Output is normally preferred over capture however, so capture frames may be
+ * discarded to avoid overrun unless paNeverDropInput is specified.
+ *
+ * @param framesAvail Return the number of available frames
+ * @param xrunOccurred Return whether an xrun has occurred
+ */
+static PaError PaAlsaStream_GetReadyFrames( PaAlsaStream *self, unsigned long *framesAvail, int *xrunOccurred )
+{
+    PaError result = paNoError;
+    int captureReady = self->capture.pcm ? self->capture.ready : 0,
+        playbackReady = self->playback.pcm ? self->playback.ready : 0;
+
+    PA_ENSURE( PaAlsaStream_GetAvailableFrames( self, captureReady, playbackReady, framesAvail, xrunOccurred ) );
+
+    if( self->capture.pcm && self->playback.pcm )
+    {
+        if( !self->playback.ready && !self->neverDropInput )
+        {
+            /* Drop input, a period's worth */
+            assert( self->capture.ready );
+            PaAlsaStreamComponent_EndProcessing( &self->capture, PA_MIN( self->capture.framesPerPeriod,
+                        *framesAvail ), xrunOccurred );
+            *framesAvail = 0;
+            self->capture.ready = 0;
+        }
+    }
+    else if( self->capture.pcm )
+        assert( self->capture.ready );
+    else
+        assert( self->playback.ready );
+
+error:
+    return result;
+}
+
+/** Wait for available buffer space with timer-based scheduling.
+ *
+ * Period wakeups are disabled, so the pcms aren't polled. Instead we sleep on a timer until a host buffer's
+ * worth of frames is expected to be available, based on the current fill level of the ALSA buffers and
+ * the time processing has been taking. The playback buffer is only filled up to the watermark, so that the
+ * latency stays as requested even though the buffer is large. Since the fill level is measured anew at
+ * every wakeup, drift between the sound card and the system clock is compensated for.
+ *
+ * @param framesAvail Return the number of available frames
+ * @param xrunOccurred Return whether an xrun has occurred
+ */
+static PaError PaAlsaStream_WaitForTimer( PaAlsaStream *self, unsigned long *framesAvail, int *xrunOccurred )
+{
+    PaError result = paNoError;
+    const double sampleRate = self->streamRepresentation.streamInfo.sampleRate;
+    unsigned long hostBufferFrames = self->maxFramesPerHostBuffer;
+    int xrun = 0;
+
+    *framesAvail = 0;
+
+    /* Update the estimate of the processing cost, rising quickly and decaying slowly */
+    if( self->tschedProcessStart )
+    {
+        PaUtilTimeNs cost = PaUtil_GetTimeNs() - self->tschedProcessStart;
+        self->tschedCost = cost > self->tschedCost ? cost : ( self->tschedCost * 15 + cost ) / 16;
+        self->tschedProcessStart = 0;
+    }
+
+    while( 1 )
+    {
+        unsigned long frames = ULONG_MAX, componentFrames;
+        PaUtilTimeNs wait;
+        int totalFds = 0, pollTimeout = -1, pollResults;
+        struct pollfd *stopPfd, *timerPfd = NULL;
+
+        if( self->capture.pcm )
+        {
+            PA_ENSURE( PaAlsaStreamComponent_GetAvailableFrames( &self->capture, &componentFrames, &xrun ) );
+            if( xrun )
+            {
+                goto end;
+            }
+            frames = componentFrames;
+        }
+        if( self->playback.pcm )
+        {
+            snd_pcm_uframes_t queued;
+
+            PA_ENSURE( PaAlsaStreamComponent_GetAvailableFrames( &self->playback, &componentFrames, &xrun ) );
+            if( xrun )
+            {
+                goto end;
+            }
+            queued = self->playback.alsaBufferSize - PA_MIN( componentFrames, self->playback.alsaBufferSize );
+            componentFrames = self->playback.watermark > queued ? self->playback.watermark - queued : 0;
+            frames = PA_MIN( frames, componentFrames );
+        }
+
+        if( frames >= hostBufferFrames )
+        {
+            if( self->capture.pcm )
+                self->capture.ready = 1;
+            if( self->playback.pcm )
+                self->playback.ready = 1;
+            *framesAvail = frames;
+            self->tschedProcessStart = PaUtil_GetTimeNs();
+            break;
+        }
+
+        /* Wake up when a host buffer's worth of frames is due, early enough to finish processing in time */
+        wait = (PaUtilTimeNs)( ( hostBufferFrames - frames ) * 1e9 / sampleRate ) - self->tschedCost;
+        wait = PA_MAX( wait, 100000 );  /* Avoid a hot loop */
+
+#ifdef PA_ALSA_USE_TIMERFD
+        if( self->timerFd >= 0 )
+        {
+            struct itimerspec timerSpec;
+
+            memset( &timerSpec, 0, sizeof (timerSpec) );
+            timerSpec.it_value.tv_sec = wait / 1000000000;
+            timerSpec.it_value.tv_nsec = wait % 1000000000;
+            PA_UNLESS( timerfd_settime( self->timerFd, 0, &timerSpec, NULL ) == 0, paInternalError );
+
+            timerPfd = self->pfds + totalFds++;
+            timerPfd->fd = self->timerFd;
+            timerPfd->events = POLLIN;
+            timerPfd->revents = 0;
+        }
+        else
+#endif
+        {
+            pollTimeout = (int)( ( wait + 999999 ) / 1000000 );
+        }
+
+        stopPfd = self->pfds + totalFds++;
+        stopPfd->fd = self->stopFds[0];
+        stopPfd->events = POLLIN;
+        stopPfd->revents = 0;
+
+        pollResults = poll( self->pfds, totalFds, pollTimeout );
+        if( pollResults < 0 )
+        {
+            if( errno == EINTR )
+            {
+                continue;
+            }
+            PA_ENSURE( paInternalError );
+        }
+
+        if( timerPfd && ( timerPfd->revents & POLLIN ) )
+        {
+            uint64_t expirations;
+            if( read( self->timerFd, &expirations, sizeof (expirations) ) < 0 )
+            {
+                PA_DEBUG(( "%s: Failed to read timer\n", __FUNCTION__ ));
+            }
         }
-    }
-    if( queryPlayback )
-    {
-        assert( self->playback.pcm );
-        PA_ENSURE( PaAlsaStreamComponent_GetAvailableFrames( &self->playback, &playbackFrames, xrunOccurred ) );
-        if( *xrunOccurred )
+        if( stopPfd->revents & POLLIN )
         {
-            goto end;
+            DrainWakePipe( self->stopFds );
+            if( self->stopRequested )
+            {
+                /* Return to the callback thread, which will act upon the request */
+                break;
+            }
         }
     }
 
-    if( queryCapture && queryPlayback )
-    {
-        *available = PA_MIN( captureFrames, playbackFrames );
-        /*PA_DEBUG(("capture: %lu, playback: %lu, combined: %lu\n", captureFrames, playbackFrames, *available));*/
-    }
-    else if( queryCapture )
-    {
-        *available = captureFrames;
-    }
-    else
+end:
+error:
+    if( xrun )
     {
-        *available = playbackFrames;
+        /* Recover from the xrun state */
+        PA_ENSURE_NO_GOTO( PaAlsaStream_HandleXrun( self ) );
+        *framesAvail = 0;
     }
+    *xrunOccurred = xrun;
 
-end:
-error:
     return result;
 }
 
@@ -3863,6 +6535,11 @@ static PaError PaAlsaStream_WaitForFrames( PaAlsaStream *self, unsigned long *fr
     assert( self );
     assert( framesAvail );
 
+    if( self->timerScheduling )
+    {
+        return PaAlsaStream_WaitForTimer( self, framesAvail, xrunOccurred );
+    }
+
     if( !self->callbackMode )
     {
         /* In blocking mode we will only wait if necessary */
@@ -3888,11 +6565,8 @@ static PaError PaAlsaStream_WaitForFrames( PaAlsaStream *self, unsigned long *fr
     while( pollPlayback || pollCapture )
     {
         int totalFds = 0;
-        struct pollfd *capturePfds = NULL, *playbackPfds = NULL;
+        struct pollfd *capturePfds = NULL, *playbackPfds = NULL, *stopPfd = NULL;
 
-#ifdef PTHREAD_CANCELED
-        pthread_testcancel();
-#endif
         if( pollCapture )
         {
             capturePfds = self->pfds;
@@ -3917,23 +6591,18 @@ static PaError PaAlsaStream_WaitForFrames( PaAlsaStream *self, unsigned long *fr
             totalFds += self->playback.nfds;
         }
 
-#ifdef PTHREAD_CANCELED
         if( self->callbackMode )
         {
-            /* To allow 'Abort' to terminate the callback thread, enable cancelability just for poll() (& disable after) */
-            pthread_setcancelstate( PTHREAD_CANCEL_ENABLE, NULL );
+            /* Let RealStop wake us up, instead of waiting for the devices */
+            stopPfd = self->pfds + totalFds;
+            stopPfd->fd = self->stopFds[0];
+            stopPfd->events = POLLIN;
+            stopPfd->revents = 0;
+            ++totalFds;
         }
-#endif
 
         pollResults = poll( self->pfds, totalFds, pollTimeout );
 
-#ifdef PTHREAD_CANCELED
-        if( self->callbackMode )
-        {
-            pthread_setcancelstate( PTHREAD_CANCEL_DISABLE, NULL );
-        }
-#endif
-
         if( pollResults < 0 )
         {
             /*  XXX: Depend on preprocessor condition? */
@@ -3977,6 +6646,17 @@ static PaError PaAlsaStream_WaitForFrames( PaAlsaStream *self, unsigned long *fr
             /* reset timouts counter */
             timeouts = 0;
 
+            if( stopPfd && ( stopPfd->revents & POLLIN ) )
+            {
+                DrainWakePipe( self->stopFds );
+                if( self->stopRequested )
+                {
+                    /* Return to the callback thread, which will act upon the request */
+                    *framesAvail = 0;
+                    goto end;
+                }
+            }
+
             /* check the return status of our pfds */
             if( pollCapture )
             {
@@ -4011,31 +6691,7 @@ static PaError PaAlsaStream_WaitForFrames( PaAlsaStream *self, unsigned long *fr
 
     if( !xrun )
     {
-        /* Get the number of available frames for the pcms that are marked ready.
-         * @concern FullDuplex If only one direction is marked ready (from poll), the number of frames available for
-         * the other direction is returned. Output is normally preferred over capture however, so capture frames may be
-         * discarded to avoid overrun unless paNeverDropInput is specified.
-         */
-        int captureReady = self->capture.pcm ? self->capture.ready : 0,
-            playbackReady = self->playback.pcm ? self->playback.ready : 0;
-        PA_ENSURE( PaAlsaStream_GetAvailableFrames( self, captureReady, playbackReady, framesAvail, &xrun ) );
-
-        if( self->capture.pcm && self->playback.pcm )
-        {
-            if( !self->playback.ready && !self->neverDropInput )
-            {
-                /* Drop input, a period's worth */
-                assert( self->capture.ready );
-                PaAlsaStreamComponent_EndProcessing( &self->capture, PA_MIN( self->capture.framesPerPeriod,
-                            *framesAvail ), &xrun );
-                *framesAvail = 0;
-                self->capture.ready = 0;
-            }
-        }
-        else if( self->capture.pcm )
-            assert( self->capture.ready );
-        else
-            assert( self->playback.ready );
+        PA_ENSURE( PaAlsaStream_GetReadyFrames( self, framesAvail, &xrun ) );
     }
 
 end:
@@ -4087,77 +6743,35 @@ static PaError PaAlsaStreamComponent_RegisterChannels( PaAlsaStreamComponent* se
     if( self->canMmap )
     {
         ENSURE_( alsa_snd_pcm_mmap_begin( self->pcm, &areas, &self->offset, numFrames ), paUnanticipatedHostError );
-        /* @concern ChannelAdaption Buffer address is recorded so we can do some channel adaption later */
-        self->channelAreas = (snd_pcm_channel_area_t *)areas;
-    }
-    else
-    {
-        unsigned int bufferSize = self->numHostChannels * alsa_snd_pcm_format_size( self->nativeFormat, *numFrames );
-        if( bufferSize > self->nonMmapBufferSize )
-        {
-            self->nonMmapBuffer = realloc( self->nonMmapBuffer, ( self->nonMmapBufferSize = bufferSize ) );
-            if( !self->nonMmapBuffer )
-            {
-                result = paInsufficientMemory;
-                goto error;
-            }
-        }
-    }
-
-    if( self->hostInterleaved )
-    {
-        int swidth = alsa_snd_pcm_format_size( self->nativeFormat, 1 );
-
-        p = buffer = self->canMmap ? ExtractAddress( areas, self->offset ) : self->nonMmapBuffer;
-        for( int i = 0; i < self->numUserChannels; ++i )
-        {
-            /* We're setting the channels up to userChannels, but the stride will be hostChannels samples */
-            setChannel( bp, i, p, self->numHostChannels );
-            p += swidth;
-        }
     }
     else
     {
-        if( self->canMmap )
-        {
-            for( int i = 0; i < self->numUserChannels; ++i )
-            {
-                area = areas + i;
-                buffer = ExtractAddress( area, self->offset );
-                setChannel( bp, i, buffer, 1 );
-            }
-        }
-        else
-        {
-            unsigned int buf_per_ch_size = self->nonMmapBufferSize / self->numHostChannels;
-            buffer = self->nonMmapBuffer;
-            for( int i = 0; i < self->numUserChannels; ++i )
-            {
-                setChannel( bp, i, buffer, 1 );
-                buffer += buf_per_ch_size;
-            }
-        }
+        /* Output is processed behind the pending frames */
+        areas = self->nonMmapAreas;
+        self->offset = self->nonMmapPending;
+        *numFrames = PA_MIN( *numFrames, self->nonMmapFrames - self->nonMmapPending );
     }
+    /* @concern ChannelAdaption Buffer address is recorded so we can do some channel adaption later */
+    self->channelAreas = (snd_pcm_channel_area_t *)areas;
 
     if( !self->canMmap && StreamDirection_In == self->streamDir )
     {
-        /* Read sound */
-        int res;
+        /* Read sound, as much as is available up to the requested number of frames */
+        snd_pcm_sframes_t res;
         if( self->hostInterleaved )
             res = alsa_snd_pcm_readi( self->pcm, self->nonMmapBuffer, *numFrames );
         else
         {
             void *bufs[self->numHostChannels];
-            unsigned int buf_per_ch_size = self->nonMmapBufferSize / self->numHostChannels;
-            unsigned char *buffer = self->nonMmapBuffer;
             for( int i = 0; i < self->numHostChannels; ++i )
-            {
-                bufs[i] = buffer;
-                buffer += buf_per_ch_size;
-            }
+                bufs[i] = self->nonMmapAreas[i].addr;
             res = alsa_snd_pcm_readn( self->pcm, bufs, *numFrames );
         }
-        if( res == -EPIPE )
+        if( res == -EAGAIN )
+        {
+            *numFrames = 0;
+        }
+        else if( res == -EPIPE )
         {
             *xrun = 1;
             *numFrames = 0;
@@ -4171,6 +6785,34 @@ static PaError PaAlsaStreamComponent_RegisterChannels( PaAlsaStreamComponent* se
             *numFrames = 0;
         }
 #endif
+        else
+        {
+            ENSURE_( res, paUnanticipatedHostError );
+            *numFrames = res;
+            self->framesTransferred += res;
+        }
+    }
+
+    if( self->hostInterleaved )
+    {
+        int swidth = alsa_snd_pcm_format_size( self->nativeFormat, 1 );
+
+        p = buffer = ExtractAddress( areas, self->offset );
+        for( int i = 0; i < self->numUserChannels; ++i )
+        {
+            /* We're setting the channels up to userChannels, but the stride will be hostChannels samples */
+            setChannel( bp, i, p, self->numHostChannels );
+            p += swidth;
+        }
+    }
+    else
+    {
+        for( int i = 0; i < self->numUserChannels; ++i )
+        {
+            area = areas + i;
+            buffer = ExtractAddress( area, self->offset );
+            setChannel( bp, i, buffer, 1 );
+        }
     }
 
 end:
@@ -4205,18 +6847,19 @@ static PaError PaAlsaStream_SetUpBuffers( PaAlsaStream* self, unsigned long* num
     /* Extract per-channel ALSA buffer pointers and register them with the buffer processor.
      * It is possible that a direction is not marked ready however, because it is out of sync with the other.
      */
-    if( self->capture.pcm && self->capture.ready )
-    {
-        captureFrames = *numFrames;
-        PA_ENSURE( PaAlsaStreamComponent_RegisterChannels( &self->capture, &self->bufferProcessor, &captureFrames,
-                    &xrun ) );
-    }
     if( self->playback.pcm && self->playback.ready )
     {
         playbackFrames = *numFrames;
         PA_ENSURE( PaAlsaStreamComponent_RegisterChannels( &self->playback, &self->bufferProcessor, &playbackFrames,
                     &xrun ) );
     }
+    if( self->capture.pcm && self->capture.ready && !xrun )
+    {
+        /* Input read without mmap can't be put back, so capture is limited to what output can take */
+        captureFrames = PA_MIN( *numFrames, playbackFrames );
+        PA_ENSURE( PaAlsaStreamComponent_RegisterChannels( &self->capture, &self->bufferProcessor, &captureFrames,
+                    &xrun ) );
+    }
     if( xrun )
     {
         /* Nothing more to do */
@@ -4224,69 +6867,295 @@ static PaError PaAlsaStream_SetUpBuffers( PaAlsaStream* self, unsigned long* num
         goto end;
     }
 
-    commonFrames = PA_MIN( captureFrames, playbackFrames );
-    /* assert( commonFrames <= *numFrames ); */
-    if( commonFrames > *numFrames )
+    commonFrames = PA_MIN( captureFrames, playbackFrames );
+    /* assert( commonFrames <= *numFrames ); */
+    if( commonFrames > *numFrames )
+    {
+        /* Hmmm ... how come there are more frames available than we requested!? Blah. */
+        PA_DEBUG(( "%s: Common available frames are reported to be more than number requested: %lu, %lu, callbackMode: %d\n", __FUNCTION__,
+                    commonFrames, *numFrames, self->callbackMode ));
+        if( self->capture.pcm )
+        {
+            PA_DEBUG(( "%s: captureFrames: %lu, capture.ready: %d\n", __FUNCTION__, captureFrames, self->capture.ready ));
+        }
+        if( self->playback.pcm )
+        {
+            PA_DEBUG(( "%s: playbackFrames: %lu, playback.ready: %d\n", __FUNCTION__, playbackFrames, self->playback.ready ));
+        }
+
+        commonFrames = 0;
+        goto end;
+    }
+
+    /* Inform PortAudio of the number of frames we got.
+     * @concern FullDuplex We might be experiencing underflow in either end; if its an input underflow, we go on
+     * with output. If its output underflow however, depending on the paNeverDropInput flag, we may want to simply
+     * discard the excess input or call the callback with paOutputOverflow flagged.
+     */
+    if( self->capture.pcm )
+    {
+        if( self->capture.ready )
+        {
+            PaUtil_SetInputFrameCount( &self->bufferProcessor, commonFrames );
+        }
+        else
+        {
+            /* We have input underflow */
+            PaUtil_SetNoInput( &self->bufferProcessor );
+        }
+    }
+    if( self->playback.pcm )
+    {
+        if( self->playback.ready )
+        {
+            PaUtil_SetOutputFrameCount( &self->bufferProcessor, commonFrames );
+        }
+        else
+        {
+            /* We have output underflow, but keeping input data (paNeverDropInput) */
+            assert( self->neverDropInput );
+            assert( self->capture.pcm != NULL );
+            PA_DEBUG(( "%s: Setting output buffers to NULL\n", __FUNCTION__ ));
+            PaUtil_SetNoOutput( &self->bufferProcessor );
+        }
+    }
+    PaAlsaStream_SetUpMemberBuffers( self, commonFrames );
+
+end:
+    *numFrames = commonFrames;
+error:
+    if( xrun )
+    {
+        PA_ENSURE_NO_GOTO( PaAlsaStream_HandleXrun( self ) );
+        *numFrames = 0;
+    }
+    *xrunOccurred = xrun;
+
+    return result;
+}
+
+/** Prime the output with data from the stream callback.
+ *
+ * The pcms are prepared, and the available space in the playback buffer is filled through the buffer processor.
+ * Input isn't available yet, so the callback is given none.
+ *
+ * @param maxFrames The number of frames to fill the buffer with at most, rounded down to whole periods
+ * @param cbFlags The flags to pass to the callback, paPrimingOutput when starting the stream
+ * @param callbackResult The result of the stream callback, updated on return
+ */
+static PaError PaAlsaStream_PrimeOutput( PaAlsaStream *self, snd_pcm_uframes_t maxFrames, PaStreamCallbackFlags cbFlags,
+        int *callbackResult )
+{
+    PaError result = paNoError;
+    PaStreamCallbackTimeInfo timeInfo = {0, 0, 0};
+    snd_pcm_sframes_t avail;
+    unsigned long framesLeft, framesGot;
+    int xrun = 0;
+#ifdef PA_ENABLE_DEBUG_OUTPUT
+    PaUtilTimeNs startTime = PaUtil_GetTimeNs();
+#endif
+
+    assert( self->playback.pcm );
+
+    ENSURE_( alsa_snd_pcm_prepare( self->playback.pcm ), paUnanticipatedHostError );
+    self->playback.nonMmapPending = 0;
+    if( self->capture.pcm && !self->pcmsSynced )
+        ENSURE_( alsa_snd_pcm_prepare( self->capture.pcm ), paUnanticipatedHostError );
+
+    /* We can't be certain that the whole ring buffer is available for priming, but there should be
+     * at least one period */
+    ENSURE_( avail = alsa_snd_pcm_avail_update( self->playback.pcm ), paUnanticipatedHostError );
+    avail = PA_MIN( (snd_pcm_uframes_t)avail, maxFrames );
+    framesLeft = avail - (avail % self->playback.framesPerPeriod);
+    if( framesLeft < self->playback.framesPerPeriod )
+    {
+        /* The device reports less, prime what there is room for */
+        PA_DEBUG(( "%s: Only %ld frames available for priming\n", __FUNCTION__, (long)avail ));
+        framesLeft = avail;
+    }
+
+    self->playback.ready = 1;
+    if( self->capture.pcm )
+        self->capture.ready = 0;
+
+    while( framesLeft > 0 && paContinue == *callbackResult )
+    {
+        framesGot = PA_MIN( framesLeft, self->maxFramesPerHostBuffer );
+        if( paUtilFixedHostBufferSize == self->bufferProcessor.hostBufferSizeMode &&
+                framesGot < self->maxFramesPerHostBuffer )
+        {
+            break;
+        }
+
+        CalculateTimeInfo( self, &timeInfo );
+        PaUtil_BeginBufferProcessing( &self->bufferProcessor, &timeInfo, cbFlags );
+        PA_ENSURE( PaAlsaStream_SetUpBuffers( self, &framesGot, &xrun ) );
+        if( 0 == framesGot )
+        {
+            break;
+        }
+        PaUtil_EndBufferProcessing( &self->bufferProcessor, callbackResult );
+        PA_ENSURE( PaAlsaStream_EndProcessing( self, framesGot, &xrun ) );
+        if( xrun )
+        {
+            break;
+        }
+        framesLeft -= framesGot;
+    }
+
+    PA_DEBUG(( "%s: Primed %ld frames in %.3f ms\n", __FUNCTION__, (long)( avail - framesLeft ),
+                PaUtil_NsToTime( PaUtil_GetTimeNs() - startTime ) * 1000. ));
+
+error:
+    return result;
+}
+
+/** Start a callback stream.
+ *
+ * Unless the output is to be primed with the stream callback, the output buffer is zeroed before starting.
+ *
+ * @param callbackResult The result of the stream callback, updated on return if it is invoked for priming
+ */
+static PaError PaAlsaStream_StartCallbackMode( PaAlsaStream *self, int *callbackResult )
+{
+    PaError result = paNoError;
+
+    if( self->primeBuffers )
+    {
+        PA_ENSURE( PaAlsaStream_PrimeOutput( self, self->playback.watermark, paPrimingOutput, callbackResult ) );
+        PA_ENSURE( AlsaStart( self, 1 ) );
+    }
+    else
+    {
+        /* Buffer will be zeroed */
+        PA_ENSURE( AlsaStart( self, 0 ) );
+    }
+
+error:
+    return result;
+}
+
+/** Restart the pcms after an xrun, with a period of output generated by the stream callback.
+ *
+ * This completes the recovery started by PaAlsaStream_HandleXrun with paAlsaXrunRecoveryRegenerate, it is called
+ * from the callback thread outside of buffer processing. The underflow is reported with the regenerated output.
+ *
+ * @param callbackResult The result of the stream callback, updated on return
+ */
+static PaError PaAlsaStream_RegenerateOutput( PaAlsaStream *self, int *callbackResult )
+{
+    PaError result = paNoError;
+
+    self->regenerateOutput = 0;
+    self->underrun = 0.0;
+    /* The callback isn't invoked with the state mutex held, it may well query the xrun statistics */
+    PA_ENSURE( PaAlsaStream_PrimeOutput( self, PA_MAX( self->playback.framesPerPeriod, self->maxFramesPerHostBuffer ),
+                paOutputUnderflow, callbackResult ) );
+    PA_ENSURE( PaUnixMutex_Lock( &self->stateMtx ) );
+    result = AlsaStart( self, 1 );
+    PA_ENSURE( PaUnixMutex_Unlock( &self->stateMtx ) );
+    PA_ENSURE( result );
+    PaAlsaStream_UpdateXrunStatistics( self, 0, 0 );
+
+error:
+    return result;
+}
+
+/** Process a number of frames that have been reported available by ALSA.
+ *
+ * @param framesAvail The number of frames available for processing
+ * @param callbackResult The result of the last stream callback invocation, updated on return
+ */
+static PaError PaAlsaStream_ProcessFrames( PaAlsaStream *stream, unsigned long framesAvail, int *callbackResult )
+{
+    PaError result = paNoError;
+    PaStreamCallbackTimeInfo timeInfo = {0, 0, 0};
+    PaStreamCallbackFlags cbFlags = 0;
+    unsigned long framesGot;
+    int xrun = 0;
+
+    /* Consume buffer space. Once we have a number of frames available for consumption we must retrieve the
+     * mmapped buffers from ALSA, this is contiguously accessible memory however, so we may receive smaller
+     * portions at a time than is available as a whole. Therefore we should be prepared to process several
+     * chunks successively. The buffers are passed to the PA buffer processor.
+     */
+    while( framesAvail > 0 )
     {
-        /* Hmmm ... how come there are more frames available than we requested!? Blah. */
-        PA_DEBUG(( "%s: Common available frames are reported to be more than number requested: %lu, %lu, callbackMode: %d\n", __FUNCTION__,
-                    commonFrames, *numFrames, self->callbackMode ));
-        if( self->capture.pcm )
+        xrun = 0;
+
+        /** @concern Xruns Under/overflows are to be reported to the callback */
+        if( stream->underrun > 0.0 )
         {
-            PA_DEBUG(( "%s: captureFrames: %lu, capture.ready: %d\n", __FUNCTION__, captureFrames, self->capture.ready ));
+            cbFlags |= paOutputUnderflow;
+            stream->underrun = 0.0;
         }
-        if( self->playback.pcm )
+        if( stream->overrun > 0.0 )
         {
-            PA_DEBUG(( "%s: playbackFrames: %lu, playback.ready: %d\n", __FUNCTION__, playbackFrames, self->playback.ready ));
+            cbFlags |= paInputOverflow;
+            stream->overrun = 0.0;
+        }
+        if( stream->capture.pcm && stream->playback.pcm )
+        {
+            /** @concern FullDuplex It's possible that only one direction is being processed to avoid an
+             * under- or overflow, this should be reported correspondingly */
+            if( !stream->capture.ready )
+            {
+                cbFlags |= paInputUnderflow;
+                PA_DEBUG(( "%s: Input underflow\n", __FUNCTION__ ));
+            }
+            else if( !stream->playback.ready )
+            {
+                cbFlags |= paOutputOverflow;
+                PA_DEBUG(( "%s: Output overflow\n", __FUNCTION__ ));
+            }
         }
 
-        commonFrames = 0;
-        goto end;
-    }
+#if 0
+        CallbackUpdate( &stream->threading );
+#endif
 
-    /* Inform PortAudio of the number of frames we got.
-     * @concern FullDuplex We might be experiencing underflow in either end; if its an input underflow, we go on
-     * with output. If its output underflow however, depending on the paNeverDropInput flag, we may want to simply
-     * discard the excess input or call the callback with paOutputOverflow flagged.
-     */
-    if( self->capture.pcm )
-    {
-        if( self->capture.ready )
+        CalculateTimeInfo( stream, &timeInfo );
+        PaUtil_BeginBufferProcessing( &stream->bufferProcessor, &timeInfo, cbFlags );
+        cbFlags = 0;
+
+        /* CPU load measurement should include processing activity external to the stream callback */
+        PaUtil_BeginCpuLoadMeasurement( &stream->cpuLoadMeasurer );
+
+        framesGot = framesAvail;
+        if( paUtilFixedHostBufferSize == stream->bufferProcessor.hostBufferSizeMode )
         {
-            PaUtil_SetInputFrameCount( &self->bufferProcessor, commonFrames );
+            /* We've committed to a fixed host buffer size, stick to that */
+            framesGot = framesGot >= stream->maxFramesPerHostBuffer ? stream->maxFramesPerHostBuffer : 0;
         }
         else
         {
-            /* We have input underflow */
-            PaUtil_SetNoInput( &self->bufferProcessor );
+            /* We've committed to an upper bound on the size of host buffers */
+            assert( paUtilBoundedHostBufferSize == stream->bufferProcessor.hostBufferSizeMode );
+            framesGot = PA_MIN( framesGot, stream->maxFramesPerHostBuffer );
         }
-    }
-    if( self->playback.pcm )
-    {
-        if( self->playback.ready )
+        PA_ENSURE( PaAlsaStream_SetUpBuffers( stream, &framesGot, &xrun ) );
+        /* Check the host buffer size against the buffer processor configuration */
+        framesAvail -= framesGot;
+
+        if( framesGot > 0 )
         {
-            PaUtil_SetOutputFrameCount( &self->bufferProcessor, commonFrames );
+            assert( !xrun );
+            PaUtil_EndBufferProcessing( &stream->bufferProcessor, callbackResult );
+            PA_ENSURE( PaAlsaStream_EndProcessing( stream, framesGot, &xrun ) );
         }
-        else
+        PaUtil_EndCpuLoadMeasurement( &stream->cpuLoadMeasurer, framesGot );
+
+        if( 0 == framesGot )
         {
-            /* We have output underflow, but keeping input data (paNeverDropInput) */
-            assert( self->neverDropInput );
-            assert( self->capture.pcm != NULL );
-            PA_DEBUG(( "%s: Setting output buffers to NULL\n", __FUNCTION__ ));
-            PaUtil_SetNoOutput( &self->bufferProcessor );
+            /* Go back to polling for more frames */
+            break;
         }
-    }
 
-end:
-    *numFrames = commonFrames;
-error:
-    if( xrun )
-    {
-        PA_ENSURE_NO_GOTO( PaAlsaStream_HandleXrun( self ) );
-        *numFrames = 0;
+        if( paContinue != *callbackResult )
+            break;
     }
-    *xrunOccurred = xrun;
 
+error:
     return result;
 }
 
@@ -4302,70 +7171,45 @@ static void *CallbackThreadFunc( void *userData )
 {
     PaError result = paNoError;
     PaAlsaStream *stream = (PaAlsaStream*) userData;
-    PaStreamCallbackTimeInfo timeInfo = {0, 0, 0};
-    snd_pcm_sframes_t startThreshold = 0;
     int callbackResult = paContinue;
-    PaStreamCallbackFlags cbFlags = 0;  /* We might want to keep state across iterations */
     int streamStarted = 0;
 
     assert( stream );
-    /* Not implemented */
-    assert( !stream->primeBuffers );
 
-    /* Execute OnExit when exiting */
+    /* Execute OnExit when exiting. The thread isn't cancelled, since the Alsa-lib functions are NOT cancel-safe,
+     * instead RealStop wakes it up through the stream's stop pipe. */
     pthread_cleanup_push( &OnExit, stream );
-#ifdef PTHREAD_CANCELED
-    /* 'Abort' will use thread cancellation to terminate the callback thread, but the Alsa-lib functions
-     * are NOT cancel-safe, (and can end up in an inconsistent state).  So, disable cancelability for
-     * the thread here, and just re-enable it for the poll() in PaAlsaStream_WaitForFrames(). */
-    pthread_testcancel();
-    pthread_setcancelstate( PTHREAD_CANCEL_DISABLE, NULL );
-#endif
 
-    /* @concern StreamStart If the output is being primed the output pcm needs to be prepared, otherwise the
-     * stream is started immediately. The latter involves signaling the waiting main thread.
+    /* @concern StreamStart The stream is started, with the output primed if so requested, before signaling the
+     * waiting main thread.
      */
-    if( stream->primeBuffers )
-    {
-        snd_pcm_sframes_t avail;
-
-        if( stream->playback.pcm )
-            ENSURE_( alsa_snd_pcm_prepare( stream->playback.pcm ), paUnanticipatedHostError );
-        if( stream->capture.pcm && !stream->pcmsSynced )
-            ENSURE_( alsa_snd_pcm_prepare( stream->capture.pcm ), paUnanticipatedHostError );
-
-        /* We can't be certain that the whole ring buffer is available for priming, but there should be
-         * at least one period */
-        avail = alsa_snd_pcm_avail_update( stream->playback.pcm );
-        startThreshold = avail - (avail % stream->playback.framesPerPeriod);
-        assert( startThreshold >= stream->playback.framesPerPeriod );
-    }
-    else
-    {
-        PA_ENSURE( PaUnixThread_PrepareNotify( &stream->thread ) );
-        /* Buffer will be zeroed */
-        PA_ENSURE( AlsaStart( stream, 0 ) );
-        PA_ENSURE( PaUnixThread_NotifyParent( &stream->thread ) );
+    PA_ENSURE( PaUnixThread_PrepareNotify( &stream->thread ) );
+    PA_ENSURE( PaAlsaStream_StartCallbackMode( stream, &callbackResult ) );
+    PA_ENSURE( PaUnixThread_NotifyParent( &stream->thread ) );
 
-        streamStarted = 1;
-    }
+    streamStarted = 1;
 
     while( 1 )
     {
-        unsigned long framesAvail, framesGot;
+        unsigned long framesAvail;
         int xrun = 0;
 
-#ifdef PTHREAD_CANCELED
-        pthread_testcancel();
-#endif
-
         /* @concern StreamStop if the main thread has requested a stop and the stream has not been effectively
-         * stopped we signal this condition by modifying callbackResult (we'll want to flush buffered output).
+         * stopped we signal this condition by modifying callbackResult (we'll want to flush buffered output,
+         * unless aborting).
          */
-        if( PaUnixThread_StopRequested( &stream->thread ) && paContinue == callbackResult )
+        if( stream->stopRequested )
         {
-            PA_DEBUG(( "Setting callbackResult to paComplete\n" ));
-            callbackResult = paComplete;
+            if( stream->abortRequested )
+            {
+                PA_DEBUG(( "Setting callbackResult to paAbort\n" ));
+                callbackResult = paAbort;
+            }
+            else if( paContinue == callbackResult )
+            {
+                PA_DEBUG(( "Setting callbackResult to paComplete\n" ));
+                callbackResult = paComplete;
+            }
         }
 
         if( paContinue != callbackResult )
@@ -4382,6 +7226,13 @@ static void *CallbackThreadFunc( void *userData )
             /* There is still buffered output that needs to be processed */
         }
 
+        if( stream->regenerateOutput )
+        {
+            /* Recovering from an xrun, see PaAlsaStream_HandleXrun */
+            PA_ENSURE( PaAlsaStream_RegenerateOutput( stream, &callbackResult ) );
+            continue;
+        }
+
         /* Wait for data to become available, this comes down to polling the ALSA file descriptors until we have
          * a number of available frames.
          */
@@ -4391,104 +7242,456 @@ static void *CallbackThreadFunc( void *userData )
             assert( 0 == framesAvail );
             continue;
 
-            /* XXX: Report xruns to the user? A situation is conceivable where the callback is never invoked due
-             * to constant xruns, it might be desirable to notify the user of this.
-             */
+            /* XXX: Report xruns to the user? A situation is conceivable where the callback is never invoked due
+             * to constant xruns, it might be desirable to notify the user of this.
+             */
+        }
+
+        PA_ENSURE( PaAlsaStream_ProcessFrames( stream, framesAvail, &callbackResult ) );
+    }
+
+    /* Note that we will not fall into this error label from above.
+     * It is a while(1) loop that only exits using a goto.
+     */
+error:
+    PA_DEBUG(( "%s: Thread %d is canceled due to error %d\n ", __FUNCTION__, pthread_self(), result ));
+
+end:
+    PA_DEBUG(( "%s: Thread %d exiting\n ", __FUNCTION__, pthread_self() ));
+    /* Match pthread_cleanup_push */
+    pthread_cleanup_pop( 1 );
+    PaUnixThreading_EXIT( result );
+}
+
+/* Shared engine */
+
+/** Initialize the state of the shared engine, the engine thread is not started until a stream is attached.
+ */
+static void PaAlsaEngine_Initialize( PaAlsaEngine *self )
+{
+    memset( self, 0, sizeof (PaAlsaEngine) );
+    PaUnixMutex_Initialize( &self->mtx );
+    pthread_cond_init( &self->cond, NULL );
+    self->wakeFds[0] = self->wakeFds[1] = -1;
+}
+
+/** Interrupt the engine's poll, so that it picks up changes to the set of attached streams.
+ */
+static void PaAlsaEngine_Wake( PaAlsaEngine *self )
+{
+    SignalWakePipe( self->wakeFds );
+}
+
+/** Wait for the engine thread to exit, either since quit is set or since it has stopped on an error.
+ */
+static void PaAlsaEngine_Join( PaAlsaEngine *self )
+{
+    PaError threadRes;
+
+    if( !self->joinable )
+    {
+        return;
+    }
+
+    PaAlsaEngine_Wake( self );
+    if( PaUnixThread_Terminate( &self->thread, 1, &threadRes ) == paNoError && threadRes != paNoError )
+    {
+        PA_DEBUG(( "%s: Engine thread returned: %d\n", __FUNCTION__, threadRes ));
+    }
+    self->joinable = 0;
+    self->running = 0;
+}
+
+static void PaAlsaEngine_Terminate( PaAlsaEngine *self )
+{
+    /* All streams should have been stopped (and thereby detached) by now */
+    assert( !self->streams );
+    self->quit = 1;
+    PaAlsaEngine_Join( self );
+
+    CloseWakePipe( self->wakeFds );
+    PaUtil_FreeMemory( self->pfds );
+
+    pthread_cond_destroy( &self->cond );
+    PaUnixMutex_Terminate( &self->mtx );
+}
+
+/** Take a stream out of the engine once it has finished.
+ *
+ * The ALSA handles are stopped and the user is notified, before the stopping thread is released.
+ * Only called from the engine thread.
+ */
+static void PaAlsaEngine_Release( PaAlsaEngine *self, PaAlsaStream *stream )
+{
+    PaAlsaStream **link;
+
+    OnExit( stream );
+
+    PaUnixMutex_Lock( &self->mtx );
+    for( link = &self->streams; *link; link = &(*link)->engineNext )
+    {
+        if( *link == stream )
+        {
+            *link = stream->engineNext;
+            break;
+        }
+    }
+    stream->engineNext = NULL;
+    stream->engineAttached = 0;
+    pthread_cond_broadcast( &self->cond );
+    PaUnixMutex_Unlock( &self->mtx );
+}
+
+/** Inspect the poll results for one of the engine's streams and process any frames it has available.
+ *
+ * This follows the logic of PaAlsaStream_WaitForFrames, except that the polling state is kept in the stream
+ * across iterations of the engine loop.
+ *
+ * @param pollResults The return value of poll()
+ */
+static PaError PaAlsaEngine_ServiceStream( PaAlsaEngine *self, PaAlsaStream *stream, int pollResults )
+{
+    PaError result = paNoError;
+    struct pollfd *capturePfds = self->pfds + stream->engineFdIndex,
+                  *playbackPfds = capturePfds + (stream->enginePollCapture ? stream->capture.nfds : 0);
+    unsigned long framesAvail = 0;
+    int xrun = 0;
+
+    stream->engineFdIndex = 0;
+
+    if( pollResults > 0 )
+    {
+        if( stream->enginePollCapture )
+        {
+            PA_ENSURE( PaAlsaStreamComponent_EndPolling( &stream->capture, capturePfds, &stream->enginePollCapture,
+                        &xrun ) );
+        }
+        if( stream->enginePollPlayback )
+        {
+            PA_ENSURE( PaAlsaStreamComponent_EndPolling( &stream->playback, playbackPfds, &stream->enginePollPlayback,
+                        &xrun ) );
+        }
+        if( xrun )
+        {
+            goto end;
+        }
+    }
+
+    /* Other streams wake up the poll as well, so the stream's own deadline tells if its device has stalled */
+    if( ( stream->enginePollCapture || stream->enginePollPlayback ) && PaUtil_GetTimeNs() >= stream->engineDeadline )
+    {
+        PA_DEBUG(( "%s: poll timed out\n", __FUNCTION__ ));
+        xrun = 1;
+        goto end;
+    }
+
+    /* @concern FullDuplex See PaAlsaStream_WaitForFrames */
+    if( stream->capture.pcm && stream->playback.pcm )
+    {
+        if( stream->enginePollCapture && !stream->enginePollPlayback )
+        {
+            PA_ENSURE( ContinuePoll( stream, StreamDirection_In, &stream->enginePollTimeout,
+                        &stream->enginePollCapture ) );
+        }
+        else if( stream->enginePollPlayback && !stream->enginePollCapture )
+        {
+            PA_ENSURE( ContinuePoll( stream, StreamDirection_Out, &stream->enginePollTimeout,
+                        &stream->enginePollPlayback ) );
+        }
+    }
+
+    if( stream->enginePollCapture || stream->enginePollPlayback )
+    {
+        /* Still waiting */
+        goto end;
+    }
+
+    PA_ENSURE( PaAlsaStream_GetReadyFrames( stream, &framesAvail, &xrun ) );
+    if( !xrun && framesAvail > 0 )
+    {
+        PA_ENSURE( PaAlsaStream_ProcessFrames( stream, framesAvail, &stream->engineCallbackResult ) );
+    }
+
+end:
+    if( xrun )
+    {
+        /* Recover from the xrun state, and start waiting anew */
+        PA_ENSURE( PaAlsaStream_HandleXrun( stream ) );
+        stream->enginePollCapture = stream->enginePollPlayback = 0;
+    }
+    if( stream->regenerateOutput )
+    {
+        /* The xrun may also have been detected while processing frames */
+        PA_ENSURE( PaAlsaStream_RegenerateOutput( stream, &stream->engineCallbackResult ) );
+        stream->enginePollCapture = stream->enginePollPlayback = 0;
+    }
+
+error:
+    return result;
+}
+
+/** The shared engine thread's function.
+ *
+ * The descriptors of all attached streams are gathered in one array, preceded by the engine's wakeup pipe, and
+ * polled together. Each stream keeps track of which of its directions it is still waiting for, once all are ready
+ * its frames are processed as in CallbackThreadFunc. Streams that have finished are released from the engine.
+ */
+static void *PaAlsaEngine_ThreadFunc( void *userData )
+{
+    PaError result = paNoError;
+    PaAlsaEngine *self = (PaAlsaEngine *) userData;
+    PaAlsaStream *stream, *next;
+
+    assert( self );
+
+    while( !self->quit )
+    {
+        unsigned int totalFds = 1;
+        int pollTimeout = -1;
+        int pollResults;
+
+        PaUnixMutex_Lock( &self->mtx );
+        stream = self->streams;
+        PaUnixMutex_Unlock( &self->mtx );
+
+        /* Make room for the descriptors of all attached streams */
+        for( next = stream; next; next = next->engineNext )
+        {
+            totalFds += next->capture.nfds + next->playback.nfds;
+        }
+        if( totalFds > self->maxPfds )
+        {
+            struct pollfd *pfds = (struct pollfd *) PaUtil_AllocateZeroInitializedMemory(
+                    totalFds * sizeof (struct pollfd) );
+            if( pfds )
+            {
+                PaUtil_FreeMemory( self->pfds );
+                self->pfds = pfds;
+                self->maxPfds = totalFds;
+            }
+        }
+        if( !self->pfds )
+        {
+            PA_ENSURE( paInsufficientMemory );
+        }
+
+        self->pfds[0].fd = self->wakeFds[0];
+        self->pfds[0].events = POLLIN;
+        self->pfds[0].revents = 0;
+        totalFds = 1;
+
+        for( ; stream; stream = next )
+        {
+            next = stream->engineNext;
+            stream->engineFdIndex = 0;
+
+            /* @concern StreamStop See CallbackThreadFunc, a stop request means buffered output should be flushed */
+            if( stream->stopRequested )
+            {
+                if( stream->abortRequested )
+                    stream->engineCallbackResult = paAbort;
+                else if( paContinue == stream->engineCallbackResult )
+                    stream->engineCallbackResult = paComplete;
+            }
+            if( paContinue != stream->engineCallbackResult )
+            {
+                stream->callbackAbort = ( paAbort == stream->engineCallbackResult );
+                if( stream->callbackAbort ||
+                        /** @concern BlockAdaption: Go on if adaption buffers are empty */
+                        PaUtil_IsBufferProcessorOutputEmpty( &stream->bufferProcessor ) )
+                {
+                    PaAlsaEngine_Release( self, stream );
+                    continue;
+                }
+            }
+
+            if( !stream->enginePollCapture && !stream->enginePollPlayback )
+            {
+                /* Start waiting for another batch of frames */
+                stream->enginePollCapture = stream->capture.pcm != NULL;
+                stream->enginePollPlayback = stream->playback.pcm != NULL;
+                stream->enginePollTimeout = stream->pollTimeout;
+                /* See PaAlsaStream_WaitForFrames, after 2048 timeouts the device is considered to have stalled */
+                stream->engineDeadline = PaUtil_GetTimeNs() + 2048 * (PaUtilTimeNs)stream->pollTimeout * 1000000;
+            }
+            if( totalFds + stream->capture.nfds + stream->playback.nfds > self->maxPfds )
+            {
+                /* Couldn't make room for this stream's descriptors */
+                PA_DEBUG(( "%s: Out of memory for stream descriptors\n", __FUNCTION__ ));
+                stream->engineCallbackResult = paAbort;
+                continue;
+            }
+
+            stream->engineFdIndex = totalFds;
+            if( stream->enginePollCapture )
+            {
+                if( PaAlsaStreamComponent_BeginPolling( &stream->capture, self->pfds + totalFds ) != paNoError )
+                {
+                    goto xrun;
+                }
+                totalFds += stream->capture.nfds;
+            }
+            if( stream->enginePollPlayback )
+            {
+                if( PaAlsaStreamComponent_BeginPolling( &stream->playback, self->pfds + totalFds ) != paNoError )
+                {
+                    goto xrun;
+                }
+                totalFds += stream->playback.nfds;
+            }
+
+            if( pollTimeout < 0 || stream->enginePollTimeout < pollTimeout )
+            {
+                pollTimeout = stream->enginePollTimeout;
+            }
+            continue;
+
+xrun:
+            /* The descriptors of this stream can't be obtained, recover and try again in the next round */
+            totalFds = stream->engineFdIndex;
+            stream->engineFdIndex = 0;
+            stream->enginePollCapture = stream->enginePollPlayback = 0;
+            if( PaAlsaStream_HandleXrun( stream ) != paNoError )
+            {
+                stream->engineCallbackResult = paAbort;
+            }
+            pollTimeout = 0;
+        }
+
+        pollResults = poll( self->pfds, totalFds, pollTimeout );
+        if( pollResults < 0 )
+        {
+            if( errno == EINTR )
+            {
+                /* gdb */
+                Pa_Sleep( 1 ); /* avoid hot loop */
+                continue;
+            }
+
+            PA_ENSURE( paInternalError );
         }
 
-        /* Consume buffer space. Once we have a number of frames available for consumption we must retrieve the
-         * mmapped buffers from ALSA, this is contiguously accessible memory however, so we may receive smaller
-         * portions at a time than is available as a whole. Therefore we should be prepared to process several
-         * chunks successively. The buffers are passed to the PA buffer processor.
-         */
-        while( framesAvail > 0 )
+        if( self->pfds[0].revents & POLLIN )
         {
-            xrun = 0;
+            DrainWakePipe( self->wakeFds );
+            --pollResults;
+        }
 
-            /** @concern Xruns Under/overflows are to be reported to the callback */
-            if( stream->underrun > 0.0 )
-            {
-                cbFlags |= paOutputUnderflow;
-                stream->underrun = 0.0;
-            }
-            if( stream->overrun > 0.0 )
+        /* Streams attached meanwhile are found at the head of the list, they have no descriptors in this round */
+        PaUnixMutex_Lock( &self->mtx );
+        stream = self->streams;
+        PaUnixMutex_Unlock( &self->mtx );
+
+        for( ; stream; stream = stream->engineNext )
+        {
+            if( 0 == stream->engineFdIndex )
             {
-                cbFlags |= paInputOverflow;
-                stream->overrun = 0.0;
+                continue;
             }
-            if( stream->capture.pcm && stream->playback.pcm )
+            if( PaAlsaEngine_ServiceStream( self, stream, pollResults ) != paNoError )
             {
-                /** @concern FullDuplex It's possible that only one direction is being processed to avoid an
-                 * under- or overflow, this should be reported correspondingly */
-                if( !stream->capture.ready )
-                {
-                    cbFlags |= paInputUnderflow;
-                    PA_DEBUG(( "%s: Input underflow\n", __FUNCTION__ ));
-                }
-                else if( !stream->playback.ready )
-                {
-                    cbFlags |= paOutputOverflow;
-                    PA_DEBUG(( "%s: Output overflow\n", __FUNCTION__ ));
-                }
+                PA_DEBUG(( "%s: Aborting stream due to error\n", __FUNCTION__ ));
+                stream->engineCallbackResult = paAbort;
             }
+        }
+    }
 
-#if 0
-            CallbackUpdate( &stream->threading );
-#endif
+end:
+    PA_DEBUG(( "%s: Engine thread exiting\n", __FUNCTION__ ));
+    PaUnixThreading_EXIT( result );
 
-            CalculateTimeInfo( stream, &timeInfo );
-            PaUtil_BeginBufferProcessing( &stream->bufferProcessor, &timeInfo, cbFlags );
-            cbFlags = 0;
+error:
+    /* Release all streams, so the threads stopping them aren't left waiting. Streams may be attached until running
+     * is cleared, after that PaAlsaEngine_Attach joins this thread and starts a new one */
+    for( ;; )
+    {
+        PaUnixMutex_Lock( &self->mtx );
+        stream = self->streams;
+        if( !stream )
+        {
+            self->running = 0;
+            PaUnixMutex_Unlock( &self->mtx );
+            break;
+        }
+        PaUnixMutex_Unlock( &self->mtx );
 
-            /* CPU load measurement should include processing activity external to the stream callback */
-            PaUtil_BeginCpuLoadMeasurement( &stream->cpuLoadMeasurer );
+        while( stream )
+        {
+            next = stream->engineNext;
+            stream->callbackAbort = 1;
+            PaAlsaEngine_Release( self, stream );
+            stream = next;
+        }
+    }
+    goto end;
+}
 
-            framesGot = framesAvail;
-            if( paUtilFixedHostBufferSize == stream->bufferProcessor.hostBufferSizeMode )
-            {
-                /* We've committed to a fixed host buffer size, stick to that */
-                framesGot = framesGot >= stream->maxFramesPerHostBuffer ? stream->maxFramesPerHostBuffer : 0;
-            }
-            else
-            {
-                /* We've committed to an upper bound on the size of host buffers */
-                assert( paUtilBoundedHostBufferSize == stream->bufferProcessor.hostBufferSizeMode );
-                framesGot = PA_MIN( framesGot, stream->maxFramesPerHostBuffer );
-            }
-            PA_ENSURE( PaAlsaStream_SetUpBuffers( stream, &framesGot, &xrun ) );
-            /* Check the host buffer size against the buffer processor configuration */
-            framesAvail -= framesGot;
+/** Attach a started stream to the shared engine, starting the engine thread if necessary.
+ */
+static PaError PaAlsaEngine_Attach( PaAlsaEngine *self, PaAlsaStream *stream, int rtSched )
+{
+    PaError result = paNoError;
+    int locked = 0;
 
-            if( framesGot > 0 )
-            {
-                assert( !xrun );
-                PaUtil_EndBufferProcessing( &stream->bufferProcessor, &callbackResult );
-                PA_ENSURE( PaAlsaStream_EndProcessing( stream, framesGot, &xrun ) );
-            }
-            PaUtil_EndCpuLoadMeasurement( &stream->cpuLoadMeasurer, framesGot );
+    PA_ENSURE( PaUnixMutex_Lock( &self->mtx ) );
+    locked = 1;
 
-            if( 0 == framesGot )
-            {
-                /* Go back to polling for more frames */
-                break;
-            }
+    if( self->wakeFds[0] < 0 )
+    {
+        PA_ENSURE( OpenWakePipe( self->wakeFds ) );
+    }
+    if( !self->running )
+    {
+        /* The thread may have stopped on an error, it doesn't take the mutex anymore by then */
+        PaAlsaEngine_Join( self );
+        self->quit = 0;
+        PA_ENSURE( PaUnixThread_New( &self->thread, &PaAlsaEngine_ThreadFunc, self, 0., rtSched ) );
+        self->running = 1;
+        self->joinable = 1;
+    }
 
-            if( paContinue != callbackResult )
-                break;
+    stream->enginePollCapture = stream->enginePollPlayback = 0;
+    stream->engineFdIndex = 0;
+    stream->engineNext = self->streams;
+    self->streams = stream;
+    stream->engineAttached = 1;
+
+    PaUnixMutex_Unlock( &self->mtx );
+    locked = 0;
+    PaAlsaEngine_Wake( self );
+
+end:
+    return result;
+error:
+    if( locked )
+    {
+        PaUnixMutex_Unlock( &self->mtx );
+    }
+    goto end;
+}
+
+/** Request that a stream stops, and wait until the engine has released it.
+ *
+ * Buffered output is flushed first, unless stream->abortRequested is set.
+ */
+static PaError PaAlsaEngine_Detach( PaAlsaEngine *self, PaAlsaStream *stream )
+{
+    PaError result = paNoError;
+
+    PA_ENSURE( PaUnixMutex_Lock( &self->mtx ) );
+    if( stream->engineAttached )
+    {
+        stream->stopRequested = 1;
+        PaAlsaEngine_Wake( self );
+        while( stream->engineAttached )
+        {
+            pthread_cond_wait( &self->cond, &self->mtx.mtx );
         }
     }
+    PA_ENSURE( PaUnixMutex_Unlock( &self->mtx ) );
 
-    /* Note that we will not fall into this error label from above.
-     * It is a while(1) loop that only exits using a goto.
-     */
 error:
-    PA_DEBUG(( "%s: Thread %d is canceled due to error %d\n ", __FUNCTION__, pthread_self(), result ));
-
-end:
-    PA_DEBUG(( "%s: Thread %d exiting\n ", __FUNCTION__, pthread_self() ));
-    /* Match pthread_cleanup_push */
-    pthread_cleanup_pop( 1 );
-    PaUnixThreading_EXIT( result );
+    return result;
 }
 
 /* Blocking interface */
@@ -4676,8 +7879,9 @@ void PaAlsa_InitializeStreamInfo( PaAlsaStreamInfo *info )
 {
     info->size = sizeof (PaAlsaStreamInfo);
     info->hostApiType = paALSA;
-    info->version = 1;
+    info->version = 2;
     info->deviceString = NULL;
+    info->flags = 0;
 }
 
 void PaAlsa_EnableRealtimeScheduling( PaStream *s, int enable )
@@ -4686,6 +7890,19 @@ void PaAlsa_EnableRealtimeScheduling( PaStream *s, int enable )
     stream->rtSched = enable;
 }
 
+void PaAlsa_EnableSharedEngine( PaStream *s, int enable )
+{
+    PaAlsaStream *stream = (PaAlsaStream *) s;
+    /* A timer-scheduled stream needs its own thread */
+    stream->useSharedEngine = enable && !stream->timerScheduling;
+}
+
+void PaAlsa_SetXrunRecovery( PaStream *s, PaAlsaXrunRecovery recovery )
+{
+    PaAlsaStream *stream = (PaAlsaStream *) s;
+    stream->xrunRecovery = recovery;
+}
+
 #if 0
 void PaAlsa_EnableWatchdog( PaStream *s, int enable )
 {
@@ -4733,6 +7950,22 @@ error:
     return result;
 }
 
+PaError PaAlsa_GetStreamXrunStatistics( PaStream *s, PaAlsaXrunStatistics *stats )
+{
+    PaAlsaStream *stream;
+    PaError result = paNoError;
+
+    stream = NULL;
+    PA_ENSURE( GetAlsaStreamPointer( s, &stream ) );
+
+    PA_ENSURE( PaUnixMutex_Lock( &stream->stateMtx ) );
+    *stats = stream->xrunStats;
+    PA_ENSURE( PaUnixMutex_Unlock( &stream->stateMtx ) );
+
+error:
+    return result;
+}
+
 PaError PaAlsa_GetStreamOutputCard( PaStream* s, int* card )
 {
     PaAlsaStream *stream;
@@ -4753,8 +7986,265 @@ error:
     return result;
 }
 
+/** Wait for and acquire a region of a component's mmap buffer, for PaAlsa_AcquireReadRegion and
+ * PaAlsa_AcquireWriteRegion.
+ *
+ * The other direction of a full-duplex stream is disregarded while waiting, as in ReadStream and WriteStream.
+ */
+static PaError PaAlsaStream_AcquireRegion( PaAlsaStream *stream, PaAlsaStreamComponent *self, unsigned long frames,
+        PaAlsaMmapRegion *region )
+{
+    PaError result = paNoError;
+    PaAlsaStreamComponent *other = self == &stream->capture ? &stream->playback : &stream->capture;
+    snd_pcm_t *save = other->pcm;
+    const snd_pcm_channel_area_t *areas;
+    snd_pcm_uframes_t offset, framesGot = 0;
+    int swidth = alsa_snd_pcm_format_size( self->nativeFormat, 1 );
+
+    PA_UNLESS( self->canMmap, paDeviceUnavailable );
+    PA_UNLESS( frames > 0 && self->regionFrames == 0, paBadBufferPtr );
+
+    other->pcm = NULL;
+    while( framesGot == 0 )
+    {
+        unsigned long framesAvail;
+        int xrun = 0;
+
+        PA_ENSURE( PaAlsaStream_WaitForFrames( stream, &framesAvail, &xrun ) );
+        if( framesAvail == 0 )
+        {
+            continue;
+        }
+
+        /* This _must_ be called before mmap_begin */
+        PA_ENSURE( PaAlsaStreamComponent_GetAvailableFrames( self, &framesAvail, &xrun ) );
+        if( xrun )
+        {
+            PA_ENSURE( PaAlsaStream_HandleXrun( stream ) );
+            continue;
+        }
+
+        framesGot = PA_MIN( frames, framesAvail );
+        ENSURE_( alsa_snd_pcm_mmap_begin( self->pcm, &areas, &offset, &framesGot ), paUnanticipatedHostError );
+    }
+
+    region->frames = framesGot;
+    region->channelCount = self->numHostChannels;
+    region->sampleFormat = self->hostSampleFormat;
+    if( self->hostInterleaved )
+    {
+        region->buffer = ExtractAddress( areas, offset );
+    }
+    else
+    {
+        if( !self->regionChannels )
+        {
+            PA_UNLESS( self->regionChannels = (void **)PaUtil_AllocateZeroInitializedMemory( sizeof (void *) *
+                        self->numHostChannels ), paInsufficientMemory );
+        }
+        for( int i = 0; i < self->numHostChannels; ++i )
+        {
+            /* The pointers can only describe channels whose samples are contiguous */
+            PA_UNLESS( areas[i].step == (unsigned int)swidth * 8, paInternalError );
+            self->regionChannels[i] = ExtractAddress( areas + i, offset );
+        }
+        region->buffer = self->regionChannels;
+        region->sampleFormat |= paNonInterleaved;
+    }
+
+    /* The region is only held once it has been fully described */
+    self->offset = offset;
+    self->channelAreas = (snd_pcm_channel_area_t *)areas;
+    self->regionFrames = framesGot;
+
+end:
+    other->pcm = save;
+    return result;
+
+error:
+    if( framesGot > 0 && self->regionFrames == 0 )
+    {
+        /* Release the region that couldn't be described */
+        alsa_snd_pcm_mmap_commit( self->pcm, offset, 0 );
+    }
+    goto end;
+}
+
+/** Commit frames of the region acquired with PaAlsaStream_AcquireRegion.
+ */
+static PaError PaAlsaStream_CommitRegion( PaAlsaStream *stream, PaAlsaStreamComponent *self, unsigned long frames )
+{
+    PaError result = paNoError;
+    snd_pcm_sframes_t res;
+
+    PA_UNLESS( self->regionFrames > 0 && frames <= self->regionFrames, paBadBufferPtr );
+    self->regionFrames = 0;
+
+    res = alsa_snd_pcm_mmap_commit( self->pcm, self->offset, frames );
+    if( res == -EPIPE
+#if defined(ESTRPIPE) && ESTRPIPE != EPIPE
+            || res == -ESTRPIPE
+#endif
+      )
+    {
+        PA_ENSURE( PaAlsaStream_HandleXrun( stream ) );
+    }
+    else
+    {
+        ENSURE_( res, paUnanticipatedHostError );
+    }
+
+error:
+    return result;
+}
+
+PaError PaAlsa_AcquireReadRegion( PaStream *s, unsigned long frames, PaAlsaMmapRegion *region )
+{
+    PaError result = paNoError;
+    PaAlsaStream *stream;
+
+    PA_ENSURE( GetAlsaStreamPointer( s, &stream ) );
+    PA_UNLESS( !stream->callbackMode, paCanNotReadFromACallbackStream );
+    PA_UNLESS( stream->capture.pcm, paCanNotReadFromAnOutputOnlyStream );
+    PA_UNLESS( region, paBadBufferPtr );
+
+    /* Start stream if in prepared state */
+    if( alsa_snd_pcm_state( stream->capture.pcm ) == SND_PCM_STATE_PREPARED )
+    {
+        ENSURE_( alsa_snd_pcm_start( stream->capture.pcm ), paUnanticipatedHostError );
+    }
+
+    PA_ENSURE( PaAlsaStream_AcquireRegion( stream, &stream->capture, frames, region ) );
+
+    if( stream->overrun > 0. )
+    {
+        result = paInputOverflowed;
+        stream->overrun = 0.0;
+    }
+
+error:
+    return result;
+}
+
+PaError PaAlsa_CommitReadRegion( PaStream *s, unsigned long frames )
+{
+    PaError result = paNoError;
+    PaAlsaStream *stream;
+
+    PA_ENSURE( GetAlsaStreamPointer( s, &stream ) );
+    PA_UNLESS( stream->capture.pcm, paCanNotReadFromAnOutputOnlyStream );
+    PA_ENSURE( PaAlsaStream_CommitRegion( stream, &stream->capture, frames ) );
+
+error:
+    return result;
+}
+
+PaError PaAlsa_AcquireWriteRegion( PaStream *s, unsigned long frames, PaAlsaMmapRegion *region )
+{
+    PaError result = paNoError;
+    PaAlsaStream *stream;
+
+    PA_ENSURE( GetAlsaStreamPointer( s, &stream ) );
+    PA_UNLESS( !stream->callbackMode, paCanNotWriteToACallbackStream );
+    PA_UNLESS( stream->playback.pcm, paCanNotWriteToAnInputOnlyStream );
+    PA_UNLESS( region, paBadBufferPtr );
+
+    PA_ENSURE( PaAlsaStream_AcquireRegion( stream, &stream->playback, frames, region ) );
+
+    if( stream->underrun > 0. )
+    {
+        result = paOutputUnderflowed;
+        stream->underrun = 0.0;
+    }
+
+error:
+    return result;
+}
+
+PaError PaAlsa_CommitWriteRegion( PaStream *s, unsigned long frames )
+{
+    PaError result = paNoError;
+    PaAlsaStream *stream;
+    signed long framesAvail;
+
+    PA_ENSURE( GetAlsaStreamPointer( s, &stream ) );
+    PA_UNLESS( stream->playback.pcm, paCanNotWriteToAnInputOnlyStream );
+    PA_ENSURE( PaAlsaStream_CommitRegion( stream, &stream->playback, frames ) );
+
+    /* Start stream after one period of samples worth, as WriteStream does */
+    PA_ENSURE( framesAvail = GetStreamWriteAvailable( stream ) );
+    if( alsa_snd_pcm_state( stream->playback.pcm ) == SND_PCM_STATE_PREPARED &&
+            stream->playback.alsaBufferSize - framesAvail >= stream->playback.framesPerPeriod )
+    {
+        ENSURE_( alsa_snd_pcm_start( stream->playback.pcm ), paUnanticipatedHostError );
+    }
+
+error:
+    return result;
+}
+
 PaError PaAlsa_SetRetriesBusy( int retries )
 {
     busyRetries_ = retries;
     return paNoError;
 }
+
+void PaAlsa_SetDeviceCachePath( const char *path )
+{
+    deviceCachePath_ = path;
+}
+
+void PaAlsa_EnableLazyDeviceProbing( int enable )
+{
+    lazyProbing_ = enable;
+}
+
+void PaAlsa_EnableDeviceMonitor( int reservedDevices, PaAlsaDevicesChangedCallback *callback, void *userData )
+{
+    monitorReservedDevices_ = reservedDevices;
+    monitorCallback_ = callback;
+    monitorUserData_ = userData;
+}
+
+PaError PaAlsa_UpdateDeviceList( void )
+{
+    PaError result = paNoError;
+    PaUtilHostApiRepresentation *hostApi;
+    PaAlsaHostApiRepresentation *alsaApi;
+
+    PA_ENSURE( PaUtil_GetHostApiRepresentation( &hostApi, paALSA ) );
+    alsaApi = (PaAlsaHostApiRepresentation *)hostApi;
+
+    PA_ENSURE( PaUnixMutex_Lock( &alsaApi->monitor.mtx ) );
+    result = UpdateDeviceList( alsaApi );
+    PA_ENSURE_NO_GOTO( PaUnixMutex_Unlock( &alsaApi->monitor.mtx ) );
+
+error:
+    return result;
+}
+
+PaError PaAlsa_AddAggregateDevice( const char *name, const char * const *deviceStrings, int count )
+{
+    PaAlsaAggregateSpec *aggregate;
+
+    if( !name || !deviceStrings || count < 2 || count > MAX_AGGREGATE_MEMBERS )
+        return paInvalidDevice;
+    for( int i = 0; i < count; ++i )
+    {
+        if( !deviceStrings[i] )
+            return paInvalidDevice;
+    }
+    if( numAggregates_ == MAX_AGGREGATE_DEVICES )
+        return paInsufficientMemory;
+
+    aggregate = &aggregates_[numAggregates_++];
+    memset( aggregate, 0, sizeof (PaAlsaAggregateSpec) );
+    aggregate->name = name;
+    aggregate->numMembers = count;
+    for( int i = 0; i < count; ++i )
+    {
+        aggregate->memberNames[i] = deviceStrings[i];
+    }
+
+    return paNoError;
+}
@@ -53,23 +53,27 @@
 #include <stdio.h>
 #include <assert.h>
 #include <sys/types.h>
-#include <errno.h>  /* EBUSY */
+#include <errno.h>  /* EAGAIN */
 #include <signal.h> /* sig_atomic_t */
 #include <math.h>
 #include <pthread.h>
 #include <semaphore.h>
+#include <time.h>
+#include <unistd.h> /* pipe */
+#include <fcntl.h>
+#include <poll.h>
 
 #include <jack/types.h>
 #include <jack/jack.h>
 
 #include "pa_util.h"
-#include "pa_pthread_util.h"
 #include "pa_hostapi.h"
 #include "pa_stream.h"
 #include "pa_process.h"
 #include "pa_allocation.h"
 #include "pa_cpuload.h"
 #include "pa_ringbuffer.h"
+#include "pa_memorybarrier.h"
 #include "pa_debugprint.h"
 
 #include "pa_jack.h"
@@ -119,6 +123,9 @@ static const char* port_regex_suffix = ":.*";
         assert( err == success ); \
     } while( 0 )
 
+/* Atomically replace *ptr by newValue if it equals oldValue, evaluates to whether it did */
+#define COMPARE_AND_SWAP(ptr, oldValue, newValue) __sync_bool_compare_and_swap( (ptr), (oldValue), (newValue) )
+
 /*
  * Functions that directly map to the PortAudio stream interface
  */
@@ -147,6 +154,7 @@ static PaError IsStreamActive( PaStream *stream );
 /*static PaTime GetStreamOutputLatency( PaStream *stream );*/
 static PaTime GetStreamTime( PaStream *stream );
 static double GetStreamCpuLoad( PaStream* stream );
+static PaError SetStreamLatency( PaStream *stream, PaTime inputLatency, PaTime outputLatency );
 
 
 /*
@@ -155,6 +163,20 @@ static double GetStreamCpuLoad( PaStream* stream );
 
 struct PaJackStream;
 
+/* The streams serviced by the JACK process callback. A queue is never modified once it has been
+ * published, adding or removing a stream publishes a new queue in its place. The epoch identifies
+ * the queue, the process thread reports the epoch of the queue it has adopted so that the memory of
+ * older queues can be reclaimed. JackBufferSizeCb pins the queue it reads instead, see PinProcessQueue.
+ */
+typedef struct PaJackProcessQueue
+{
+    unsigned long epoch;
+    struct PaJackProcessQueue *retired;     /* Older queues waiting to be reclaimed */
+    int numStreams;
+    struct PaJackStream *streams[];
+}
+PaJackProcessQueue;
+
 typedef struct
 {
     PaUtilHostApiRepresentation commonHostApiRep;
@@ -165,21 +187,36 @@ typedef struct
 
     jack_client_t *jack_client;
     int jack_buffer_size;
+    volatile jack_nframes_t sampleRate;     /* Kept up to date by JackSrCb */
     PaHostApiIndex hostApiIndex;
 
-    pthread_mutex_t mtx;
-    pthread_cond_t cond;
-    PaUtilClockId condClockId;
+    pthread_mutex_t mtx;    /* Serializes the requests to the process thread, it never locks it */
+    int wakeFds[2];         /* Written to when the process thread has acted on a request, see WaitProcessThread */
     unsigned long inputBase, outputBase;
 
     /* For dealing with the process thread */
     volatile int xrun;     /* Received xrun notification from JACK? */
-    struct PaJackStream * volatile toAdd, * volatile toRemove;
-    struct PaJackStream *processQueue;
+    PaJackProcessQueue * volatile processQueue;
+    PaJackProcessQueue *retiredQueues;
+    volatile unsigned long processEpoch;   /* Epoch of the queue adopted by the process thread */
+    PaJackProcessQueue * volatile pinnedQueue;     /* Read by JackBufferSizeCb, it's kept along with its streams */
+    volatile int captureLatencyChanged, playbackLatencyChanged;    /* Set by JackLatencyCb */
     volatile sig_atomic_t jackIsDown;
 }
 PaJackHostApiRepresentation;
 
+/* Requests for the process thread to start or stop a stream. The process thread resets the request
+ * once it has been carried out, and the main thread when calling it off.
+ */
+typedef enum
+{
+    paJackRequestNone,
+    paJackRequestStart,
+    paJackRequestStop,
+    paJackRequestAbort
+}
+PaJackStreamRequest;
+
 /* PaJackStream - a stream data structure specifically for this implementation */
 
 typedef struct PaJackStream
@@ -207,11 +244,19 @@ typedef struct PaJackStream
      */
     volatile sig_atomic_t is_running;
     volatile sig_atomic_t is_active;
-    /* Used to signal processing thread that stream should start or stop, respectively */
-    volatile sig_atomic_t doStart, doStop, doAbort;
+    /* Used to signal processing thread that stream should start or stop, see PaJackStreamRequest */
+    volatile int request;
 
     jack_nframes_t t0;
 
+    /* Latencies of the connected ports, cached for the process callback by UpdateStreamLatencies. The process
+     * callback refreshes them once JackLatencyCb has been called. */
+    volatile jack_nframes_t inputLatencyFrames, outputLatencyFrames;
+
+    /* Notifies the user of a new JACK period, see PaJack_SetBufferSizeCallback */
+    PaJackBufferSizeCallback *bufferSizeCallback;
+    void *bufferSizeUserData;
+
     PaUtilAllocationGroup *stream_memory;
 
     /* These are useful in the process callback */
@@ -230,10 +275,22 @@ typedef struct PaJackStream
     int                     bytesPerFrame;
     int                     samplesPerFrame;
 
-    struct PaJackStream *next;
+    /* Direct blocking mode, for streams in the ports' format (paFloat32 | paNonInterleaved). The process callback
+     * moves the samples between the ports and a ring per port, bypassing the buffer processor and the FIFOs. */
+    int                     isDirectBlocking;
+    PaUtilRingBuffer        *inRings;
+    PaUtilRingBuffer        *outRings;
+    /* The number of frames that Pa_ReadStream or Pa_WriteStream waits for, 0 if it isn't waiting. The process
+     * callback posts the semaphore once that many frames can be read or written, see BlockingDirectWait. */
+    volatile long           readWaitFrames, writeWaitFrames;
+    sem_t                   readSemaphore, writeSemaphore;
 }
 PaJackStream;
 
+/* The largest period of a JACK server. The buffer processor's temp buffers are allocated for it, so that
+ * they can be adapted to a new period in the process thread. */
+#define JACK_MAX_BUFFER_SIZE (8192)
+
 /* In calls to jack_get_ports() this filter expression is used instead of ""
  * to prevent any other types (eg Midi ports etc) being listed */
 #define JACK_PORT_TYPE_FILTER "audio"
@@ -246,6 +303,10 @@ PaJackStream;
  */
 
 static int JackCallback( jack_nframes_t frames, void *userData );
+static void UpdateStreamLatencies( struct PaJackStream *stream, double sampleRate );
+static void ReclaimProcessQueues( PaJackHostApiRepresentation *hostApi, int all );
+static void SignalMainThread( PaJackHostApiRepresentation *hostApi );
+static void CloseWakePipe( PaJackHostApiRepresentation *hostApi );
 
 
 /*
@@ -274,6 +335,19 @@ static PaError BlockingTermFIFO( PaUtilRingBuffer *rbuf )
     return paNoError;
 }
 
+/* Free the buffers of all FIFOs and rings of a stream. */
+static void BlockingTermFIFOs( PaJackStream *stream )
+{
+    int i;
+
+    BlockingTermFIFO( &stream->inFIFO );
+    BlockingTermFIFO( &stream->outFIFO );
+    for( i = 0; stream->inRings && i < stream->num_incoming_connections; ++i )
+        BlockingTermFIFO( &stream->inRings[i] );
+    for( i = 0; stream->outRings && i < stream->num_outgoing_connections; ++i )
+        BlockingTermFIFO( &stream->outRings[i] );
+}
+
 static int
 BlockingCallback( const void                      *inputBuffer,
                   void                            *outputBuffer,
@@ -305,8 +379,32 @@ BlockingCallback( const void                      *inputBuffer,
     return paContinue;
 }
 
+/* The number of frames the FIFOs should hold for a suggested latency */
+static int
+BlockingMinimumBufferFrames( PaJackHostApiRepresentation *jackHostApi, const PaStreamParameters *inputParameters,
+                             const PaStreamParameters *outputParameters )
+{
+    float latency = 0.001f; /* 1ms is the absolute minimum we support */
+    int   minimum_buffer_frames = 0;
+
+    if( inputParameters && inputParameters->suggestedLatency > latency )
+        latency = inputParameters->suggestedLatency;
+    else if( outputParameters && outputParameters->suggestedLatency > latency )
+        latency = outputParameters->suggestedLatency;
+
+    /* the latency the user asked for indicates the minimum buffer size in frames */
+    minimum_buffer_frames = (int) (latency * jack_get_sample_rate( jackHostApi->jack_client ));
+
+    /* we also need to be able to store at least three full jack buffers to avoid dropouts */
+    if( jackHostApi->jack_buffer_size * 3 > minimum_buffer_frames )
+        minimum_buffer_frames = jackHostApi->jack_buffer_size * 3;
+
+    return minimum_buffer_frames;
+}
+
+/* Allocate the FIFOs, large enough for minimum_buffer_size frames. */
 static PaError
-BlockingBegin( PaJackStream *stream, int minimum_buffer_size )
+BlockingInitFIFOs( PaJackStream *stream, int minimum_buffer_size )
 {
     long    doRead = 0;
     long    doWrite = 0;
@@ -315,14 +413,25 @@ BlockingBegin( PaJackStream *stream, int minimum_buffer_size )
 
     doRead = stream->local_input_ports != NULL;
     doWrite = stream->local_output_ports != NULL;
-    /* <FIXME> */
-    stream->samplesPerFrame = 2;
-    stream->bytesPerFrame = sizeof(float) * stream->samplesPerFrame;
-    /* </FIXME> */
     numFrames = 32;
     while (numFrames < minimum_buffer_size)
         numFrames *= 2;
 
+    if( stream->isDirectBlocking )
+    {
+        int i;
+
+        for( i = 0; i < stream->num_incoming_connections; ++i )
+            ENSURE_PA( BlockingInitFIFO( &stream->inRings[i], numFrames, sizeof (float) ) );
+        for( i = 0; i < stream->num_outgoing_connections; ++i )
+        {
+            ENSURE_PA( BlockingInitFIFO( &stream->outRings[i], numFrames, sizeof (float) ) );
+            /* Make the rings appear full of silence initially, like the write FIFO. */
+            PaUtil_AdvanceRingBufferWriteIndex( &stream->outRings[i], PaUtil_GetRingBufferWriteAvailable( &stream->outRings[i] ) );
+        }
+        goto error;
+    }
+
     if( doRead )
     {
         ENSURE_PA( BlockingInitFIFO( &stream->inFIFO, numFrames, stream->bytesPerFrame ) );
@@ -338,8 +447,43 @@ BlockingBegin( PaJackStream *stream, int minimum_buffer_size )
         PaUtil_AdvanceRingBufferWriteIndex( &stream->outFIFO, numBytes );
     }
 
+error:
+    return result;
+}
+
+/* Set up the FIFOs or rings of a blocking stream. The semaphores are initialized first, so that BlockingEnd can
+ * clean up after a failure. */
+static PaError
+BlockingBegin( PaJackStream *stream, int minimum_buffer_size )
+{
+    PaError result = paNoError;
+
     stream->data_available = 0;
     sem_init( &stream->data_semaphore, 0, 0 );
+    stream->readWaitFrames = stream->writeWaitFrames = 0;
+    sem_init( &stream->readSemaphore, 0, 0 );
+    sem_init( &stream->writeSemaphore, 0, 0 );
+
+    if( stream->isDirectBlocking )
+    {
+        /* The samples of each port are moved as is */
+        stream->samplesPerFrame = 1;
+        stream->bytesPerFrame = sizeof (float);
+        if( stream->num_incoming_connections > 0 )
+            UNLESS( stream->inRings = (PaUtilRingBuffer *)PaUtil_GroupAllocateZeroInitializedMemory( stream->stream_memory,
+                        sizeof (PaUtilRingBuffer) * stream->num_incoming_connections ), paInsufficientMemory );
+        if( stream->num_outgoing_connections > 0 )
+            UNLESS( stream->outRings = (PaUtilRingBuffer *)PaUtil_GroupAllocateZeroInitializedMemory( stream->stream_memory,
+                        sizeof (PaUtilRingBuffer) * stream->num_outgoing_connections ), paInsufficientMemory );
+    }
+    else
+    {
+        /* <FIXME> */
+        stream->samplesPerFrame = 2;
+        stream->bytesPerFrame = sizeof(float) * stream->samplesPerFrame;
+        /* </FIXME> */
+    }
+    ENSURE_PA( BlockingInitFIFOs( stream, minimum_buffer_size ) );
 
 error:
     return result;
@@ -348,10 +492,132 @@ error:
 static void
 BlockingEnd( PaJackStream *stream )
 {
-    BlockingTermFIFO( &stream->inFIFO );
-    BlockingTermFIFO( &stream->outFIFO );
+    BlockingTermFIFOs( stream );
 
     sem_destroy( &stream->data_semaphore );
+    sem_destroy( &stream->readSemaphore );
+    sem_destroy( &stream->writeSemaphore );
+}
+
+/* The rings of a direct blocking stream advance together. The process callback and the reader or writer both move
+ * the last ring last, so it holds the fewest frames to read and the least space to write of them all. */
+static long BlockingDirectReadAvailable( PaUtilRingBuffer *rings, int numRings )
+{
+    return PaUtil_GetRingBufferReadAvailable( &rings[numRings - 1] ) / sizeof (float);
+}
+
+static long BlockingDirectWriteAvailable( PaUtilRingBuffer *rings, int numRings )
+{
+    return PaUtil_GetRingBufferWriteAvailable( &rings[numRings - 1] ) / sizeof (float);
+}
+
+/* Called by the process callback once it has moved frames, wakes the reader or writer if it has enough of them. */
+static void BlockingDirectNotify( volatile long *waitFrames, sem_t *semaphore, long available )
+{
+    const long frames = *waitFrames;
+
+    if( frames > 0 && available >= frames && COMPARE_AND_SWAP( waitFrames, frames, 0 ) )
+        sem_post( semaphore );
+}
+
+/* Wait until frames can be read (input) or written (output), without waking up for every process cycle. */
+static void BlockingDirectWait( PaJackStream *stream, int output, long frames )
+{
+    volatile long *waitFrames = output ? &stream->writeWaitFrames : &stream->readWaitFrames;
+    sem_t *semaphore = output ? &stream->writeSemaphore : &stream->readSemaphore;
+
+    *waitFrames = frames;
+    PaUtil_FullMemoryBarrier();
+
+    /* The frames may have become available before the process callback could see that we're waiting */
+    if( (output ? BlockingDirectWriteAvailable( stream->outRings, stream->num_outgoing_connections )
+                : BlockingDirectReadAvailable( stream->inRings, stream->num_incoming_connections )) >= frames
+            && COMPARE_AND_SWAP( waitFrames, frames, 0 ) )
+        return;
+
+    /* Either we'll be notified, or we have been already */
+    while( sem_wait( semaphore ) != 0 && errno == EINTR )
+        ;
+}
+
+/* Move the samples of one cycle between the ports and the rings of a direct blocking stream. */
+static void BlockingDirectProcess( PaJackStream *stream, jack_nframes_t frames )
+{
+    long n;
+    int i;
+
+    if( stream->num_incoming_connections > 0 )
+    {
+        /* Input that doesn't fit is dropped */
+        n = BlockingDirectWriteAvailable( stream->inRings, stream->num_incoming_connections );
+        if( n > (long)frames )
+            n = frames;
+        for( i = 0; i < stream->num_incoming_connections; ++i )
+            PaUtil_WriteRingBuffer( &stream->inRings[i], jack_port_get_buffer( stream->local_input_ports[i], frames ),
+                    n * sizeof (float) );
+        BlockingDirectNotify( &stream->readWaitFrames, &stream->readSemaphore,
+                BlockingDirectReadAvailable( stream->inRings, stream->num_incoming_connections ) );
+    }
+
+    if( stream->num_outgoing_connections > 0 )
+    {
+        /* Output that hasn't been written is silence */
+        n = BlockingDirectReadAvailable( stream->outRings, stream->num_outgoing_connections );
+        if( n > (long)frames )
+            n = frames;
+        for( i = 0; i < stream->num_outgoing_connections; ++i )
+        {
+            float *buffer = (float *)jack_port_get_buffer( stream->local_output_ports[i], frames );
+            PaUtil_ReadRingBuffer( &stream->outRings[i], buffer, n * sizeof (float) );
+            memset( buffer + n, 0, (frames - n) * sizeof (float) );
+        }
+        BlockingDirectNotify( &stream->writeWaitFrames, &stream->writeSemaphore,
+                BlockingDirectWriteAvailable( stream->outRings, stream->num_outgoing_connections ) );
+    }
+}
+
+static PaError BlockingDirectReadStream( PaJackStream *stream, float **channels, unsigned long numFrames )
+{
+    const long capacity = stream->inRings[0].bufferSize / sizeof (float);
+    unsigned long done = 0;
+    int i;
+
+    while( done < numFrames )
+    {
+        long n = BlockingDirectReadAvailable( stream->inRings, stream->num_incoming_connections );
+        if( n > (long)(numFrames - done) )
+            n = numFrames - done;
+        for( i = 0; i < stream->num_incoming_connections; ++i )
+            PaUtil_ReadRingBuffer( &stream->inRings[i], channels[i] + done, n * sizeof (float) );
+        done += n;
+
+        if( done < numFrames )
+            BlockingDirectWait( stream, 0, numFrames - done < (unsigned long)capacity ? (long)(numFrames - done) : capacity );
+    }
+
+    return paNoError;
+}
+
+static PaError BlockingDirectWriteStream( PaJackStream *stream, const float * const *channels, unsigned long numFrames )
+{
+    const long capacity = stream->outRings[0].bufferSize / sizeof (float);
+    unsigned long done = 0;
+    int i;
+
+    while( done < numFrames )
+    {
+        long n = BlockingDirectWriteAvailable( stream->outRings, stream->num_outgoing_connections );
+        if( n > (long)(numFrames - done) )
+            n = numFrames - done;
+        for( i = 0; i < stream->num_outgoing_connections; ++i )
+            PaUtil_WriteRingBuffer( &stream->outRings[i], channels[i] + done, n * sizeof (float) );
+        done += n;
+
+        if( done < numFrames )
+            BlockingDirectWait( stream, 1, numFrames - done < (unsigned long)capacity ? (long)(numFrames - done) : capacity );
+    }
+
+    return paNoError;
 }
 
 static PaError BlockingReadStream( PaStream* s, void *data, unsigned long numFrames )
@@ -362,6 +628,9 @@ static PaError BlockingReadStream( PaStream* s, void *data, unsigned long numFra
     long bytesRead;
     char *p = (char *) data;
     long numBytes = stream->bytesPerFrame * numFrames;
+
+    if( stream->isDirectBlocking )
+        return BlockingDirectReadStream( stream, (float **)data, numFrames );
     while( numBytes > 0 )
     {
         bytesRead = PaUtil_ReadRingBuffer( &stream->inFIFO, p, numBytes );
@@ -387,6 +656,10 @@ static PaError BlockingWriteStream( PaStream* s, const void *data, unsigned long
     long bytesWritten;
     char *p = (char *) data;
     long numBytes = stream->bytesPerFrame * numFrames;
+
+    if( stream->isDirectBlocking )
+        return BlockingDirectWriteStream( stream, (const float * const *)data, numFrames );
+
     while( numBytes > 0 )
     {
         bytesWritten = PaUtil_WriteRingBuffer( &stream->outFIFO, p, numBytes );
@@ -423,6 +696,9 @@ BlockingGetStreamReadAvailable( PaStream* s )
 {
     PaJackStream *stream = (PaJackStream *)s;
 
+    if( stream->isDirectBlocking )
+        return BlockingDirectReadAvailable( stream->inRings, stream->num_incoming_connections );
+
     int bytesFull = PaUtil_GetRingBufferReadAvailable( &stream->inFIFO );
     return bytesFull / stream->bytesPerFrame;
 }
@@ -432,6 +708,9 @@ BlockingGetStreamWriteAvailable( PaStream* s )
 {
     PaJackStream *stream = (PaJackStream *)s;
 
+    if( stream->isDirectBlocking )
+        return BlockingDirectWriteAvailable( stream->outRings, stream->num_outgoing_connections );
+
     int bytesEmpty = PaUtil_GetRingBufferWriteAvailable( &stream->outFIFO );
     return bytesEmpty / stream->bytesPerFrame;
 }
@@ -441,6 +720,15 @@ BlockingWaitEmpty( PaStream *s )
 {
     PaJackStream *stream = (PaJackStream *)s;
 
+    if( stream->isDirectBlocking )
+    {
+        /* Wait until the rings have been played entirely */
+        const long capacity = stream->num_outgoing_connections > 0 ? stream->outRings[0].bufferSize / sizeof (float) : 0;
+        while( capacity > 0 && BlockingDirectWriteAvailable( stream->outRings, stream->num_outgoing_connections ) < capacity )
+            BlockingDirectWait( stream, 1, capacity );
+        return 0;
+    }
+
     while( PaUtil_GetRingBufferReadAvailable( &stream->outFIFO ) > 0 )
     {
         stream->data_available = 0;
@@ -717,42 +1005,107 @@ static void JackErrorCallback( const char *msg )
 static void JackOnShutdown( void *arg )
 {
     PaJackHostApiRepresentation *jackApi = (PaJackHostApiRepresentation *)arg;
-    PaJackStream *stream = jackApi->processQueue;
+    PaJackProcessQueue *queue;
+    int i;
 
     PA_DEBUG(( "%s: JACK server is shutting down\n", __FUNCTION__ ));
-    for( ; stream; stream = stream->next )
-    {
-        stream->is_active = 0;
-    }
 
-    /* Make sure that the main thread doesn't get stuck waiting on the condition */
-    ASSERT_CALL( pthread_mutex_lock( &jackApi->mtx ), 0 );
+    /* Make sure that the main thread doesn't get stuck waiting on the process thread */
     jackApi->jackIsDown = 1;
-    ASSERT_CALL( pthread_cond_signal( &jackApi->cond ), 0 );
-    ASSERT_CALL( pthread_mutex_unlock( &jackApi->mtx ), 0 );
+    SignalMainThread( jackApi );
 
+    /* The queue can't be replaced while we hold the lock */
+    ASSERT_CALL( pthread_mutex_lock( &jackApi->mtx ), 0 );
+    queue = jackApi->processQueue;
+    for( i = 0; i < queue->numStreams; ++i )
+    {
+        queue->streams[i]->is_active = 0;
+    }
+    ASSERT_CALL( pthread_mutex_unlock( &jackApi->mtx ), 0 );
 }
 
 static int JackSrCb( jack_nframes_t nframes, void *arg )
 {
     PaJackHostApiRepresentation *jackApi = (PaJackHostApiRepresentation *)arg;
-    double sampleRate = (double)nframes;
-    PaJackStream *stream = jackApi->processQueue;
 
-    /* Update all streams in process queue */
-    PA_DEBUG(( "%s: Acting on change in JACK samplerate: %f\n", __FUNCTION__, sampleRate ));
-    for( ; stream; stream = stream->next )
+    /* The streams are updated by the process callback, before they process the next buffer */
+    PA_DEBUG(( "%s: Acting on change in JACK samplerate: %f\n", __FUNCTION__, (double)nframes ));
+    jackApi->sampleRate = nframes;
+
+    return 0;
+}
+
+/* Get the current process queue on a thread other than the process thread, without taking hostApi->mtx. Once
+ * the queue is still current after it has been pinned, it isn't reclaimed and its streams aren't closed until
+ * it's unpinned, see ReclaimProcessQueues and PublishProcessQueue. Only JackBufferSizeCb pins a queue, JACK
+ * calls it on a single notification thread.
+ */
+static PaJackProcessQueue *PinProcessQueue( PaJackHostApiRepresentation *hostApi )
+{
+    PaJackProcessQueue *queue;
+
+    do
     {
-        if( stream->streamRepresentation.streamInfo.sampleRate != sampleRate )
-        {
-            PA_DEBUG(( "%s: Updating samplerate\n", __FUNCTION__ ));
-            UpdateSampleRate( stream, sampleRate );
-        }
+        queue = hostApi->processQueue;
+        hostApi->pinnedQueue = queue;
+        PaUtil_FullMemoryBarrier();
+    } while( queue != hostApi->processQueue );
+
+    return queue;
+}
+
+static void UnpinProcessQueue( PaJackHostApiRepresentation *hostApi )
+{
+    /* Don't let the queue go before we're done reading it */
+    PaUtil_FullMemoryBarrier();
+    hostApi->pinnedQueue = NULL;
+    SignalMainThread( hostApi );
+}
+
+/* Called by JACK before the process callback gets buffers of a new size. The buffer processors are adapted by the
+ * process callback, between two cycles, and the users are notified here. The main thread may wait for the process
+ * thread while holding hostApi->mtx, so it isn't taken here, nor is the user called with it held.
+ */
+static int JackBufferSizeCb( jack_nframes_t nframes, void *arg )
+{
+    PaJackHostApiRepresentation *jackApi = (PaJackHostApiRepresentation *)arg;
+    PaJackProcessQueue *queue;
+    int i;
+
+    PA_DEBUG(( "%s: JACK buffer size changed to %u\n", __FUNCTION__, (unsigned)nframes ));
+    jackApi->jack_buffer_size = nframes;
+
+    queue = PinProcessQueue( jackApi );
+    for( i = 0; i < queue->numStreams; ++i )
+    {
+        PaJackStream *stream = queue->streams[i];
+        PaJackBufferSizeCallback *callback = stream->bufferSizeCallback;
+
+        /* The user data is set before the callback, see PaJack_SetBufferSizeCallback */
+        PaUtil_ReadMemoryBarrier();
+        if( callback )
+            callback( (PaStream *)stream, nframes, stream->bufferSizeUserData );
     }
+    UnpinProcessQueue( jackApi );
 
     return 0;
 }
 
+/* Called by JACK when the latencies in the graph have changed. The port latencies are cached per stream, so that
+ * the process callback doesn't have to query them for every buffer. It refreshes them before its next cycle, the
+ * streams can't be reached from here without taking hostApi->mtx. Our ports don't pass audio through, so there
+ * are no latencies to propagate from the input to the output ports.
+ */
+static void JackLatencyCb( jack_latency_callback_mode_t mode, void *arg )
+{
+    PaJackHostApiRepresentation *jackApi = (PaJackHostApiRepresentation *)arg;
+
+    if( mode == JackCaptureLatency )
+        jackApi->captureLatencyChanged = 1;
+    else
+        jackApi->playbackLatencyChanged = 1;
+}
+
 static int JackXRunCb(void *arg) {
     PaJackHostApiRepresentation *hostApi = (PaJackHostApiRepresentation *)arg;
     assert( hostApi );
@@ -769,18 +1122,20 @@ PaError PaJack_Initialize( PaUtilHostApiRepresentation **hostApi,
     int activated = 0;
     jack_status_t jackStatus = 0;
     *hostApi = NULL;    /* Initialize to NULL */
-    pthread_condattr_t cattr;
 
     UNLESS( jackHostApi = (PaJackHostApiRepresentation*)
         PaUtil_AllocateZeroInitializedMemory( sizeof(PaJackHostApiRepresentation) ), paInsufficientMemory );
     UNLESS( jackHostApi->deviceInfoMemory = PaUtil_CreateAllocationGroup(), paInsufficientMemory );
+    /* Start out with an empty process queue */
+    UNLESS( jackHostApi->processQueue = (PaJackProcessQueue*)
+        PaUtil_AllocateZeroInitializedMemory( sizeof(PaJackProcessQueue) ), paInsufficientMemory );
 
     mainThread_ = pthread_self();
     ASSERT_CALL( pthread_mutex_init( &jackHostApi->mtx, NULL ), 0 );
-
-    ASSERT_CALL( pthread_condattr_init( &cattr ), 0 );
-    jackHostApi->condClockId = PaPthreadUtil_NegotiateCondAttrClock( &cattr );
-    ASSERT_CALL( pthread_cond_init( &jackHostApi->cond, &cattr), 0 );
+    jackHostApi->wakeFds[0] = jackHostApi->wakeFds[1] = -1;
+    UNLESS( pipe( jackHostApi->wakeFds ) == 0, paInternalError );
+    fcntl( jackHostApi->wakeFds[0], F_SETFL, O_NONBLOCK );
+    fcntl( jackHostApi->wakeFds[1], F_SETFL, O_NONBLOCK );
 
     /* Try to become a client of the JACK server.  If we cannot do
      * this, then this API cannot be used.
@@ -830,18 +1185,24 @@ PaError PaJack_Initialize( PaUtilHostApiRepresentation **hostApi,
                                       GetStreamTime, PaUtil_DummyGetCpuLoad,
                                       BlockingReadStream, BlockingWriteStream,
                                       BlockingGetStreamReadAvailable, BlockingGetStreamWriteAvailable );
+    jackHostApi->blockingStreamInterface.SetLatency = SetStreamLatency;
 
     jackHostApi->inputBase = jackHostApi->outputBase = 0;
     jackHostApi->xrun = 0;
-    jackHostApi->toAdd = jackHostApi->toRemove = NULL;
-    jackHostApi->processQueue = NULL;
+    jackHostApi->retiredQueues = NULL;
+    jackHostApi->processEpoch = 0;
+    jackHostApi->pinnedQueue = NULL;
+    jackHostApi->captureLatencyChanged = jackHostApi->playbackLatencyChanged = 0;
     jackHostApi->jackIsDown = 0;
 
     jack_on_shutdown( jackHostApi->jack_client, JackOnShutdown, jackHostApi );
     jack_set_error_function( JackErrorCallback );
     jackHostApi->jack_buffer_size = jack_get_buffer_size ( jackHostApi->jack_client );
+    jackHostApi->sampleRate = jack_get_sample_rate( jackHostApi->jack_client );
     /* Don't check for error, may not be supported (deprecated in at least jackdmp) */
     jack_set_sample_rate_callback( jackHostApi->jack_client, JackSrCb, jackHostApi );
+    UNLESS( !jack_set_latency_callback( jackHostApi->jack_client, JackLatencyCb, jackHostApi ), paUnanticipatedHostError );
+    UNLESS( !jack_set_buffer_size_callback( jackHostApi->jack_client, JackBufferSizeCb, jackHostApi ), paUnanticipatedHostError );
     UNLESS( !jack_set_xrun_callback( jackHostApi->jack_client, JackXRunCb, jackHostApi ), paUnanticipatedHostError );
     UNLESS( !jack_set_process_callback( jackHostApi->jack_client, JackCallback, jackHostApi ), paUnanticipatedHostError );
     UNLESS( !jack_activate( jackHostApi->jack_client ), paUnanticipatedHostError );
@@ -864,6 +1225,13 @@ error:
             PaUtil_DestroyAllocationGroup( jackHostApi->deviceInfoMemory );
         }
 
+        if( jackHostApi->processQueue )
+        {
+            ASSERT_CALL( pthread_mutex_destroy( &jackHostApi->mtx ), 0 );
+            CloseWakePipe( jackHostApi );
+            PaUtil_FreeMemory( jackHostApi->processQueue );
+        }
+
         PaUtil_FreeMemory( jackHostApi );
     }
     return result;
@@ -878,8 +1246,12 @@ static void Terminate( struct PaUtilHostApiRepresentation *hostApi )
      * client is not allowed to have any ports connected */
     ASSERT_CALL( jack_deactivate( jackHostApi->jack_client ), 0 );
 
+    /* The process thread is gone, so all queues can be reclaimed */
+    ReclaimProcessQueues( jackHostApi, 1 );
+    PaUtil_FreeMemory( jackHostApi->processQueue );
+
     ASSERT_CALL( pthread_mutex_destroy( &jackHostApi->mtx ), 0 );
-    ASSERT_CALL( pthread_cond_destroy( &jackHostApi->cond ), 0 );
+    CloseWakePipe( jackHostApi );
 
     ASSERT_CALL( jack_client_close( jackHostApi->jack_client ), 0 );
 
@@ -1059,30 +1431,139 @@ static void CleanUpStream( PaJackStream *stream, int terminateStreamRepresentati
     PaUtil_FreeMemory( stream );
 }
 
-static PaError WaitCondition( PaJackHostApiRepresentation *hostApi )
+/* Get the time until which the main thread waits for the process thread */
+static PaTime GetWaitDeadline( void )
+{
+    return PaUtil_GetTime() + 10 * 60; /* 10 minutes */
+}
+
+/* Wait for the process thread to signal that it has acted on a request, or adopted a new process queue.
+ * The caller holds hostApi->mtx throughout and checks whether the request has been carried out, since the
+ * pipe may also have been written to for an earlier request.
+ *
+ * The process thread mustn't block on hostApi->mtx or any other lock, so it writes to a pipe, which is
+ * polled here. A signal sent after the caller has checked, but before it polls, stays in the pipe, so no
+ * wakeup is lost.
+ */
+static PaError WaitProcessThread( PaJackHostApiRepresentation *hostApi, PaTime deadline )
 {
     PaError result = paNoError;
-    int err = 0;
-    struct timespec ts;
+    PaTime now = PaUtil_GetTime();
+    struct pollfd pfd;
+    char buf[16];
+
+    /* Make sure we didn't time out */
+    UNLESS( now < deadline, paTimedOut );
+
+    pfd.fd = hostApi->wakeFds[0];
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    UNLESS( poll( &pfd, 1, (int)ceil( (deadline - now) * 1000 ) ) >= 0 || errno == EINTR, paInternalError );
+    while( read( hostApi->wakeFds[0], buf, sizeof (buf) ) > 0 )
+        ;
+
+error:
+    return result;
+}
 
-    if( PaPthreadUtil_GetTime( hostApi->condClockId, &ts ) == 0 )
+/* Wake up the main thread in WaitProcessThread. Writing to the pipe doesn't block or take a lock, so this
+ * can be called from the process thread.
+ */
+static void SignalMainThread( PaJackHostApiRepresentation *hostApi )
+{
+    char c = 0;
+    /* If the pipe is full, the main thread has a wakeup pending anyway */
+    if( write( hostApi->wakeFds[1], &c, 1 ) < 0 && errno != EAGAIN )
     {
-        ts.tv_sec += 10 * 60; /* 10 minutes */
+        PA_DEBUG(( "%s: Failed to write to wakeup pipe\n", __FUNCTION__ ));
+    }
+}
 
-        /* XXX: Best enclose in loop, in case of spurious wakeups? */
-        err = pthread_cond_timedwait( &hostApi->cond, &hostApi->mtx, &ts );
+static void CloseWakePipe( PaJackHostApiRepresentation *hostApi )
+{
+    if( hostApi->wakeFds[0] >= 0 )
+    {
+        close( hostApi->wakeFds[0] );
+        close( hostApi->wakeFds[1] );
+        hostApi->wakeFds[0] = hostApi->wakeFds[1] = -1;
     }
-    else
+}
+
+/* Free the retired process queues that the process thread can't be using anymore, or all of them if it
+ * doesn't run. Called with hostApi->mtx held, or once the process thread is gone.
+ */
+static void ReclaimProcessQueues( PaJackHostApiRepresentation *hostApi, int all )
+{
+    PaJackProcessQueue **link = &hostApi->retiredQueues;
+    const unsigned long epoch = hostApi->processEpoch;
+    PaJackProcessQueue *pinnedQueue;
+
+    /* Don't read anything of the retired queues before the process thread is done with them. The queues have
+     * been retired before, so PinProcessQueue either sees that or has pinned the queue already */
+    PaUtil_FullMemoryBarrier();
+    pinnedQueue = hostApi->pinnedQueue;
+
+    while( *link )
     {
-        /* XXX: Best enclose in loop, in case of spurious wakeups? */
-        err = pthread_cond_wait( &hostApi->cond, &hostApi->mtx );
+        PaJackProcessQueue *queue = *link;
+        /* The epochs only increase, by one per queue */
+        if( all || ((long)(epoch - queue->epoch) > 0 && queue != pinnedQueue) )
+        {
+            *link = queue->retired;
+            PaUtil_FreeMemory( queue );
+        }
+        else
+            link = &queue->retired;
     }
+}
 
-    /* Make sure we didn't time out */
-    UNLESS( err != ETIMEDOUT, paTimedOut );
-    UNLESS( !err, paInternalError );
+/* Publish a process queue with stream added and/or remove removed, and wait for the process thread to
+ * adopt it. The process thread never waits for the main thread, the replaced queue is reclaimed once the
+ * process thread has moved on. Until an older queue has been unpinned, the streams removed from it
+ * mustn't be closed either, so that is waited for as well. Called with hostApi->mtx held.
+ */
+static PaError PublishProcessQueue( PaJackHostApiRepresentation *hostApi, PaJackStream *add, PaJackStream *remove )
+{
+    PaError result = paNoError;
+    PaJackProcessQueue *oldQueue = hostApi->processQueue, *newQueue = NULL;
+    PaTime deadline;
+    int i, removed = 0;
+
+    UNLESS( newQueue = (PaJackProcessQueue *)PaUtil_AllocateZeroInitializedMemory( sizeof (PaJackProcessQueue) +
+                (oldQueue->numStreams + 1) * sizeof (PaJackStream *) ), paInsufficientMemory );
+    for( i = 0; i < oldQueue->numStreams; ++i )
+    {
+        if( oldQueue->streams[i] == remove )
+        {
+            removed = 1;
+            continue;
+        }
+        newQueue->streams[newQueue->numStreams++] = oldQueue->streams[i];
+    }
+    UNLESS( !remove || removed, paInternalError );
+    if( add )
+        newQueue->streams[newQueue->numStreams++] = add;
+    newQueue->epoch = oldQueue->epoch + 1;
+
+    /* Make the queue's contents visible before the queue itself */
+    PaUtil_WriteMemoryBarrier();
+    hostApi->processQueue = newQueue;
+    oldQueue->retired = hostApi->retiredQueues;
+    hostApi->retiredQueues = oldQueue;
+    newQueue = NULL;
+
+    deadline = GetWaitDeadline();
+    while( hostApi->processEpoch != hostApi->processQueue->epoch && !hostApi->jackIsDown )
+        ENSURE_PA( WaitProcessThread( hostApi, deadline ) );
+    PaUtil_FullMemoryBarrier();
+    while( hostApi->pinnedQueue && hostApi->pinnedQueue != hostApi->processQueue )
+        ENSURE_PA( WaitProcessThread( hostApi, deadline ) );
+    PA_DEBUG(( "%s: Published process queue %lu\n", __FUNCTION__, hostApi->processQueue->epoch ));
 
 error:
+    /* If the process thread didn't adopt the queue, older ones are reclaimed at a later opportunity */
+    ReclaimProcessQueues( hostApi, 0 );
+    PaUtil_FreeMemory( newQueue );
     return result;
 }
 
@@ -1094,9 +1575,15 @@ static PaError AddStream( PaJackStream *stream )
     ASSERT_CALL( pthread_mutex_lock( &hostApi->mtx ), 0 );
     if( !hostApi->jackIsDown )
     {
-        hostApi->toAdd = stream;
-        /* Unlock mutex and await signal from processing thread */
-        result = WaitCondition( stream->hostApi );
+        result = PublishProcessQueue( hostApi, stream, NULL );
+        if( result == paNoError && hostApi->jackIsDown )
+            result = paDeviceUnavailable;
+        if( result != paNoError && hostApi->processQueue->numStreams > 0 &&
+                hostApi->processQueue->streams[hostApi->processQueue->numStreams - 1] == stream )
+        {
+            /* Don't leave the stream in the queue, it's about to be freed */
+            PublishProcessQueue( hostApi, NULL, stream );
+        }
     }
     ASSERT_CALL( pthread_mutex_unlock( &hostApi->mtx ), 0 );
     ENSURE_PA( result );
@@ -1113,14 +1600,9 @@ static PaError RemoveStream( PaJackStream *stream )
     PaError result = paNoError;
     PaJackHostApiRepresentation *hostApi = stream->hostApi;
 
-    /* Add to queue over streams that should be processed */
+    /* Remove from the queue even if JACK is down, the queue mustn't refer to freed streams */
     ASSERT_CALL( pthread_mutex_lock( &hostApi->mtx ), 0 );
-    if( !hostApi->jackIsDown )
-    {
-        hostApi->toRemove = stream;
-        /* Unlock mutex and await signal from processing thread */
-        result = WaitCondition( stream->hostApi );
-    }
+    result = PublishProcessQueue( hostApi, NULL, stream );
     ASSERT_CALL( pthread_mutex_unlock( &hostApi->mtx ), 0 );
     ENSURE_PA( result );
 
@@ -1128,6 +1610,23 @@ error:
     return result;
 }
 
+/* Cache the latencies of the connected ports, and derive the latencies in the stream info from them */
+static void UpdateStreamLatencies( PaJackStream *stream, double sampleRate )
+{
+    if( stream->num_incoming_connections > 0 )
+    {
+        stream->inputLatencyFrames = port_get_min_latency( stream->remote_output_ports[0], JackCaptureLatency );
+        stream->streamRepresentation.streamInfo.inputLatency = (stream->inputLatencyFrames
+            + PaUtil_GetBufferProcessorInputLatencyFrames( &stream->bufferProcessor )) / sampleRate;
+    }
+    if( stream->num_outgoing_connections > 0 )
+    {
+        stream->outputLatencyFrames = port_get_min_latency( stream->remote_input_ports[0], JackPlaybackLatency );
+        stream->streamRepresentation.streamInfo.outputLatency = (stream->outputLatencyFrames
+            + PaUtil_GetBufferProcessorOutputLatencyFrames( &stream->bufferProcessor )) / sampleRate;
+    }
+}
+
 /* Add stream to JACK callback processing queue */
 static PaError OpenStream( struct PaUtilHostApiRepresentation *hostApi,
                            PaStream** s,
@@ -1153,6 +1652,7 @@ static PaError OpenStream( struct PaUtilHostApiRepresentation *hostApi,
     int i;
     int inputChannelCount, outputChannelCount;
     const double jackSr = jack_get_sample_rate( jackHostApi->jack_client );
+    const jack_nframes_t jackBufferSize = jack_get_buffer_size( jackHostApi->jack_client );
     PaSampleFormat inputSampleFormat = 0, outputSampleFormat = 0;
     int bpInitialized = 0, srInitialized = 0;   /* Initialized buffer processor and stream representation? */
     unsigned long ofs;
@@ -1235,25 +1735,14 @@ static PaError OpenStream( struct PaUtilHostApiRepresentation *hostApi,
 
     /* the blocking emulation, if necessary */
     stream->isBlockingStream = !streamCallback;
+    /* Samples in the ports' format are moved directly */
+    stream->isDirectBlocking = stream->isBlockingStream &&
+        (inputChannelCount == 0 || inputSampleFormat == (paFloat32 | paNonInterleaved)) &&
+        (outputChannelCount == 0 || outputSampleFormat == (paFloat32 | paNonInterleaved));
     if( stream->isBlockingStream )
     {
-        float latency = 0.001f; /* 1ms is the absolute minimum we support */
-        int   minimum_buffer_frames = 0;
-
-        if( inputParameters && inputParameters->suggestedLatency > latency )
-            latency = inputParameters->suggestedLatency;
-        else if( outputParameters && outputParameters->suggestedLatency > latency )
-            latency = outputParameters->suggestedLatency;
-
-        /* the latency the user asked for indicates the minimum buffer size in frames */
-        minimum_buffer_frames = (int) (latency * jack_get_sample_rate( jackHostApi->jack_client ));
-
-        /* we also need to be able to store at least three full jack buffers to avoid dropouts */
-        if( jackHostApi->jack_buffer_size * 3 > minimum_buffer_frames )
-            minimum_buffer_frames = jackHostApi->jack_buffer_size * 3;
-
-        /* setup blocking API data structures (FIXME: can fail) */
-        BlockingBegin( stream, minimum_buffer_frames );
+        /* setup blocking API data structures, CleanUpStream calls BlockingEnd if this fails */
+        ENSURE_PA( BlockingBegin( stream, BlockingMinimumBufferFrames( jackHostApi, inputParameters, outputParameters ) ) );
 
         /* install our own callback for the blocking API */
         streamCallback = BlockingCallback;
@@ -1365,20 +1854,15 @@ static PaError OpenStream( struct PaUtilHostApiRepresentation *hostApi,
                   jackSr,
                   streamFlags,
                   framesPerBuffer,
-                  0,                            /* Ignored */
-                  paUtilUnknownHostBufferSize,  /* Buffer size may vary on JACK's discretion */
+                  jackBufferSize > JACK_MAX_BUFFER_SIZE ? jackBufferSize : JACK_MAX_BUFFER_SIZE,
+                  paUtilFixedHostBufferSize,    /* Adapted by the process callback when the period changes */
                   streamCallback,
                   userData ) );
     bpInitialized = 1;
+    ENSURE_PA( PaUtil_SetBufferProcessorHostBufferSize( &stream->bufferProcessor, jackBufferSize,
+                paUtilFixedHostBufferSize ) );
 
-    if( stream->num_incoming_connections > 0 )
-        stream->streamRepresentation.streamInfo.inputLatency =
-            (port_get_min_latency( stream->remote_output_ports[0], JackCaptureLatency )
-            + PaUtil_GetBufferProcessorInputLatencyFrames( &stream->bufferProcessor )) / sampleRate;
-    if( stream->num_outgoing_connections > 0 )
-        stream->streamRepresentation.streamInfo.outputLatency =
-            (port_get_min_latency( stream->remote_input_ports[0], JackPlaybackLatency )
-            + PaUtil_GetBufferProcessorOutputLatencyFrames( &stream->bufferProcessor )) / sampleRate;
+    UpdateStreamLatencies( stream, sampleRate );
 
     stream->streamRepresentation.streamInfo.sampleRate = jackSr;
     stream->t0 = jack_frame_time( jackHostApi->jack_client );   /* A: Time should run from Pa_OpenStream */
@@ -1408,7 +1892,7 @@ static void CheckAndResetPortBase( PaJackHostApiRepresentation *jackApi )
     int noStreams;
 
     ASSERT_CALL( pthread_mutex_lock( &jackApi->mtx ), 0 );
-    noStreams = jackApi->jackIsDown || jackApi->processQueue == NULL;
+    noStreams = jackApi->jackIsDown || jackApi->processQueue->numStreams == 0;
     ASSERT_CALL( pthread_mutex_unlock( &jackApi->mtx ), 0 );
 
     if ( noStreams ) {
@@ -1442,7 +1926,7 @@ static PaError RealProcess( PaJackStream *stream, jack_nframes_t frames )
     PaStreamCallbackTimeInfo timeInfo = {0,0,0};
     int chn;
     int framesProcessed;
-    const double sr = jack_get_sample_rate( stream->jack_client );    /* Shouldn't change during the process callback */
+    const double sr = stream->streamRepresentation.streamInfo.sampleRate;    /* Updated by JackCallback */
     PaStreamCallbackFlags cbFlags = 0;
 
     /* If the user has returned !paContinue from the callback we'll want to flush the internal buffers,
@@ -1459,12 +1943,12 @@ static PaError RealProcess( PaJackStream *stream, jack_nframes_t frames )
     }
 
     timeInfo.currentTime = (jack_frame_time( stream->jack_client ) - stream->t0) / sr;
+    /* The port latencies are cached by UpdateStreamLatencies, querying them here would cost too much at small
+     * buffer sizes */
     if( stream->num_incoming_connections > 0 )
-        timeInfo.inputBufferAdcTime = timeInfo.currentTime -
-            port_get_min_latency( stream->remote_output_ports[0], JackCaptureLatency ) / sr;
+        timeInfo.inputBufferAdcTime = timeInfo.currentTime - stream->inputLatencyFrames / sr;
     if( stream->num_outgoing_connections > 0 )
-        timeInfo.outputBufferDacTime = timeInfo.currentTime +
-            port_get_min_latency( stream->remote_input_ports[0], JackPlaybackLatency ) / sr;
+        timeInfo.outputBufferDacTime = timeInfo.currentTime + stream->outputLatencyFrames / sr;
 
     PaUtil_BeginCpuLoadMeasurement( &stream->cpuLoadMeasurer );
 
@@ -1515,82 +1999,41 @@ end:
     return result;
 }
 
-/* Update the JACK callback's stream processing queue. */
-static PaError UpdateQueue( PaJackHostApiRepresentation *hostApi )
+/* Process a direct blocking stream, which doesn't need the buffer processor */
+static void BlockingDirectRealProcess( PaJackStream *stream, jack_nframes_t frames )
 {
-    PaError result = paNoError;
-    int queueModified = 0;
-    const double jackSr = jack_get_sample_rate( hostApi->jack_client );
-    int err;
-
-    if( (err = pthread_mutex_trylock( &hostApi->mtx )) != 0 )
+    /* Stopping doesn't need to flush anything */
+    if( stream->callbackResult != paContinue )
     {
-        assert( err == EBUSY );
-        return paNoError;
-    }
-
-    if( hostApi->toAdd )
-    {
-        if( hostApi->processQueue )
-        {
-            PaJackStream *node = hostApi->processQueue;
-            /* Advance to end of queue */
-            while( node->next )
-                node = node->next;
-
-            node->next = hostApi->toAdd;
-        }
-        else
-        {
-            /* The only queue entry. */
-            hostApi->processQueue = (PaJackStream *)hostApi->toAdd;
-        }
-
-        /* If necessary, update stream state */
-        if( hostApi->toAdd->streamRepresentation.streamInfo.sampleRate != jackSr )
-            UpdateSampleRate( hostApi->toAdd, jackSr );
-
-        hostApi->toAdd = NULL;
-        queueModified = 1;
+        stream->is_active = 0;
+        if( stream->streamRepresentation.streamFinishedCallback )
+            stream->streamRepresentation.streamFinishedCallback( stream->streamRepresentation.userData );
+        return;
     }
-    if( hostApi->toRemove )
-    {
-        int removed = 0;
-        PaJackStream *node = hostApi->processQueue, *prev = NULL;
-        assert( hostApi->processQueue );
-
-        while( node )
-        {
-            if( node == hostApi->toRemove )
-            {
-                if( prev )
-                    prev->next = node->next;
-                else
-                    hostApi->processQueue = (PaJackStream *)node->next;
 
-                removed = 1;
-                break;
-            }
+    BlockingDirectProcess( stream, frames );
+}
 
-            prev = node;
-            node = node->next;
-        }
-        UNLESS( removed, paInternalError );
-        hostApi->toRemove = NULL;
-        PA_DEBUG(( "%s: Removed stream from processing queue\n", __FUNCTION__ ));
-        queueModified = 1;
-    }
+/* Reset a request of the main thread once it has been carried out, returns 0 if the request has been called off. */
+static int CompleteRequest( PaJackStream *stream, int request )
+{
+    if( !COMPARE_AND_SWAP( &stream->request, request, paJackRequestNone ) )
+        return 0;
+    SignalMainThread( stream->hostApi );
+    return 1;
+}
 
-    if( queueModified )
+/* Adapt the buffer processor to a new JACK period, this is called from the process thread between cycles */
+static void UpdateHostBufferSize( PaJackStream *stream, jack_nframes_t frames )
+{
+    PA_DEBUG(( "%s: Adapting to %u frames per buffer\n", __FUNCTION__, (unsigned)frames ));
+    if( PaUtil_SetBufferProcessorHostBufferSize( &stream->bufferProcessor, frames,
+                paUtilFixedHostBufferSize ) != paNoError )
     {
-        /* Signal that we've done what was asked of us */
-        ASSERT_CALL( pthread_cond_signal( &hostApi->cond ), 0 );
+        /* Larger than the temp buffers, the buffer processor can still handle it as a buffer of unknown size */
+        ASSERT_CALL( PaUtil_SetBufferProcessorHostBufferSize( &stream->bufferProcessor, frames,
+                    paUtilUnknownHostBufferSize ), paNoError );
     }
-
-error:
-    ASSERT_CALL( pthread_mutex_unlock( &hostApi->mtx ), 0 );
-
-    return result;
 }
 
 /* Audio processing callback invoked periodically from JACK. */
@@ -1598,53 +2041,79 @@ static int JackCallback( jack_nframes_t frames, void *userData )
 {
     PaError result = paNoError;
     PaJackHostApiRepresentation *hostApi = (PaJackHostApiRepresentation *)userData;
-    PaJackStream *stream = NULL;
+    PaJackProcessQueue *queue;
+    const double sampleRate = hostApi->sampleRate;
     int xrun = hostApi->xrun;
+    /* Reset the flags of JackLatencyCb only if they're still set, so that a change meanwhile isn't missed */
+    const int captureLatencyChanged = hostApi->captureLatencyChanged &&
+        COMPARE_AND_SWAP( &hostApi->captureLatencyChanged, 1, 0 );
+    const int playbackLatencyChanged = hostApi->playbackLatencyChanged &&
+        COMPARE_AND_SWAP( &hostApi->playbackLatencyChanged, 1, 0 );
+    int n;
     hostApi->xrun = 0;
 
     assert( hostApi );
 
-    ENSURE_PA( UpdateQueue( hostApi ) );
+    /* Adopt the latest process queue, this thread never blocks on the main thread */
+    queue = hostApi->processQueue;
+    PaUtil_ReadMemoryBarrier();
+    if( queue->epoch != hostApi->processEpoch )
+    {
+        /* We're done with the older queues, make sure that they're not read after they've been reclaimed */
+        PaUtil_FullMemoryBarrier();
+        hostApi->processEpoch = queue->epoch;
+        SignalMainThread( hostApi );
+    }
 
     /* Process each stream */
-    stream = hostApi->processQueue;
-    for( ; stream; stream = stream->next )
+    for( n = 0; n < queue->numStreams; ++n )
     {
+        PaJackStream *stream = queue->streams[n];
+        const int request = stream->request;
+
         if( xrun )  /* Don't override if already set */
             stream->xrun = 1;
 
+        /* The sample rate may have changed since the stream was added */
+        if( stream->streamRepresentation.streamInfo.sampleRate != sampleRate )
+        {
+            PA_DEBUG(( "%s: Updating samplerate\n", __FUNCTION__ ));
+            UpdateSampleRate( stream, sampleRate );
+        }
+
+        if( (captureLatencyChanged && stream->num_incoming_connections > 0) ||
+                (playbackLatencyChanged && stream->num_outgoing_connections > 0) )
+            UpdateStreamLatencies( stream, sampleRate );
+
+        /* JackBufferSizeCb has been called if the period has changed since the previous cycle */
+        if( frames != stream->bufferProcessor.framesPerHostBuffer )
+            UpdateHostBufferSize( stream, frames );
+
         /* See if this stream is to be started */
-        if( stream->doStart )
+        if( request == paJackRequestStart )
         {
-            /* If we can't obtain a lock, we'll try next time */
-            int err = pthread_mutex_trylock( &stream->hostApi->mtx );
-            if( !err )
+            stream->callbackResult = paContinue;
+            stream->isSilenced = 0;
+            stream->is_active = 1;
+            if( CompleteRequest( stream, request ) )
             {
-                if( stream->doStart )   /* Could potentially change before obtaining the lock */
-                {
-                    stream->is_active = 1;
-                    stream->doStart = 0;
-                    PA_DEBUG(( "%s: Starting stream\n", __FUNCTION__ ));
-                    ASSERT_CALL( pthread_cond_signal( &stream->hostApi->cond ), 0 );
-                    stream->callbackResult = paContinue;
-                    stream->isSilenced = 0;
-                }
-
-                ASSERT_CALL( pthread_mutex_unlock( &stream->hostApi->mtx ), 0 );
+                PA_DEBUG(( "%s: Starting stream\n", __FUNCTION__ ));
             }
             else
-                assert( err == EBUSY );
+                stream->is_active = 0;  /* The start has been called off */
         }
-        else if( stream->doStop || stream->doAbort )    /* Should we stop/abort stream? */
+        else if( request == paJackRequestStop || request == paJackRequestAbort )    /* Should we stop/abort stream? */
         {
             if( stream->callbackResult == paContinue )     /* Ok, make it stop */
             {
                 PA_DEBUG(( "%s: Stopping stream\n", __FUNCTION__ ));
-                stream->callbackResult = stream->doStop ? paComplete : paAbort;
+                stream->callbackResult = request == paJackRequestStop ? paComplete : paAbort;
             }
         }
 
-        if( stream->is_active )
+        if( stream->is_active && stream->isDirectBlocking )
+            BlockingDirectRealProcess( stream, frames );
+        else if( stream->is_active )
             ENSURE_PA( RealProcess( stream, frames ) );
         /* If we have just entered inactive state, silence output */
         if( !stream->is_active && !stream->isSilenced )
@@ -1660,23 +2129,9 @@ static int JackCallback( jack_nframes_t frames, void *userData )
             stream->isSilenced = 1;
         }
 
-        if( stream->doStop || stream->doAbort )
-        {
-            /* See if RealProcess has acted on the request */
-            if( !stream->is_active )   /* Ok, signal to the main thread that we've carried out the operation */
-            {
-                /* If we can't obtain a lock, we'll try next time */
-                int err = pthread_mutex_trylock( &stream->hostApi->mtx );
-                if( !err )
-                {
-                    stream->doStop = stream->doAbort = 0;
-                    ASSERT_CALL( pthread_cond_signal( &stream->hostApi->cond ), 0 );
-                    ASSERT_CALL( pthread_mutex_unlock( &stream->hostApi->mtx ), 0 );
-                }
-                else
-                    assert( err == EBUSY );
-            }
-        }
+        /* See if RealProcess has acted on a stop request, if so signal the main thread */
+        if( (request == paJackRequestStop || request == paJackRequestAbort) && !stream->is_active )
+            CompleteRequest( stream, request );
     }
 
     return 0;
@@ -1688,6 +2143,7 @@ static PaError StartStream( PaStream *s )
 {
     PaError result = paNoError;
     PaJackStream *stream = (PaJackStream*)s;
+    PaTime deadline;
 
     /* Ready the processor */
     PaUtil_ResetBufferProcessor( &stream->bufferProcessor );
@@ -1720,21 +2176,22 @@ static PaError StartStream( PaStream *s )
     /* Enable processing */
 
     ASSERT_CALL( pthread_mutex_lock( &stream->hostApi->mtx ), 0 );
-    stream->doStart = 1;
+    /* Make the stream's state visible before the request */
+    PaUtil_WriteMemoryBarrier();
+    stream->request = paJackRequestStart;
 
     /* Wait for stream to be started */
-    result = WaitCondition( stream->hostApi );
-    /*
-    do
-    {
-        err = pthread_cond_timedwait( &stream->hostApi->cond, &stream->hostApi->mtx, &ts );
-    } while( !stream->is_active && !err );
-    */
-    if( result != paNoError )   /* Something went wrong, call off the stream start */
+    deadline = GetWaitDeadline();
+    while( stream->request != paJackRequestNone && result == paNoError )
     {
-        stream->doStart = 0;
-        stream->is_active = 0;  /* Cancel any processing */
+        if( stream->hostApi->jackIsDown )
+            result = paDeviceUnavailable;
+        else
+            result = WaitProcessThread( stream->hostApi, deadline );
     }
+    /* Something went wrong, call off the stream start unless the process thread has carried it out meanwhile */
+    if( result != paNoError && COMPARE_AND_SWAP( &stream->request, paJackRequestStart, paJackRequestNone ) )
+        stream->is_active = 0;  /* Cancel any processing */
     ASSERT_CALL( pthread_mutex_unlock( &stream->hostApi->mtx ), 0 );
 
     ENSURE_PA( result );
@@ -1749,18 +2206,20 @@ error:
 static PaError RealStop( PaJackStream *stream, int abort )
 {
     PaError result = paNoError;
+    const int request = abort ? paJackRequestAbort : paJackRequestStop;
+    PaTime deadline;
 
     if( stream->isBlockingStream )
         BlockingWaitEmpty ( stream );
 
     ASSERT_CALL( pthread_mutex_lock( &stream->hostApi->mtx ), 0 );
-    if( abort )
-        stream->doAbort = 1;
-    else
-        stream->doStop = 1;
+    stream->request = request;
 
-    /* Wait for stream to be stopped */
-    result = WaitCondition( stream->hostApi );
+    /* Wait for stream to be stopped, if JACK is down it has been stopped already */
+    deadline = GetWaitDeadline();
+    while( stream->request != paJackRequestNone && !stream->hostApi->jackIsDown && result == paNoError )
+        result = WaitProcessThread( stream->hostApi, deadline );
+    COMPARE_AND_SWAP( &stream->request, request, paJackRequestNone );
     ASSERT_CALL( pthread_mutex_unlock( &stream->hostApi->mtx ), 0 );
     ENSURE_PA( result );
 
@@ -1837,6 +2296,84 @@ static double GetStreamCpuLoad( PaStream* s )
     return PaUtil_GetCpuLoad( &stream->cpuLoadMeasurer );
 }
 
+
+/*
+    The period size is a property of the JACK server, it is shared by all clients. A callback stream's
+    latency therefore can't be changed, so only blocking streams implement this (callback streams get
+    paIncompatibleStreamHostApi): the FIFOs of the blocking emulation are resized. The reported latencies
+    are refreshed, since the ports may have been reconnected since the stream was opened.
+*/
+static PaError SetStreamLatency( PaStream *s, PaTime inputLatency, PaTime outputLatency )
+{
+    PaError result = paNoError;
+    PaJackStream *stream = (PaJackStream*)s;
+    PaStreamParameters inputParameters, outputParameters;
+
+    assert( stream->isBlockingStream );
+    memset( &inputParameters, 0, sizeof (inputParameters) );
+    memset( &outputParameters, 0, sizeof (outputParameters) );
+    inputParameters.suggestedLatency = inputLatency;
+    outputParameters.suggestedLatency = outputLatency;
+
+    /* The stream is stopped, so the process callback doesn't touch the FIFOs */
+    BlockingTermFIFOs( stream );
+    ENSURE_PA( BlockingInitFIFOs( stream, BlockingMinimumBufferFrames( stream->hostApi,
+                    stream->bufferProcessor.inputChannelCount > 0 ? &inputParameters : NULL,
+                    stream->bufferProcessor.outputChannelCount > 0 ? &outputParameters : NULL ) ) );
+
+    UpdateStreamLatencies( stream, jack_get_sample_rate( stream->jack_client ) );
+
+error:
+    return result;
+}
+
+static PaError GetJackStreamPointer( PaStream* s, PaJackStream** stream )
+{
+    PaError result = paNoError;
+    PaUtilHostApiRepresentation* hostApi;
+    PaJackHostApiRepresentation* jackHostApi;
+
+    ENSURE_PA( PaUtil_ValidateStreamPointer( s ) );
+    ENSURE_PA( PaUtil_GetHostApiRepresentation( &hostApi, paJACK ) );
+    jackHostApi = (PaJackHostApiRepresentation*)hostApi;
+
+    UNLESS( PA_STREAM_REP( s )->streamInterface == &jackHostApi->callbackStreamInterface
+            || PA_STREAM_REP( s )->streamInterface == &jackHostApi->blockingStreamInterface,
+        paIncompatibleStreamHostApi );
+
+    *stream = (PaJackStream*)s;
+error:
+    return result;
+}
+
+PaError PaJack_SetBufferSizeCallback( PaStream* s, PaJackBufferSizeCallback* callback, void* userData )
+{
+    PaError result = paNoError;
+    PaJackStream *stream;
+    PaTime deadline;
+
+    ENSURE_PA( GetJackStreamPointer( s, &stream ) );
+
+    /* JackBufferSizeCb reads the callback without a lock. Remove the old one and wait until it can't be running
+     * anymore, so that a new callback is never called with the old user data */
+    ASSERT_CALL( pthread_mutex_lock( &stream->hostApi->mtx ), 0 );
+    stream->bufferSizeCallback = NULL;
+    PaUtil_FullMemoryBarrier();
+    deadline = GetWaitDeadline();
+    while( stream->hostApi->pinnedQueue && result == paNoError )
+        result = WaitProcessThread( stream->hostApi, deadline );
+    if( result == paNoError )
+    {
+        stream->bufferSizeUserData = userData;
+        PaUtil_WriteMemoryBarrier();
+        stream->bufferSizeCallback = callback;
+    }
+    ASSERT_CALL( pthread_mutex_unlock( &stream->hostApi->mtx ), 0 );
+
+error:
+    return result;
+}
+
 PaError PaJack_SetClientName( const char* name )
 {
     if( strlen( name ) > jack_client_name_size() )
@@ -158,6 +158,9 @@ PaPulseAudio_HostApiRepresentation *PaPulseAudio_New( void )
     /* Make sure we have NULL all struct first */
     memset(ptr, 0x00, sizeof(PaPulseAudio_HostApiRepresentation));
 
+    ptr->defaultOutputSlot = -1;
+    ptr->defaultInputSlot = -1;
+
     ptr->mainloop = pa_threaded_mainloop_new();
 
     if( !ptr->mainloop )
@@ -202,6 +205,35 @@ PaPulseAudio_HostApiRepresentation *PaPulseAudio_New( void )
     return NULL;
 }
 
+/* Entries are only needed until device slots are filled,
+ * so they are not in allocation group
+ */
+static void _PaPulseAudio_FreeDeviceEntry( PaPulseAudio_DeviceEntry *entry )
+{
+    PaUtil_FreeMemory( entry->name );
+    PaUtil_FreeMemory( entry->description );
+    PaUtil_FreeMemory( entry );
+}
+
+static void _PaPulseAudio_FreeDeviceEntries( PaPulseAudio_HostApiRepresentation *hostapi )
+{
+    PaPulseAudio_DeviceEntry *entry = NULL;
+
+    while( hostapi->sinkEntries )
+    {
+        entry = hostapi->sinkEntries;
+        hostapi->sinkEntries = entry->next;
+        _PaPulseAudio_FreeDeviceEntry( entry );
+    }
+
+    while( hostapi->sourceEntries )
+    {
+        entry = hostapi->sourceEntries;
+        hostapi->sourceEntries = entry->next;
+        _PaPulseAudio_FreeDeviceEntry( entry );
+    }
+}
+
 /* Free HostAPI */
 void PaPulseAudio_Free( PaPulseAudio_HostApiRepresentation * ptr )
 {
@@ -221,6 +253,9 @@ void PaPulseAudio_Free( PaPulseAudio_HostApiRepresentation * ptr )
         pa_threaded_mainloop_stop( ptr->mainloop );
     }
 
+    /* Left over if enumeration did not finish */
+    _PaPulseAudio_FreeDeviceEntries( ptr );
+
     if( ptr->context )
     {
         pa_context_disconnect( ptr->context );
@@ -279,6 +314,8 @@ void PaPulseAudio_ServerInfoCb( pa_context *c,
     PaPulseAudio_HostApiRepresentation *pulseaudioHostApi =
       (PaPulseAudio_HostApiRepresentation *) userdata;
 
+    pulseaudioHostApi->pendingOperations--;
+
     if( !c  || !i )
     {
         PA_PULSEAUDIO_SET_LAST_HOST_ERROR( 0,
@@ -292,19 +329,22 @@ void PaPulseAudio_ServerInfoCb( pa_context *c,
     pa_threaded_mainloop_signal( pulseaudioHostApi->mainloop, 0 );
 }
 
-/* Function adds device to list. It can be input or output stream
- *  or in pulseaudio source or sink.
+/* Fill device slot. Strings are copied to host API allocations
+ * only if they have changed. A slot keeps its name once it has one,
+ * see _PaPulseAudio_FindDeviceSlot, so only description can change.
+ * It's internal and read with mainloop locked so old one is freed
  */
-int _PaPulseAudio_AddAudioDevice( PaPulseAudio_HostApiRepresentation *hostapi,
-                                  const char *PaPulseAudio_SinkSourceName,
-                                  const char *PaPulseAudio_SinkSourceNameDesc,
-                                  int inputChannels,
-                                  int outputChannels,
-                                  double defaultLowInputLatency,
-                                  double defaultHighInputLatency,
-                                  double defaultLowOutputLatency,
-                                  double defaultHighOutputLatency,
-                                  const long defaultSampleRate )
+static PaError _PaPulseAudio_SetAudioDevice( PaPulseAudio_HostApiRepresentation *hostapi,
+                                             int slot,
+                                             const char *PaPulseAudio_SinkSourceName,
+                                             const char *PaPulseAudio_SinkSourceNameDesc,
+                                             int inputChannels,
+                                             int outputChannels,
+                                             double defaultLowInputLatency,
+                                             double defaultHighInputLatency,
+                                             double defaultLowOutputLatency,
+                                             double defaultHighOutputLatency,
+                                             const long defaultSampleRate )
 {
     /* These should be at least 1
      *
@@ -314,55 +354,161 @@ int _PaPulseAudio_AddAudioDevice( PaPulseAudio_HostApiRepresentation *hostapi,
      */
     int pulseaudioRealNameSize = strnlen( PaPulseAudio_SinkSourceNameDesc, (PAPULSEAUDIO_MAX_DEVICENAME - 1) ) + 1;
     int pulseaudioDeviceNameSize = strnlen( PaPulseAudio_SinkSourceName, (PAPULSEAUDIO_MAX_DEVICENAME - 1) ) + 1;
-    char *pulseaudioLocalDeviceName = NULL;
-
-    hostapi->deviceInfoArray[hostapi->deviceCount].structVersion = 2;
-    hostapi->deviceInfoArray[hostapi->deviceCount].hostApi = hostapi->hostApiIndex;
-    hostapi->pulseaudioDeviceNames[hostapi->deviceCount] =
-        PaUtil_GroupAllocateZeroInitializedMemory( hostapi->allocations,
-                                                   pulseaudioRealNameSize );
-    pulseaudioLocalDeviceName = PaUtil_GroupAllocateZeroInitializedMemory( hostapi->allocations,
-                                                                pulseaudioDeviceNameSize );
-    if( !hostapi->pulseaudioDeviceNames[hostapi->deviceCount] &&
+    PaDeviceInfo *deviceInfo = &hostapi->deviceInfoArray[slot];
+    char *pulseaudioRealName = hostapi->pulseaudioDeviceNames[slot];
+    char *pulseaudioLocalDeviceName = (char *) deviceInfo->name;
+    int pulseaudioRealNameChanged = !pulseaudioRealName ||
+        strncmp( pulseaudioRealName, PaPulseAudio_SinkSourceNameDesc, pulseaudioRealNameSize );
+
+    if( pulseaudioRealNameChanged )
+    {
+        pulseaudioRealName = PaUtil_GroupAllocateZeroInitializedMemory( hostapi->allocations,
+                                                                        pulseaudioRealNameSize );
+    }
+
+    if( !pulseaudioLocalDeviceName ||
+        strncmp( pulseaudioLocalDeviceName, PaPulseAudio_SinkSourceName, pulseaudioDeviceNameSize ) )
+    {
+        pulseaudioLocalDeviceName = PaUtil_GroupAllocateZeroInitializedMemory( hostapi->allocations,
+                                                                               pulseaudioDeviceNameSize );
+    }
+
+    if( !pulseaudioRealName ||
         !pulseaudioLocalDeviceName )
     {
         PA_PULSEAUDIO_SET_LAST_HOST_ERROR( 0,
-                                          "_PaPulseAudio_AddAudioDevice: Can't alloc memory" );
+                                          "_PaPulseAudio_SetAudioDevice: Can't alloc memory" );
         return paInsufficientMemory;
     }
 
-    /* We can maximum have 1024 (PAPULSEAUDIO_MAX_DEVICECOUNT)
-     * devices where to choose which should be mostly enough
-     */
-    if( hostapi->deviceCount >= PAPULSEAUDIO_MAX_DEVICECOUNT )
+    if( pulseaudioRealNameChanged )
     {
-        return paDeviceUnavailable;
+        snprintf( pulseaudioRealName,
+                  pulseaudioRealNameSize,
+                  "%s",
+                  PaPulseAudio_SinkSourceNameDesc );
+
+        if( hostapi->pulseaudioDeviceNames[slot] )
+        {
+            PaUtil_GroupFreeMemory( hostapi->allocations,
+                                    hostapi->pulseaudioDeviceNames[slot] );
+        }
+
+        hostapi->pulseaudioDeviceNames[slot] = pulseaudioRealName;
     }
 
-    snprintf( hostapi->pulseaudioDeviceNames[hostapi->deviceCount],
-              pulseaudioRealNameSize,
-              "%s",
-              PaPulseAudio_SinkSourceNameDesc );
     snprintf( pulseaudioLocalDeviceName,
               pulseaudioDeviceNameSize,
               "%s",
               PaPulseAudio_SinkSourceName );
 
+    deviceInfo->structVersion = 2;
+    deviceInfo->hostApi = hostapi->hostApiIndex;
+    deviceInfo->name = pulseaudioLocalDeviceName;
+
+    deviceInfo->maxInputChannels = inputChannels;
+    deviceInfo->maxOutputChannels = outputChannels;
+    deviceInfo->defaultLowInputLatency = defaultLowInputLatency;
+    deviceInfo->defaultLowOutputLatency = defaultLowOutputLatency;
+    deviceInfo->defaultHighInputLatency = defaultHighInputLatency;
+    deviceInfo->defaultHighOutputLatency = defaultHighOutputLatency;
+    deviceInfo->defaultSampleRate = defaultSampleRate;
+
+    return paNoError;
+}
+
+/* Function adds device to end of list. It can be input or output stream
+ *  or in pulseaudio source or sink.
+ */
+int _PaPulseAudio_AddAudioDevice( PaPulseAudio_HostApiRepresentation *hostapi,
+                                  uint32_t pulseaudioIndex,
+                                  const char *PaPulseAudio_SinkSourceName,
+                                  const char *PaPulseAudio_SinkSourceNameDesc,
+                                  int inputChannels,
+                                  int outputChannels,
+                                  double defaultLowInputLatency,
+                                  double defaultHighInputLatency,
+                                  double defaultLowOutputLatency,
+                                  double defaultHighOutputLatency,
+                                  const long defaultSampleRate )
+{
+    PaError result = paNoError;
+
+    /* Tables are sized when enumeration is done */
+    if( hostapi->deviceCount >= hostapi->deviceSlotCount )
+    {
+        return paDeviceUnavailable;
+    }
+
+    result = _PaPulseAudio_SetAudioDevice( hostapi,
+                                           hostapi->deviceCount,
+                                           PaPulseAudio_SinkSourceName,
+                                           PaPulseAudio_SinkSourceNameDesc,
+                                           inputChannels,
+                                           outputChannels,
+                                           defaultLowInputLatency,
+                                           defaultHighInputLatency,
+                                           defaultLowOutputLatency,
+                                           defaultHighOutputLatency,
+                                           defaultSampleRate );
 
-    hostapi->deviceInfoArray[hostapi->deviceCount].name = pulseaudioLocalDeviceName;
+    if( result != paNoError )
+    {
+        return result;
+    }
 
-    hostapi->deviceInfoArray[hostapi->deviceCount].maxInputChannels = inputChannels;
-    hostapi->deviceInfoArray[hostapi->deviceCount].maxOutputChannels = outputChannels;
-    hostapi->deviceInfoArray[hostapi->deviceCount].defaultLowInputLatency = defaultLowInputLatency;
-    hostapi->deviceInfoArray[hostapi->deviceCount].defaultLowOutputLatency = defaultLowOutputLatency;
-    hostapi->deviceInfoArray[hostapi->deviceCount].defaultHighInputLatency = defaultHighInputLatency;
-    hostapi->deviceInfoArray[hostapi->deviceCount].defaultHighOutputLatency = defaultHighOutputLatency;
-    hostapi->deviceInfoArray[hostapi->deviceCount].defaultSampleRate = defaultSampleRate;
+    hostapi->pulseaudioDeviceIndices[hostapi->deviceCount] = pulseaudioIndex;
+    hostapi->pulseaudioDeviceIsSink[hostapi->deviceCount] = outputChannels > 0;
     hostapi->deviceCount++;
 
     return paNoError;
 }
 
+/* Sinks and sources found while enumerating. They are collected
+ * first as sink, source and server info requests run in parallel
+ * and tables can be sized only when all of them have finished
+ */
+static PaError _PaPulseAudio_CollectAudioDevice( PaPulseAudio_HostApiRepresentation *hostapi,
+                                                 PaPulseAudio_DeviceEntry **list,
+                                                 uint32_t pulseaudioIndex,
+                                                 const char *name,
+                                                 const char *description,
+                                                 int channels,
+                                                 uint32_t sampleRate )
+{
+    PaPulseAudio_DeviceEntry *entry = (PaPulseAudio_DeviceEntry *)
+        PaUtil_AllocateZeroInitializedMemory( sizeof( PaPulseAudio_DeviceEntry ) );
+
+    if( !entry )
+    {
+        return paInsufficientMemory;
+    }
+
+    entry->name = PaUtil_AllocateZeroInitializedMemory( strnlen( name, (PAPULSEAUDIO_MAX_DEVICENAME - 1) ) + 1 );
+    entry->description = PaUtil_AllocateZeroInitializedMemory( strnlen( description, (PAPULSEAUDIO_MAX_DEVICENAME - 1) ) + 1 );
+
+    if( !entry->name || !entry->description )
+    {
+        _PaPulseAudio_FreeDeviceEntry( entry );
+        return paInsufficientMemory;
+    }
+
+    snprintf( entry->name, strnlen( name, (PAPULSEAUDIO_MAX_DEVICENAME - 1) ) + 1, "%s", name );
+    snprintf( entry->description, strnlen( description, (PAPULSEAUDIO_MAX_DEVICENAME - 1) ) + 1, "%s", description );
+    entry->pulseaudioIndex = pulseaudioIndex;
+    entry->channels = channels;
+    entry->sampleRate = sampleRate;
+
+    /* Keep the order Pulseaudio lists them */
+    while( *list )
+    {
+        list = &(*list)->next;
+    }
+    *list = entry;
+
+    return paNoError;
+}
+
 /* Called when iterating through sinks */
 void PaPulseAudio_SinkListCb( pa_context * c,
                               const pa_sink_info * l,
@@ -373,6 +519,14 @@ void PaPulseAudio_SinkListCb( pa_context * c,
         (PaPulseAudio_HostApiRepresentation *) userdata;
     const char *pulseaudioDeviceDescription = NULL;
 
+    /* If eol is set to a positive number, you're at the end of the list
+     * and negative on error
+     */
+    if( eol )
+    {
+        pulseaudioHostApi->pendingOperations--;
+        goto error;
+    }
 
     /* If this is null we have big problems and we probably are out of memory */
     if( !c || !l )
@@ -382,12 +536,6 @@ void PaPulseAudio_SinkListCb( pa_context * c,
         goto error;
     }
 
-    /* If eol is set to a positive number, you're at the end of the list */
-    if( eol > 0 )
-    {
-        goto error;
-    }
-
     pulseaudioDeviceDescription = l->name;
 
     if( l->description != NULL )
@@ -395,19 +543,16 @@ void PaPulseAudio_SinkListCb( pa_context * c,
         pulseaudioDeviceDescription = l->description;
     }
 
-    if( _PaPulseAudio_AddAudioDevice( pulseaudioHostApi,
-                                      l->name,
-                                      pulseaudioDeviceDescription,
-                                      0,
-                                      l->sample_spec.channels,
-                                      0,
-                                      0,
-                                      PA_PULSEAUDIO_DEFAULT_MIN_LATENCY,
-                                      PA_PULSEAUDIO_DEFAULT_MAX_LATENCY,
-                                      l->sample_spec.rate ) != paNoError )
+    if( _PaPulseAudio_CollectAudioDevice( pulseaudioHostApi,
+                                          &pulseaudioHostApi->sinkEntries,
+                                          l->index,
+                                          l->name,
+                                          pulseaudioDeviceDescription,
+                                          l->sample_spec.channels,
+                                          l->sample_spec.rate ) != paNoError )
     {
         PA_PULSEAUDIO_SET_LAST_HOST_ERROR( 0,
-                                           "PaPulseAudio_SinkListCb: Can't add device. Maximum amount reached!" );
+                                           "PaPulseAudio_SinkListCb: Can't add device" );
     }
 
     error:
@@ -425,18 +570,20 @@ void PaPulseAudio_SourceListCb( pa_context * c,
         (PaPulseAudio_HostApiRepresentation *) userdata;
     const char *pulseaudioDeviceDescription = NULL;
 
-
-    /* If this is null we have big problems and we probably are out of memory */
-    if( !c )
+    /* If eol is set to a positive number, you're at the end of the list
+     * and negative on error
+     */
+    if( eol )
     {
-        PA_PULSEAUDIO_SET_LAST_HOST_ERROR( 0,
-                                           "PaPulseAudio_SourceListCb: Invalid context" );
+        pulseaudioHostApi->pendingOperations--;
         goto error;
     }
 
-    /* If eol is set to a positive number, you're at the end of the list */
-    if( eol > 0 )
+    /* If this is null we have big problems and we probably are out of memory */
+    if( !c || !l )
     {
+        PA_PULSEAUDIO_SET_LAST_HOST_ERROR( 0,
+                                           "PaPulseAudio_SourceListCb: Invalid context or source info" );
         goto error;
     }
 
@@ -447,19 +594,16 @@ void PaPulseAudio_SourceListCb( pa_context * c,
         pulseaudioDeviceDescription = l->description;
     }
 
-    if( _PaPulseAudio_AddAudioDevice( pulseaudioHostApi,
-                                      l->name,
-                                      pulseaudioDeviceDescription,
-                                      l->sample_spec.channels,
-                                      0,
-                                      PA_PULSEAUDIO_DEFAULT_MIN_LATENCY,
-                                      PA_PULSEAUDIO_DEFAULT_MAX_LATENCY,
-                                      0,
-                                      0,
-                                      l->sample_spec.rate ) != paNoError )
+    if( _PaPulseAudio_CollectAudioDevice( pulseaudioHostApi,
+                                          &pulseaudioHostApi->sourceEntries,
+                                          l->index,
+                                          l->name,
+                                          pulseaudioDeviceDescription,
+                                          l->sample_spec.channels,
+                                          l->sample_spec.rate ) != paNoError )
     {
         PA_PULSEAUDIO_SET_LAST_HOST_ERROR( 0,
-                                           "PaPulseAudio_SourceListCb: Can't add device. Maximum amount reached!" );
+                                           "PaPulseAudio_SourceListCb: Can't add device" );
     }
 
     error:
@@ -467,6 +611,222 @@ void PaPulseAudio_SourceListCb( pa_context * c,
                                  0 );
 }
 
+/* Find slot of sink (isSink) or source by Pulseaudio index
+ * or if there is not such then inactive slot with same name.
+ * Slot is never given to device with other name as then device
+ * index would mean other device to application than before
+ */
+static int _PaPulseAudio_FindDeviceSlot( PaPulseAudio_HostApiRepresentation *hostapi,
+                                         int isSink,
+                                         uint32_t pulseaudioIndex,
+                                         const char *name )
+{
+    int i;
+
+    for( i = 0; i < hostapi->deviceCount; i++ )
+    {
+        PaDeviceInfo *deviceInfo = &hostapi->deviceInfoArray[i];
+
+        /* Default sink and source are never replaced */
+        if( i == hostapi->defaultOutputSlot ||
+            i == hostapi->defaultInputSlot ||
+            hostapi->pulseaudioDeviceIsSink[i] != isSink )
+        {
+            continue;
+        }
+
+        if( hostapi->pulseaudioDeviceIndices[i] == pulseaudioIndex )
+        {
+            return i;
+        }
+
+        if( hostapi->pulseaudioDeviceIndices[i] == PA_INVALID_INDEX &&
+            name &&
+            !strcmp( deviceInfo->name, name ) )
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/* Sink or source went away. Slot is kept so device indices
+ * don't change but it has no channels anymore
+ */
+static void _PaPulseAudio_RemoveAudioDevice( PaPulseAudio_HostApiRepresentation *hostapi,
+                                             int isSink,
+                                             uint32_t pulseaudioIndex )
+{
+    int slot = _PaPulseAudio_FindDeviceSlot( hostapi, isSink, pulseaudioIndex, NULL );
+
+    if( slot < 0 )
+    {
+        return;
+    }
+
+    PA_DEBUG( ("Portaudio %s: '%s' removed\n",
+               __FUNCTION__, hostapi->deviceInfoArray[slot].name) );
+
+    hostapi->pulseaudioDeviceIndices[slot] = PA_INVALID_INDEX;
+    hostapi->deviceInfoArray[slot].maxInputChannels = 0;
+    hostapi->deviceInfoArray[slot].maxOutputChannels = 0;
+}
+
+/* New or changed sink or source */
+static void _PaPulseAudio_UpdateAudioDevice( PaPulseAudio_HostApiRepresentation *hostapi,
+                                             int isSink,
+                                             uint32_t pulseaudioIndex,
+                                             const char *name,
+                                             const char *description,
+                                             int channels,
+                                             uint32_t sampleRate )
+{
+    int slot = _PaPulseAudio_FindDeviceSlot( hostapi, isSink, pulseaudioIndex, name );
+
+    /* New devices get their index when Pa_Initialize is called again */
+    if( slot < 0 )
+    {
+        PA_DEBUG( ("Portaudio %s: No slot for '%s'\n",
+                   __FUNCTION__, name) );
+        return;
+    }
+
+    if( _PaPulseAudio_SetAudioDevice( hostapi,
+                                      slot,
+                                      name,
+                                      description,
+                                      isSink ? 0 : channels,
+                                      isSink ? channels : 0,
+                                      isSink ? 0 : PA_PULSEAUDIO_DEFAULT_MIN_LATENCY,
+                                      isSink ? 0 : PA_PULSEAUDIO_DEFAULT_MAX_LATENCY,
+                                      isSink ? PA_PULSEAUDIO_DEFAULT_MIN_LATENCY : 0,
+                                      isSink ? PA_PULSEAUDIO_DEFAULT_MAX_LATENCY : 0,
+                                      sampleRate ) == paNoError )
+    {
+        hostapi->pulseaudioDeviceIndices[slot] = pulseaudioIndex;
+    }
+}
+
+static void PaPulseAudio_SinkUpdateCb( pa_context * c,
+                                       const pa_sink_info * l,
+                                       int eol,
+                                       void *userdata )
+{
+    if( eol || !l )
+    {
+        return;
+    }
+
+    _PaPulseAudio_UpdateAudioDevice( (PaPulseAudio_HostApiRepresentation *) userdata,
+                                     1,
+                                     l->index,
+                                     l->name,
+                                     l->description ? l->description : l->name,
+                                     l->sample_spec.channels,
+                                     l->sample_spec.rate );
+}
+
+static void PaPulseAudio_SourceUpdateCb( pa_context * c,
+                                         const pa_source_info * l,
+                                         int eol,
+                                         void *userdata )
+{
+    if( eol || !l )
+    {
+        return;
+    }
+
+    _PaPulseAudio_UpdateAudioDevice( (PaPulseAudio_HostApiRepresentation *) userdata,
+                                     0,
+                                     l->index,
+                                     l->name,
+                                     l->description ? l->description : l->name,
+                                     l->sample_spec.channels,
+                                     l->sample_spec.rate );
+}
+
+static void PaPulseAudio_ServerUpdateCb( pa_context *c,
+                                         const pa_server_info *i,
+                                         void *userdata )
+{
+    PaPulseAudio_HostApiRepresentation *pulseaudioHostApi =
+      (PaPulseAudio_HostApiRepresentation *) userdata;
+
+    if( !i )
+    {
+        return;
+    }
+
+    pulseaudioHostApi->pulseaudioDefaultSampleSpec = i->sample_spec;
+
+    if( pulseaudioHostApi->defaultOutputSlot >= 0 )
+    {
+        pulseaudioHostApi->deviceInfoArray[pulseaudioHostApi->defaultOutputSlot].defaultSampleRate =
+            i->sample_spec.rate;
+    }
+
+    if( pulseaudioHostApi->defaultInputSlot >= 0 )
+    {
+        pulseaudioHostApi->deviceInfoArray[pulseaudioHostApi->defaultInputSlot].defaultSampleRate =
+            i->sample_spec.rate;
+    }
+}
+
+/* Device changes from context subscription. Only changed sink
+ * or source is queried so there is no need to enumerate again
+ */
+static void PaPulseAudio_SubscribeCb( pa_context *c,
+                                      pa_subscription_event_type_t t,
+                                      uint32_t idx,
+                                      void *userdata )
+{
+    PaPulseAudio_HostApiRepresentation *pulseaudioHostApi =
+      (PaPulseAudio_HostApiRepresentation *) userdata;
+    pa_operation *pulseaudioOperation = NULL;
+    int facility = t & PA_SUBSCRIPTION_EVENT_FACILITY_MASK;
+    int type = t & PA_SUBSCRIPTION_EVENT_TYPE_MASK;
+
+    switch( facility )
+    {
+        case PA_SUBSCRIPTION_EVENT_SINK:
+        case PA_SUBSCRIPTION_EVENT_SOURCE:
+            if( type == PA_SUBSCRIPTION_EVENT_REMOVE )
+            {
+                _PaPulseAudio_RemoveAudioDevice( pulseaudioHostApi,
+                                                 facility == PA_SUBSCRIPTION_EVENT_SINK,
+                                                 idx );
+            }
+            else if( facility == PA_SUBSCRIPTION_EVENT_SINK )
+            {
+                pulseaudioOperation = pa_context_get_sink_info_by_index( c,
+                                                                         idx,
+                                                                         PaPulseAudio_SinkUpdateCb,
+                                                                         pulseaudioHostApi );
+            }
+            else
+            {
+                pulseaudioOperation = pa_context_get_source_info_by_index( c,
+                                                                           idx,
+                                                                           PaPulseAudio_SourceUpdateCb,
+                                                                           pulseaudioHostApi );
+            }
+            break;
+
+        case PA_SUBSCRIPTION_EVENT_SERVER:
+            pulseaudioOperation = pa_context_get_server_info( c,
+                                                              PaPulseAudio_ServerUpdateCb,
+                                                              pulseaudioHostApi );
+            break;
+    }
+
+    /* Operation goes on without us holding reference */
+    if( pulseaudioOperation )
+    {
+        pa_operation_unref( pulseaudioOperation );
+    }
+}
+
 /* This routine is called whenever the stream state changes */
 void PaPulseAudio_StreamStateCb( pa_stream * s,
                                  void *userdata )
@@ -508,6 +868,15 @@ void PaPulseAudio_StreamStateCb( pa_stream * s,
                            __FUNCTION__, pa_stream_get_device_name(s),
                            pulseaudioBufferAttr->maxlength, pulseaudioBufferAttr->tlength, pulseaudioBufferAttr->prebuf,
                            pulseaudioBufferAttr->minreq, pulseaudioBufferAttr->maxlength, pulseaudioBufferAttr->fragsize) );
+
+                /* Adaptive latency never shrinks below this */
+                if( s == stream->outputStream )
+                {
+                    stream->outputNegotiatedLength = pulseaudioBufferAttr->tlength;
+                    stream->outputLatencyChangeTime = PaUtil_GetTime();
+                }
+
+                PaPulseAudio_UpdateStreamLatency( stream );
             }
             break;
 
@@ -525,12 +894,147 @@ void PaPulseAudio_StreamStateCb( pa_stream * s,
 
             break;
     }
+
+    /* Blocking read and write wait for the stream, they have
+     * to see it fail or terminate as well
+     */
+    pa_threaded_mainloop_signal( stream->mainloop,
+                                 0 );
+}
+
+/* Report latency of what is buffered in Pulseaudio plus
+ * buffer processor latency through PaStreamInfo
+ */
+void PaPulseAudio_UpdateStreamLatency( PaPulseAudio_Stream * stream )
+{
+    const pa_buffer_attr *pulseaudioBufferAttr = NULL;
+    PaTime sampleRate = stream->streamRepresentation.streamInfo.sampleRate;
+
+    if( stream->outputStream &&
+        (pulseaudioBufferAttr = pa_stream_get_buffer_attr( stream->outputStream )) )
+    {
+        stream->streamRepresentation.streamInfo.outputLatency =
+            (PaTime) PaUtil_GetBufferProcessorOutputLatencyFrames( &stream->bufferProcessor ) / sampleRate +
+            (PaTime) pa_bytes_to_usec( pulseaudioBufferAttr->tlength, &stream->outputSampleSpec ) / (PaTime) 1000000;
+    }
+
+    if( stream->inputStream &&
+        (pulseaudioBufferAttr = pa_stream_get_buffer_attr( stream->inputStream )) )
+    {
+        stream->streamRepresentation.streamInfo.inputLatency =
+            (PaTime) PaUtil_GetBufferProcessorInputLatencyFrames( &stream->bufferProcessor ) / sampleRate +
+            (PaTime) pa_bytes_to_usec( pulseaudioBufferAttr->fragsize, &stream->inputSampleSpec ) / (PaTime) 1000000;
+    }
+}
+
+static void PaPulseAudio_BufferAttrSuccessCb( pa_stream * s,
+                                              int success,
+                                              void *userdata )
+{
+    PaPulseAudio_Stream *stream = (PaPulseAudio_Stream *) userdata;
+
+    stream->outputLatencyChangePending = 0;
+
+    if( success )
+    {
+        PaPulseAudio_UpdateStreamLatency( stream );
+    }
+    else
+    {
+        PA_DEBUG( ("Portaudio %s: Can't change buffer attr: '%s'\n",
+                   __FUNCTION__,
+                   pa_strerror( pa_context_errno( pa_stream_get_context( s ) ) )) );
+    }
+
+    pa_threaded_mainloop_signal( stream->mainloop,
+                                 0 );
+}
+
+/* Grow output tlength and minreq when underflowed and shrink them
+ * back one step at the time after stable period. Called from
+ * mainloop thread only.
+ */
+void PaPulseAudio_AdaptOutputLatency( PaPulseAudio_Stream * stream,
+                                      int underflow )
+{
+    const pa_buffer_attr *pulseaudioBufferAttr = NULL;
+    pa_buffer_attr pulseaudioNewBufferAttr;
+    pa_operation *pulseaudioOperation = NULL;
+    PaTime now = PaUtil_GetTime();
+    uint32_t tlength = 0;
+    uint32_t maxLength = 0;
+
+    if( !stream->outputStream ||
+        !stream->outputNegotiatedLength ||
+        stream->outputLatencyChangePending ||
+        pa_stream_get_state( stream->outputStream ) != PA_STREAM_READY )
+    {
+        return;
+    }
+
+    if( !underflow &&
+        now - stream->outputLatencyChangeTime < PA_PULSEAUDIO_LATENCY_STABLE_PERIOD )
+    {
+        return;
+    }
+
+    pulseaudioBufferAttr = pa_stream_get_buffer_attr( stream->outputStream );
+
+    if( !pulseaudioBufferAttr || !pulseaudioBufferAttr->tlength )
+    {
+        return;
+    }
+
+    if( underflow )
+    {
+        maxLength = pa_usec_to_bytes( (pa_usec_t) (PA_PULSEAUDIO_MAX_ADAPTIVE_LATENCY * 1000000),
+                                      &stream->outputSampleSpec );
+        tlength = PA_MIN( pulseaudioBufferAttr->tlength * PA_PULSEAUDIO_LATENCY_GROW_FACTOR,
+                          PA_MAX( maxLength, stream->outputNegotiatedLength ) );
+    }
+    else
+    {
+        tlength = PA_MAX( pulseaudioBufferAttr->tlength / PA_PULSEAUDIO_LATENCY_GROW_FACTOR,
+                          stream->outputNegotiatedLength );
+    }
+
+    /* Next shrink waits for another stable period */
+    stream->outputLatencyChangeTime = now;
+
+    if( tlength == pulseaudioBufferAttr->tlength )
+    {
+        return;
+    }
+
+    pulseaudioNewBufferAttr = *pulseaudioBufferAttr;
+    pulseaudioNewBufferAttr.minreq = (uint32_t) ((uint64_t) pulseaudioBufferAttr->minreq *
+                                                 tlength / pulseaudioBufferAttr->tlength);
+    pulseaudioNewBufferAttr.tlength = tlength;
+    pulseaudioNewBufferAttr.prebuf = (uint32_t)-1;
+
+    PA_DEBUG( ("Portaudio %s: tlength %u -> %u, minreq %u -> %u\n",
+               __FUNCTION__,
+               pulseaudioBufferAttr->tlength, pulseaudioNewBufferAttr.tlength,
+               pulseaudioBufferAttr->minreq, pulseaudioNewBufferAttr.minreq) );
+
+    pulseaudioOperation = pa_stream_set_buffer_attr( stream->outputStream,
+                                                     &pulseaudioNewBufferAttr,
+                                                     PaPulseAudio_BufferAttrSuccessCb,
+                                                     stream );
+
+    /* Operation goes on without us holding reference */
+    if( pulseaudioOperation )
+    {
+        stream->outputLatencyChangePending = 1;
+        pa_operation_unref( pulseaudioOperation );
+    }
 }
 
 /* If stream is underflowed then this callback is called
  * one needs to enable debug to make use os this
  *
- * Otherwise it's used to update error message
+ * Otherwise it's used to update error message and grow
+ * output latency
  */
 void PaPulseAudio_StreamUnderflowCb( pa_stream *s,
                                      void *userdata )
@@ -553,10 +1057,28 @@ void PaPulseAudio_StreamUnderflowCb( pa_stream *s,
                pa_stream_get_device_name(s),
                pulseaudioOutputSampleSpec->tlength) );
 
+    PaPulseAudio_AdaptOutputLatency( stream, 1 );
+
     pa_threaded_mainloop_signal( stream->mainloop,
                                  0 );
 }
 
+/* Operation runs without us holding reference. If it could not
+ * be started at all it will never finish so don't wait for it
+ */
+static void _PaPulseAudio_UnrefPendingOperation( PaPulseAudio_HostApiRepresentation *hostapi,
+                                                 pa_operation *operation )
+{
+    if( operation )
+    {
+        pa_operation_unref( operation );
+    }
+    else
+    {
+        hostapi->pendingOperations--;
+    }
+}
+
 /* Initialize HostAPI */
 PaError PaPulseAudio_Initialize( PaUtilHostApiRepresentation ** hostApi,
                                  PaHostApiIndex hostApiIndex )
@@ -566,7 +1088,7 @@ PaError PaPulseAudio_Initialize( PaUtilHostApiRepresentation ** hostApi,
     int ret = 0;
     int lockTaken = 0;
     PaPulseAudio_HostApiRepresentation *pulseaudioHostApi = NULL;
-    PaDeviceInfo *deviceInfoArray = NULL;
+    PaPulseAudio_DeviceEntry *entry = NULL;
 
     pa_operation *pulseaudioOperation = NULL;
 
@@ -634,31 +1156,83 @@ PaError PaPulseAudio_Initialize( PaUtilHostApiRepresentation ** hostApi,
         }
     }
 
-    memset( pulseaudioHostApi->deviceInfoArray,
-            0x00,
-            sizeof(PaDeviceInfo) * PAPULSEAUDIO_MAX_DEVICECOUNT );
-    for (i = 0; i < PAPULSEAUDIO_MAX_DEVICECOUNT; i++)
-    {
-        pulseaudioHostApi->pulseaudioDeviceNames[i] = NULL;
-    }
+    /* Ask server info, sinks and sources all at once and wait
+     * until every one of them has finished
+     */
+    pulseaudioHostApi->pendingOperations = 3;
 
     /* Get info about server. This returns Default sink and soure name. */
     pulseaudioOperation =
     pa_context_get_server_info( pulseaudioHostApi->context,
                                 PaPulseAudio_ServerInfoCb,
                                 pulseaudioHostApi );
+    _PaPulseAudio_UnrefPendingOperation( pulseaudioHostApi, pulseaudioOperation );
 
-    PaPulseAudio_UnLock( pulseaudioHostApi->mainloop );
-    lockTaken = 0;
+    /* List PulseAudio sinks. If found callback: PaPulseAudio_SinkListCb */
+    pulseaudioOperation =
+        pa_context_get_sink_info_list( pulseaudioHostApi->context,
+                                       PaPulseAudio_SinkListCb,
+                                       pulseaudioHostApi );
+    _PaPulseAudio_UnrefPendingOperation( pulseaudioHostApi, pulseaudioOperation );
+
+    /* List PulseAudio sources. If found callback: PaPulseAudio_SourceListCb */
+    pulseaudioOperation =
+        pa_context_get_source_info_list( pulseaudioHostApi->context,
+                                         PaPulseAudio_SourceListCb,
+                                         pulseaudioHostApi );
+    _PaPulseAudio_UnrefPendingOperation( pulseaudioHostApi, pulseaudioOperation );
 
-    PaPulseAudio_ReleaseOperation( pulseaudioHostApi,
-                                   &pulseaudioOperation );
+    while( pulseaudioHostApi->pendingOperations > 0 )
+    {
+        pa_threaded_mainloop_wait( pulseaudioHostApi->mainloop );
 
-    PaPulseAudio_Lock( pulseaudioHostApi->mainloop );
-    lockTaken = 1;
+        if( PaPulseAudio_CheckConnection( pulseaudioHostApi ) > PA_OK )
+        {
+            result = paUnanticipatedHostError;
+            goto error;
+        }
+    }
+
+    /* Now we know how many devices there are. Default sink and
+     * source come first
+     */
+    pulseaudioHostApi->deviceSlotCount = 2;
+
+    for( entry = pulseaudioHostApi->sinkEntries; entry; entry = entry->next )
+    {
+        pulseaudioHostApi->deviceSlotCount++;
+    }
+
+    for( entry = pulseaudioHostApi->sourceEntries; entry; entry = entry->next )
+    {
+        pulseaudioHostApi->deviceSlotCount++;
+    }
+
+    pulseaudioHostApi->deviceInfoArray = (PaDeviceInfo *)
+        PaUtil_GroupAllocateZeroInitializedMemory( pulseaudioHostApi->allocations,
+                                                   sizeof(PaDeviceInfo) * pulseaudioHostApi->deviceSlotCount );
+    pulseaudioHostApi->pulseaudioDeviceNames = (char **)
+        PaUtil_GroupAllocateZeroInitializedMemory( pulseaudioHostApi->allocations,
+                                                   sizeof(char *) * pulseaudioHostApi->deviceSlotCount );
+    pulseaudioHostApi->pulseaudioDeviceIndices = (uint32_t *)
+        PaUtil_GroupAllocateZeroInitializedMemory( pulseaudioHostApi->allocations,
+                                                   sizeof(uint32_t) * pulseaudioHostApi->deviceSlotCount );
+    pulseaudioHostApi->pulseaudioDeviceIsSink = (int *)
+        PaUtil_GroupAllocateZeroInitializedMemory( pulseaudioHostApi->allocations,
+                                                   sizeof(int) * pulseaudioHostApi->deviceSlotCount );
+
+    if( !pulseaudioHostApi->deviceInfoArray ||
+        !pulseaudioHostApi->pulseaudioDeviceNames ||
+        !pulseaudioHostApi->pulseaudioDeviceIndices ||
+        !pulseaudioHostApi->pulseaudioDeviceIsSink )
+    {
+        result = paInsufficientMemory;
+        goto error;
+    }
 
     /* Add the "Default" sink at index 0 */
     if( _PaPulseAudio_AddAudioDevice( pulseaudioHostApi,
+                                      PA_INVALID_INDEX,
                                       "Default Sink",
                                       "The PulseAudio default sink",
                                       0,
@@ -670,14 +1244,16 @@ PaError PaPulseAudio_Initialize( PaUtilHostApiRepresentation ** hostApi,
                                       pulseaudioHostApi->pulseaudioDefaultSampleSpec.rate ) != paNoError )
     {
         PA_PULSEAUDIO_SET_LAST_HOST_ERROR( 0,
-                                           "PaPulseAudio_SinkListCb: Can't add device. Maximum amount reached!" );
+                                           "PaPulseAudio_Initialize: Can't add default sink" );
     } else {
+        pulseaudioHostApi->defaultOutputSlot = pulseaudioHostApi->deviceCount - 1;
         pulseaudioHostApi->inheritedHostApiRep.info.defaultOutputDevice =
-                pulseaudioHostApi->deviceCount - 1;
+                pulseaudioHostApi->defaultOutputSlot;
     }
 
     /* Add the "Default" source at index 1 */
     if( _PaPulseAudio_AddAudioDevice( pulseaudioHostApi,
+                                      PA_INVALID_INDEX,
                                       "Default Source",
                                       "The PulseAudio default source",
                                       PA_CHANNELS_MAX,
@@ -689,48 +1265,49 @@ PaError PaPulseAudio_Initialize( PaUtilHostApiRepresentation ** hostApi,
                                       pulseaudioHostApi->pulseaudioDefaultSampleSpec.rate ) != paNoError )
     {
         PA_PULSEAUDIO_SET_LAST_HOST_ERROR( 0,
-                                           "PaPulseAudio_SinkListCb: Can't add device. Maximum amount reached!" );
+                                           "PaPulseAudio_Initialize: Can't add default source" );
     } else {
+        pulseaudioHostApi->defaultInputSlot = pulseaudioHostApi->deviceCount - 1;
         pulseaudioHostApi->inheritedHostApiRep.info.defaultInputDevice =
-                pulseaudioHostApi->deviceCount - 1;
+                pulseaudioHostApi->defaultInputSlot;
     }
 
-    /* List PulseAudio sinks. If found callback: PaPulseAudio_SinkListCb */
-    pulseaudioOperation =
-        pa_context_get_sink_info_list( pulseaudioHostApi->context,
-                                       PaPulseAudio_SinkListCb,
-                                       pulseaudioHostApi );
-
-    PaPulseAudio_UnLock( pulseaudioHostApi->mainloop );
-    lockTaken = 0;
-
-    PaPulseAudio_ReleaseOperation( pulseaudioHostApi,
-                                   &pulseaudioOperation );
-
-    PaPulseAudio_Lock( pulseaudioHostApi->mainloop );
-    lockTaken = 1;
-
-    /* List PulseAudio sources. If found callback: PaPulseAudio_SourceListCb */
-    pulseaudioOperation =
-        pa_context_get_source_info_list( pulseaudioHostApi->context,
-                                         PaPulseAudio_SourceListCb,
-                                         pulseaudioHostApi );
-
-    PaPulseAudio_UnLock( pulseaudioHostApi->mainloop );
-    lockTaken = 0;
+    for( entry = pulseaudioHostApi->sinkEntries; entry; entry = entry->next )
+    {
+        _PaPulseAudio_AddAudioDevice( pulseaudioHostApi,
+                                      entry->pulseaudioIndex,
+                                      entry->name,
+                                      entry->description,
+                                      0,
+                                      entry->channels,
+                                      0,
+                                      0,
+                                      PA_PULSEAUDIO_DEFAULT_MIN_LATENCY,
+                                      PA_PULSEAUDIO_DEFAULT_MAX_LATENCY,
+                                      entry->sampleRate );
+    }
 
-    PaPulseAudio_ReleaseOperation( pulseaudioHostApi,
-                                   &pulseaudioOperation );
+    for( entry = pulseaudioHostApi->sourceEntries; entry; entry = entry->next )
+    {
+        _PaPulseAudio_AddAudioDevice( pulseaudioHostApi,
+                                      entry->pulseaudioIndex,
+                                      entry->name,
+                                      entry->description,
+                                      entry->channels,
+                                      0,
+                                      PA_PULSEAUDIO_DEFAULT_MIN_LATENCY,
+                                      PA_PULSEAUDIO_DEFAULT_MAX_LATENCY,
+                                      0,
+                                      0,
+                                      entry->sampleRate );
+    }
 
-    PaPulseAudio_Lock( pulseaudioHostApi->mainloop );
-    lockTaken = 1;
+    _PaPulseAudio_FreeDeviceEntries( pulseaudioHostApi );
 
     (*hostApi)->info.deviceCount = pulseaudioHostApi->deviceCount;
 
     if( pulseaudioHostApi->deviceCount > 0 )
     {
-        /* If you have over 1024 Audio devices.. shame on you! */
-
         (*hostApi)->deviceInfos =
             (PaDeviceInfo **)
             PaUtil_GroupAllocateZeroInitializedMemory( pulseaudioHostApi->allocations,
@@ -750,6 +1327,24 @@ PaError PaPulseAudio_Initialize( PaUtilHostApiRepresentation ** hostApi,
         }
     }
 
+    /* Follow sinks and sources coming and going. From now on
+     * only changed one is queried
+     */
+    pa_context_set_subscribe_callback( pulseaudioHostApi->context,
+                                       PaPulseAudio_SubscribeCb,
+                                       pulseaudioHostApi );
+    pulseaudioOperation = pa_context_subscribe( pulseaudioHostApi->context,
+                                                PA_SUBSCRIPTION_MASK_SINK |
+                                                PA_SUBSCRIPTION_MASK_SOURCE |
+                                                PA_SUBSCRIPTION_MASK_SERVER,
+                                                NULL,
+                                                NULL );
+    if( pulseaudioOperation )
+    {
+        pa_operation_unref( pulseaudioOperation );
+        pulseaudioOperation = NULL;
+    }
+
     (*hostApi)->Terminate = Terminate;
     (*hostApi)->OpenStream = OpenStream;
     (*hostApi)->IsFormatSupported = IsFormatSupported;
@@ -821,10 +1416,13 @@ PaError IsFormatSupported( struct PaUtilHostApiRepresentation *hostApi,
                            const PaStreamParameters * outputParameters,
                            double sampleRate )
 {
+    PaPulseAudio_HostApiRepresentation *pulseaudioHostApi =
+        (PaPulseAudio_HostApiRepresentation *) hostApi;
     int inputChannelCount,
      outputChannelCount;
     PaSampleFormat inputSampleFormat,
      outputSampleFormat;
+    int deviceChannelCount = 0;
 
     if( inputParameters )
     {
@@ -846,9 +1444,14 @@ PaError IsFormatSupported( struct PaUtilHostApiRepresentation *hostApi,
             return paInvalidDevice;
         }
 
-        /* check that input device can support inputChannelCount */
-        if( inputChannelCount >
-            hostApi->deviceInfos[inputParameters->device]->maxInputChannels )
+        /* check that input device can support inputChannelCount.
+         * Devices are updated from mainloop when sources change
+         */
+        PaPulseAudio_Lock( pulseaudioHostApi->mainloop );
+        deviceChannelCount = hostApi->deviceInfos[inputParameters->device]->maxInputChannels;
+        PaPulseAudio_UnLock( pulseaudioHostApi->mainloop );
+
+        if( inputChannelCount > deviceChannelCount )
         {
             return paInvalidChannelCount;
         }
@@ -887,9 +1490,14 @@ PaError IsFormatSupported( struct PaUtilHostApiRepresentation *hostApi,
             return paInvalidDevice;
         }
 
-        /* check that output device can support outputChannelCount */
-        if( outputChannelCount >
-            hostApi->deviceInfos[outputParameters->device]->maxOutputChannels )
+        /* check that output device can support outputChannelCount.
+         * Devices are updated from mainloop when sinks change
+         */
+        PaPulseAudio_Lock( pulseaudioHostApi->mainloop );
+        deviceChannelCount = hostApi->deviceInfos[outputParameters->device]->maxOutputChannels;
+        PaPulseAudio_UnLock( pulseaudioHostApi->mainloop );
+
+        if( outputChannelCount > deviceChannelCount )
         {
             return paInvalidChannelCount;
         }
@@ -1011,6 +1619,7 @@ PaError OpenStream( struct PaUtilHostApiRepresentation *hostApi,
         (PaPulseAudio_HostApiRepresentation *) hostApi;
     PaPulseAudio_Stream *stream = NULL;
     unsigned long framesPerHostBuffer = framesPerBuffer;        /* these may not be equivalent for all implementations */
+    unsigned long hostFramesPerBuffer;
     int inputChannelCount,
      outputChannelCount;
     PaSampleFormat inputSampleFormat,
@@ -1171,7 +1780,6 @@ PaError OpenStream( struct PaUtilHostApiRepresentation *hostApi,
         {
             goto openstream_error;
         }
-
     }
 
     else
@@ -1289,6 +1897,42 @@ PaError OpenStream( struct PaUtilHostApiRepresentation *hostApi,
         outputSampleFormat = hostOutputSampleFormat = paFloat32;
     }
 
+    /* The scratch buffers hold one host buffer of _PaPulseAudio_ProcessAudio,
+     * which uses the frames substituted above if they are unspecified
+     */
+    hostFramesPerBuffer = framesPerHostBuffer != paFramesPerBufferUnspecified ?
+        framesPerHostBuffer : stream->framesPerHostCallback;
+
+    /* Duplex callback mode moves input from ring buffer to buffer
+     * processor one host buffer at the time
+     */
+    if( streamCallback && inputParameters && outputParameters )
+    {
+        stream->inputSampleBuffer =
+            PaUtil_AllocateZeroInitializedMemory( hostFramesPerBuffer * stream->inputFrameSize );
+
+        if( !stream->inputSampleBuffer )
+        {
+            result = paInsufficientMemory;
+            goto openstream_error;
+        }
+    }
+
+    /* In duplex mode one host buffer of output is counted in input frames */
+    if( streamCallback && outputParameters )
+    {
+        stream->outputSampleBufferSize = hostFramesPerBuffer *
+            PA_MAX( stream->inputFrameSize, stream->outputFrameSize );
+        stream->outputSampleBuffer =
+            PaUtil_AllocateZeroInitializedMemory( stream->outputSampleBufferSize );
+
+        if( !stream->outputSampleBuffer )
+        {
+            result = paInsufficientMemory;
+            goto openstream_error;
+        }
+    }
+
     stream->hostapi = pulseaudioHostApi;
     stream->context = pulseaudioHostApi->context;
     stream->mainloop = pulseaudioHostApi->mainloop;
@@ -1369,6 +2013,8 @@ PaError OpenStream( struct PaUtilHostApiRepresentation *hostApi,
             stream->inputRing.buffer = NULL;
         }
 
+        PaUtil_FreeMemory( stream->inputSampleBuffer );
+        PaUtil_FreeMemory( stream->outputSampleBuffer );
         PaUtil_FreeMemory( stream->inputStreamName );
         PaUtil_FreeMemory( stream->outputStreamName );
         PaUtil_FreeMemory( stream );
@@ -50,7 +50,6 @@
 */
 
 #include "pa_linux_pulseaudio_block_internal.h"
-#include <unistd.h>
 
 /*
     As separate stream interfaces are used for blocking and callback
@@ -58,40 +57,64 @@
     for blocking streams.
 */
 
+/*
+    Blocking read and write don't poll. They sleep in
+    pa_threaded_mainloop_wait() which is signalled from stream read
+    and write callbacks when there is something to read or room to
+    write, and from the stream state callback and stopping. Stream
+    state, ringbuffer and writable size are checked with mainloop
+    locked so no signal can be missed between check and wait.
+*/
+
+/* Check with mainloop locked whether blocking read or write can go
+ * on. A terminated stream is not signalled anymore, so anything but
+ * a good state stops them.
+ */
+static PaError _PaPulseAudio_CheckBlockingStream( PaPulseAudio_Stream *stream )
+{
+    PA_PULSEAUDIO_IS_ERROR( stream, paStreamIsStopped )
+
+    if( !PA_CONTEXT_IS_GOOD( pa_context_get_state( stream->context ) ) ||
+        ( stream->outputStream &&
+          !PA_STREAM_IS_GOOD( pa_stream_get_state( stream->outputStream ) ) ) ||
+        ( stream->inputStream &&
+          !PA_STREAM_IS_GOOD( pa_stream_get_state( stream->inputStream ) ) ) )
+    {
+        return paStreamIsStopped;
+    }
+
+    return paNoError;
+}
+
 PaError PaPulseAudio_ReadStreamBlock( PaStream * s,
                                       void *buffer,
                                       unsigned long frames )
 {
     PaPulseAudio_Stream *pulseaudioStream = (PaPulseAudio_Stream *) s;
-    PaPulseAudio_HostApiRepresentation *pulseaudioHostApi =
-        pulseaudioStream->hostapi;
-    PaError ret = 0;
+    PaError result = paNoError;
     uint8_t *readableBuffer = (uint8_t *) buffer;
     long bufferLeftToRead = (frames * pulseaudioStream->inputFrameSize);
 
+    PaPulseAudio_Lock( pulseaudioStream->mainloop );
     while( bufferLeftToRead > 0 )
     {
-        PA_PULSEAUDIO_IS_ERROR( pulseaudioStream, paStreamIsStopped )
+        /* Checked again after every wake up */
+        result = _PaPulseAudio_CheckBlockingStream( pulseaudioStream );
+        if( result != paNoError )
+        {
+            break;
+        }
 
-        PaPulseAudio_Lock( pulseaudioStream->mainloop );
         long l_read = PaUtil_ReadRingBuffer( &pulseaudioStream->inputRing, readableBuffer,
                                              bufferLeftToRead );
         readableBuffer += l_read;
         bufferLeftToRead -= l_read;
         if( bufferLeftToRead > 0 )
             pa_threaded_mainloop_wait( pulseaudioStream->mainloop );
-
-        PaPulseAudio_UnLock( pulseaudioStream->mainloop );
-
-        if( bufferLeftToRead > 0 )
-        {
-            /* Sleep small amount of time not burn CPU
-            * we block anyway so this is bearable
-            */
-            usleep(100);
-        }
     }
-    return paNoError;
+    PaPulseAudio_UnLock( pulseaudioStream->mainloop );
+
+    return result;
 }
 
 
@@ -100,6 +123,7 @@ PaError PaPulseAudio_WriteStreamBlock( PaStream * s,
                                        unsigned long frames )
 {
     PaPulseAudio_Stream *pulseaudioStream = (PaPulseAudio_Stream *) s;
+    PaError result = paNoError;
     int ret = 0;
     size_t pulseaudioWritable = 0;
     uint8_t *writableBuffer = (uint8_t *) buffer;
@@ -110,72 +134,71 @@ PaError PaPulseAudio_WriteStreamBlock( PaStream * s,
 
     while( bufferLeftToWrite > 0)
     {
-        PA_PULSEAUDIO_IS_ERROR( pulseaudioStream, paStreamIsStopped )
-
         PaPulseAudio_Lock( pulseaudioStream->mainloop );
-        pulseaudioWritable = pa_stream_writable_size( pulseaudioStream->outputStream );
-        PaPulseAudio_UnLock( pulseaudioStream->mainloop );
 
-        if( pulseaudioWritable > 0 )
+        /* Checked again after every wake up */
+        result = _PaPulseAudio_CheckBlockingStream( pulseaudioStream );
+        if( result != paNoError )
         {
-            if( bufferLeftToWrite < pulseaudioWritable )
-            {
-                pulseaudioWritable = bufferLeftToWrite;
-            }
-            PaPulseAudio_Lock( pulseaudioStream->mainloop );
-            ret = pa_stream_write( pulseaudioStream->outputStream,
-                                     writableBuffer,
-                                     pulseaudioWritable,
-                                     NULL,
-                                     0,
-                                     PA_SEEK_RELATIVE );
-
-            pulseaudioOperation = pa_stream_update_timing_info( pulseaudioStream->outputStream,
-                                                                NULL,
-                                                                NULL );
             PaPulseAudio_UnLock( pulseaudioStream->mainloop );
+            return result;
+        }
 
-            ret = 0;
-
-            if( pulseaudioOperation == NULL )
-            {
-                return paInsufficientMemory;
-            }
-
-            while( pa_operation_get_state( pulseaudioOperation ) == PA_OPERATION_RUNNING )
-            {
-                ret ++;
-                PA_PULSEAUDIO_IS_ERROR( pulseaudioStream, paStreamIsStopped )
-
-                /* As this shouldn never happen it's error if it does */
-                if( ret >= 10000 )
-                {
-                    return paStreamIsStopped;
-                }
-
-                usleep(100);
-            }
-
-            PaPulseAudio_Lock( pulseaudioStream->mainloop );
+        pulseaudioWritable = pa_stream_writable_size( pulseaudioStream->outputStream );
 
-            pa_operation_unref( pulseaudioOperation );
-            pulseaudioOperation = NULL;
+        if( pulseaudioWritable == (size_t) -1 )
+        {
+            PaPulseAudio_UnLock( pulseaudioStream->mainloop );
+            return paUnanticipatedHostError;
+        }
 
+        /* No room. Wait for write callback to tell there is */
+        if( pulseaudioWritable == 0 )
+        {
+            pa_threaded_mainloop_wait( pulseaudioStream->mainloop );
             PaPulseAudio_UnLock( pulseaudioStream->mainloop );
+            continue;
+        }
 
-            writableBuffer += pulseaudioWritable;
-            bufferLeftToWrite -= pulseaudioWritable;
+        if( bufferLeftToWrite < pulseaudioWritable )
+        {
+            pulseaudioWritable = bufferLeftToWrite;
         }
 
-        if( bufferLeftToWrite > 0 )
+        ret = pa_stream_write( pulseaudioStream->outputStream,
+                               writableBuffer,
+                               pulseaudioWritable,
+                               NULL,
+                               0,
+                               PA_SEEK_RELATIVE );
+        PaPulseAudio_UnLock( pulseaudioStream->mainloop );
+
+        if( ret )
         {
-            /* Sleep small amount of time not burn CPU
-            * we block anyway so this is bearable
-            */
-            usleep(100);
+            PA_DEBUG( ("Portaudio %s: Can't write audio!\n",
+                      __FUNCTION__) );
+            return paUnanticipatedHostError;
         }
 
+        writableBuffer += pulseaudioWritable;
+        bufferLeftToWrite -= pulseaudioWritable;
     }
+
+    /* Stream is connected with PA_STREAM_AUTO_TIMING_UPDATE so there
+     * is no need to wait for timing info. Just ask fresh one once per
+     * write so stream time follows written data closely.
+     */
+    PaPulseAudio_Lock( pulseaudioStream->mainloop );
+    pulseaudioOperation = pa_stream_update_timing_info( pulseaudioStream->outputStream,
+                                                        NULL,
+                                                        NULL );
+    if( pulseaudioOperation )
+    {
+        pa_operation_unref( pulseaudioOperation );
+        pulseaudioOperation = NULL;
+    }
+    PaPulseAudio_UnLock( pulseaudioStream->mainloop );
+
     PaUtil_EndCpuLoadMeasurement( &pulseaudioStream->cpuLoadMeasurer,
                                   frames );
 
@@ -66,6 +66,7 @@
 /* PulseAudio headers */
 #include <string.h>
 #include <unistd.h>
+#include <assert.h>
 
 int PaPulseAudio_updateTimeInfo( pa_stream * s,
                                  PaStreamCallbackTimeInfo *timeInfo,
@@ -187,19 +188,25 @@ void _PaPulseAudio_WriteRingBuffer( PaUtilRingBuffer *ringbuffer,
                                     const void *buffer,
                                     size_t length )
 {
+    ring_buffer_size_t writeAvailable = PaUtil_GetRingBufferWriteAvailable( ringbuffer );
+
     /*
-     * If there is not enough room. Read from ringbuffer to make
-     * sure that if not full and audio will just underrun
-     *
-     * If you try to read too much and there is no room then this
-     * will fail. But I don't know how to get into that?
+     * If there is not enough room drop the oldest data from
+     * ringbuffer so the newest audio fits in. Nothing has to be
+     * copied for that, just move read index forward.
      */
-    if( PaUtil_GetRingBufferWriteAvailable( ringbuffer ) < length )
+    if( writeAvailable < (ring_buffer_size_t) length )
     {
-        uint8_t tmpBuffer[ PULSEAUDIO_BUFFER_SIZE ];
-        PaUtil_ReadRingBuffer( ringbuffer,
-                               tmpBuffer,
-                               length );
+        ring_buffer_size_t discard = (ring_buffer_size_t) length - writeAvailable;
+        ring_buffer_size_t readAvailable = PaUtil_GetRingBufferReadAvailable( ringbuffer );
+
+        if( discard > readAvailable )
+        {
+            discard = readAvailable;
+        }
+
+        PaUtil_AdvanceRingBufferReadIndex( ringbuffer,
+                                           discard );
     }
 
     PaUtil_WriteRingBuffer( ringbuffer,
@@ -270,7 +277,6 @@ static int _PaPulseaudio_WriteZero(PaPulseAudio_Stream *stream,
 static int _PaPulseAudio_ProcessAudio(PaPulseAudio_Stream *stream,
                                       size_t length)
 {
-    uint8_t pulseaudioSampleBuffer[PULSEAUDIO_BUFFER_SIZE];
     size_t hostFramesPerBuffer = stream->bufferProcessor.framesPerHostBuffer;
     size_t pulseaudioOutputBytes = 0;
     size_t pulseaudioInputBytes = 0;
@@ -280,6 +286,7 @@ static int _PaPulseAudio_ProcessAudio(PaPulseAudio_Stream *stream,
     PaStreamCallbackTimeInfo timeInfo;
     int ret = paContinue;
     void *bufferData = NULL;
+    int isBeginWrite = 0;
     size_t pulseaudioOutputWritten = 0;
     size_t pulseaudioLength = length;
 
@@ -317,12 +324,13 @@ static int _PaPulseAudio_ProcessAudio(PaPulseAudio_Stream *stream,
         }
     }
 
-    /* If we just want to have input but not output (Not Duplex)
-     * Use this calculation
+    /* Input is read in its own frame size. Output stays in
+     * output frame size as buffer processor always renders
+     * full host buffer of output frames
      */
     if( stream->inputStream )
     {
-        pulseaudioInputBytes = pulseaudioOutputBytes = (hostFramesPerBuffer * stream->inputFrameSize);
+        pulseaudioInputBytes = (hostFramesPerBuffer * stream->inputFrameSize);
 
         if( stream->bufferProcessor.streamCallback )
         {
@@ -406,12 +414,12 @@ static int _PaPulseAudio_ProcessAudio(PaPulseAudio_Stream *stream,
         if( isInputCb )
         {
             PaUtil_ReadRingBuffer( &stream->inputRing,
-                                   pulseaudioSampleBuffer,
+                                   stream->inputSampleBuffer,
                                    pulseaudioInputBytes);
 
             PaUtil_SetInterleavedInputChannels( &stream->bufferProcessor,
                                                 0,
-                                                pulseaudioSampleBuffer,
+                                                stream->inputSampleBuffer,
                                                 stream->inputSampleSpec.channels );
 
             PaUtil_SetInputFrameCount( &stream->bufferProcessor,
@@ -426,7 +434,10 @@ static int _PaPulseAudio_ProcessAudio(PaPulseAudio_Stream *stream,
 
             size_t tmpSize = pulseaudioOutputBytes;
 
-            /* Prepare memory to make it faster to output stuff */
+            /* Ask memory from Pulseaudio so callback renders straight
+             * into the block that is sent to server and pa_stream_write
+             * does not have to copy it
+             */
             if( pa_stream_begin_write( stream->outputStream, &bufferData, &tmpSize ) )
             {
                 PA_DEBUG( ("Portaudio %s: Can't output to stream!\n",
@@ -434,6 +445,21 @@ static int _PaPulseAudio_ProcessAudio(PaPulseAudio_Stream *stream,
                 return paUnanticipatedHostError;
             }
 
+            isBeginWrite = 1;
+
+            /* Block can be smaller than host buffer if host buffer
+             * is very big. Then use our own buffer which gets copied
+             */
+            if( bufferData && tmpSize < pulseaudioOutputBytes )
+            {
+                pa_stream_cancel_write( stream->outputStream );
+                bufferData = stream->outputSampleBuffer;
+                isBeginWrite = 0;
+
+                /* The fallback has to hold one full host buffer */
+                assert( stream->outputSampleBufferSize >= pulseaudioOutputBytes );
+            }
+
             PaUtil_SetInterleavedOutputChannels( &stream->bufferProcessor,
                                                  0,
                                                  bufferData,
@@ -482,7 +508,10 @@ static int _PaPulseAudio_ProcessAudio(PaPulseAudio_Stream *stream,
         }
         else if( ret != paContinue && isOutputCb && bufferData )
         {
-            pa_stream_cancel_write( stream->outputStream );
+            if( isBeginWrite )
+            {
+                pa_stream_cancel_write( stream->outputStream );
+            }
             bufferData = NULL;
         }
         else if( isOutputCb && !bufferData )
@@ -498,23 +527,119 @@ static int _PaPulseAudio_ProcessAudio(PaPulseAudio_Stream *stream,
     return ret;
 }
 
+/* Input only callback stream. Fragments from pa_stream_peek are
+ * given straight to buffer processor which is in unknown host
+ * buffer size mode and carries partial user buffers over to the
+ * next fragment. This way there is no copy to ringbuffer and back.
+ */
+static int _PaPulseAudio_ProcessInput( PaPulseAudio_Stream *stream )
+{
+    const void *pulseaudioData = NULL;
+    size_t pulseaudioLength = 0;
+    unsigned long hostFrameCount = 0;
+    PaStreamCallbackTimeInfo timeInfo;
+    int ret = stream->callbackResult;
+
+    memset( &timeInfo, 0x00, sizeof( PaStreamCallbackTimeInfo ) );
+
+    while( pa_stream_readable_size( stream->inputStream ) > 0 )
+    {
+        if( pa_stream_peek( stream->inputStream,
+                            &pulseaudioData,
+                            &pulseaudioLength ) )
+        {
+            PA_DEBUG( ("Portaudio %s: Can't read audio!\n",
+                      __FUNCTION__) );
+            return paUnanticipatedHostError;
+        }
+
+        /* Nothing to read */
+        if( !pulseaudioLength )
+        {
+            break;
+        }
+
+        /* NULL data is a hole in stream. Just skip it */
+        if( pulseaudioData &&
+            stream->isActive &&
+            !stream->isStopped &&
+            ret == paContinue )
+        {
+            PaPulseAudio_updateTimeInfo( stream->inputStream,
+                                         &timeInfo,
+                                         1 );
+
+            PaUtil_BeginCpuLoadMeasurement( &stream->cpuLoadMeasurer );
+
+            PaUtil_BeginBufferProcessing( &stream->bufferProcessor,
+                                          &timeInfo,
+                                          0 );
+
+            PaUtil_SetInterleavedInputChannels( &stream->bufferProcessor,
+                                                0,
+                                                (void *) pulseaudioData,
+                                                stream->inputSampleSpec.channels );
+
+            PaUtil_SetInputFrameCount( &stream->bufferProcessor,
+                                       pulseaudioLength / stream->inputFrameSize );
+
+            hostFrameCount =
+                    PaUtil_EndBufferProcessing( &stream->bufferProcessor,
+                                                &ret );
+
+            PaUtil_EndCpuLoadMeasurement( &stream->cpuLoadMeasurer,
+                                          hostFrameCount );
+        }
+
+        pa_stream_drop( stream->inputStream );
+    }
+
+    pulseaudioData = NULL;
+
+    /* Callback has finished the stream. Remember it so the next
+     * record callback doesn't start calling it again
+     */
+    if( ret != paContinue && stream->callbackResult == paContinue )
+    {
+        stream->callbackResult = ret;
+        stream->isActive = 0;
+
+        if( stream->streamRepresentation.streamFinishedCallback )
+        {
+            stream->streamRepresentation.streamFinishedCallback( stream->streamRepresentation.userData );
+        }
+    }
+
+    return ret;
+}
+
 void PaPulseAudio_StreamRecordCb( pa_stream * s,
                                   size_t length,
                                   void *userdata )
 {
     PaPulseAudio_Stream *pulseaudioStream = (PaPulseAudio_Stream *) userdata;
 
-    _PaPulseAudio_Read( pulseaudioStream, length );
-
-    /* Let's handle when output happens if Duplex
-     *
-     * Also there is no callback there is no meaning to continue
-     * as we have blocking reading
-     */
-    if( pulseaudioStream->bufferProcessor.streamCallback )
+    if( pulseaudioStream->bufferProcessor.streamCallback &&
+        !pulseaudioStream->outputStream )
     {
-        _PaPulseAudio_ProcessAudio( pulseaudioStream, length );
+        _PaPulseAudio_ProcessInput( pulseaudioStream );
     }
+    else
+    {
+        _PaPulseAudio_Read( pulseaudioStream, length );
+
+        /* Let's handle when output happens if Duplex
+         *
+         * Also there is no callback there is no meaning to continue
+         * as we have blocking reading
+         */
+        if( pulseaudioStream->bufferProcessor.streamCallback )
+        {
+            _PaPulseAudio_ProcessAudio( pulseaudioStream, length );
+        }
+    }
+
+    PaPulseAudio_AdaptOutputLatency( pulseaudioStream, 0 );
 
     pa_threaded_mainloop_signal( pulseaudioStream->mainloop,
                                  0 );
@@ -531,6 +656,8 @@ void PaPulseAudio_StreamPlaybackCb( pa_stream * s,
         _PaPulseAudio_ProcessAudio( pulseaudioStream, length );
     }
 
+    PaPulseAudio_AdaptOutputLatency( pulseaudioStream, 0 );
+
     pa_threaded_mainloop_signal( pulseaudioStream->mainloop,
                                  0 );
 }
@@ -676,7 +803,8 @@ PaError PaPulseAudio_CloseStreamCb( PaStream * s )
         stream->inputRing.buffer = NULL;
     }
 
-
+    PaUtil_FreeMemory( stream->inputSampleBuffer );
+    PaUtil_FreeMemory( stream->outputSampleBuffer );
     PaUtil_FreeMemory( stream->inputStreamName );
     PaUtil_FreeMemory( stream->outputStreamName );
     PaUtil_FreeMemory( stream );
@@ -770,6 +898,7 @@ PaError PaPulseAudio_StartStreamCb( PaStream * s )
     stream->inputBufferAttr.minreq = (uint32_t)-1;
 
     stream->outputUnderflows = 0;
+    stream->outputLatencyChangePending = 0;
     PaPulseAudio_UnLock( pulseaudioHostApi->mainloop );
 
     pa_stream_flags_t pulseaudioStreamFlags = PA_STREAM_INTERPOLATE_TIMING |
@@ -789,32 +918,36 @@ PaError PaPulseAudio_StartStreamCb( PaStream * s )
         stream->inputBufferAttr.fragsize = pa_usec_to_bytes( pulseaudioReqFrameSize,
                                                              &stream->inputSampleSpec );
 
-        if( stream->inputDevice != paNoDevice)
-        {
-            PA_DEBUG( ("Portaudio %s: %d (%s)\n", __FUNCTION__, stream->inputDevice,
-                      pulseaudioHostApi->pulseaudioDeviceNames[stream->
-                                                                    inputDevice]) );
-        }
-
         PaDeviceIndex defaultInputDevice;
         PaError result = PaUtil_DeviceIndexToHostApiDeviceIndex(
                 &defaultInputDevice,
                 pulseaudioHostApi->inheritedHostApiRep.info.defaultInputDevice,
                 &(pulseaudioHostApi->inheritedHostApiRep) );
 
-        /* NULL means default device */
-        pulseaudioName = NULL;
-
-        /* If default device is not requested then change to wanted device */
-        if( result == paNoError && stream->inputDevice != defaultInputDevice )
-        {
-            pulseaudioName = pulseaudioHostApi->
-                                deviceInfoArray[stream->inputDevice].name;
-        }
-
         if ( result == paNoError )
         {
+            /* Devices are updated from mainloop so they
+             * are read with it locked
+             */
             PaPulseAudio_Lock( pulseaudioHostApi->mainloop );
+
+            if( stream->inputDevice != paNoDevice)
+            {
+                PA_DEBUG( ("Portaudio %s: %d (%s)\n", __FUNCTION__, stream->inputDevice,
+                          pulseaudioHostApi->pulseaudioDeviceNames[stream->
+                                                                        inputDevice]) );
+            }
+
+            /* NULL means default device */
+            pulseaudioName = NULL;
+
+            /* If default device is not requested then change to wanted device */
+            if( stream->inputDevice != defaultInputDevice )
+            {
+                pulseaudioName = pulseaudioHostApi->
+                                    deviceInfoArray[stream->inputDevice].name;
+            }
+
             /* Zero means success */
             if( pa_stream_connect_record( stream->inputStream,
                                           pulseaudioName,
@@ -868,39 +1001,46 @@ PaError PaPulseAudio_StartStreamCb( PaStream * s )
         }
         else
         {
-            if( stream->outputDevice != paNoDevice )
-            {
-                PA_DEBUG( ("Portaudio %s: %d (%s)\n",
-                          __FUNCTION__,
-                          stream->outputDevice,
-                          pulseaudioHostApi->pulseaudioDeviceNames[stream->
-                                                            outputDevice]) );
-            }
-
             PaDeviceIndex defaultOutputDevice;
             PaError result = PaUtil_DeviceIndexToHostApiDeviceIndex( &defaultOutputDevice,
                              pulseaudioHostApi->inheritedHostApiRep.info.defaultOutputDevice,
                              &(pulseaudioHostApi->inheritedHostApiRep) );
 
-            /* NULL means default device */
-            pulseaudioName = NULL;
-
-            /* If default device is not requested then change to wanted device */
-            if( result == paNoError && stream->outputDevice != defaultOutputDevice )
-            {
-                pulseaudioName = pulseaudioHostApi->
-                                    deviceInfoArray[stream->outputDevice].name;
-            }
-
             if(result == paNoError)
             {
+                /* Devices are updated from mainloop so they
+                 * are read with it locked
+                 */
                 PaPulseAudio_Lock( pulseaudioHostApi->mainloop );
 
+                if( stream->outputDevice != paNoDevice )
+                {
+                    PA_DEBUG( ("Portaudio %s: %d (%s)\n",
+                              __FUNCTION__,
+                              stream->outputDevice,
+                              pulseaudioHostApi->pulseaudioDeviceNames[stream->
+                                                                outputDevice]) );
+                }
+
+                /* NULL means default device */
+                pulseaudioName = NULL;
+
+                /* If default device is not requested then change to wanted device */
+                if( stream->outputDevice != defaultOutputDevice )
+                {
+                    pulseaudioName = pulseaudioHostApi->
+                                        deviceInfoArray[stream->outputDevice].name;
+                }
+
                 /* This is only needed when making non duplex
                  * as when duplexing then input should feed
-                 * output and we don't need playback callback
+                 * output and we don't need playback callback.
+                 *
+                 * Blocking streams always need it as it wakes
+                 * up blocking writer when there is room
                  */
-                if( !stream->inputStream )
+                if( !stream->inputStream ||
+                    !stream->bufferProcessor.streamCallback )
                 {
                     pa_stream_set_write_callback( stream->outputStream,
                                                   PaPulseAudio_StreamPlaybackCb,
@@ -945,7 +1085,11 @@ PaError PaPulseAudio_StartStreamCb( PaStream * s )
     /* Make sure we pass no error on intialize */
     ret = paNoError;
 
-    /* Stream is now active */
+    /* Stream is now active. Record callback of previous run
+     * can still be running so state is reset with mainloop locked
+     */
+    PaPulseAudio_Lock( pulseaudioHostApi->mainloop );
+    stream->callbackResult = paContinue;
     stream->isActive = 1;
     stream->isStopped = 0;
 
@@ -958,6 +1102,7 @@ PaError PaPulseAudio_StartStreamCb( PaStream * s )
                                      PaPulseAudio_StreamRecordCb,
                                      stream );
     }
+    PaPulseAudio_UnLock( pulseaudioHostApi->mainloop );
 
     /* Allways unlock.. so we don't get locked */
     startstreamcb_end:
@@ -993,6 +1138,10 @@ static PaError RequestStop( PaPulseAudio_Stream * stream,
     stream->isActive = 0;
     stream->isStopped = 1;
 
+    /* Wake up blocking read or write */
+    pa_threaded_mainloop_signal( pulseaudioHostApi->mainloop,
+                                 0 );
+
     /* Test if there is something that we can play */
     if( stream->outputStream
         && pa_stream_get_state( stream->outputStream ) == PA_STREAM_READY
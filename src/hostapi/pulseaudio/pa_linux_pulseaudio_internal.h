@@ -69,7 +69,6 @@ extern "C"
 #define PA_PULSEAUDIO_SET_LAST_HOST_ERROR(errorCode, errorText) \
     PaUtil_SetLastHostErrorInfo(paInDevelopment, errorCode, errorText)
 
-#define PAPULSEAUDIO_MAX_DEVICECOUNT 1024
 #define PAPULSEAUDIO_MAX_DEVICENAME 1024
 
 /* Default latency values to expose. Chosen by trial and error to be reasonable. */
@@ -79,11 +78,25 @@ extern "C"
 /* Just some value that Pulseaudio can handle */
 #define PAPULSEAUDIO_FRAMESPERBUFFERUNSPEC 32
 
-/* Assuming of 2 seconds of 44100 Hz sample rate with FLOAT (4 bytes) and stereo channels (2 channels).
-   You should have pretty good size buffer with this. If output/intput doesn't happens in 2 second we
-   have more trouble than this buffer.
-   @todo change this to something more sophisticated */
-#define PULSEAUDIO_BUFFER_SIZE (96100 * 4 * 2)
+/* Output latency adapts while stream is running. Underflow grows
+ * tlength by factor up to max latency. After stable period without
+ * underflows it is shrunk one step back towards negotiated latency.
+ */
+#define PA_PULSEAUDIO_LATENCY_GROW_FACTOR 2
+#define PA_PULSEAUDIO_MAX_ADAPTIVE_LATENCY 0.500
+#define PA_PULSEAUDIO_LATENCY_STABLE_PERIOD 10.0
+
+/* Sink or source found while enumerating devices */
+typedef struct PaPulseAudio_DeviceEntry
+{
+    struct PaPulseAudio_DeviceEntry *next;
+    uint32_t pulseaudioIndex;
+    char *name;
+    char *description;
+    int channels;
+    uint32_t sampleRate;
+}
+PaPulseAudio_DeviceEntry;
 
 typedef struct
 {
@@ -94,8 +107,29 @@ typedef struct
     PaUtilAllocationGroup *allocations;
 
     PaHostApiIndex hostApiIndex;
-    PaDeviceInfo deviceInfoArray[PAPULSEAUDIO_MAX_DEVICECOUNT];
-    char *pulseaudioDeviceNames[PAPULSEAUDIO_MAX_DEVICECOUNT];
+
+    /* Device tables sized from device count when enumeration is done.
+     * pulseaudioDeviceIndices has sink or source index of each device
+     * and PA_INVALID_INDEX when device has gone away
+     */
+    PaDeviceInfo *deviceInfoArray;
+    char **pulseaudioDeviceNames;
+    uint32_t *pulseaudioDeviceIndices;
+    int *pulseaudioDeviceIsSink;
+    int deviceSlotCount;
+
+    /* Slots of default sink and source in deviceInfoArray or -1.
+     * info.defaultOutputDevice and info.defaultInputDevice can't be
+     * used as slots as front end makes them global device indices
+     */
+    int defaultOutputSlot;
+    int defaultInputSlot;
+
+    /* Enumeration requests still running and what they have found */
+    int pendingOperations;
+    PaPulseAudio_DeviceEntry *sinkEntries;
+    PaPulseAudio_DeviceEntry *sourceEntries;
+
     pa_sample_spec pulseaudioDefaultSampleSpec;
 
     /* PulseAudio stuff goes here */
@@ -127,6 +161,14 @@ typedef struct PaPulseAudio_Stream
     pa_buffer_attr inputBufferAttr;
     unsigned int suggestedLatencyUSecs;
     int outputUnderflows;
+
+    /* Adaptive output latency. tlength negotiated when stream
+     * became ready, when tlength was last changed and is there
+     * pa_stream_set_buffer_attr still running
+     */
+    uint32_t outputNegotiatedLength;
+    PaTime outputLatencyChangeTime;
+    int outputLatencyChangePending;
     int outputChannelCount;
     int inputChannelCount;
 
@@ -143,6 +185,20 @@ typedef struct PaPulseAudio_Stream
 
     PaUtilRingBuffer inputRing;
 
+    /* One host buffer of input taken from inputRing and handed to the
+     * buffer processor in duplex callback mode. Allocated in OpenStream
+     * so the mainloop callbacks never need big stack buffers. Input only
+     * callback streams process pa_stream_peek fragments directly.
+     */
+    void *inputSampleBuffer;
+
+    /* Output is rendered straight into memory from pa_stream_begin_write.
+     * If PulseAudio hands out a block smaller than one host buffer this
+     * is rendered instead and copied by pa_stream_write.
+     */
+    void *outputSampleBuffer;
+    size_t outputSampleBufferSize;
+
     /* Used in communication between threads
      *
      * State machine works like this:
@@ -166,6 +222,12 @@ typedef struct PaPulseAudio_Stream
      */
     volatile sig_atomic_t isActive;
     volatile sig_atomic_t isStopped;
+
+    /* What the stream callback of an input only callback stream
+     * returned last. Once it is not paContinue isActive is 0 and
+     * the callback is not called anymore until Pa_StartStream
+     */
+    int callbackResult;
     volatile sig_atomic_t pulseaudioIsActive;
     volatile sig_atomic_t pulseaudioIsStopped;
 
@@ -262,6 +324,11 @@ void PaPulseAudio_StreamStartedCb( pa_stream * s,
 void PaPulseAudio_StreamUnderflowCb( pa_stream * s,
                                      void *userdata );
 
+void PaPulseAudio_UpdateStreamLatency( PaPulseAudio_Stream * stream );
+
+void PaPulseAudio_AdaptOutputLatency( PaPulseAudio_Stream * stream,
+                                      int underflow );
+
 PaError PaPulseAudio_ConvertPortaudioFormatToPaPulseAudio_( PaSampleFormat portaudiosf,
                                                             pa_sample_spec * pulseaudiosf
 );
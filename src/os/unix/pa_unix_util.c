@@ -145,6 +145,8 @@ void Pa_Sleep( long msec )
 
 /* Scaler to convert the result of mach_absolute_time to seconds */
 static double machSecondsConversionScaler_ = 0.0;
+/* Ratio to convert the result of mach_absolute_time to nanoseconds */
+static uint32_t machNanosecondsNumer_ = 1, machNanosecondsDenom_ = 1;
 #endif
 
 void PaUtil_InitializeClock( void )
@@ -153,7 +155,11 @@ void PaUtil_InitializeClock( void )
     mach_timebase_info_data_t info;
     kern_return_t err = mach_timebase_info( &info );
     if( err == 0  )
+    {
         machSecondsConversionScaler_ = 1e-9 * (double) info.numer / (double) info.denom;
+        machNanosecondsNumer_ = info.numer;
+        machNanosecondsDenom_ = info.denom;
+    }
 #endif
 }
 
@@ -162,6 +168,24 @@ PaTime PaUtil_GetTime( void )
 {
 #ifdef HAVE_MACH_ABSOLUTE_TIME
     return mach_absolute_time() * machSecondsConversionScaler_;
+#else
+    return PaUtil_NsToTime( PaUtil_GetTimeNs() );
+#endif
+}
+
+
+/*
+    CLOCK_MONOTONIC is served from the vDSO on Linux, so reading it doesn't
+    enter the kernel. CLOCK_MONOTONIC_RAW isn't used even where it is as cheap,
+    since host APIs compare our time with device timestamps (such as ALSA's
+    htimestamps) which are taken from CLOCK_MONOTONIC, and the two clocks drift
+    apart. Reading the TSC directly isn't safe on systems where it isn't
+    synchronized across cores or is unstable (see also pa_win_util.c).
+*/
+PaUtilTimeNs PaUtil_GetTimeNs( void )
+{
+#ifdef HAVE_MACH_ABSOLUTE_TIME
+    return (PaUtilTimeNs)( mach_absolute_time() * machNanosecondsNumer_ / machNanosecondsDenom_ );
 #elif defined(HAVE_CLOCK_GETTIME)
     struct timespec tp;
 #if defined(CLOCK_MONOTONIC)
@@ -169,11 +193,11 @@ PaTime PaUtil_GetTime( void )
 #else
     clock_gettime(CLOCK_REALTIME, &tp);
 #endif
-    return (PaTime)(tp.tv_sec + tp.tv_nsec * 1e-9);
+    return (PaUtilTimeNs)tp.tv_sec * 1000000000 + tp.tv_nsec;
 #else
     struct timeval tv;
     gettimeofday( &tv, NULL );
-    return (PaTime) tv.tv_usec * 1e-6 + tv.tv_sec;
+    return (PaUtilTimeNs)tv.tv_sec * 1000000000 + (PaUtilTimeNs)tv.tv_usec * 1000;
 #endif
 }
 
@@ -106,6 +106,7 @@ void Pa_Sleep( long msec )
 
 static int usePerformanceCounter_;
 static double secondsPerTick_;
+static LONGLONG ticksPerSecond_;
 
 void PaUtil_InitializeClock( void )
 {
@@ -115,6 +116,7 @@ void PaUtil_InitializeClock( void )
     {
         usePerformanceCounter_ = 1;
         secondsPerTick_ = 1.0 / (double)ticksPerSecond.QuadPart;
+        ticksPerSecond_ = ticksPerSecond.QuadPart;
     }
     else
     {
@@ -159,6 +161,32 @@ double PaUtil_GetTime( void )
     }
 }
 
+
+PaUtilTimeNs PaUtil_GetTimeNs( void )
+{
+    LARGE_INTEGER time;
+
+    if( usePerformanceCounter_ )
+    {
+        /* See PaUtil_GetTime. Split the conversion so that ticks * 1e9 can't overflow */
+        QueryPerformanceCounter( &time );
+        return (PaUtilTimeNs)( time.QuadPart / ticksPerSecond_ ) * 1000000000 +
+            (PaUtilTimeNs)( time.QuadPart % ticksPerSecond_ ) * 1000000000 / ticksPerSecond_;
+    }
+    else
+    {
+#ifndef UNDER_CE
+    #if defined(WINAPI_FAMILY) && (WINAPI_FAMILY == WINAPI_FAMILY_APP)
+        return (PaUtilTimeNs)GetTickCount64() * 1000000;
+    #else
+        return (PaUtilTimeNs)timeGetTime() * 1000000;
+    #endif
+#else
+        return (PaUtilTimeNs)GetTickCount() * 1000000;
+#endif
+    }
+}
+
 void PaWinUtil_SetLastSystemErrorInfo( PaHostApiTypeId hostApiType, long winError )
 {
     wchar_t wide_msg[1024]; //PA_LAST_HOST_ERROR_TEXT_LENGTH_
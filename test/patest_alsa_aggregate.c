@@ -0,0 +1,185 @@
+/** @file patest_alsa_aggregate.c
+    @ingroup test_src
+    @brief Play a sine wave on every channel of an ALSA aggregate device (see PaAlsa_AddAggregateDevice),
+    with a different frequency for each channel.
+
+    Usage: patest_alsa_aggregate [master member...]
+    The devices are ALSA device strings, by default "hw:0" and "hw:1". The first device is the clock master.
+*/
+/*
+ * $Id$
+ *
+ * This program uses the PortAudio Portable Audio Library.
+ * For more information see: http://www.portaudio.com
+ * Copyright (c) 1999-2000 Ross Bencina and Phil Burk
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * The text above constitutes the entire PortAudio license; however,
+ * the PortAudio community also makes the following non-binding requests:
+ *
+ * Any person wishing to distribute modifications to the Software is
+ * requested to send the modifications to the original developer so that
+ * they can be incorporated into the canonical version. It is also
+ * requested that these non-binding requests be included along with the
+ * license above.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "portaudio.h"
+#include "pa_linux_alsa.h"
+
+#define NUM_SECONDS         (10)
+#define SAMPLE_RATE         (48000)
+#define FRAMES_PER_BUFFER   (256)
+#define MAX_CHANNELS        (64)
+#define AGGREGATE_NAME      "PortAudio aggregate test"
+
+#ifndef M_PI
+#define M_PI  (3.14159265)
+#endif
+
+typedef struct
+{
+    int channelCount;
+    double phase[MAX_CHANNELS];
+    unsigned long underflows;
+}
+paTestData;
+
+static int patestCallback( const void *inputBuffer, void *outputBuffer,
+                           unsigned long framesPerBuffer,
+                           const PaStreamCallbackTimeInfo* timeInfo,
+                           PaStreamCallbackFlags statusFlags,
+                           void *userData )
+{
+    paTestData *data = (paTestData*)userData;
+    float *out = (float*)outputBuffer;
+    unsigned long i;
+    int c;
+
+    (void) timeInfo;
+    (void) inputBuffer;
+
+    if( statusFlags & paOutputUnderflow )
+        data->underflows++;
+
+    for( i=0; i<framesPerBuffer; i++ )
+    {
+        for( c=0; c<data->channelCount; c++ )
+        {
+            /* 220 Hz on the first channel, a semitone higher on each next one */
+            *out++ = (float) (0.2 * sin( data->phase[c] ));
+            data->phase[c] += 2. * M_PI * 220. * pow( 2., c / 12. ) / SAMPLE_RATE;
+            if( data->phase[c] >= 2. * M_PI ) data->phase[c] -= 2. * M_PI;
+        }
+    }
+    return paContinue;
+}
+
+int main( int argc, char **argv );
+int main( int argc, char **argv )
+{
+    static const char *defaultDevices[] = { "hw:0", "hw:1" };
+    PaStreamParameters outputParameters;
+    PaStream *stream;
+    PaError err;
+    paTestData data;
+    const PaDeviceInfo *deviceInfo = NULL;
+    PaDeviceIndex device;
+    int i;
+
+    printf( "PortAudio Test: ALSA aggregate device. SR = %d, BufSize = %d\n", SAMPLE_RATE, FRAMES_PER_BUFFER );
+    memset( &data, 0, sizeof (data) );
+
+    if( argc > 2 )
+        err = PaAlsa_AddAggregateDevice( AGGREGATE_NAME, (const char * const *)&argv[1], argc - 1 );
+    else
+        err = PaAlsa_AddAggregateDevice( AGGREGATE_NAME, defaultDevices, 2 );
+    if( err != paNoError ) goto error;
+
+    err = Pa_Initialize();
+    if( err != paNoError ) goto error;
+
+    for( device = 0; device < Pa_GetDeviceCount(); device++ )
+    {
+        deviceInfo = Pa_GetDeviceInfo( device );
+        if( !strcmp( deviceInfo->name, AGGREGATE_NAME ) )
+            break;
+    }
+    if( device == Pa_GetDeviceCount() || deviceInfo->maxOutputChannels == 0 )
+    {
+        fprintf( stderr, "The aggregate device can't play, check the member devices\n" );
+        err = paDeviceUnavailable;
+        goto error;
+    }
+
+    data.channelCount = deviceInfo->maxOutputChannels < MAX_CHANNELS ? deviceInfo->maxOutputChannels : MAX_CHANNELS;
+    outputParameters.device = device;
+    outputParameters.channelCount = data.channelCount;
+    outputParameters.sampleFormat = paFloat32;
+    outputParameters.suggestedLatency = deviceInfo->defaultLowOutputLatency;
+    outputParameters.hostApiSpecificStreamInfo = NULL;
+
+    err = Pa_OpenStream(
+              &stream,
+              NULL, /* no input */
+              &outputParameters,
+              SAMPLE_RATE,
+              FRAMES_PER_BUFFER,
+              paClipOff,
+              patestCallback,
+              &data );
+    if( err != paNoError ) goto error;
+
+    printf( "Playing %d channels, output latency = %g\n", data.channelCount,
+            Pa_GetStreamInfo( stream )->outputLatency );
+
+    err = Pa_StartStream( stream );
+    if( err != paNoError ) goto error;
+
+    for( i=0; i<NUM_SECONDS; i++ )
+    {
+        Pa_Sleep( 1000 );
+        printf( "CPU load = %f, underflows = %lu\n", Pa_GetStreamCpuLoad( stream ), data.underflows );
+        fflush( stdout );
+    }
+
+    err = Pa_StopStream( stream );
+    if( err != paNoError ) goto error;
+
+    err = Pa_CloseStream( stream );
+    if( err != paNoError ) goto error;
+
+    Pa_Terminate();
+    printf( "Test finished.\n" );
+    return err;
+
+error:
+    Pa_Terminate();
+    fprintf( stderr, "An error occurred while using the portaudio stream\n" );
+    fprintf( stderr, "Error number: %d\n", err );
+    fprintf( stderr, "Error message: %s\n", Pa_GetErrorText( err ) );
+    return err;
+}
@@ -0,0 +1,173 @@
+/** @file patest_alsa_hotplug.c
+    @ingroup test_src
+    @brief Check that the ALSA device monitor updates the device list while PortAudio is
+    initialized, see PaAlsa_EnableDeviceMonitor.
+
+    Usage: patest_alsa_hotplug [seconds]
+    Without arguments, device nodes are created and removed in a temporary directory that
+    is watched instead of /dev/snd, and the test checks that the monitor responds to each.
+    With a number of seconds, /dev/snd is watched for that long, and the device list is
+    printed whenever it has been updated; plug sound cards in and out meanwhile.
+*/
+/*
+ * $Id$
+ *
+ * This program uses the PortAudio Portable Audio Library.
+ * For more information see: http://www.portaudio.com
+ * Copyright (c) 1999-2000 Ross Bencina and Phil Burk
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * The text above constitutes the entire PortAudio license; however,
+ * the PortAudio community also makes the following non-binding requests:
+ *
+ * Any person wishing to distribute modifications to the Software is
+ * requested to send the modifications to the original developer so that
+ * they can be incorporated into the canonical version. It is also
+ * requested that these non-binding requests be included along with the
+ * license above.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "portaudio.h"
+#include "pa_linux_alsa.h"
+
+#define RESERVED_DEVICES    (8)
+#define TIMEOUT_MSEC        (2000)
+
+static volatile int updates = 0;
+
+static void devicesChanged( void *userData )
+{
+    (void) userData;
+    updates++;
+}
+
+static void printDevices( void )
+{
+    PaHostApiIndex alsaApi = Pa_HostApiTypeIdToHostApiIndex( paALSA );
+    int i;
+
+    for( i=0; i<Pa_GetDeviceCount(); i++ )
+    {
+        const PaDeviceInfo *info = Pa_GetDeviceInfo( i );
+        if( info->hostApi != alsaApi )
+            continue;
+        if( info->name[0] == 0 )
+            printf( "  %2d: (inactive)\n", i );
+        else
+            printf( "  %2d: %s, %d in, %d out\n", i, info->name, info->maxInputChannels, info->maxOutputChannels );
+    }
+    printf( "  default input = %d, default output = %d\n", Pa_GetDefaultInputDevice(), Pa_GetDefaultOutputDevice() );
+}
+
+/* Wait for the monitor to have updated the device list since the last time */
+static int waitForUpdate( int *seen )
+{
+    int msec;
+
+    for( msec=0; msec<TIMEOUT_MSEC && updates == *seen; msec+=10 )
+        Pa_Sleep( 10 );
+    if( updates == *seen )
+        return 0;
+    *seen = updates;
+    return 1;
+}
+
+int main( int argc, char **argv );
+int main( int argc, char **argv )
+{
+    char dir[] = "/tmp/patest_alsa_hotplugXXXXXX";
+    char node[sizeof (dir) + 16];
+    PaError err;
+    FILE *file;
+    int seen = 0, seconds, deviceCount, failed = 0;
+
+    printf( "PortAudio Test: ALSA device monitor\n" );
+
+    if( argc > 1 )
+    {
+        seconds = atoi( argv[1] );
+
+        PaAlsa_EnableDeviceMonitor( RESERVED_DEVICES, devicesChanged, NULL );
+        err = Pa_Initialize();
+        if( err != paNoError ) goto error;
+        printDevices();
+
+        printf( "Watching /dev/snd for %d seconds\n", seconds );
+        for( ; seconds > 0; seconds-- )
+        {
+            Pa_Sleep( 1000 );
+            if( updates != seen )
+            {
+                seen = updates;
+                printf( "Device list updated:\n" );
+                printDevices();
+            }
+        }
+    }
+    else
+    {
+        if( !mkdtemp( dir ) )
+        {
+            fprintf( stderr, "Can't create a temporary directory\n" );
+            return 1;
+        }
+        setenv( "PA_ALSA_DEVICE_MONITOR_DIR", dir, 1 );
+        snprintf( node, sizeof (node), "%s/controlC31", dir );
+
+        PaAlsa_EnableDeviceMonitor( RESERVED_DEVICES, devicesChanged, NULL );
+        err = Pa_Initialize();
+        if( err != paNoError ) goto error;
+        printDevices();
+        deviceCount = Pa_GetDeviceCount();
+
+        file = fopen( node, "w" );
+        if( file ) fclose( file );
+        printf( "Added %s: %s\n", node, waitForUpdate( &seen ) ? "updated" : "NOT UPDATED" );
+        failed |= updates == 0;
+
+        remove( node );
+        printf( "Removed %s: %s\n", node, waitForUpdate( &seen ) ? "updated" : "NOT UPDATED" );
+        failed |= updates != 2;
+
+        /* The slots of the device list stay the same */
+        printf( "Device count %d, was %d\n", Pa_GetDeviceCount(), deviceCount );
+        failed |= Pa_GetDeviceCount() != deviceCount;
+
+        rmdir( dir );
+    }
+
+    Pa_Terminate();
+    printf( "Test %s.\n", failed ? "FAILED" : "finished" );
+    return failed;
+
+error:
+    Pa_Terminate();
+    fprintf( stderr, "An error occurred while using the portaudio stream\n" );
+    fprintf( stderr, "Error number: %d\n", err );
+    fprintf( stderr, "Error message: %s\n", Pa_GetErrorText( err ) );
+    return err;
+}
@@ -0,0 +1,169 @@
+/** @file patest_alsa_mmap_read.c
+    @ingroup test_src
+    @brief Record from an ALSA device in place, with PaAlsa_AcquireReadRegion and
+    PaAlsa_CommitReadRegion, and print the peak level of each second.
+
+    Usage: patest_alsa_mmap_read [device]
+    The device is an ALSA device string such as "hw:0" (the default).
+*/
+/*
+ * $Id$
+ *
+ * This program uses the PortAudio Portable Audio Library.
+ * For more information see: http://www.portaudio.com
+ * Copyright (c) 1999-2000 Ross Bencina and Phil Burk
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * The text above constitutes the entire PortAudio license; however,
+ * the PortAudio community also makes the following non-binding requests:
+ *
+ * Any person wishing to distribute modifications to the Software is
+ * requested to send the modifications to the original developer so that
+ * they can be incorporated into the canonical version. It is also
+ * requested that these non-binding requests be included along with the
+ * license above.
+ */
+
+#include <stdio.h>
+#include "portaudio.h"
+#include "pa_linux_alsa.h"
+
+#define NUM_SECONDS         (5)
+#define SAMPLE_RATE         (48000)
+#define CHANNEL_COUNT       (2)
+
+/* Return the peak magnitude of the frames in a region, as a fraction of full scale */
+static double RegionPeak( const PaAlsaMmapRegion *region )
+{
+    double peak = 0.;
+    unsigned long i;
+    int c;
+
+    for( c = 0; c < region->channelCount; c++ )
+    {
+        for( i = 0; i < region->frames; i++ )
+        {
+            double value;
+            if( region->sampleFormat & paNonInterleaved )
+            {
+                const void *channel = ((void **)region->buffer)[c];
+                if( (region->sampleFormat & ~paNonInterleaved) == paInt16 )
+                    value = ((const short *)channel)[i] / 32768.;
+                else if( (region->sampleFormat & ~paNonInterleaved) == paInt32 )
+                    value = ((const int *)channel)[i] / 2147483648.;
+                else
+                    value = ((const float *)channel)[i];
+            }
+            else
+            {
+                unsigned long sample = i * region->channelCount + c;
+                if( region->sampleFormat == paInt16 )
+                    value = ((const short *)region->buffer)[sample] / 32768.;
+                else if( region->sampleFormat == paInt32 )
+                    value = ((const int *)region->buffer)[sample] / 2147483648.;
+                else
+                    value = ((const float *)region->buffer)[sample];
+            }
+            if( value < 0. ) value = -value;
+            if( value > peak ) peak = value;
+        }
+    }
+    return peak;
+}
+
+int main( int argc, char **argv );
+int main( int argc, char **argv )
+{
+    PaStreamParameters inputParameters;
+    PaAlsaStreamInfo streamInfo;
+    PaAlsaMmapRegion region;
+    PaStream *stream = NULL;
+    PaError err;
+    unsigned long framesLeft, second = 0;
+    double peak = 0.;
+
+    printf( "PortAudio Test: in place ALSA recording. SR = %d\n", SAMPLE_RATE );
+
+    err = Pa_Initialize();
+    if( err != paNoError ) goto error;
+
+    PaAlsa_InitializeStreamInfo( &streamInfo );
+    streamInfo.deviceString = argc > 1 ? argv[1] : "hw:0";
+
+    inputParameters.device = paUseHostApiSpecificDeviceSpecification;
+    inputParameters.channelCount = CHANNEL_COUNT;
+    /* The region is in the device's format, this merely has to be one the device supports */
+    inputParameters.sampleFormat = paInt16;
+    inputParameters.suggestedLatency = 0.05;
+    inputParameters.hostApiSpecificStreamInfo = &streamInfo;
+
+    err = Pa_OpenStream( &stream, &inputParameters, NULL, SAMPLE_RATE, paFramesPerBufferUnspecified,
+            paClipOff, NULL, NULL );
+    if( err != paNoError ) goto error;
+
+    err = Pa_StartStream( stream );
+    if( err != paNoError ) goto error;
+
+    framesLeft = NUM_SECONDS * SAMPLE_RATE;
+    while( framesLeft > 0 )
+    {
+        err = PaAlsa_AcquireReadRegion( stream, framesLeft, &region );
+        if( err == paInputOverflowed )
+            printf( "Input overflowed\n" );
+        else if( err != paNoError )
+            goto error;
+
+        {
+            double regionPeak = RegionPeak( &region );
+            if( regionPeak > peak ) peak = regionPeak;
+        }
+
+        err = PaAlsa_CommitReadRegion( stream, region.frames );
+        if( err != paNoError ) goto error;
+
+        framesLeft -= region.frames;
+        if( (NUM_SECONDS * SAMPLE_RATE - framesLeft) / SAMPLE_RATE > second )
+        {
+            ++second;
+            printf( "Second %lu: peak = %f (%d device channels)\n", second, peak, region.channelCount );
+            fflush( stdout );
+            peak = 0.;
+        }
+    }
+
+    err = Pa_CloseStream( stream );
+    if( err != paNoError ) goto error;
+
+    Pa_Terminate();
+    printf( "Test finished.\n" );
+    return err;
+
+error:
+    if( stream )
+        Pa_CloseStream( stream );
+    Pa_Terminate();
+    fprintf( stderr, "An error occurred while using the portaudio stream\n" );
+    fprintf( stderr, "Error number: %d\n", err );
+    fprintf( stderr, "Error message: %s\n", Pa_GetErrorText( err ) );
+    return err;
+}
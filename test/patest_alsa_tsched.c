@@ -0,0 +1,168 @@
+/** @file patest_alsa_tsched.c
+    @ingroup test_src
+    @brief Play a sine wave with ALSA timer-based scheduling (paAlsaTimerScheduling),
+    and report the resulting latency and CPU load.
+
+    Usage: patest_alsa_tsched [device]
+    The device is an ALSA device string such as "hw:0" (the default), or "hw:Dummy"
+    with the snd-dummy module loaded.
+*/
+/*
+ * $Id$
+ *
+ * This program uses the PortAudio Portable Audio Library.
+ * For more information see: http://www.portaudio.com
+ * Copyright (c) 1999-2000 Ross Bencina and Phil Burk
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * The text above constitutes the entire PortAudio license; however,
+ * the PortAudio community also makes the following non-binding requests:
+ *
+ * Any person wishing to distribute modifications to the Software is
+ * requested to send the modifications to the original developer so that
+ * they can be incorporated into the canonical version. It is also
+ * requested that these non-binding requests be included along with the
+ * license above.
+ */
+
+#include <stdio.h>
+#include <math.h>
+#include "portaudio.h"
+#include "pa_linux_alsa.h"
+
+#define NUM_SECONDS         (5)
+#define SAMPLE_RATE         (48000)
+#define FRAMES_PER_BUFFER   (256)
+#define LATENCY             (0.02)
+
+#ifndef M_PI
+#define M_PI  (3.14159265)
+#endif
+
+#define TABLE_SIZE   (200)
+typedef struct
+{
+    float sine[TABLE_SIZE];
+    int phase;
+    unsigned long underflows;
+}
+paTestData;
+
+static int patestCallback( const void *inputBuffer, void *outputBuffer,
+                           unsigned long framesPerBuffer,
+                           const PaStreamCallbackTimeInfo* timeInfo,
+                           PaStreamCallbackFlags statusFlags,
+                           void *userData )
+{
+    paTestData *data = (paTestData*)userData;
+    float *out = (float*)outputBuffer;
+    unsigned long i;
+
+    (void) timeInfo;
+    (void) inputBuffer;
+
+    if( statusFlags & paOutputUnderflow )
+        data->underflows++;
+
+    for( i=0; i<framesPerBuffer; i++ )
+    {
+        *out++ = data->sine[data->phase];  /* left */
+        *out++ = data->sine[data->phase];  /* right */
+        if( ++data->phase >= TABLE_SIZE ) data->phase = 0;
+    }
+    return paContinue;
+}
+
+int main( int argc, char **argv );
+int main( int argc, char **argv )
+{
+    PaStreamParameters outputParameters;
+    PaAlsaStreamInfo streamInfo;
+    PaStream *stream;
+    PaError err;
+    paTestData data;
+    int i;
+
+    printf( "PortAudio Test: ALSA timer-based scheduling. SR = %d, BufSize = %d\n", SAMPLE_RATE, FRAMES_PER_BUFFER );
+
+    for( i=0; i<TABLE_SIZE; i++ )
+    {
+        data.sine[i] = (float) (0.2 * sin( ((double)i/(double)TABLE_SIZE) * M_PI * 2. ));
+    }
+    data.phase = 0;
+    data.underflows = 0;
+
+    err = Pa_Initialize();
+    if( err != paNoError ) goto error;
+
+    PaAlsa_InitializeStreamInfo( &streamInfo );
+    streamInfo.deviceString = argc > 1 ? argv[1] : "hw:0";
+    streamInfo.flags = paAlsaTimerScheduling;
+
+    outputParameters.device = paUseHostApiSpecificDeviceSpecification;
+    outputParameters.channelCount = 2;
+    outputParameters.sampleFormat = paFloat32;
+    outputParameters.suggestedLatency = LATENCY;
+    outputParameters.hostApiSpecificStreamInfo = &streamInfo;
+
+    err = Pa_OpenStream(
+              &stream,
+              NULL, /* no input */
+              &outputParameters,
+              SAMPLE_RATE,
+              FRAMES_PER_BUFFER,
+              paClipOff,
+              patestCallback,
+              &data );
+    if( err != paNoError ) goto error;
+
+    printf( "Device: %s, suggested latency = %g, output latency = %g\n", streamInfo.deviceString, LATENCY,
+            Pa_GetStreamInfo( stream )->outputLatency );
+
+    err = Pa_StartStream( stream );
+    if( err != paNoError ) goto error;
+
+    for( i=0; i<NUM_SECONDS; i++ )
+    {
+        Pa_Sleep( 1000 );
+        printf( "CPU load = %f, underflows = %lu\n", Pa_GetStreamCpuLoad( stream ), data.underflows );
+        fflush( stdout );
+    }
+
+    err = Pa_StopStream( stream );
+    if( err != paNoError ) goto error;
+
+    err = Pa_CloseStream( stream );
+    if( err != paNoError ) goto error;
+
+    Pa_Terminate();
+    printf( "Test finished.\n" );
+    return err;
+
+error:
+    Pa_Terminate();
+    fprintf( stderr, "An error occurred while using the portaudio stream\n" );
+    fprintf( stderr, "Error number: %d\n", err );
+    fprintf( stderr, "Error message: %s\n", Pa_GetErrorText( err ) );
+    return err;
+}
@@ -0,0 +1,125 @@
+/** @file patest_clock_cost.c
+    @ingroup test_src
+    @brief Measure the cost of reading the clock used for CPU load measurement
+    and time stamping, with PaUtil_GetTime() and PaUtil_GetTimeNs().
+
+    No audio device is needed. The per-call cost is printed in nanoseconds.
+*/
+/*
+ * $Id$
+ *
+ * This program uses the PortAudio Portable Audio Library.
+ * For more information see: http://www.portaudio.com
+ * Copyright (c) 1999-2000 Ross Bencina and Phil Burk
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * The text above constitutes the entire PortAudio license; however,
+ * the PortAudio community also makes the following non-binding requests:
+ *
+ * Any person wishing to distribute modifications to the Software is
+ * requested to send the modifications to the original developer so that
+ * they can be incorporated into the canonical version. It is also
+ * requested that these non-binding requests be included along with the
+ * license above.
+ */
+
+#include <stdio.h>
+#include "portaudio.h"
+#include "pa_util.h"
+#include "pa_cpuload.h"
+
+#define NUM_CALLS       (1000000)
+#define NUM_RUNS        (5)
+
+/* Keep the compiler from optimizing the calls away */
+static volatile double sinkTime_;
+static volatile PaUtilTimeNs sinkTimeNs_;
+
+static double MeasureGetTime( void )
+{
+    PaUtilTimeNs start = PaUtil_GetTimeNs();
+    int i;
+    for( i = 0; i < NUM_CALLS; ++i )
+        sinkTime_ = PaUtil_GetTime();
+    return (double)( PaUtil_GetTimeNs() - start ) / NUM_CALLS;
+}
+
+static double MeasureGetTimeNs( void )
+{
+    PaUtilTimeNs start = PaUtil_GetTimeNs();
+    int i;
+    for( i = 0; i < NUM_CALLS; ++i )
+        sinkTimeNs_ = PaUtil_GetTimeNs();
+    return (double)( PaUtil_GetTimeNs() - start ) / NUM_CALLS;
+}
+
+static double MeasureCpuLoadMeasurement( void )
+{
+    PaUtilCpuLoadMeasurer measurer;
+    PaUtilTimeNs start;
+    int i;
+
+    PaUtil_InitializeCpuLoadMeasurer( &measurer, 44100. );
+    start = PaUtil_GetTimeNs();
+    for( i = 0; i < NUM_CALLS; ++i )
+    {
+        PaUtil_BeginCpuLoadMeasurement( &measurer );
+        PaUtil_EndCpuLoadMeasurement( &measurer, 64 );
+    }
+    sinkTime_ = PaUtil_GetCpuLoad( &measurer );
+    return (double)( PaUtil_GetTimeNs() - start ) / NUM_CALLS;
+}
+
+/*******************************************************************/
+int main(void);
+int main(void)
+{
+    int run;
+    PaUtilTimeNs previous, now;
+
+    PaUtil_InitializeClock();
+
+    printf("patest_clock_cost: %d calls per run, cost per call in nanoseconds.\n", NUM_CALLS );
+
+    /* The integer clock must never run backwards */
+    previous = PaUtil_GetTimeNs();
+    for( run = 0; run < NUM_CALLS; ++run )
+    {
+        now = PaUtil_GetTimeNs();
+        if( now < previous )
+        {
+            printf("ERROR: PaUtil_GetTimeNs() went backwards by %lld ns!\n", (long long)( previous - now ) );
+            return 1;
+        }
+        previous = now;
+    }
+
+    for( run = 0; run < NUM_RUNS; ++run )
+    {
+        printf("run %d: PaUtil_GetTime() %6.1f, PaUtil_GetTimeNs() %6.1f, CPU load measurement %6.1f\n",
+               run, MeasureGetTime(), MeasureGetTimeNs(), MeasureCpuLoadMeasurement() );
+    }
+
+    printf("Test finished.\n");
+    return 0;
+}
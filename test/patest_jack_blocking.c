@@ -0,0 +1,161 @@
+/** @file patest_jack_blocking.c
+    @ingroup test_src
+    @brief Compare the cost of JACK blocking streams with interleaved samples, which go through the buffer
+    processor, and with paFloat32 | paNonInterleaved samples, which are moved directly between the ports and
+    the stream's rings.
+
+    Run against a JACK server with the dummy driver, so that the results don't depend on a sound card, e.g.
+    jackd -d dummy -r 48000 -p 32. The CPU time of the whole process is measured, including JACK's process
+    thread, while a full-duplex stream reads and writes for a few seconds.
+*/
+/*
+ * $Id$
+ *
+ * This program uses the PortAudio Portable Audio Library.
+ * For more information see: http://www.portaudio.com
+ * Copyright (c) 1999-2000 Ross Bencina and Phil Burk
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * The text above constitutes the entire PortAudio license; however,
+ * the PortAudio community also makes the following non-binding requests:
+ *
+ * Any person wishing to distribute modifications to the Software is
+ * requested to send the modifications to the original developer so that
+ * they can be incorporated into the canonical version. It is also
+ * requested that these non-binding requests be included along with the
+ * license above.
+ */
+
+#include <stdio.h>
+#include <time.h>
+#include "portaudio.h"
+
+#define NUM_SECONDS         (5)
+#define NUM_CHANNELS        (2)
+#define FRAMES_PER_BUFFER   (256)
+
+static float interleaved[FRAMES_PER_BUFFER * NUM_CHANNELS];
+static float channelBuffers[NUM_CHANNELS][FRAMES_PER_BUFFER];
+
+/* Run a full-duplex blocking stream, returns the CPU seconds used per second of audio */
+static PaError measure( PaDeviceIndex inputDevice, PaDeviceIndex outputDevice, PaSampleFormat sampleFormat,
+        double sampleRate, double *cpuSeconds )
+{
+    PaStreamParameters inputParameters, outputParameters;
+    PaStream *stream;
+    PaError err;
+    void *buffer;
+    float *channels[NUM_CHANNELS];
+    unsigned long frames = 0;
+    clock_t start;
+    int i;
+
+    for( i=0; i<NUM_CHANNELS; i++ )
+        channels[i] = channelBuffers[i];
+    buffer = sampleFormat & paNonInterleaved ? (void *)channels : (void *)interleaved;
+
+    inputParameters.device = inputDevice;
+    inputParameters.channelCount = NUM_CHANNELS;
+    inputParameters.sampleFormat = sampleFormat;
+    inputParameters.suggestedLatency = Pa_GetDeviceInfo( inputDevice )->defaultLowInputLatency;
+    inputParameters.hostApiSpecificStreamInfo = NULL;
+    outputParameters.device = outputDevice;
+    outputParameters.channelCount = NUM_CHANNELS;
+    outputParameters.sampleFormat = sampleFormat;
+    outputParameters.suggestedLatency = Pa_GetDeviceInfo( outputDevice )->defaultLowOutputLatency;
+    outputParameters.hostApiSpecificStreamInfo = NULL;
+
+    err = Pa_OpenStream( &stream, &inputParameters, &outputParameters, sampleRate, FRAMES_PER_BUFFER,
+            paClipOff, NULL, NULL );
+    if( err != paNoError ) return err;
+
+    err = Pa_StartStream( stream );
+    if( err != paNoError ) goto done;
+
+    start = clock();
+    while( frames < NUM_SECONDS * sampleRate )
+    {
+        err = Pa_ReadStream( stream, buffer, FRAMES_PER_BUFFER );
+        if( err != paNoError && err != paInputOverflowed ) goto done;
+        err = Pa_WriteStream( stream, buffer, FRAMES_PER_BUFFER );
+        if( err != paNoError && err != paOutputUnderflowed ) goto done;
+        frames += FRAMES_PER_BUFFER;
+    }
+    *cpuSeconds = (double)(clock() - start) / CLOCKS_PER_SEC / NUM_SECONDS;
+
+    err = Pa_StopStream( stream );
+
+done:
+    Pa_CloseStream( stream );
+    return err;
+}
+
+int main( void );
+int main( void )
+{
+    PaError err;
+    PaHostApiIndex hostApi;
+    const PaHostApiInfo *hostApiInfo;
+    double sampleRate, interleavedCpu = 0., directCpu = 0.;
+
+    err = Pa_Initialize();
+    if( err != paNoError ) goto error;
+
+    hostApi = Pa_HostApiTypeIdToHostApiIndex( paJACK );
+    if( hostApi < 0 )
+    {
+        err = hostApi;
+        goto error;
+    }
+    hostApiInfo = Pa_GetHostApiInfo( hostApi );
+    if( hostApiInfo->defaultInputDevice == paNoDevice || hostApiInfo->defaultOutputDevice == paNoDevice )
+    {
+        fprintf( stderr, "Error: No JACK input or output device.\n" );
+        err = paDeviceUnavailable;
+        goto error;
+    }
+    sampleRate = Pa_GetDeviceInfo( hostApiInfo->defaultOutputDevice )->defaultSampleRate;
+
+    printf( "PortAudio Test: JACK blocking stream throughput. SR = %g, %d channels\n", sampleRate, NUM_CHANNELS );
+
+    err = measure( hostApiInfo->defaultInputDevice, hostApiInfo->defaultOutputDevice, paFloat32,
+            sampleRate, &interleavedCpu );
+    if( err != paNoError ) goto error;
+    printf( "paFloat32:                   %f CPU seconds per second\n", interleavedCpu );
+
+    err = measure( hostApiInfo->defaultInputDevice, hostApiInfo->defaultOutputDevice, paFloat32 | paNonInterleaved,
+            sampleRate, &directCpu );
+    if( err != paNoError ) goto error;
+    printf( "paFloat32 | paNonInterleaved: %f CPU seconds per second\n", directCpu );
+
+    Pa_Terminate();
+    printf( "Test finished.\n" );
+    return err;
+
+error:
+    Pa_Terminate();
+    fprintf( stderr, "An error occurred while using the portaudio stream\n" );
+    fprintf( stderr, "Error number: %d\n", err );
+    fprintf( stderr, "Error message: %s\n", Pa_GetErrorText( err ) );
+    return err;
+}
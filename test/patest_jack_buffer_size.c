@@ -0,0 +1,190 @@
+/** @file patest_jack_buffer_size.c
+    @ingroup test_src
+    @brief Play a sine wave through JACK while the server's period is changed, e.g. with jack_bufsize,
+    and report the buffer sizes that the stream callback is called with.
+
+    The stream has to keep playing without glitches, the callback's buffer size follows the period.
+*/
+/*
+ * $Id$
+ *
+ * This program uses the PortAudio Portable Audio Library.
+ * For more information see: http://www.portaudio.com
+ * Copyright (c) 1999-2000 Ross Bencina and Phil Burk
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * The text above constitutes the entire PortAudio license; however,
+ * the PortAudio community also makes the following non-binding requests:
+ *
+ * Any person wishing to distribute modifications to the Software is
+ * requested to send the modifications to the original developer so that
+ * they can be incorporated into the canonical version. It is also
+ * requested that these non-binding requests be included along with the
+ * license above.
+ */
+
+#include <stdio.h>
+#include <math.h>
+#include "portaudio.h"
+#include "pa_jack.h"
+
+#define NUM_SECONDS         (30)
+
+#ifndef M_PI
+#define M_PI  (3.14159265)
+#endif
+
+#define TABLE_SIZE   (200)
+typedef struct
+{
+    float sine[TABLE_SIZE];
+    int phase;
+    volatile unsigned long framesPerBuffer;
+    volatile unsigned long periodChanges;
+    volatile unsigned long period;
+}
+paTestData;
+
+static int patestCallback( const void *inputBuffer, void *outputBuffer,
+                           unsigned long framesPerBuffer,
+                           const PaStreamCallbackTimeInfo* timeInfo,
+                           PaStreamCallbackFlags statusFlags,
+                           void *userData )
+{
+    paTestData *data = (paTestData*)userData;
+    float *out = (float*)outputBuffer;
+    unsigned long i;
+
+    (void) timeInfo;
+    (void) inputBuffer;
+    (void) statusFlags;
+
+    data->framesPerBuffer = framesPerBuffer;
+
+    for( i=0; i<framesPerBuffer; i++ )
+    {
+        *out++ = data->sine[data->phase];  /* left */
+        *out++ = data->sine[data->phase];  /* right */
+        if( ++data->phase >= TABLE_SIZE ) data->phase = 0;
+    }
+    return paContinue;
+}
+
+static void periodChanged( PaStream *stream, unsigned long framesPerHostBuffer, void *userData )
+{
+    paTestData *data = (paTestData*)userData;
+
+    (void) stream;
+
+    data->period = framesPerHostBuffer;
+    data->periodChanges++;
+}
+
+int main( void );
+int main( void )
+{
+    PaStreamParameters outputParameters;
+    PaStream *stream;
+    PaError err;
+    PaHostApiIndex hostApi;
+    paTestData data;
+    double sampleRate;
+    int i;
+
+    for( i=0; i<TABLE_SIZE; i++ )
+    {
+        data.sine[i] = (float) (0.2 * sin( ((double)i/(double)TABLE_SIZE) * M_PI * 2. ));
+    }
+    data.phase = 0;
+    data.framesPerBuffer = 0;
+    data.periodChanges = 0;
+    data.period = 0;
+
+    err = Pa_Initialize();
+    if( err != paNoError ) goto error;
+
+    hostApi = Pa_HostApiTypeIdToHostApiIndex( paJACK );
+    if( hostApi < 0 )
+    {
+        err = hostApi;
+        goto error;
+    }
+
+    outputParameters.device = Pa_GetHostApiInfo( hostApi )->defaultOutputDevice;
+    if( outputParameters.device == paNoDevice )
+    {
+        fprintf( stderr, "Error: No JACK output device.\n" );
+        err = paDeviceUnavailable;
+        goto error;
+    }
+    outputParameters.channelCount = 2;
+    outputParameters.sampleFormat = paFloat32;
+    outputParameters.suggestedLatency = Pa_GetDeviceInfo( outputParameters.device )->defaultLowOutputLatency;
+    outputParameters.hostApiSpecificStreamInfo = NULL;
+    sampleRate = Pa_GetDeviceInfo( outputParameters.device )->defaultSampleRate;
+
+    printf( "PortAudio Test: JACK period changes. SR = %g\n", sampleRate );
+    printf( "Change the period meanwhile, e.g. with jack_bufsize 64\n" );
+
+    err = Pa_OpenStream(
+              &stream,
+              NULL, /* no input */
+              &outputParameters,
+              sampleRate,
+              paFramesPerBufferUnspecified, /* The JACK period */
+              paClipOff,
+              patestCallback,
+              &data );
+    if( err != paNoError ) goto error;
+
+    err = PaJack_SetBufferSizeCallback( stream, periodChanged, &data );
+    if( err != paNoError ) goto error;
+
+    err = Pa_StartStream( stream );
+    if( err != paNoError ) goto error;
+
+    for( i=0; i<NUM_SECONDS; i++ )
+    {
+        Pa_Sleep( 1000 );
+        printf( "frames per buffer = %lu, period changes = %lu (last to %lu), output latency = %g\n",
+                data.framesPerBuffer, data.periodChanges, data.period, Pa_GetStreamInfo( stream )->outputLatency );
+        fflush( stdout );
+    }
+
+    err = Pa_StopStream( stream );
+    if( err != paNoError ) goto error;
+
+    err = Pa_CloseStream( stream );
+    if( err != paNoError ) goto error;
+
+    Pa_Terminate();
+    printf( "Test finished.\n" );
+    return err;
+
+error:
+    Pa_Terminate();
+    fprintf( stderr, "An error occurred while using the portaudio stream\n" );
+    fprintf( stderr, "Error number: %d\n", err );
+    fprintf( stderr, "Error message: %s\n", Pa_GetErrorText( err ) );
+    return err;
+}
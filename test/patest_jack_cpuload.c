@@ -0,0 +1,167 @@
+/** @file patest_jack_cpuload.c
+    @ingroup test_src
+    @brief Play silence through JACK and report the CPU load of the process callback, together with
+    the output latency that the stream callback derives from its time info. The load is also given
+    as time spent per cycle, which can be compared between period sizes.
+
+    The fixed cost of every process cycle dominates at small buffer sizes, run the JACK server with
+    16 or 32 frames per period (e.g. jackd -d alsa -p 16) to compare implementations. Reconnect the
+    ports meanwhile to check that the reported latency follows the graph.
+*/
+/*
+ * $Id$
+ *
+ * This program uses the PortAudio Portable Audio Library.
+ * For more information see: http://www.portaudio.com
+ * Copyright (c) 1999-2000 Ross Bencina and Phil Burk
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * The text above constitutes the entire PortAudio license; however,
+ * the PortAudio community also makes the following non-binding requests:
+ *
+ * Any person wishing to distribute modifications to the Software is
+ * requested to send the modifications to the original developer so that
+ * they can be incorporated into the canonical version. It is also
+ * requested that these non-binding requests be included along with the
+ * license above.
+ */
+
+#include <stdio.h>
+#include "portaudio.h"
+
+#define NUM_SECONDS         (10)
+
+typedef struct
+{
+    PaTime outputLatency;
+    unsigned long callbacks;
+    unsigned long framesPerBuffer;
+}
+paTestData;
+
+static int patestCallback( const void *inputBuffer, void *outputBuffer,
+                           unsigned long framesPerBuffer,
+                           const PaStreamCallbackTimeInfo* timeInfo,
+                           PaStreamCallbackFlags statusFlags,
+                           void *userData )
+{
+    paTestData *data = (paTestData*)userData;
+    float *out = (float*)outputBuffer;
+    unsigned long i;
+
+    (void) inputBuffer;
+    (void) statusFlags;
+
+    data->outputLatency = timeInfo->outputBufferDacTime - timeInfo->currentTime;
+    data->callbacks++;
+    data->framesPerBuffer = framesPerBuffer;
+
+    for( i=0; i<framesPerBuffer; i++ )
+    {
+        *out++ = 0.f;  /* left */
+        *out++ = 0.f;  /* right */
+    }
+    return paContinue;
+}
+
+int main( void );
+int main( void )
+{
+    PaStreamParameters outputParameters;
+    PaStream *stream;
+    PaError err;
+    PaHostApiIndex hostApi;
+    paTestData data;
+    double sampleRate, cpuLoad;
+    int i;
+
+    data.outputLatency = 0.;
+    data.callbacks = 0;
+    data.framesPerBuffer = 0;
+
+    err = Pa_Initialize();
+    if( err != paNoError ) goto error;
+
+    hostApi = Pa_HostApiTypeIdToHostApiIndex( paJACK );
+    if( hostApi < 0 )
+    {
+        err = hostApi;
+        goto error;
+    }
+
+    outputParameters.device = Pa_GetHostApiInfo( hostApi )->defaultOutputDevice;
+    if( outputParameters.device == paNoDevice )
+    {
+        fprintf( stderr, "Error: No JACK output device.\n" );
+        err = paDeviceUnavailable;
+        goto error;
+    }
+    outputParameters.channelCount = 2;
+    outputParameters.sampleFormat = paFloat32;
+    outputParameters.suggestedLatency = Pa_GetDeviceInfo( outputParameters.device )->defaultLowOutputLatency;
+    outputParameters.hostApiSpecificStreamInfo = NULL;
+    sampleRate = Pa_GetDeviceInfo( outputParameters.device )->defaultSampleRate;
+
+    printf( "PortAudio Test: JACK process callback CPU load. SR = %g\n", sampleRate );
+
+    err = Pa_OpenStream(
+              &stream,
+              NULL, /* no input */
+              &outputParameters,
+              sampleRate,
+              paFramesPerBufferUnspecified, /* The JACK period */
+              paClipOff,
+              patestCallback,
+              &data );
+    if( err != paNoError ) goto error;
+
+    err = Pa_StartStream( stream );
+    if( err != paNoError ) goto error;
+
+    for( i=0; i<NUM_SECONDS; i++ )
+    {
+        Pa_Sleep( 1000 );
+        cpuLoad = Pa_GetStreamCpuLoad( stream );
+        printf( "CPU load = %f (%.2f us per %lu frame cycle), callbacks = %lu, output latency = %g (stream info %g)\n",
+                cpuLoad, cpuLoad * data.framesPerBuffer / sampleRate * 1e6, data.framesPerBuffer,
+                data.callbacks, data.outputLatency, Pa_GetStreamInfo( stream )->outputLatency );
+        fflush( stdout );
+    }
+
+    err = Pa_StopStream( stream );
+    if( err != paNoError ) goto error;
+
+    err = Pa_CloseStream( stream );
+    if( err != paNoError ) goto error;
+
+    Pa_Terminate();
+    printf( "Test finished.\n" );
+    return err;
+
+error:
+    Pa_Terminate();
+    fprintf( stderr, "An error occurred while using the portaudio stream\n" );
+    fprintf( stderr, "Error number: %d\n", err );
+    fprintf( stderr, "Error message: %s\n", Pa_GetErrorText( err ) );
+    return err;
+}
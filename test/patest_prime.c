@@ -65,6 +65,7 @@ typedef struct
     int          state;
     int          beepCountdown;
     int          idleCountdown;
+    PaTime       firstDacTime;  /* When the first sample of the beep is played, 0 until the first callback */
 }
 paTestData;
 
@@ -75,6 +76,7 @@ static void InitializeTestData( paTestData *testData )
     testData->state = STATE_BKG_BEEPING;
     testData->beepCountdown = BEEP_DURATION;
     testData->idleCountdown = IDLE_DURATION;
+    testData->firstDacTime = 0;
 }
 
 /* This routine will be called by the PortAudio engine when audio is needed.
@@ -94,9 +96,12 @@ static int patestCallback( const void *inputBuffer, void *outputBuffer,
 
     /* suppress unused parameter warnings */
     (void) inputBuffer;
-    (void) timeInfo;
     (void) statusFlags;
 
+    /* The beep starts with the first buffer */
+    if( data->firstDacTime == 0 )
+        data->firstDacTime = timeInfo->outputBufferDacTime;
+
     for( i=0; i<framesPerBuffer; i++ )
     {
         switch( data->state )
@@ -144,6 +149,7 @@ static PaError DoTest( int flags )
     PaError    err = paNoError;
     paTestData data;
     PaStreamParameters outputParameters;
+    PaTime startTime;
 
     InitializeTestData( &data );
 
@@ -170,6 +176,7 @@ static PaError DoTest( int flags )
     if( err != paNoError ) goto error;
 
 
+    startTime = Pa_GetStreamTime( stream );
     err = Pa_StartStream( stream );
     if( err != paNoError ) goto error;
 
@@ -182,6 +189,9 @@ static PaError DoTest( int flags )
     err = Pa_StopStream( stream );
     if( err != paNoError ) goto error;
 
+    /* Time to first sample, as far as the host API's time info can tell */
+    printf("first sample played %.1f ms after starting\n", (data.firstDacTime - startTime) * 1000. );
+
     err = Pa_CloseStream( stream );
     if( err != paNoError ) goto error;
 
@@ -0,0 +1,159 @@
+/** @file patest_pulseaudio_blocking.c
+    @ingroup test_src
+    @brief Measure the CPU use and timing jitter of a PulseAudio full-duplex blocking stream.
+
+    Run against a local PulseAudio daemon. A full-duplex stream reads and writes for a few seconds; the CPU
+    time of the whole process is measured, and so is how far the interval between successive Pa_ReadStream()
+    returns strays from one buffer period. Run it with builds before and after a change to compare them.
+*/
+/*
+ * $Id$
+ *
+ * This program uses the PortAudio Portable Audio Library.
+ * For more information see: http://www.portaudio.com
+ * Copyright (c) 1999-2000 Ross Bencina and Phil Burk
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+ * CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * The text above constitutes the entire PortAudio license; however,
+ * the PortAudio community also makes the following non-binding requests:
+ *
+ * Any person wishing to distribute modifications to the Software is
+ * requested to send the modifications to the original developer so that
+ * they can be incorporated into the canonical version. It is also
+ * requested that these non-binding requests be included along with the
+ * license above.
+ */
+
+#include <stdio.h>
+#include <time.h>
+#include "portaudio.h"
+
+#define NUM_SECONDS         (5)
+#define NUM_CHANNELS        (2)
+#define FRAMES_PER_BUFFER   (256)
+
+static float buffer[FRAMES_PER_BUFFER * NUM_CHANNELS];
+
+static double now( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main( void );
+int main( void )
+{
+    PaStreamParameters inputParameters, outputParameters;
+    PaStream *stream = NULL;
+    PaError err;
+    PaHostApiIndex hostApi;
+    const PaHostApiInfo *hostApiInfo;
+    double sampleRate, period, last, interval, jitter, maxJitter = 0., sumJitter = 0.;
+    unsigned long frames = 0, reads = 0;
+    clock_t start;
+
+    err = Pa_Initialize();
+    if( err != paNoError ) goto error;
+
+    hostApi = Pa_HostApiTypeIdToHostApiIndex( paPulseAudio );
+    if( hostApi < 0 )
+    {
+        err = hostApi;
+        goto error;
+    }
+    hostApiInfo = Pa_GetHostApiInfo( hostApi );
+    if( hostApiInfo->defaultInputDevice == paNoDevice || hostApiInfo->defaultOutputDevice == paNoDevice )
+    {
+        fprintf( stderr, "Error: No PulseAudio input or output device.\n" );
+        err = paDeviceUnavailable;
+        goto error;
+    }
+    sampleRate = Pa_GetDeviceInfo( hostApiInfo->defaultOutputDevice )->defaultSampleRate;
+    period = FRAMES_PER_BUFFER / sampleRate;
+
+    printf( "PortAudio Test: PulseAudio blocking stream. SR = %g, %d channels, %d frames per buffer\n",
+            sampleRate, NUM_CHANNELS, FRAMES_PER_BUFFER );
+
+    inputParameters.device = hostApiInfo->defaultInputDevice;
+    inputParameters.channelCount = NUM_CHANNELS;
+    inputParameters.sampleFormat = paFloat32;
+    inputParameters.suggestedLatency = Pa_GetDeviceInfo( inputParameters.device )->defaultLowInputLatency;
+    inputParameters.hostApiSpecificStreamInfo = NULL;
+    outputParameters.device = hostApiInfo->defaultOutputDevice;
+    outputParameters.channelCount = NUM_CHANNELS;
+    outputParameters.sampleFormat = paFloat32;
+    outputParameters.suggestedLatency = Pa_GetDeviceInfo( outputParameters.device )->defaultLowOutputLatency;
+    outputParameters.hostApiSpecificStreamInfo = NULL;
+
+    err = Pa_OpenStream( &stream, &inputParameters, &outputParameters, sampleRate, FRAMES_PER_BUFFER,
+            paClipOff, NULL, NULL );
+    if( err != paNoError ) goto error;
+
+    err = Pa_StartStream( stream );
+    if( err != paNoError ) goto error;
+
+    start = clock();
+    last = now();
+    while( frames < NUM_SECONDS * sampleRate )
+    {
+        err = Pa_ReadStream( stream, buffer, FRAMES_PER_BUFFER );
+        if( err != paNoError && err != paInputOverflowed ) goto error;
+
+        interval = now();
+        jitter = interval - last - period;
+        last = interval;
+        if( jitter < 0. ) jitter = -jitter;
+        if( jitter > maxJitter ) maxJitter = jitter;
+        sumJitter += jitter;
+        reads++;
+
+        err = Pa_WriteStream( stream, buffer, FRAMES_PER_BUFFER );
+        if( err != paNoError && err != paOutputUnderflowed ) goto error;
+        frames += FRAMES_PER_BUFFER;
+    }
+
+    printf( "CPU:              %f CPU seconds per second\n",
+            (double)(clock() - start) / CLOCKS_PER_SEC / NUM_SECONDS );
+    printf( "Read jitter:      mean %.3f ms, max %.3f ms\n", sumJitter / reads * 1e3, maxJitter * 1e3 );
+    printf( "Stream latency:   input %.3f ms, output %.3f ms\n",
+            Pa_GetStreamInfo( stream )->inputLatency * 1e3, Pa_GetStreamInfo( stream )->outputLatency * 1e3 );
+
+    err = Pa_StopStream( stream );
+    if( err != paNoError ) goto error;
+    err = Pa_CloseStream( stream );
+    stream = NULL;
+    if( err != paNoError ) goto error;
+
+    Pa_Terminate();
+    printf( "Test finished.\n" );
+    return err;
+
+error:
+    if( stream ) Pa_CloseStream( stream );
+    Pa_Terminate();
+    fprintf( stderr, "An error occurred while using the portaudio stream\n" );
+    fprintf( stderr, "Error number: %d\n", err );
+    fprintf( stderr, "Error message: %s\n", Pa_GetErrorText( err ) );
+    return err;
+}